@@ -0,0 +1,72 @@
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QCoreApplication>
+
+#include "fixture.h"
+
+/* The files are named after their size, so the size of a path is known without asking */
+static const qint64 sizes[] = { 128, 1024, 4096, 16384, 65536, 1048576 };
+static const int size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+Fixture::Fixture()
+{
+}
+
+Fixture::~Fixture()
+{
+    if (m_root.isEmpty())
+        return;
+    QDir folder(m_folder);
+    foreach (const QString &name, folder.entryList(QDir::Files))
+        folder.remove(name);
+    QDir root(m_root);
+    root.rmdir("www");
+    root.remove("configuration.xml");
+    QDir::temp().rmdir(QDir(m_root).dirName());
+}
+
+bool Fixture::create()
+{
+    m_root = QDir::temp().absoluteFilePath(QString("rainbow-bench-%1").arg(QCoreApplication::applicationPid()));
+    m_folder = m_root + "/www";
+    if (!QDir().mkpath(m_folder))
+        return false;
+    QByteArray line("The quick brown fox jumps over the lazy dog, rainbow serves it again.\n");
+    for (int i = 0; i < size_count; ++i) {
+        QString name = QString("file-%1.html").arg(sizes[i]);
+        QFile file(m_folder + "/" + name);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        /* Text, so the compression has something to do */
+        QByteArray content;
+        content.reserve((int)sizes[i]);
+        while (content.size() < sizes[i])
+            content.append(line);
+        content.truncate((int)sizes[i]);
+        file.write(content);
+        m_paths.append("/www/" + name);
+    }
+    return true;
+}
+
+QString Fixture::writeConfiguration(quint16 port, const QString &attributes)
+{
+    m_configuration = m_root + "/configuration.xml";
+    QFile file(m_configuration);
+    if (!file.open(QIODevice::WriteOnly))
+        return QString();
+    QString xml = QString("<rainbow port=\"%1\" %2>\n"
+                          "  <folder name=\"/www\" handler=\"%3\" type=\"web\"/>\n"
+                          "</rainbow>\n").arg(port).arg(attributes).arg(m_folder);
+    file.write(xml.toUtf8());
+    return m_configuration;
+}
+
+qint64 Fixture::sizeOf(const QString &path)
+{
+    int start = path.lastIndexOf('-');
+    int end = path.lastIndexOf('.');
+    if ((start == -1) || (end <= start))
+        return -1;
+    return path.mid(start + 1, end - start - 1).toLongLong();
+}
@@ -0,0 +1,29 @@
+#ifndef FIXTURE_H
+#define FIXTURE_H
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+/*
+ * A folder of generated files of known sizes, and a configuration that
+ * serves it on the loopback. Everything goes away with the fixture.
+ */
+class Fixture
+{
+    QString m_root;
+    QString m_folder;
+    QString m_configuration;
+    QStringList m_paths;
+public:
+    Fixture();
+    ~Fixture();
+    bool create();
+    /* Attributes are added to the rainbow element as they are */
+    QString writeConfiguration(quint16 port, const QString &attributes = QString());
+    QString folder() const { return m_folder; }
+    /* Paths as a client asks for them, from the smallest file to the biggest */
+    QStringList paths() const { return m_paths; }
+    static qint64 sizeOf(const QString &path);
+};
+
+#endif // FIXTURE_H
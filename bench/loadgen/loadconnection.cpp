@@ -0,0 +1,126 @@
+#include "loadconnection.h"
+#include "loadgenerator.h"
+
+LoadConnection::LoadConnection(LoadGenerator *generator) :
+    m_generator(generator),
+    m_socket(NULL),
+    m_started(0),
+    m_headerLength(-1),
+    m_expected(-1),
+    m_keepAlive(false),
+    m_waiting(false)
+{
+}
+
+LoadConnection::~LoadConnection()
+{
+    if (m_socket) {
+        m_socket->disconnect(this);
+        m_socket->abort();
+        delete m_socket;
+    }
+}
+
+/*
+ * Without keep-alive opening the connection is part of every request, so
+ * that is when the clock starts.
+ */
+void LoadConnection::open()
+{
+    if (m_socket) {
+        m_socket->disconnect(this);
+        m_socket->deleteLater();
+    }
+    m_socket = new QTcpSocket(this);
+    connect(m_socket, SIGNAL(connected()), this, SLOT(socket_connected()));
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(socket_readyRead()));
+    connect(m_socket, SIGNAL(disconnected()), this, SLOT(socket_disconnected()));
+    connect(m_socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socket_error(QAbstractSocket::SocketError)));
+    m_started = m_generator->now();
+    m_socket->connectToHost(m_generator->options().host, m_generator->options().port);
+}
+
+void LoadConnection::send()
+{
+    m_buffer.resize(0);
+    m_headerLength = -1;
+    m_expected = -1;
+    m_waiting = true;
+    if (m_generator->options().keepAlive)
+        m_started = m_generator->now();
+    m_socket->write(m_generator->pick());
+}
+
+void LoadConnection::socket_connected()
+{
+    m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    send();
+}
+
+/*
+ * Only what is needed to find the end of the reply, and to know if the
+ * connection stays open.
+ */
+bool LoadConnection::parse_header()
+{
+    int end = m_buffer.indexOf("\r\n\r\n");
+    if (end == -1)
+        return false;
+    m_headerLength = end + 4;
+    QByteArray header = m_buffer.left(end).toLower();
+    int length = header.indexOf("\r\ncontent-length:");
+    if (length != -1) {
+        int start = length + 17;
+        int stop = header.indexOf("\r\n", start);
+        m_expected = header.mid(start, (stop == -1) ? -1 : stop - start).trimmed().toLongLong();
+    } else {
+        /* Nothing else we ask for comes without a length, 304 and HEAD aside */
+        m_expected = 0;
+    }
+    m_keepAlive = header.startsWith("http/1.1") && (header.indexOf("\r\nconnection: close") == -1);
+    if (!header.startsWith("http/1.1 2") && !header.startsWith("http/1.0 2"))
+        m_generator->failed();
+    return true;
+}
+
+void LoadConnection::socket_readyRead()
+{
+    m_buffer.append(m_socket->readAll());
+    if (!m_waiting)
+        return;
+    if ((m_headerLength == -1) && !parse_header())
+        return;
+    qint64 size = m_headerLength + m_expected;
+    if (m_buffer.size() < size)
+        return;
+    m_waiting = false;
+    m_generator->completed(m_generator->now() - m_started, size);
+    if (!m_generator->isRunning())
+        return;
+    if (m_keepAlive && m_generator->options().keepAlive) {
+        send();
+        return;
+    }
+    m_socket->disconnectFromHost();
+}
+
+void LoadConnection::socket_disconnected()
+{
+    if (m_waiting)
+        m_generator->failed();
+    m_waiting = false;
+    /* A connection that never opened does not tell that it was closed */
+    if ((m_socket->state() == QAbstractSocket::UnconnectedState) && m_generator->isRunning())
+        open();
+}
+
+void LoadConnection::socket_error(QAbstractSocket::SocketError error)
+{
+    if (error == QAbstractSocket::RemoteHostClosedError)
+        return;
+    m_generator->failed();
+    m_waiting = false;
+    /* A connection that never opened does not tell that it was closed */
+    if ((m_socket->state() == QAbstractSocket::UnconnectedState) && m_generator->isRunning())
+        open();
+}
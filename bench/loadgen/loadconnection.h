@@ -0,0 +1,42 @@
+#ifndef LOADCONNECTION_H
+#define LOADCONNECTION_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtNetwork/QTcpSocket>
+
+class LoadGenerator;
+
+/*
+ * One client connection. It sends a request, waits for the whole reply and
+ * sends the next one, on the same connection if both sides keep it alive or
+ * on a new one otherwise.
+ */
+class LoadConnection : public QObject
+{
+    Q_OBJECT
+    LoadGenerator *m_generator;
+    QTcpSocket *m_socket;
+    QByteArray m_buffer;
+    /* When the request went out, or the connection was opened for it */
+    qint64 m_started;
+    int m_headerLength;
+    qint64 m_expected;
+    bool m_keepAlive;
+    bool m_waiting;
+
+    void open();
+    void send();
+    bool parse_header();
+private slots:
+    void socket_connected();
+    void socket_readyRead();
+    void socket_disconnected();
+    void socket_error(QAbstractSocket::SocketError error);
+public:
+    LoadConnection(LoadGenerator *generator);
+    virtual ~LoadConnection();
+    void start() { open(); }
+};
+
+#endif // LOADCONNECTION_H
@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# HTTP load generator, starts rainbow on a generated folder
+#
+#-------------------------------------------------
+
+QT       += core network
+
+QT       -= gui
+
+TARGET = loadgen
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../../src ../common
+VPATH += ../../src ../common
+
+SOURCES += main.cpp \
+    loadgenerator.cpp \
+    loadconnection.cpp \
+    serverusage.cpp \
+    fixture.cpp \
+    histogram.cpp
+
+HEADERS += \
+    loadgenerator.h \
+    loadconnection.h \
+    serverusage.h \
+    fixture.h \
+    histogram.h
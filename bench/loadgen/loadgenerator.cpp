@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "loadgenerator.h"
+#include "loadconnection.h"
+
+LoadGenerator::LoadGenerator(const LoadOptions &options, int connections, unsigned int seed) :
+    m_options(options),
+    m_connectionCount(connections),
+    m_requests(0),
+    m_errors(0),
+    m_bytes(0),
+    m_running(false),
+    m_seed(seed)
+{
+}
+
+/*
+ * Runs in the thread of the generator, so the sockets belong to it.
+ */
+void LoadGenerator::start()
+{
+    m_clock.start();
+    m_running = true;
+    for (int i = 0; i < m_connectionCount; ++i) {
+        LoadConnection *connection = new LoadConnection(this);
+        m_connections.append(connection);
+        connection->start();
+    }
+}
+
+void LoadGenerator::reset()
+{
+    m_latency.clear();
+    m_requests = 0;
+    m_errors = 0;
+    m_bytes = 0;
+}
+
+void LoadGenerator::stop()
+{
+    m_running = false;
+    qDeleteAll(m_connections);
+    m_connections.clear();
+}
+
+const QByteArray &LoadGenerator::pick()
+{
+    int total = m_options.weights.last();
+    int choice = rand_r(&m_seed) % total;
+    int i = 0;
+    while (m_options.weights.at(i) <= choice)
+        ++i;
+    return m_options.requests.at(i);
+}
+
+void LoadGenerator::completed(qint64 latency, qint64 bytes)
+{
+    m_latency.record(latency);
+    ++m_requests;
+    m_bytes += bytes;
+}
+
+void LoadGenerator::failed()
+{
+    ++m_errors;
+}
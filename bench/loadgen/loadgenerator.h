@@ -0,0 +1,66 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QVector>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QElapsedTimer>
+
+#include "histogram.h"
+
+class LoadConnection;
+
+/*
+ * What every generator does. The requests are built once, a connection only
+ * picks one of them.
+ */
+struct LoadOptions {
+    QString host;
+    quint16 port;
+    int connections;
+    bool keepAlive;
+    QList<QByteArray> requests;
+    /* Running sum of the weights of the requests */
+    QVector<int> weights;
+};
+
+/*
+ * A set of connections that keep sending requests, all of them in the
+ * thread of the generator. The numbers are only read once the thread is done.
+ */
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+    const LoadOptions &m_options;
+    int m_connectionCount;
+    QList<LoadConnection *> m_connections;
+    QElapsedTimer m_clock;
+    Histogram m_latency;
+    quint64 m_requests;
+    quint64 m_errors;
+    quint64 m_bytes;
+    bool m_running;
+    unsigned int m_seed;
+public:
+    LoadGenerator(const LoadOptions &options, int connections, unsigned int seed);
+    const LoadOptions &options() const { return m_options; }
+    bool isRunning() const { return m_running; }
+    /* Microseconds since the generator started */
+    qint64 now() const { return m_clock.nsecsElapsed() / 1000; }
+    const QByteArray &pick();
+    void completed(qint64 latency, qint64 bytes);
+    void failed();
+    const Histogram &latency() const { return m_latency; }
+    quint64 requests() const { return m_requests; }
+    quint64 errors() const { return m_errors; }
+    quint64 bytes() const { return m_bytes; }
+public slots:
+    void start();
+    /* Forget what happened during the warm up */
+    void reset();
+    void stop();
+};
+
+#endif // LOADGENERATOR_H
@@ -0,0 +1,247 @@
+#include <QCoreApplication>
+#include <QtCore/QProcess>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpSocket>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fixture.h"
+#include "histogram.h"
+#include "loadgenerator.h"
+#include "serverusage.h"
+
+const char *optstring = "s:S:I:x:a:p:c:t:d:w:m:nh";
+void usage()
+{
+    printf("Usage: loadgen [-s <rainbow binary> [-S event|pulse] [-I qt|epoll] [-x attributes]] [-a address] [-p port]\n");
+    printf("               [-c connections] [-t threads] [-d seconds] [-w seconds] [-m path=weight,...] [-n]\n");
+    printf("-s starts the server on a generated folder, -S picks its scheduler, -I its I/O backend and -x adds attributes\n");
+    printf("to its configuration. A server started here also gets its CPU time and read and write calls per request reported,\n");
+    printf("other system calls such as poll, epoll_wait and accept are not counted.\n");
+    printf("Without -s the server at the address and port is used, and -m is needed.\n");
+    printf("-c connections (64) spread over -t threads (1), measured for -d seconds (10) after -w seconds (2) of warm up.\n");
+    printf("-m is the mix of paths and how often each one is asked for, by default small files are the most frequent.\n");
+    printf("-n opens a new connection for every request.\n");
+}
+
+/*
+ * The server is ready once it takes connections.
+ */
+static bool wait_for_server(const QString &host, quint16 port)
+{
+    for (int i = 0; i < 50; ++i) {
+        QTcpSocket probe;
+        probe.connectToHost(host, port);
+        if (probe.waitForConnected(100))
+            return true;
+        usleep(100000);
+    }
+    return false;
+}
+
+/*
+ * Every path of the mix is asked for once before the load starts, errors
+ * would only be counted otherwise and the numbers would be those of 404s.
+ */
+static bool check_paths(const LoadOptions &options)
+{
+    foreach (const QByteArray &request, options.requests) {
+        QTcpSocket probe;
+        probe.connectToHost(options.host, options.port);
+        if (!probe.waitForConnected(1000)) {
+            fprintf(stderr, "could not connect to the server\n");
+            return false;
+        }
+        probe.write(request);
+        while (!probe.canReadLine() && probe.waitForReadyRead(1000))
+            ;
+        QByteArray status = probe.readLine().trimmed();
+        if (!status.startsWith("HTTP/1.1 200 ") && !status.startsWith("HTTP/1.0 200 ")) {
+            fprintf(stderr, "%s: %s\n", request.left(request.indexOf('\r')).constData(),
+                    status.isEmpty() ? "no reply" : status.constData());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void add_request(LoadOptions &options, const QString &path, int weight)
+{
+    QByteArray request = "GET " + path.toLatin1() + " HTTP/1.1\r\nHost: " + options.host.toLatin1() + "\r\n";
+    if (!options.keepAlive)
+        request.append("Connection: close\r\n");
+    request.append("\r\n");
+    options.requests.append(request);
+    options.weights.append((options.weights.isEmpty() ? 0 : options.weights.last()) + qMax(weight, 1));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QString server;
+    QString scheduler = "event";
+    QString io = "qt";
+    QString attributes;
+    QString mix;
+    int threads = 1;
+    int duration = 10;
+    int warmup = 2;
+    LoadOptions options;
+    options.host = "127.0.0.1";
+    options.port = 18080;
+    options.connections = 64;
+    options.keepAlive = true;
+    int result = 0;
+
+    while ((result = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (result)
+        {
+        case 's':
+            server = QString::fromLocal8Bit(optarg);
+            break;
+        case 'S':
+            scheduler = QString::fromLatin1(optarg);
+            break;
+        case 'I':
+            io = QString::fromLatin1(optarg);
+            break;
+        case 'x':
+            attributes = QString::fromLocal8Bit(optarg);
+            break;
+        case 'a':
+            options.host = QString::fromLatin1(optarg);
+            break;
+        case 'p':
+            options.port = (quint16)atoi(optarg);
+            break;
+        case 'c':
+            options.connections = qMax(atoi(optarg), 1);
+            break;
+        case 't':
+            threads = qMax(atoi(optarg), 1);
+            break;
+        case 'd':
+            duration = qMax(atoi(optarg), 1);
+            break;
+        case 'w':
+            warmup = qMax(atoi(optarg), 0);
+            break;
+        case 'm':
+            mix = QString::fromLocal8Bit(optarg);
+            break;
+        case 'n':
+            options.keepAlive = false;
+            break;
+        case 'h':
+        default:
+            usage();
+            exit (0);
+        }
+    }
+
+    Fixture fixture;
+    QProcess rainbow;
+    if (!server.isEmpty()) {
+        if (!fixture.create()) {
+            fprintf(stderr, "could not create the fixture\n");
+            return 1;
+        }
+        QString configuration = fixture.writeConfiguration(options.port, QString("scheduler=\"%1\" io=\"%2\" loglevel=\"critical\" %3").arg(scheduler).arg(io).arg(attributes));
+        rainbow.setProcessChannelMode(QProcess::ForwardedChannels);
+        rainbow.start(server, QStringList() << "-c" << configuration);
+        if (!rainbow.waitForStarted() || !wait_for_server(options.host, options.port)) {
+            fprintf(stderr, "could not start the server\n");
+            rainbow.kill();
+            return 1;
+        }
+    }
+    if (!mix.isEmpty()) {
+        foreach (const QString &entry, mix.split(',')) {
+            int separator = entry.lastIndexOf('=');
+            if (separator == -1)
+                add_request(options, entry, 1);
+            else
+                add_request(options, entry.left(separator), entry.mid(separator + 1).toInt());
+        }
+    } else if (!server.isEmpty()) {
+        /* Mostly small files, like a page and its resources */
+        static const int weights[] = { 40, 25, 15, 10, 7, 3 };
+        QStringList paths = fixture.paths();
+        for (int i = 0; i < paths.count(); ++i)
+            add_request(options, paths.at(i), weights[i % 6]);
+    } else {
+        fprintf(stderr, "a mix of paths is needed when the server is not started here\n");
+        return 1;
+    }
+
+    if (!check_paths(options)) {
+        if (!server.isEmpty())
+            rainbow.kill();
+        return 1;
+    }
+
+#if QT_VERSION >= 0x050300
+    ServerUsage usage(server.isEmpty() ? 0 : rainbow.processId());
+#else
+    ServerUsage usage(server.isEmpty() ? 0 : (qint64)rainbow.pid());
+#endif
+    QList<LoadGenerator *> generators;
+    QList<QThread *> workers;
+    for (int i = 0; i < threads; ++i) {
+        int connections = options.connections / threads + ((i < options.connections % threads) ? 1 : 0);
+        LoadGenerator *generator = new LoadGenerator(options, connections, 1 + i);
+        QThread *thread = new QThread();
+        generator->moveToThread(thread);
+        QObject::connect(thread, SIGNAL(started()), generator, SLOT(start()));
+        generators.append(generator);
+        workers.append(thread);
+        thread->start();
+    }
+    printf("%d connections on %d threads, %s, %d paths, %d seconds after %d seconds of warm up\n",
+           options.connections, threads, options.keepAlive ? "keep-alive" : "a connection per request",
+           options.requests.count(), duration, warmup);
+    foreach (LoadGenerator *generator, generators)
+        QTimer::singleShot(warmup * 1000, generator, SLOT(reset()));
+    foreach (LoadGenerator *generator, generators)
+        QTimer::singleShot((warmup + duration) * 1000, generator, SLOT(stop()));
+    if (!server.isEmpty()) {
+        QTimer::singleShot(warmup * 1000, &usage, SLOT(reset()));
+        QTimer::singleShot((warmup + duration) * 1000, &usage, SLOT(stop()));
+    }
+    QTimer::singleShot((warmup + duration) * 1000 + 200, &app, SLOT(quit()));
+    app.exec();
+
+    Histogram latency;
+    quint64 requests = 0;
+    quint64 errors = 0;
+    quint64 bytes = 0;
+    for (int i = 0; i < threads; ++i) {
+        workers.at(i)->quit();
+        workers.at(i)->wait();
+        latency.merge(generators.at(i)->latency());
+        requests += generators.at(i)->requests();
+        errors += generators.at(i)->errors();
+        bytes += generators.at(i)->bytes();
+    }
+    printf("requests %llu, errors %llu\n", (unsigned long long)requests, (unsigned long long)errors);
+    printf("throughput %.1f requests/s, %.2f MiB/s\n", (double)requests / duration, (double)bytes / duration / 1048576.0);
+    printf("latency ms: p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f max %.3f\n",
+           latency.percentile(0.5) / 1000.0, latency.percentile(0.9) / 1000.0, latency.percentile(0.99) / 1000.0,
+           latency.percentile(0.999) / 1000.0, latency.percentile(1.0) / 1000.0);
+    /* Requests per CPU second is what a request costs on one core, whatever the number of workers */
+    if (usage.isValid() && requests) {
+        printf("server cpu %.2f s, %.0f requests per cpu second, %.2f read calls and %.2f write calls per request"
+               " (poll, epoll_wait and accept not counted)\n",
+               usage.cpu(), usage.cpu() > 0 ? requests / usage.cpu() : 0.0,
+               (double)usage.readCalls() / requests, (double)usage.writeCalls() / requests);
+    }
+    if (!server.isEmpty()) {
+        rainbow.terminate();
+        if (!rainbow.waitForFinished(2000))
+            rainbow.kill();
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <unistd.h>
+
+#include "serverusage.h"
+
+ServerUsage::ServerUsage(qint64 pid) :
+    m_pid(pid),
+    m_valid(false)
+{
+    m_start.cpu = m_end.cpu = 0;
+    m_start.readCalls = m_end.readCalls = 0;
+    m_start.writeCalls = m_end.writeCalls = 0;
+}
+
+/*
+ * utime and stime are the 14th and 15th fields of stat, counted after the
+ * command, which may have spaces of its own. The calls are syscr and syscw
+ * of io, sendfile() counts as both. Waiting for events is in neither.
+ */
+bool ServerUsage::read(Sample &sample) const
+{
+    QByteArray base = "/proc/" + QByteArray::number(m_pid);
+    QFile stat(QString::fromLatin1(base + "/stat"));
+    if (!stat.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray line = stat.readAll();
+    int command = line.lastIndexOf(')');
+    if (command == -1)
+        return false;
+    QList<QByteArray> fields = line.mid(command + 2).split(' ');
+    /* The state is the 3rd field, the first one after the command */
+    if (fields.count() < 13)
+        return false;
+    sample.cpu = (double)(fields.at(11).toULongLong() + fields.at(12).toULongLong()) / sysconf(_SC_CLK_TCK);
+    QFile io(QString::fromLatin1(base + "/io"));
+    if (!io.open(QIODevice::ReadOnly))
+        return false;
+    sample.readCalls = 0;
+    sample.writeCalls = 0;
+    foreach (const QByteArray &entry, io.readAll().split('\n')) {
+        if (entry.startsWith("syscr:"))
+            sample.readCalls = entry.mid(6).trimmed().toULongLong();
+        else if (entry.startsWith("syscw:"))
+            sample.writeCalls = entry.mid(6).trimmed().toULongLong();
+    }
+    return true;
+}
+
+void ServerUsage::reset()
+{
+    m_valid = read(m_start);
+}
+
+void ServerUsage::stop()
+{
+    m_valid = m_valid && read(m_end);
+}
@@ -0,0 +1,41 @@
+#ifndef SERVERUSAGE_H
+#define SERVERUSAGE_H
+
+#include <QtCore/QObject>
+
+/*
+ * What the server process spent while it was measured, taken from /proc so
+ * the I/O backends can be compared by what a request costs them and not
+ * only by how many requests there were. These are not all the system
+ * calls: the kernel only counts the read and write kind, poll, epoll_wait,
+ * accept and the others are not part of it.
+ */
+class ServerUsage : public QObject
+{
+    Q_OBJECT
+    struct Sample {
+        /* User and system time of all the threads, in seconds */
+        double cpu;
+        quint64 readCalls;
+        quint64 writeCalls;
+    };
+    qint64 m_pid;
+    bool m_valid;
+    Sample m_start;
+    Sample m_end;
+
+    bool read(Sample &sample) const;
+public:
+    ServerUsage(qint64 pid);
+    /* False where there is no /proc, or the server went away in between */
+    bool isValid() const { return m_valid; }
+    double cpu() const { return m_end.cpu - m_start.cpu; }
+    quint64 readCalls() const { return m_end.readCalls - m_start.readCalls; }
+    quint64 writeCalls() const { return m_end.writeCalls - m_start.writeCalls; }
+public slots:
+    /* The warm up is over */
+    void reset();
+    void stop();
+};
+
+#endif // SERVERUSAGE_H
@@ -0,0 +1,127 @@
+#include <QtCore/QElapsedTimer>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "benchmark.h"
+
+/*
+ * Every allocation goes through malloc, Qt's own included, so that is what
+ * we count. The definitions here take the place of the ones in the C library
+ * and forward to glibc's real ones. The counter is per thread so the log
+ * writer and the other threads of Qt do not show up in the numbers.
+ */
+static __thread quint64 allocation_count = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void __libc_free(void *pointer);
+
+void *malloc(size_t size)
+{
+    ++allocation_count;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    ++allocation_count;
+    return __libc_calloc(count, size);
+}
+
+/* Growing a buffer costs as much as allocating one */
+void *realloc(void *pointer, size_t size)
+{
+    ++allocation_count;
+    return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer)
+{
+    __libc_free(pointer);
+}
+}
+
+quint64 Benchmark::allocations()
+{
+    return allocation_count;
+}
+
+bool Check::expect(bool condition, const char *what) const
+{
+    if (!condition)
+        printf("%-28s %s does not hold\n", m_name, what);
+    return condition;
+}
+
+BenchmarkRunner::~BenchmarkRunner()
+{
+    qDeleteAll(m_checks);
+    qDeleteAll(m_benchmarks);
+}
+
+static bool selected(const char *name, const QStringList &filters)
+{
+    if (filters.isEmpty())
+        return true;
+    foreach (const QString &filter, filters) {
+        if (QString::fromLatin1(name).startsWith(filter))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * The operations are run in batches that double until a batch takes long
+ * enough for the clock, the batches then go on for the whole duration.
+ */
+int BenchmarkRunner::exec(const QStringList &filters)
+{
+    int failed = 0;
+    foreach (Check *check, m_checks) {
+        if (!selected(check->name(), filters))
+            continue;
+        bool passed = check->run();
+        printf("%-28s %s\n", check->name(), passed ? "ok" : "FAILED");
+        if (!passed)
+            ++failed;
+    }
+    printf("%-28s %12s %12s %14s %10s\n", "benchmark", "operations", "ns/op", "op/s", "allocs/op");
+    foreach (Benchmark *benchmark, m_benchmarks) {
+        if (!selected(benchmark->name(), filters))
+            continue;
+        if (!benchmark->setUp()) {
+            printf("%-28s could not be set up\n", benchmark->name());
+            ++failed;
+            continue;
+        }
+        QElapsedTimer clock;
+        clock.start();
+        while (clock.elapsed() < BENCHMARK_WARMUP)
+            benchmark->run();
+        quint64 operations = 0;
+        quint64 batch = 1;
+        qint64 elapsed = 0;
+        quint64 allocations = Benchmark::allocations();
+        clock.restart();
+        while (elapsed < (qint64)m_duration * 1000000) {
+            for (quint64 i = 0; i < batch; ++i)
+                benchmark->run();
+            operations += batch;
+            elapsed = clock.nsecsElapsed();
+            if (elapsed < 1000000)
+                batch *= 2;
+        }
+        allocations = Benchmark::allocations() - allocations;
+        bool checked = benchmark->check();
+        benchmark->tearDown();
+        printf("%-28s %12llu %12.1f %14.0f %10.2f\n", benchmark->name(), (unsigned long long)operations,
+               (double)elapsed / operations, operations * 1e9 / elapsed, (double)allocations / operations);
+        if (!checked) {
+            printf("%-28s FAILED\n", benchmark->name());
+            ++failed;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,65 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+
+#define BENCHMARK_DURATION 1000     /* Milliseconds each benchmark is measured for */
+#define BENCHMARK_WARMUP 100        /* Milliseconds it runs before that */
+
+/*
+ * One operation of a hot path. run() is called over and over, whatever has
+ * to exist before is built in setUp() so it is not measured.
+ */
+class Benchmark
+{
+    const char *m_name;
+public:
+    Benchmark(const char *name) : m_name(name) {}
+    virtual ~Benchmark() {}
+    const char *name() const { return m_name; }
+    virtual bool setUp() { return true; }
+    virtual void run() = 0;
+    /* After the last operation, false if they left something they should not have */
+    virtual bool check() { return true; }
+    virtual void tearDown() {}
+    /* Heap allocations made by this thread so far */
+    static quint64 allocations();
+};
+
+/*
+ * What a hot path has to get right, so the benchmarks do not time a broken
+ * one. The checks run before anything is timed.
+ */
+class Check
+{
+    const char *m_name;
+protected:
+    /* Says which case failed, if it did */
+    bool expect(bool condition, const char *what) const;
+public:
+    Check(const char *name) : m_name(name) {}
+    virtual ~Check() {}
+    const char *name() const { return m_name; }
+    virtual bool run() = 0;
+};
+
+/*
+ * Runs the checks and the benchmarks whose name starts with one of the
+ * filters, all of them without filters, and prints the time and the
+ * allocations of an operation. A failed check fails the run.
+ */
+class BenchmarkRunner
+{
+    QList<Check *> m_checks;
+    QList<Benchmark *> m_benchmarks;
+    int m_duration;
+public:
+    BenchmarkRunner(int duration = BENCHMARK_DURATION) : m_duration(duration) {}
+    ~BenchmarkRunner();
+    void add(Check *check) { m_checks.append(check); }
+    void add(Benchmark *benchmark) { m_benchmarks.append(benchmark); }
+    int exec(const QStringList &filters);
+};
+
+#endif // BENCHMARK_H
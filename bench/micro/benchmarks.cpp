@@ -0,0 +1,385 @@
+#include <QtCore/QRegExp>
+#include <QtCore/QCoreApplication>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "benchmarks.h"
+#include "log.h"
+
+#define BENCH_TARGET "/www/file-4096.html"
+#define BENCH_FRAME 4096
+
+/*
+ * A connected pair on the loopback, the server side for us to reply on.
+ */
+static bool connected_pair(int &server, int &client)
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if ((::bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0)
+            || (::listen(listener, 1) != 0)
+            || (::getsockname(listener, (struct sockaddr *)&address, &length) != 0)) {
+        ::close(listener);
+        return false;
+    }
+    client = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(client, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        ::close(listener);
+        return false;
+    }
+    server = ::accept(listener, NULL, NULL);
+    ::close(listener);
+    return server != -1;
+}
+
+/*
+ * Whether the header and as much of the body as it announced arrived.
+ */
+static bool complete_reply(const QByteArray &data)
+{
+    int end = data.indexOf("\r\n\r\n");
+    if (end == -1)
+        return false;
+    int field = data.indexOf("Content-Length: ");
+    if ((field == -1) || (field > end))
+        return true;
+    qint64 length = 0;
+    for (const char *digit = data.constData() + field + 16; (*digit >= '0') && (*digit <= '9'); ++digit)
+        length = length * 10 + (*digit - '0');
+    return data.size() >= end + 4 + length;
+}
+
+QByteArray browserRequest(const QByteArray &target)
+{
+    return "GET " + target + " HTTP/1.1\r\n"
+            "Host: localhost:8080\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+            "Accept-Language: en-US,en;q=0.5\r\n"
+            "Accept-Encoding: identity\r\n"
+            "Connection: keep-alive\r\n"
+            "Cache-Control: max-age=0\r\n"
+            "\r\n";
+}
+
+ParserBenchmark::ParserBenchmark() :
+    Benchmark("parser/requestparser"),
+    m_request(browserRequest(BENCH_TARGET))
+{
+}
+
+void ParserBenchmark::run()
+{
+    m_parser.reset();
+    m_parser.parse(m_request);
+}
+
+RegExpBenchmark::RegExpBenchmark() :
+    Benchmark("parser/qregexp"),
+    m_request(browserRequest(BENCH_TARGET))
+{
+}
+
+/*
+ * The expression was built for every request and its captures were copied.
+ */
+void RegExpBenchmark::run()
+{
+    QRegExp first("^(GET|HEAD)\\s+(\\S+)\\s+(HTTP/1.[01])");
+    if (first.indexIn(m_request) == -1)
+        return;
+    QByteArray target;
+    QByteArray version;
+    target.append(first.cap(2));
+    version.append(first.cap(3));
+}
+
+/*
+ * The socket is never connected, there is nothing to read from it, the
+ * request is already in the buffer as if it was pipelined.
+ */
+RequestParseBenchmark::RequestParseBenchmark() :
+    Benchmark("request/parse"),
+    m_raw(browserRequest(BENCH_TARGET))
+{
+}
+
+void RequestParseBenchmark::run()
+{
+    m_request.reset(&m_socket, 0, true, 0, m_raw);
+    m_request.fetch();
+    m_request.parse();
+}
+
+ResolveBenchmark::ResolveBenchmark(const Configuration *configuration) :
+    Benchmark("configuration/resolve"),
+    m_configuration(configuration),
+    m_target(BENCH_TARGET)
+{
+}
+
+void ResolveBenchmark::run()
+{
+    m_configuration->resolve(m_target);
+}
+
+ConfigurationFileBenchmark::ConfigurationFileBenchmark(const Configuration *configuration) :
+    Benchmark("configuration/file"),
+    m_configuration(configuration)
+{
+}
+
+bool ConfigurationFileBenchmark::setUp()
+{
+    m_route = m_configuration->resolve(QByteArray(BENCH_TARGET));
+    return m_route.isValid();
+}
+
+void ConfigurationFileBenchmark::run()
+{
+    m_response.resize(0);
+    m_configuration->file(m_route, m_response);
+}
+
+WebFolderBenchmark::WebFolderBenchmark(const char *name, const QString &handler, bool file) :
+    Benchmark(name),
+    m_handler(handler),
+    m_file(file)
+{
+}
+
+bool WebFolderBenchmark::setUp()
+{
+    m_folder.setHandler(m_handler);
+    m_folder.setName("/www");
+    return m_folder.load();
+}
+
+void WebFolderBenchmark::run()
+{
+    if (m_file) {
+        m_response.resize(0);
+        m_folder.file("/file-4096.html", m_response);
+    } else {
+        m_folder.has("/file-4096.html");
+    }
+}
+
+LogBenchmark::LogBenchmark(const char *name, Log::LogLevel level) :
+    Benchmark(name),
+    m_level(level),
+    m_dropped(0)
+{
+}
+
+/*
+ * We log far faster than the writer can write. Dropping, the buffer would be
+ * full after a few thousand entries and we would time the drops, blocking we
+ * time what an entry costs when the writer keeps up.
+ */
+bool LogBenchmark::setUp()
+{
+    Log *log = Log::instance();
+    log->setLevel(Log::LogLevelNormal);
+    log->setOverflowPolicy(Log::Block);
+    m_dropped = log->dropped();
+    return true;
+}
+
+void LogBenchmark::run()
+{
+    Log::instance()->entry(m_level, "benchmark entry");
+}
+
+bool LogBenchmark::check()
+{
+    int dropped = Log::instance()->dropped() - m_dropped;
+    if (dropped)
+        printf("%-28s %d entries dropped\n", name(), dropped);
+    return dropped == 0;
+}
+
+/*
+ * The other benchmarks run with the log the configuration asked for.
+ */
+void LogBenchmark::tearDown()
+{
+    Log *log = Log::instance();
+    log->setLevel(Log::LogLevelCritical);
+    log->setOverflowPolicy(Log::Drop);
+}
+
+static const unsigned char bench_mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+/*
+ * Masking twice gives the payload back, it is the same work either way.
+ */
+UnmaskBenchmark::UnmaskBenchmark(const char *name, bool bytewise) :
+    Benchmark(name),
+    m_bytewise(bytewise),
+    m_payload(BENCH_FRAME, 'x')
+{
+}
+
+void UnmaskBenchmark::run()
+{
+    char *data = m_payload.data();
+    if (!m_bytewise) {
+        WebSocketFrame::unmask(data, m_payload.size(), bench_mask);
+        return;
+    }
+    for (int i = 0; i < m_payload.size(); ++i)
+        data[i] ^= bench_mask[i & 3];
+}
+
+CycleBenchmark::CycleBenchmark(const char *name, const Configuration *configuration) :
+    Benchmark(name),
+    m_configuration(configuration),
+    m_socket(NULL),
+    m_client(-1),
+    m_raw(browserRequest(BENCH_TARGET)),
+    m_allocations(0),
+    m_created(0)
+{
+}
+
+/*
+ * A connected pair on the loopback, the server side is ours to reply on,
+ * the client side is only read to make room.
+ */
+bool CycleBenchmark::setUp()
+{
+    int server;
+    if (!connected_pair(server, m_client))
+        return false;
+    m_socket = new QTcpSocket();
+    if (!m_socket->setSocketDescriptor(server))
+        return false;
+    /* Timing anything but the file would be pointless, a 404 is much cheaper */
+    QByteArray received;
+    cycle(&received);
+    m_allocations = m_pool.buffers().allocations();
+    m_created = m_pool.created();
+    return received.startsWith("HTTP/1.1 200 ");
+}
+
+/*
+ * What the client got is kept only if asked for.
+ */
+void CycleBenchmark::drain(QByteArray *received)
+{
+    char scratch[65536];
+    ssize_t got;
+    while ((got = ::recv(m_client, scratch, sizeof(scratch), MSG_DONTWAIT)) > 0) {
+        if (received)
+            received->append(scratch, (int)got);
+    }
+}
+
+void CycleBenchmark::cycle(QByteArray *received)
+{
+    Request *request = m_pool.acquire(m_socket, 0, true, 0, m_raw);
+    request->fetch();
+    request->parse();
+    request->reply(m_configuration);
+    forever {
+        m_socket->flush();
+        drain(received);
+        if (request->isReady())
+            break;
+    }
+    drain(received);
+    m_pool.release(request);
+}
+
+void CycleBenchmark::run()
+{
+    cycle(NULL);
+}
+
+/*
+ * One request at a time, the first one made everything the others need.
+ * Anything more means a buffer or a request was not given back.
+ */
+bool CycleBenchmark::check()
+{
+    bool flat = true;
+    /* Qt 4 cannot keep the memory of an empty buffer, there every request allocates */
+#if QT_VERSION >= 0x050000
+    if (m_pool.buffers().allocations() != m_allocations) {
+        printf("%-28s %llu buffers allocated after the first request\n", name(),
+               (unsigned long long)(m_pool.buffers().allocations() - m_allocations));
+        flat = false;
+    }
+#endif
+    if (m_pool.created() != m_created) {
+        printf("%-28s %llu requests created after the first one\n", name(),
+               (unsigned long long)(m_pool.created() - m_created));
+        flat = false;
+    }
+    return flat;
+}
+
+void CycleBenchmark::tearDown()
+{
+    delete m_socket;
+    m_socket = NULL;
+    ::close(m_client);
+}
+
+WorkerBenchmark::WorkerBenchmark(const char *name, const Configuration *configuration) :
+    Benchmark(name),
+    m_configuration(configuration),
+    m_worker(NULL),
+    m_client(-1),
+    m_raw(browserRequest(BENCH_TARGET))
+{
+}
+
+/*
+ * The worker lives in our thread, the connection is handed to it the way
+ * the acceptor does, only without counting it.
+ */
+bool WorkerBenchmark::setUp()
+{
+    int server;
+    if (!connected_pair(server, m_client))
+        return false;
+    m_worker = new Worker(m_configuration);
+    m_worker->start();
+    m_worker->handle_connection(server, false);
+    run();
+    return m_received.startsWith("HTTP/1.1 200 ");
+}
+
+void WorkerBenchmark::run()
+{
+    ::send(m_client, m_raw.constData(), m_raw.size(), 0);
+    m_received.resize(0);
+    char scratch[65536];
+    do {
+        QCoreApplication::processEvents();
+        ssize_t got;
+        while ((got = ::recv(m_client, scratch, sizeof(scratch), MSG_DONTWAIT)) > 0)
+            m_received.append(scratch, (int)got);
+    } while (!complete_reply(m_received));
+}
+
+/*
+ * The worker sees the client go before it is deleted.
+ */
+void WorkerBenchmark::tearDown()
+{
+    ::close(m_client);
+    QCoreApplication::processEvents();
+    delete m_worker;
+    m_worker = NULL;
+}
@@ -0,0 +1,151 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QtCore/QByteArray>
+#include <QtNetwork/QTcpSocket>
+
+#include "benchmark.h"
+#include "configuration.h"
+#include "log.h"
+#include "requestparser.h"
+#include "requestpool.h"
+#include "request.h"
+#include "webfolder.h"
+#include "websocketframe.h"
+#include "worker.h"
+
+/* What a browser sends for a page, about 400 bytes */
+QByteArray browserRequest(const QByteArray &target);
+
+class ParserBenchmark : public Benchmark
+{
+    RequestParser m_parser;
+    QByteArray m_request;
+public:
+    ParserBenchmark();
+    virtual void run();
+};
+
+/* The request line the way it was parsed before the state machine, for comparison */
+class RegExpBenchmark : public Benchmark
+{
+    QByteArray m_request;
+public:
+    RegExpBenchmark();
+    virtual void run();
+};
+
+class RequestParseBenchmark : public Benchmark
+{
+    Request m_request;
+    QTcpSocket m_socket;
+    QByteArray m_raw;
+public:
+    RequestParseBenchmark();
+    virtual void run();
+};
+
+class ResolveBenchmark : public Benchmark
+{
+    const Configuration *m_configuration;
+    QByteArray m_target;
+public:
+    ResolveBenchmark(const Configuration *configuration);
+    virtual void run();
+};
+
+class ConfigurationFileBenchmark : public Benchmark
+{
+    const Configuration *m_configuration;
+    Route m_route;
+    QByteArray m_response;
+public:
+    ConfigurationFileBenchmark(const Configuration *configuration);
+    virtual bool setUp();
+    virtual void run();
+};
+
+class WebFolderBenchmark : public Benchmark
+{
+    QString m_handler;
+    bool m_file;
+    WebFolder m_folder;
+    QByteArray m_response;
+public:
+    /* Either has() or file() */
+    WebFolderBenchmark(const char *name, const QString &handler, bool file);
+    virtual bool setUp();
+    virtual void run();
+};
+
+class LogBenchmark : public Benchmark
+{
+    Log::LogLevel m_level;
+    int m_dropped;
+public:
+    /* Entries of the given level, the log only takes normal ones */
+    LogBenchmark(const char *name, Log::LogLevel level);
+    virtual bool setUp();
+    virtual void run();
+    virtual bool check();
+    virtual void tearDown();
+};
+
+/* The payload of a client frame, unmasked as the server does it or byte by byte for comparison */
+class UnmaskBenchmark : public Benchmark
+{
+    bool m_bytewise;
+    QByteArray m_payload;
+public:
+    UnmaskBenchmark(const char *name, bool bytewise);
+    virtual void run();
+};
+
+/*
+ * A whole request on a loopback connection: a request from the pool, the
+ * header read, parsed and replied, the reply taken by the client and the
+ * request given back. The allocations per operation are the ones a request
+ * costs under steady load.
+ */
+class CycleBenchmark : public Benchmark
+{
+    const Configuration *m_configuration;
+    RequestPool m_pool;
+    QTcpSocket *m_socket;
+    int m_client;
+    QByteArray m_raw;
+    /* What the pool had made once the first request went through */
+    quint64 m_allocations;
+    quint64 m_created;
+
+    void drain(QByteArray *received);
+    void cycle(QByteArray *received);
+public:
+    CycleBenchmark(const char *name, const Configuration *configuration);
+    virtual bool setUp();
+    virtual void run();
+    virtual bool check();
+    virtual void tearDown();
+};
+
+/*
+ * A request on a keep-alive connection served by a worker in event driven
+ * mode: the client writes it and the event loop runs until the whole reply
+ * is back. It is what every request waits for, a pulse mode worker would
+ * take up to a pulse for the same request.
+ */
+class WorkerBenchmark : public Benchmark
+{
+    const Configuration *m_configuration;
+    Worker *m_worker;
+    int m_client;
+    QByteArray m_raw;
+    QByteArray m_received;
+public:
+    WorkerBenchmark(const char *name, const Configuration *configuration);
+    virtual bool setUp();
+    virtual void run();
+    virtual void tearDown();
+};
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,248 @@
+#include "checks.h"
+#include "benchmarks.h"
+
+#define CHECK_TARGET "/www/file-4096.html"
+
+ParserCheck::ParserCheck() :
+    Check("parser/cases")
+{
+}
+
+bool ParserCheck::run()
+{
+    return split() && bare_lf() && too_large() && empty_value() && folded() && pipelined();
+}
+
+/*
+ * The request arrives in two reads, cut at every possible place. The parser
+ * goes on from where it stopped and ends up where a single read gets.
+ */
+bool ParserCheck::split()
+{
+    QByteArray request = browserRequest(CHECK_TARGET);
+    RequestParser whole;
+    if (!expect(whole.parse(request) == RequestParser::Complete, "a browser request is complete"))
+        return false;
+    for (int cut = 1; cut < request.size(); ++cut) {
+        RequestParser parser;
+        QByteArray buffer = request.left(cut);
+        if (!expect(parser.parse(buffer) == RequestParser::Incomplete, "a cut request is incomplete"))
+            return false;
+        buffer.append(request.mid(cut));
+        if (!expect(parser.parse(buffer) == RequestParser::Complete, "the rest completes it")
+                || !expect(parser.length() == request.size(), "the length is the one of the whole request")
+                || !expect(parser.headerCount() == whole.headerCount(), "every header is found")
+                || !expect(RequestParser::equals(buffer, parser.target(), CHECK_TARGET), "the target is found"))
+            return false;
+        RequestParser::Span host;
+        if (!expect(parser.find(buffer, "host", host) && RequestParser::equals(buffer, host, "localhost:8080"),
+                    "the host survives the cut"))
+            return false;
+    }
+    return true;
+}
+
+bool ParserCheck::bare_lf()
+{
+    QByteArray request("GET /a HTTP/1.0\nHost: example\nAccept: */*\n\n");
+    RequestParser parser;
+    if (!expect(parser.parse(request) == RequestParser::Complete, "bare LF line endings are taken"))
+        return false;
+    RequestParser::Span host;
+    return expect(parser.length() == request.size(), "a bare LF ends the header")
+            && expect(parser.headerCount() == 2, "bare LF headers are counted")
+            && expect(parser.find(request, "Host", host) && RequestParser::equals(request, host, "example"),
+                      "a bare LF is not part of the value")
+            && expect(RequestParser::equals(request, parser.version(), "HTTP/1.0"), "the version ends at a bare LF");
+}
+
+/*
+ * A header of exactly the maximum size is fine, one byte more is not, and
+ * neither is one header too many.
+ */
+bool ParserCheck::too_large()
+{
+    QByteArray start("GET / HTTP/1.1\r\nX-Fill: ");
+    QByteArray exact = start;
+    exact.append(QByteArray(PARSER_MAX_HEADER_SIZE - start.size() - 4, 'x'));
+    exact.append("\r\n\r\n");
+    RequestParser fits;
+    if (!expect(fits.parse(exact) == RequestParser::Complete, "a header of the maximum size is complete"))
+        return false;
+    QByteArray over = start;
+    over.append(QByteArray(PARSER_MAX_HEADER_SIZE - start.size() - 3, 'x'));
+    over.append("\r\n\r\n");
+    RequestParser large;
+    if (!expect(large.parse(over) == RequestParser::TooLarge, "a header one byte over the maximum is too large"))
+        return false;
+    /* It does not matter how much of it came at once */
+    RequestParser endless;
+    QByteArray buffer("GET / HTTP/1.1\r\nX-Fill: ");
+    while ((endless.parse(buffer) == RequestParser::Incomplete) && (buffer.size() < 2 * PARSER_MAX_HEADER_SIZE))
+        buffer.append(QByteArray(1000, 'x'));
+    if (!expect(endless.status() == RequestParser::TooLarge, "a header that never ends is too large"))
+        return false;
+    QByteArray many("GET / HTTP/1.1\r\n");
+    for (int i = 0; i < PARSER_MAX_HEADERS; ++i)
+        many.append("X-H: v\r\n");
+    RequestParser most;
+    if (!expect(most.parse(many + "\r\n") == RequestParser::Complete, "the maximum number of headers is complete"))
+        return false;
+    many.append("X-H: v\r\n\r\n");
+    RequestParser count;
+    return expect(count.parse(many) == RequestParser::TooLarge, "one header over the maximum is too large");
+}
+
+bool ParserCheck::empty_value()
+{
+    QByteArray request("GET / HTTP/1.1\r\nX-Empty:\r\nX-Blank:   \r\nHost: h\r\n\r\n");
+    RequestParser parser;
+    if (!expect(parser.parse(request) == RequestParser::Complete, "empty values are taken"))
+        return false;
+    RequestParser::Span empty;
+    RequestParser::Span blank;
+    RequestParser::Span host;
+    return expect(parser.find(request, "x-empty", empty) && (empty.length == 0), "an empty value is empty")
+            && expect(parser.find(request, "x-blank", blank) && (blank.length == 0), "a blank value is empty")
+            && expect(parser.find(request, "host", host) && RequestParser::equals(request, host, "h"),
+                      "the header after an empty one is found");
+}
+
+/*
+ * Obsolete line folding, a header line that starts with white space.
+ */
+bool ParserCheck::folded()
+{
+    RequestParser space;
+    RequestParser tab;
+    return expect(space.parse("GET / HTTP/1.1\r\nX-Long: one\r\n two\r\n\r\n") == RequestParser::Invalid,
+                  "a line folded with a space is invalid")
+            && expect(tab.parse("GET / HTTP/1.1\r\nX-Long: one\r\n\ttwo\r\n\r\n") == RequestParser::Invalid,
+                      "a line folded with a tab is invalid");
+}
+
+/*
+ * Two requests in one read, the second one is parsed where the first ends.
+ */
+bool ParserCheck::pipelined()
+{
+    QByteArray first("GET /first HTTP/1.1\r\nHost: h\r\n\r\n");
+    QByteArray buffer = first + "HEAD /second HTTP/1.1\r\nHost: h\r\nX-Last: yes\r\n\r\n";
+    RequestParser parser;
+    if (!expect(parser.parse(buffer) == RequestParser::Complete, "the first request is complete")
+            || !expect(parser.length() == first.size(), "the first request ends where it ends"))
+        return false;
+    parser.reset(parser.length());
+    if (!expect(parser.parse(buffer) == RequestParser::Complete, "the second request is complete"))
+        return false;
+    RequestParser::Span last;
+    return expect(parser.method().offset == first.size(), "the second request starts after the first")
+            && expect(RequestParser::equals(buffer, parser.method(), "HEAD"), "the second method is found")
+            && expect(RequestParser::equals(buffer, parser.target(), "/second"), "the second target is found")
+            && expect(parser.headerCount() == 2, "only the headers of the second request are there")
+            && expect(parser.find(buffer, "x-last", last), "the headers of the second request are found")
+            && expect(parser.length() == buffer.size(), "the second request ends at the end of the buffer");
+}
+
+TimerWheelCheck::TimerWheelCheck() :
+    Check("timers/wheel")
+{
+}
+
+bool TimerWheelCheck::run()
+{
+    return levels() && clamped() && cancelled() && rescheduled();
+}
+
+bool TimerWheelCheck::fires(qint64 start, qint64 deadline)
+{
+    TimerWheel wheel(1);
+    wheel.reset(start);
+    TimerWheel::Timer timer;
+    wheel.schedule(&timer, deadline, 1);
+    return expect(wheel.take(deadline - 1) == NULL, "a timer does not expire before its deadline")
+            && expect(wheel.take(deadline) == &timer, "a timer expires on its deadline")
+            && expect(!timer.isActive() && (timer.kind() == 1), "an expired timer is no longer scheduled")
+            && expect(wheel.take(deadline) == NULL, "a timer expires once");
+}
+
+/*
+ * Right before, on and right after the first tick of the second and of the
+ * third level, from a clock that starts on a turn and from one that does not.
+ */
+bool TimerWheelCheck::levels()
+{
+    static const qint64 starts[] = { 0, 37, TIMERWHEEL_SLOTS * TIMERWHEEL_SLOTS - 1 };
+    static const qint64 distances[] = {
+        1, TIMERWHEEL_SLOTS - 1, TIMERWHEEL_SLOTS, TIMERWHEEL_SLOTS + 1,
+        TIMERWHEEL_SLOTS * TIMERWHEEL_SLOTS - 1, TIMERWHEEL_SLOTS * TIMERWHEEL_SLOTS,
+        TIMERWHEEL_SLOTS * TIMERWHEEL_SLOTS + 1
+    };
+    for (unsigned int i = 0; i < sizeof(starts) / sizeof(starts[0]); ++i) {
+        for (unsigned int j = 0; j < sizeof(distances) / sizeof(distances[0]); ++j) {
+            if (!fires(starts[i], starts[i] + distances[j]))
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Deadlines farther than the last level wait in its farthest slot, they are
+ * sorted again on the way and still expire on their tick.
+ */
+bool TimerWheelCheck::clamped()
+{
+    qint64 farthest = ((qint64)1 << (TIMERWHEEL_BITS * TIMERWHEEL_LEVELS)) - 1;
+    return fires(0, farthest)
+            && fires(0, farthest + 1)
+            && fires(0, 3 * farthest + 5)
+            && fires(TIMERWHEEL_SLOTS * TIMERWHEEL_SLOTS - 1, 3 * farthest + 5);
+}
+
+/*
+ * What the caller does with an expired timer can cancel or schedule others
+ * before it takes the next one.
+ */
+bool TimerWheelCheck::cancelled()
+{
+    TimerWheel wheel(1);
+    TimerWheel::Timer first;
+    TimerWheel::Timer second;
+    TimerWheel::Timer later;
+    TimerWheel::Timer added;
+    wheel.schedule(&first, 10);
+    wheel.schedule(&second, 10);
+    wheel.schedule(&later, 20);
+    if (!expect(wheel.take(30) == &first, "the first of two timers on a tick expires first"))
+        return false;
+    second.cancel();
+    wheel.schedule(&added, 25);
+    return expect(!second.isActive(), "a timer cancelled in between is no longer scheduled")
+            && expect(wheel.take(30) == &later, "a timer cancelled in between does not expire")
+            && expect(wheel.take(30) == &added, "a timer scheduled in between expires if it is due")
+            && expect(wheel.take(30) == NULL, "nothing else expires");
+}
+
+/*
+ * An expired timer that is scheduled again, for a deadline that already
+ * passed and for one to come.
+ */
+bool TimerWheelCheck::rescheduled()
+{
+    TimerWheel wheel(1);
+    TimerWheel::Timer timer;
+    wheel.schedule(&timer, 10, 1);
+    if (!expect(wheel.take(10) == &timer, "the timer expires"))
+        return false;
+    wheel.schedule(&timer, 5, 2);
+    if (!expect(timer.isActive(), "an expired timer can be scheduled again")
+            || !expect(wheel.take(10) == NULL, "a timer scheduled again does not expire on the tick it expired")
+            || !expect(wheel.take(11) == &timer, "a deadline that passed expires on the next tick")
+            || !expect(timer.kind() == 2, "a timer scheduled again has its new kind"))
+        return false;
+    wheel.schedule(&timer, 11 + TIMERWHEEL_SLOTS, 3);
+    return expect(wheel.take(10 + TIMERWHEEL_SLOTS) == NULL, "a timer scheduled again waits for its new deadline")
+            && expect(wheel.take(11 + TIMERWHEEL_SLOTS) == &timer, "a timer scheduled again expires on its new deadline")
+            && expect(timer.kind() == 3, "a timer scheduled again has its new kind");
+}
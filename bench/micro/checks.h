@@ -0,0 +1,44 @@
+#ifndef CHECKS_H
+#define CHECKS_H
+
+#include <QtCore/QByteArray>
+
+#include "benchmark.h"
+#include "requestparser.h"
+#include "timerwheel.h"
+
+/*
+ * The request parser works on untrusted input and keeps its state across
+ * reads, these are the cases it has to get right.
+ */
+class ParserCheck : public Check
+{
+    bool split();
+    bool bare_lf();
+    bool too_large();
+    bool empty_value();
+    bool folded();
+    bool pipelined();
+public:
+    ParserCheck();
+    virtual bool run();
+};
+
+/*
+ * The timer wheel with a tick of a millisecond, so deadlines are ticks. A
+ * deadline has to expire on its tick, not before and not after, wherever it
+ * falls in the levels.
+ */
+class TimerWheelCheck : public Check
+{
+    bool fires(qint64 start, qint64 deadline);
+    bool levels();
+    bool clamped();
+    bool cancelled();
+    bool rescheduled();
+public:
+    TimerWheelCheck();
+    virtual bool run();
+};
+
+#endif // CHECKS_H
@@ -0,0 +1,64 @@
+#include <QCoreApplication>
+#include <stdio.h>
+
+#include "benchmark.h"
+#include "benchmarks.h"
+#include "checks.h"
+#include "configuration.h"
+#include "fixture.h"
+
+/*
+ * Usage: micro [prefix...]
+ * Only the benchmarks whose name starts with one of the prefixes are run.
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    Fixture fixture;
+    if (!fixture.create()) {
+        fprintf(stderr, "could not create the fixture\n");
+        return 1;
+    }
+    /* The request path runs with the log that production uses */
+    Configuration plain;
+    plain.setConfigurationFile(fixture.writeConfiguration(8080, "loglevel=\"critical\""));
+    if (!plain.parse()) {
+        fprintf(stderr, "could not parse the configuration\n");
+        return 1;
+    }
+    Configuration cached;
+    cached.setConfigurationFile(fixture.writeConfiguration(8080, "loglevel=\"critical\" cache=\"4194304\""));
+    if (!cached.parse()) {
+        fprintf(stderr, "could not parse the configuration\n");
+        return 1;
+    }
+
+    /* The worker keeps a single connection for the whole run */
+    Configuration persistent;
+    persistent.setConfigurationFile(fixture.writeConfiguration(8080, "loglevel=\"critical\" maxrequests=\"2147483647\""));
+    if (!persistent.parse()) {
+        fprintf(stderr, "could not parse the configuration\n");
+        return 1;
+    }
+
+    BenchmarkRunner runner;
+    runner.add(new ParserCheck());
+    runner.add(new TimerWheelCheck());
+    runner.add(new ParserBenchmark());
+    runner.add(new RegExpBenchmark());
+    runner.add(new RequestParseBenchmark());
+    runner.add(new ResolveBenchmark(&plain));
+    runner.add(new ConfigurationFileBenchmark(&plain));
+    runner.add(new WebFolderBenchmark("webfolder/has", fixture.folder(), false));
+    runner.add(new WebFolderBenchmark("webfolder/file", fixture.folder(), true));
+    runner.add(new LogBenchmark("log/entry", Log::LogLevelNormal));
+    runner.add(new LogBenchmark("log/disabled", Log::LogLevelDebug));
+    runner.add(new UnmaskBenchmark("websocket/unmask", false));
+    runner.add(new UnmaskBenchmark("websocket/unmask-bytewise", true));
+    runner.add(new CycleBenchmark("request/cycle", &plain));
+    runner.add(new CycleBenchmark("request/cycle-cached", &cached));
+    runner.add(new WorkerBenchmark("worker/event", &persistent));
+    int failed = runner.exec(app.arguments().mid(1));
+    Log::instance()->shutdown();
+    return failed ? 1 : 0;
+}
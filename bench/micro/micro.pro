@@ -0,0 +1,96 @@
+#-------------------------------------------------
+#
+# Microbenchmarks of the request path
+#
+#-------------------------------------------------
+
+QT       += core network
+
+QT       -= gui
+
+TARGET = micro
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+LIBS += -lz
+
+INCLUDEPATH += ../../src ../common
+VPATH += ../../src ../common
+
+SOURCES += main.cpp \
+    benchmark.cpp \
+    benchmarks.cpp \
+    checks.cpp \
+    fixture.cpp \
+    configuration.cpp \
+    log.cpp \
+    folder.cpp \
+    webfolder.cpp \
+    appfolder.cpp \
+    handlerresponse.cpp \
+    upstream.cpp \
+    upstreampool.cpp \
+    upstreamexchange.cpp \
+    cgiprotocol.cpp \
+    websocket.cpp \
+    websocketframe.cpp \
+    websocketdeflate.cpp \
+    bodyproducer.cpp \
+    filetransfer.cpp \
+    filereader.cpp \
+    contentcache.cpp \
+    compressioncache.cpp \
+    admission.cpp \
+    worker.cpp \
+    request.cpp \
+    requestpool.cpp \
+    metrics.cpp \
+    histogram.cpp \
+    timerwheel.cpp \
+    bufferpool.cpp \
+    requestparser.cpp \
+    responseheader.cpp
+
+HEADERS += \
+    benchmark.h \
+    benchmarks.h \
+    checks.h \
+    fixture.h \
+    configuration.h \
+    log.h \
+    atomics.h \
+    folder.h \
+    webfolder.h \
+    appfolder.h \
+    handler.h \
+    handlerrequest.h \
+    responsesink.h \
+    handlerresponse.h \
+    upstream.h \
+    upstreampool.h \
+    upstreamexchange.h \
+    cgiprotocol.h \
+    websocketchannel.h \
+    websockethandler.h \
+    websocket.h \
+    websocketframe.h \
+    websocketdeflate.h \
+    bodyproducer.h \
+    filetransfer.h \
+    filereader.h \
+    contentcache.h \
+    compressioncache.h \
+    admission.h \
+    worker.h \
+    request.h \
+    requestpool.h \
+    clientconnection.h \
+    metrics.h \
+    histogram.h \
+    timerwheel.h \
+    bufferpool.h \
+    requestparser.h \
+    route.h \
+    responseheader.h
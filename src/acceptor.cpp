@@ -0,0 +1,70 @@
+#include <unistd.h>
+
+#include "acceptor.h"
+#include "log.h"
+
+Acceptor::Acceptor(QObject *parent) :
+    QTcpServer(parent),
+    m_next(0),
+    m_admission(NULL)
+{
+}
+
+void Acceptor::setAdmission(Admission *admission)
+{
+    m_admission = admission;
+    connect(m_admission, SIGNAL(available()), this, SLOT(resume()), Qt::QueuedConnection);
+}
+
+/*
+ * Round robin among the workers. The worker might live in a different thread,
+ * so we always go through its event loop.
+ */
+#if QT_VERSION >= 0x050000
+void Acceptor::incomingConnection(qintptr descriptor)
+#else
+void Acceptor::incomingConnection(int descriptor)
+#endif
+{
+    Log *log = Log::instance();
+    if (m_workers.isEmpty()) {
+        log->entry(Log::LogLevelCritical, "no workers to handle the connection");
+        ::close(descriptor);
+        return;
+    }
+    log->entry(Log::LogLevelDebug, "received connection");
+    if (m_admission && !m_admission->admit()) {
+        log->entry(Log::LogLevelDebug, "too many connections, refusing it");
+        m_admission->refuse((int)descriptor);
+        if (m_admission->policy() == Admission::Pause)
+            pause();
+        return;
+    }
+    Worker *worker = m_workers.at(m_next);
+    m_next = (m_next + 1) % m_workers.count();
+    int socket = (int)descriptor;
+    bool admitted = (m_admission != NULL);
+    QMetaObject::invokeMethod(worker, "handle_connection", Qt::QueuedConnection, Q_ARG(int, socket), Q_ARG(bool, admitted));
+}
+
+/*
+ * The clients that come while we are paused wait in the listen backlog.
+ * Qt 4 cannot pause a server, there the connections are refused.
+ */
+void Acceptor::pause()
+{
+#if QT_VERSION >= 0x050000
+    if (m_admission->pause()) {
+        Log::instance()->entry(Log::LogLevelNormal, "too many connections, not accepting any more for now");
+        pauseAccepting();
+    }
+#endif
+}
+
+void Acceptor::resume()
+{
+#if QT_VERSION >= 0x050000
+    Log::instance()->entry(Log::LogLevelNormal, "accepting connections again");
+    resumeAccepting();
+#endif
+}
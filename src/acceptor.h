@@ -0,0 +1,36 @@
+#ifndef ACCEPTOR_H
+#define ACCEPTOR_H
+
+#include <QtCore/QList>
+#include <QtNetwork/QTcpServer>
+
+#include "worker.h"
+#include "admission.h"
+
+/*
+ * The acceptor does not create any sockets, it takes the descriptor of every
+ * accepted connection and hands it over to one of the workers.
+ */
+class Acceptor : public QTcpServer
+{
+    Q_OBJECT
+    QList<Worker *> m_workers;
+    int m_next;
+    Admission *m_admission;
+
+    void pause();
+private slots:
+    void resume();
+protected:
+#if QT_VERSION >= 0x050000
+    virtual void incomingConnection(qintptr descriptor);
+#else
+    virtual void incomingConnection(int descriptor);
+#endif
+public:
+    Acceptor(QObject *parent);
+    void setWorkers(const QList<Worker *> &workers) { m_workers = workers; }
+    void setAdmission(Admission *admission);
+};
+
+#endif // ACCEPTOR_H
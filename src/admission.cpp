@@ -0,0 +1,93 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "responseheader.h"
+
+static const QByteArray http_11("HTTP/1.1");
+
+Admission::Admission(int maxConnections, int maxQueue, Policy policy, int retryAfter) :
+    m_maxConnections(qMax(maxConnections, 0)),
+    m_maxQueue(qMax(maxQueue, 0)),
+    m_policy(policy),
+    m_connections(0),
+    m_paused(0),
+    m_accepted(0),
+    m_rejected(0),
+    m_shed(0),
+    m_pauses(0)
+{
+    m_retryAfter.append("Retry-After: ");
+    ResponseHeader::appendNumber(m_retryAfter, qMax(retryAfter, 0));
+    m_retryAfter.append("\r\nContent-Length: 0\r\n");
+}
+
+/*
+ * Counts the connection if there is room for it. Two threads might both see
+ * room for the last one, so the count is taken first and given back if it
+ * went over.
+ */
+bool Admission::admit()
+{
+    int connections = m_connections.fetchAndAddOrdered(1) + 1;
+    if (m_maxConnections && (connections > m_maxConnections)) {
+        m_connections.fetchAndAddOrdered(-1);
+        m_rejected.fetchAndAddRelaxed(1);
+        return false;
+    }
+    m_accepted.fetchAndAddRelaxed(1);
+    return true;
+}
+
+/*
+ * Called from the workers when a connection they took is gone. The acceptor
+ * is told to go on only once there is some room, so it does not flip between
+ * paused and accepting on every connection.
+ */
+void Admission::release()
+{
+    int connections = m_connections.fetchAndAddOrdered(-1) - 1;
+    if (connections * 100 >= m_maxConnections * ADMISSION_RESUME)
+        return;
+    if (m_paused.testAndSetOrdered(1, 0))
+        emit available();
+}
+
+/*
+ * The acceptor stops. Returns false if the connections that made it stop are
+ * already gone, then there would be nobody to tell it to go on.
+ */
+bool Admission::pause()
+{
+    m_paused.fetchAndStoreOrdered(1);
+    m_pauses.fetchAndAddRelaxed(1);
+    /* Not a plain load, it must not be done before the store above is seen by release() */
+    int connections = m_connections.fetchAndAddOrdered(0);
+    if ((connections * 100 < m_maxConnections * ADMISSION_RESUME) && m_paused.testAndSetOrdered(1, 0))
+        return false;
+    return true;
+}
+
+/*
+ * The request was not even read, so the reply is the one of our own version.
+ */
+void Admission::unavailable(QByteArray &response) const
+{
+    ResponseHeader header(response, http_11, ResponseHeader::ServiceUnavailable, false);
+    header.append(m_retryAfter);
+    header.finish();
+}
+
+/*
+ * For connections that never reach a worker. The reply fits in the socket
+ * buffer of a new connection, if it does not there is nothing to wait for.
+ */
+void Admission::refuse(int descriptor)
+{
+    QByteArray response;
+    unavailable(response);
+    ::send(descriptor, response.constData(), response.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    ::shutdown(descriptor, SHUT_WR);
+    ::close(descriptor);
+}
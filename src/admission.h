@@ -0,0 +1,62 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QAtomicInt>
+
+#include "atomics.h"
+
+#define ADMISSION_RESUME 90     /* Percent of the connection limit at which a paused acceptor goes on */
+
+/*
+ * Decides whether there is room for one more connection. The acceptor asks
+ * before handing a connection to a worker, the workers tell when a connection
+ * is gone and refuse new ones while their queues are full. What is refused
+ * gets a 503 with Retry-After right away, or, if the policy says so, the
+ * acceptor stops accepting and the clients wait in the listen backlog.
+ * It is shared by all the threads, everything in it is atomic.
+ */
+class Admission : public QObject
+{
+    Q_OBJECT
+public:
+    enum Policy {
+        Reject
+        , Pause
+    };
+private:
+    int m_maxConnections;
+    int m_maxQueue;
+    Policy m_policy;
+    /* The lines of the 503 that never change */
+    QByteArray m_retryAfter;
+    QAtomicInt m_connections;
+    QAtomicInt m_paused;
+    QAtomicInt m_accepted;
+    QAtomicInt m_rejected;
+    QAtomicInt m_shed;
+    QAtomicInt m_pauses;
+signals:
+    /* The acceptor was paused and there is room again */
+    void available();
+public:
+    /* A limit of 0 means there is no limit */
+    Admission(int maxConnections, int maxQueue, Policy policy, int retryAfter);
+    bool admit();
+    void release();
+    bool pause();
+    void unavailable(QByteArray &response) const;
+    void refuse(int descriptor);
+    void countShed() { m_shed.fetchAndAddRelaxed(1); }
+    int maxQueue() const { return m_maxQueue; }
+    Policy policy() const { return m_policy; }
+    /* What happened so far, for whoever wants to know */
+    int connections() const { return load_relaxed(m_connections); }
+    int accepted() const { return load_relaxed(m_accepted); }
+    int rejected() const { return load_relaxed(m_rejected); }
+    int shed() const { return load_relaxed(m_shed); }
+    int pauses() const { return load_relaxed(m_pauses); }
+};
+
+#endif // ADMISSION_H
@@ -1,14 +1,253 @@
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+
 #include "appfolder.h"
+#include "log.h"
+
+/*
+ * A call to a blocking handler, run by the pool of the folder.
+ */
+class HandlerTask : public QRunnable
+{
+    Handler *m_handler;
+    HandlerRequest m_request;
+    ResponseSink *m_response;
+public:
+    HandlerTask(Handler *handler, const HandlerRequest &request, ResponseSink *response) :
+        m_handler(handler), m_request(request), m_response(response) {}
+    virtual void run() { m_handler->handle(m_request, m_response); }
+};
 
 AppFolder::AppFolder() :
-    Folder(APP)
+    Folder(APP),
+    m_loader(NULL),
+    m_plugin(NULL),
+    m_webSocket(NULL),
+    m_deflate(false),
+    m_pool(NULL),
+    m_threads(0),
+    m_connections(0),
+    m_queue(-1),
+    m_multiplex(0),
+    m_next(0)
+{
+}
+
+/*
+ * The pool waits for the handlers that are still running before the plugin goes.
+ */
+AppFolder::~AppFolder()
 {
+    qDeleteAll(m_upstreams);
+    delete m_pool;
+    if (m_loader)
+        m_loader->unload();
+    delete m_loader;
 }
 
 /*
- * An app does not do any loading, since it is just a wrapper.
+ * The limits of the backend are per worker, 0 leaves the default.
  */
+bool AppFolder::setOption(const QString &name, const QString &value)
+{
+    if (name == "threads") {
+        m_threads = positive(value, "invalid number of handler threads, using one per core");
+    } else if (name == "deflate") {
+        m_deflate = (value == "on");
+        if (!m_deflate && (value != "off"))
+            Log::instance()->entry(Log::LogLevelCritical, "invalid deflate, expected on or off");
+    } else if (name == "protocol") {
+        m_protocol = value;
+    } else if (name == "balance") {
+        m_balance = value;
+    } else if (name == "script") {
+        m_script = value;
+    } else if (name == "connections") {
+        m_connections = positive(value, "invalid number of backend connections, using the default");
+    } else if (name == "queue") {
+        bool ok;
+        m_queue = value.toInt(&ok);
+        if (!ok || (m_queue < 0)) {
+            Log::instance()->entry(Log::LogLevelCritical, "invalid backend queue, using the default");
+            m_queue = -1;
+        }
+    } else if (name == "multiplex") {
+        m_multiplex = positive(value, "invalid multiplex, using one request per connection");
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int AppFolder::positive(const QString &value, const char *what)
+{
+    bool ok;
+    int number = value.toInt(&ok);
+    if (!ok || (number <= 0)) {
+        Log::instance()->entry(Log::LogLevelCritical, what);
+        return 0;
+    }
+    return number;
+}
+
 bool AppFolder::load()
 {
+    if (m_protocol.isEmpty())
+        return load_plugin();
+    return load_upstream();
+}
+
+/*
+ * The plugin is loaded once, all the workers share its instance.
+ */
+bool AppFolder::load_plugin()
+{
+    Log *log = Log::instance();
+    m_loader = new QPluginLoader(m_handler);
+    QObject *instance = m_loader->instance();
+    if (!instance) {
+        log->entry(Log::LogLevelCritical, QString("could not load handler: %1").arg(m_loader->errorString()));
+        return false;
+    }
+    m_plugin = qobject_cast<Handler *>(instance);
+    if (!m_plugin) {
+        log->entry(Log::LogLevelCritical, "the plugin is not a handler");
+        return false;
+    }
+    m_webSocket = qobject_cast<WebSocketHandler *>(instance);
+    if (!m_plugin->initialize(m_name)) {
+        log->entry(Log::LogLevelCritical, "handler failed to initialize");
+        return false;
+    }
+    if (m_plugin->isBlocking()) {
+        m_pool = new QThreadPool();
+        m_pool->setMaxThreadCount(m_threads ? m_threads : QThread::idealThreadCount());
+    }
+    return true;
+}
+
+/*
+ * Nothing is connected here, the pools of the workers connect when their
+ * first request comes.
+ */
+bool AppFolder::load_upstream()
+{
+    Log *log = Log::instance();
+    Upstream::Protocol protocol;
+    if (m_protocol == "fastcgi") {
+        protocol = Upstream::FastCgi;
+    } else if (m_protocol == "scgi") {
+        protocol = Upstream::Scgi;
+    } else if (m_protocol == "http") {
+        protocol = Upstream::Http;
+    } else {
+        log->entry(Log::LogLevelCritical, "unknown backend protocol");
+        return false;
+    }
+    if (!m_balance.isEmpty() && (m_balance != "leastconn") && (m_balance != "p2c")) {
+        log->entry(Log::LogLevelCritical, "unknown balance, expected leastconn or p2c");
+        return false;
+    }
+    QString addresses = QString(m_handler).replace(',', ' ').simplified();
+    if (addresses.isEmpty()) {
+        log->entry(Log::LogLevelCritical, "no backend address");
+        return false;
+    }
+    foreach (const QString &address, addresses.split(' ')) {
+        Upstream *upstream = new Upstream(protocol);
+        m_upstreams.append(upstream);
+        if (!upstream->setAddress(address)) {
+            log->entry(Log::LogLevelCritical, QString("invalid backend address %1, expected unix:/path or address:port").arg(address));
+            return false;
+        }
+        if (m_connections)
+            upstream->setConnections(m_connections);
+        if (m_queue >= 0)
+            upstream->setQueue(m_queue);
+        if (m_multiplex)
+            upstream->setMultiplex(m_multiplex);
+    }
     return true;
 }
+
+/*
+ * The backend for the next request. The load is read without any lock, it
+ * may be off by the requests being chosen at the same time by the other
+ * workers, which does not matter much. When every backend is out they are
+ * all tried anyway, one of them might be back.
+ */
+int AppFolder::choose() const
+{
+    int count = m_upstreams.size();
+    if (count == 1)
+        return 0;
+    if (m_balance == "p2c") {
+        int first = qrand() % count;
+        int second = qrand() % (count - 1);
+        if (second >= first)
+            ++second;
+        const Upstream *a = m_upstreams.at(first);
+        const Upstream *b = m_upstreams.at(second);
+        if (a->isAvailable() != b->isAvailable())
+            return a->isAvailable() ? first : second;
+        return (b->load() < a->load()) ? second : first;
+    }
+    int start = (int)((uint)m_next.fetchAndAddRelaxed(1) % (uint)count);
+    int best = -1;
+    int least = 0;
+    for (int i = 0; i < count; ++i) {
+        int index = (start + i) % count;
+        const Upstream *upstream = m_upstreams.at(index);
+        if (!upstream->isAvailable())
+            continue;
+        int load = upstream->load();
+        if ((best == -1) || (load < least)) {
+            best = index;
+            least = load;
+        }
+    }
+    return (best == -1) ? start : best;
+}
+
+/*
+ * Non blocking handlers run right here on the worker, they either reply at
+ * once or hand the response to something that completes it later.
+ */
+void AppFolder::dispatch(const HandlerRequest &request, ResponseSink *response) const
+{
+    if (m_pool)
+        m_pool->start(new HandlerTask(m_plugin, request, response));
+    else
+        m_plugin->handle(request, response);
+}
+
+/*
+ * The pools of the calling worker, created on its first request so that they
+ * and their sockets live in the thread of the worker.
+ */
+void AppFolder::forward(const HandlerRequest &request, QTcpSocket *client, UpstreamExchange *exchange) const
+{
+    if (!m_pools.hasLocalData()) {
+        UpstreamPools *pools = new UpstreamPools();
+        foreach (const Upstream *upstream, m_upstreams)
+            pools->append(new UpstreamPool(upstream));
+        m_pools.setLocalData(pools);
+    }
+    int index = choose();
+    if (isProxy())
+        exchange->setProxyRequest(request, client);
+    else
+        exchange->setEnvironment(request, client, m_name, m_script);
+    m_pools.localData()->at(index)->submit(exchange);
+}
+
+/*
+ * Called by every worker, from its own thread, once none of its requests can
+ * reach the folder anymore. The pools have to go from the thread they live in,
+ * the folder itself is deleted later by the server.
+ */
+void AppFolder::retire() const
+{
+    if (m_pools.hasLocalData())
+        m_pools.setLocalData(NULL);
+}
@@ -1,13 +1,68 @@
 #ifndef APPFOLDER_H
 #define APPFOLDER_H
 
+#include <QtCore/QPluginLoader>
+#include <QtCore/QThreadPool>
+#include <QtCore/QThreadStorage>
+#include <QtNetwork/QTcpSocket>
+
 #include "folder.h"
+#include "handler.h"
+#include "websockethandler.h"
+#include "upstream.h"
+#include "upstreampool.h"
 
+/*
+ * A folder whose replies come from a handler plugin or a backend instead of
+ * files. Without a protocol the handler attribute is the path of the plugin,
+ * handlers that block get a pool of threads of their own, "threads" threads,
+ * one per core by default. With protocol="fastcgi", "scgi" or "http" it is
+ * the address of the backend, every worker keeps its own connections to it.
+ * It can be a list of backends, each request goes to one of them as balance
+ * says: "leastconn", the one with the fewest requests, or "p2c", the better
+ * of two picked at random, which spreads the load almost as well without
+ * looking at every backend. Backends that keep failing are skipped.
+ * A plugin that also implements WebSocketHandler takes the requests of the
+ * folder that ask for a WebSocket upgrade, with deflate="on" they may use
+ * permessage-deflate.
+ */
 class AppFolder : public Folder
 {
+    QPluginLoader *m_loader;
+    Handler *m_plugin;
+    WebSocketHandler *m_webSocket;
+    bool m_deflate;
+    QThreadPool *m_pool;
+    int m_threads;
+    QList<Upstream *> m_upstreams;
+    QString m_protocol;
+    QString m_balance;
+    QString m_script;
+    int m_connections;
+    int m_queue;
+    int m_multiplex;
+    /* Where least connections starts looking, so ties do not all go to the first backend */
+    mutable QAtomicInt m_next;
+    mutable QThreadStorage<UpstreamPools *> m_pools;
+
+    bool load_plugin();
+    bool load_upstream();
+    int choose() const;
+    static int positive(const QString &value, const char *what);
 public:
     AppFolder();
+    virtual ~AppFolder();
     virtual bool load();
+    virtual bool setOption(const QString &name, const QString &value);
+    WebSocketHandler *webSocketHandler() const { return m_webSocket; }
+    bool isDeflate() const { return m_deflate; }
+    bool isUpstream() const { return !m_upstreams.isEmpty(); }
+    /* Forwards the request as it came, body included */
+    bool isProxy() const { return isUpstream() && (m_upstreams.first()->protocol() == Upstream::Http); }
+    void dispatch(const HandlerRequest &request, ResponseSink *response) const;
+    void forward(const HandlerRequest &request, QTcpSocket *client, UpstreamExchange *exchange) const;
+    /* Drops the backend connections of the calling worker */
+    void retire() const;
 };
 
 #endif // APPFOLDER_H
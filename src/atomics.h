@@ -0,0 +1,31 @@
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <QtCore/QAtomicInt>
+
+/*
+ * Reading an atomic without writing it. A fetchAndAdd(0) would do, but it
+ * is a locked read-modify-write that takes the cache line away from every
+ * other core reading it, on every read. Qt 4 has no loads of its own, a
+ * plain read of the volatile value is a relaxed load there, an acquire one
+ * still needs the read-modify-write.
+ */
+static inline int load_relaxed(const QAtomicInt &value)
+{
+#if QT_VERSION >= 0x050000
+    return value.load();
+#else
+    return (int)value;
+#endif
+}
+
+static inline int load_acquire(const QAtomicInt &value)
+{
+#if QT_VERSION >= 0x050000
+    return value.loadAcquire();
+#else
+    return const_cast<QAtomicInt &>(value).fetchAndAddAcquire(0);
+#endif
+}
+
+#endif // ATOMICS_H
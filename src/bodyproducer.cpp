@@ -0,0 +1,72 @@
+#include <QtCore/QFile>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bodyproducer.h"
+#include "log.h"
+
+BodyProducer::BodyProducer() :
+    m_file(-1),
+    m_size(0)
+{
+}
+
+BodyProducer::~BodyProducer()
+{
+    if (m_file != -1)
+        ::close(m_file);
+}
+
+bool BodyProducer::open(const QString &path)
+{
+    Log *log = Log::instance();
+    m_file = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (m_file == -1) {
+        log->entry(Log::LogLevelCritical, "could not open file for transfer");
+        return false;
+    }
+    struct stat status;
+    if (fstat(m_file, &status) == -1) {
+        log->entry(Log::LogLevelCritical, "could not stat file for transfer");
+        return false;
+    }
+    m_size = status.st_size;
+    return true;
+}
+
+/*
+ * A negative length means up to the end of the file.
+ */
+bool BodyProducer::addRegion(qint64 offset, qint64 length)
+{
+    if ((offset < 0) || (offset > m_size)) {
+        Log::instance()->entry(Log::LogLevelCritical, "transfer outside of the file");
+        return false;
+    }
+    Part part;
+    part.offset = offset;
+    part.remaining = m_size - offset;
+    if ((length >= 0) && (length < part.remaining))
+        part.remaining = length;
+    m_parts.append(part);
+    return true;
+}
+
+void BodyProducer::addData(const QByteArray &data)
+{
+    Part part;
+    part.data = data;
+    part.offset = 0;
+    part.remaining = data.size();
+    m_parts.append(part);
+}
+
+qint64 BodyProducer::remaining() const
+{
+    qint64 remaining = 0;
+    foreach (const Part &part, m_parts)
+        remaining += part.remaining;
+    return remaining;
+}
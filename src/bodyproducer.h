@@ -0,0 +1,53 @@
+#ifndef BODYPRODUCER_H
+#define BODYPRODUCER_H
+
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+
+#include "clientconnection.h"
+
+#define BODY_CHUNK (64 * 1024)          /* What we read from a file at a time */
+#define BODY_HIGH_WATER (256 * 1024)    /* Most we let the socket buffer hold for a connection */
+
+/*
+ * The body of a reply that is too big to be written at once. It is a sequence
+ * of parts, regions of a file and small pieces of memory in between, pushed
+ * to the socket a bit at a time as the client takes it. How the bytes get
+ * there is up to the subclasses.
+ * produce() is called whenever the socket might have room again, it returns
+ * Pending if it is waiting for the socket's own buffer to drain (bytesWritten
+ * will tell) and Blocked if it is waiting for the descriptor to be writable.
+ */
+class BodyProducer
+{
+public:
+    enum Status {
+        Done
+        , Pending
+        , Blocked
+        , Failed
+    };
+protected:
+    struct Part {
+        /* Memory parts have data, file parts have an offset */
+        QByteArray data;
+        qint64 offset;
+        qint64 remaining;
+    };
+    int m_file;
+    qint64 m_size;
+    QList<Part> m_parts;
+public:
+    BodyProducer();
+    virtual ~BodyProducer();
+    bool open(const QString &path);
+    bool addRegion(qint64 offset = 0, qint64 length = -1);
+    void addData(const QByteArray &data);
+    /* Size of the file when it was opened */
+    qint64 size() const { return m_size; }
+    virtual qint64 remaining() const;
+    virtual Status produce(ClientConnection *socket) = 0;
+};
+
+#endif // BODYPRODUCER_H
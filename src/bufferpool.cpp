@@ -0,0 +1,68 @@
+#include "bufferpool.h"
+
+BufferPool::BufferPool() :
+    m_allocations(0),
+    m_reuses(0)
+{
+    for (int i = 0; i < BUFFERPOOL_CLASSES; ++i)
+        m_free[i].reserve(BUFFERPOOL_KEEP);
+}
+
+/*
+ * The class that fits a capacity, -1 if it is bigger than the biggest class.
+ */
+int BufferPool::size_class(int capacity)
+{
+    int size = BUFFERPOOL_SMALLEST;
+    for (int i = 0; i < BUFFERPOOL_CLASSES; ++i) {
+        if (capacity <= size)
+            return i;
+        size *= 4;
+    }
+    return -1;
+}
+
+/*
+ * An empty buffer that can take at least size bytes without growing.
+ * Bigger requests than the biggest class are not pooled.
+ */
+QByteArray BufferPool::acquire(int size)
+{
+    int index = size_class(size);
+    if ((index != -1) && !m_free[index].isEmpty()) {
+        ++m_reuses;
+        QByteArray buffer = m_free[index].last();
+        m_free[index].resize(m_free[index].size() - 1);
+        return buffer;
+    }
+    ++m_allocations;
+    QByteArray buffer;
+    /* On Qt 5 reserve also tells the array to keep its memory when it is emptied */
+    buffer.reserve((index == -1) ? size : (BUFFERPOOL_SMALLEST << (2 * index)));
+    return buffer;
+}
+
+/*
+ * Buffers that grew past the biggest class or are still shared with
+ * somebody else (a socket, a cache) are simply dropped. The others go to
+ * the biggest class they fully cover, if emptying them kept their memory.
+ * Qt 4 frees the memory of any array that is emptied, reserved or not, so
+ * there nothing is pooled and every buffer is an allocation.
+ */
+void BufferPool::release(QByteArray &buffer)
+{
+    int capacity = buffer.capacity();
+    int index = -1;
+    if (buffer.isDetached() && (size_class(capacity) != -1)) {
+        for (int i = 0; i < BUFFERPOOL_CLASSES; ++i) {
+            if (capacity >= (BUFFERPOOL_SMALLEST << (2 * i)))
+                index = i;
+        }
+    }
+    if ((index != -1) && (m_free[index].size() < BUFFERPOOL_KEEP)) {
+        buffer.resize(0);
+        if (buffer.capacity() == capacity)
+            m_free[index].append(buffer);
+    }
+    buffer = QByteArray();
+}
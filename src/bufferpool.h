@@ -0,0 +1,35 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+#define BUFFERPOOL_CLASSES 3        /* 4 KiB, 16 KiB and 64 KiB */
+#define BUFFERPOOL_SMALLEST 4096
+#define BUFFERPOOL_KEEP 64          /* Free buffers kept in each class */
+
+/*
+ * Buffers with their memory already reserved, sorted by size class. A buffer
+ * that is given back is kept for the next request instead of being freed,
+ * so under steady load the buffers of a connection come from here and not
+ * from the heap. Keeping the memory of an empty array takes Qt 5, on Qt 4
+ * the pool still reserves the buffers but cannot keep them.
+ * Every worker has its own pool, it is not thread safe.
+ */
+class BufferPool
+{
+    QVector<QByteArray> m_free[BUFFERPOOL_CLASSES];
+    quint64 m_allocations;
+    quint64 m_reuses;
+
+    static int size_class(int capacity);
+public:
+    BufferPool();
+    QByteArray acquire(int size);
+    void release(QByteArray &buffer);
+    /* Buffers that had to be created, and buffers that came from the pool */
+    quint64 allocations() const { return m_allocations; }
+    quint64 reuses() const { return m_reuses; }
+};
+
+#endif // BUFFERPOOL_H
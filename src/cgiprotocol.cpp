@@ -0,0 +1,120 @@
+#include "cgiprotocol.h"
+
+#define FASTCGI_VERSION 1
+#define FASTCGI_RESPONDER 1
+#define FASTCGI_KEEP_CONN 1
+
+void FastCgi::append_header(QByteArray &buffer, int type, int id, int length)
+{
+    char header[FASTCGI_HEADER];
+    header[0] = FASTCGI_VERSION;
+    header[1] = (char)type;
+    header[2] = (char)((id >> 8) & 0xff);
+    header[3] = (char)(id & 0xff);
+    header[4] = (char)((length >> 8) & 0xff);
+    header[5] = (char)(length & 0xff);
+    header[6] = 0;
+    header[7] = 0;
+    buffer.append(header, FASTCGI_HEADER);
+}
+
+/*
+ * Lengths below 128 take one byte, the others four with the top bit set.
+ */
+void FastCgi::append_length(QByteArray &buffer, int length)
+{
+    if (length < 128) {
+        buffer.append((char)length);
+        return;
+    }
+    char bytes[4];
+    bytes[0] = (char)(((length >> 24) & 0x7f) | 0x80);
+    bytes[1] = (char)((length >> 16) & 0xff);
+    bytes[2] = (char)((length >> 8) & 0xff);
+    bytes[3] = (char)(length & 0xff);
+    buffer.append(bytes, 4);
+}
+
+/*
+ * The header of the request in one buffer, so it goes out in one write: the
+ * begin record, the params split in as many records as they need and the
+ * empty params record that ends them. Stdin follows, even without a body.
+ */
+void FastCgi::appendRequest(QByteArray &buffer, int id, bool keepConnection, const CgiParams &params)
+{
+    append_header(buffer, BeginRequest, id, 8);
+    char body[8] = { 0, FASTCGI_RESPONDER, (char)(keepConnection ? FASTCGI_KEEP_CONN : 0), 0, 0, 0, 0, 0 };
+    buffer.append(body, 8);
+    QByteArray encoded;
+    for (int i = 0; i < params.size(); ++i) {
+        append_length(encoded, params.at(i).first.size());
+        append_length(encoded, params.at(i).second.size());
+        encoded.append(params.at(i).first);
+        encoded.append(params.at(i).second);
+    }
+    for (int offset = 0; offset < encoded.size(); offset += FASTCGI_MAX_CONTENT) {
+        int length = qMin(encoded.size() - offset, FASTCGI_MAX_CONTENT);
+        append_header(buffer, Params, id, length);
+        buffer.append(encoded.constData() + offset, length);
+    }
+    append_header(buffer, Params, id, 0);
+}
+
+void FastCgi::appendStdin(QByteArray &buffer, int id, const char *data, int size)
+{
+    if (size <= 0) {
+        append_header(buffer, Stdin, id, 0);
+        return;
+    }
+    for (int offset = 0; offset < size; offset += FASTCGI_MAX_CONTENT) {
+        int length = qMin(size - offset, FASTCGI_MAX_CONTENT);
+        append_header(buffer, Stdin, id, length);
+        buffer.append(data + offset, length);
+    }
+}
+
+void FastCgi::appendAbort(QByteArray &buffer, int id)
+{
+    append_header(buffer, AbortRequest, id, 0);
+}
+
+int FastCgi::parse(const char *data, int size, Record &record)
+{
+    if (size < FASTCGI_HEADER)
+        return 0;
+    const unsigned char *header = (const unsigned char *)data;
+    record.type = header[1];
+    record.id = (header[2] << 8) | header[3];
+    record.offset = FASTCGI_HEADER;
+    record.length = (header[4] << 8) | header[5];
+    int total = FASTCGI_HEADER + record.length + header[6];
+    return (size < total) ? 0 : total;
+}
+
+/*
+ * CONTENT_LENGTH has to be the first variable and SCGI has to be there.
+ * Without a body the length is 0, it may not be empty.
+ */
+void Scgi::appendRequest(QByteArray &buffer, const CgiParams &params)
+{
+    QByteArray length("0");
+    for (int i = 0; i < params.size(); ++i) {
+        if ((params.at(i).first == "CONTENT_LENGTH") && !params.at(i).second.isEmpty())
+            length = params.at(i).second;
+    }
+    QByteArray header("CONTENT_LENGTH", 15);
+    header.append(length);
+    header.append("\0" "SCGI\0" "1\0", 8);
+    for (int i = 0; i < params.size(); ++i) {
+        if (params.at(i).first == "CONTENT_LENGTH")
+            continue;
+        header.append(params.at(i).first);
+        header.append('\0');
+        header.append(params.at(i).second);
+        header.append('\0');
+    }
+    buffer.append(QByteArray::number(header.size()));
+    buffer.append(':');
+    buffer.append(header);
+    buffer.append(',');
+}
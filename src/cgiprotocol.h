@@ -0,0 +1,60 @@
+#ifndef CGIPROTOCOL_H
+#define CGIPROTOCOL_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+
+#define FASTCGI_HEADER 8            /* Every record starts with it */
+#define FASTCGI_MAX_CONTENT 65535   /* Most a record carries, longer params are split */
+
+/* The CGI meta variables of a request, in the order they are sent */
+typedef QList<QPair<QByteArray, QByteArray> > CgiParams;
+
+/*
+ * The records of FastCGI that a web server sends and receives, for the
+ * responder role only. The body of a request goes as stdin records after
+ * the params, the empty one ends it.
+ */
+class FastCgi
+{
+public:
+    enum RecordType {
+        BeginRequest = 1
+        , AbortRequest = 2
+        , EndRequest = 3
+        , Params = 4
+        , Stdin = 5
+        , Stdout = 6
+        , Stderr = 7
+    };
+    struct Record {
+        int type;
+        int id;
+        /* Where the content starts in the buffer that was parsed */
+        int offset;
+        int length;
+    };
+    static void appendRequest(QByteArray &buffer, int id, bool keepConnection, const CgiParams &params);
+    /* Split in as many records as it needs, nothing at all is the end of stdin */
+    static void appendStdin(QByteArray &buffer, int id, const char *data, int size);
+    static void appendAbort(QByteArray &buffer, int id);
+    /* The length of the record at the start of data, padding included, 0 if it is not all there yet */
+    static int parse(const char *data, int size, Record &record);
+private:
+    static void append_header(QByteArray &buffer, int type, int id, int length);
+    static void append_length(QByteArray &buffer, int length);
+};
+
+/*
+ * SCGI has a single header, a netstring of the params, followed by exactly
+ * CONTENT_LENGTH bytes of body. The reply is whatever comes back until the
+ * backend closes the connection.
+ */
+class Scgi
+{
+public:
+    static void appendRequest(QByteArray &buffer, const CgiParams &params);
+};
+
+#endif // CGIPROTOCOL_H
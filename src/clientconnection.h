@@ -0,0 +1,62 @@
+#ifndef CLIENTCONNECTION_H
+#define CLIENTCONNECTION_H
+
+#include <QtCore/QByteArray>
+#include <QtNetwork/QTcpSocket>
+
+/*
+ * The connection of a client as a request sees it. Writes are queued and go
+ * out on flush(), close() waits for them and abort() does not. What happens
+ * once the connection is closed is up to the worker that owns it, the request
+ * must not assume anything about it.
+ */
+class ClientConnection
+{
+public:
+    virtual ~ClientConnection() {}
+    /* Appends whatever the client sent so far to the buffer, returns how much that was */
+    virtual qint64 receive(QByteArray &buffer) = 0;
+    virtual void write(const QByteArray &data) = 0;
+    virtual void write(const char *data, qint64 size) = 0;
+    virtual qint64 bytesToWrite() const = 0;
+    virtual void flush() = 0;
+    virtual void close() = 0;
+    virtual void abort() = 0;
+    virtual int descriptor() const = 0;
+    virtual quint16 localPort() const = 0;
+};
+
+/*
+ * A QTcpSocket, whose own buffers do the queueing. Requests embed one, so it
+ * costs nothing to create.
+ */
+class SocketConnection : public ClientConnection
+{
+    QTcpSocket *m_socket;
+public:
+    SocketConnection() : m_socket(NULL) {}
+    QTcpSocket *socket() const { return m_socket; }
+    void setSocket(QTcpSocket *socket) { m_socket = socket; }
+    virtual qint64 receive(QByteArray &buffer)
+    {
+        qint64 available = m_socket->bytesAvailable();
+        if (available <= 0)
+            return 0;
+        /* Straight into the buffer, which usually has the room already */
+        int size = buffer.size();
+        buffer.resize(size + (int)available);
+        qint64 read = qMax(m_socket->read(buffer.data() + size, available), (qint64)0);
+        buffer.resize(size + (int)read);
+        return read;
+    }
+    virtual void write(const QByteArray &data) { m_socket->write(data); }
+    virtual void write(const char *data, qint64 size) { m_socket->write(data, size); }
+    virtual qint64 bytesToWrite() const { return m_socket->bytesToWrite(); }
+    virtual void flush() { m_socket->flush(); }
+    virtual void close() { m_socket->disconnectFromHost(); }
+    virtual void abort() { m_socket->abort(); }
+    virtual int descriptor() const { return (int)m_socket->socketDescriptor(); }
+    virtual quint16 localPort() const { return m_socket->localPort(); }
+};
+
+#endif // CLIENTCONNECTION_H
@@ -0,0 +1,130 @@
+#include <QtCore/QFile>
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "compressioncache.h"
+#include "log.h"
+
+/*
+ * Reads and compresses one file. If the file changed while we were reading
+ * it the result is thrown away, the next request asks again.
+ */
+class CompressionJob : public QRunnable
+{
+    CompressionCache *m_cache;
+    QString m_path;
+    qint64 m_mtime;
+public:
+    CompressionJob(CompressionCache *cache, const QString &path, qint64 mtime) :
+        m_cache(cache), m_path(path), m_mtime(mtime) {}
+    void run()
+    {
+        QByteArray compressed;
+        QFile file(m_path);
+        if (file.open(QIODevice::ReadOnly)) {
+            QByteArray data = file.readAll();
+            struct stat status;
+            if ((fstat(file.handle(), &status) == 0) && (status.st_mtime == m_mtime)) {
+                compressed = CompressionCache::gzip(data);
+                /* Not smaller, the file is better sent as it is */
+                if (compressed.size() >= data.size())
+                    compressed = QByteArray();
+            }
+        }
+        m_cache->store(m_path, m_mtime, compressed);
+    }
+};
+
+CompressionCache::CompressionCache(qint64 budget) :
+    m_budget(budget)
+{
+    m_entries.setMaxCost((int)qMin(budget, (qint64)0x7fffffff));
+    m_pool = new QThreadPool();
+    m_pool->setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 4));
+}
+
+CompressionCache::~CompressionCache()
+{
+    m_pool->waitForDone();
+    delete m_pool;
+}
+
+QString CompressionCache::key(const QString &path, qint64 mtime)
+{
+    return path + "\n" + QString::number(mtime);
+}
+
+/*
+ * False if there is nothing for this version of the file yet. An empty
+ * content means the file was looked at and is sent uncompressed.
+ */
+bool CompressionCache::lookup(const QString &path, qint64 mtime, QByteArray &content)
+{
+    QMutexLocker locker(&m_lock);
+    QByteArray *entry = m_entries.object(key(path, mtime));
+    if (!entry)
+        return false;
+    content = *entry;
+    return true;
+}
+
+/*
+ * Queue the file for compression, unless it already is or it is too big to
+ * be kept.
+ */
+void CompressionCache::compress(const QString &path, qint64 mtime, qint64 size)
+{
+    if ((size < COMPRESSION_MINIMUM) || (size > maximumEntrySize()))
+        return;
+    QString name = key(path, mtime);
+    QMutexLocker locker(&m_lock);
+    if (m_pending.contains(name))
+        return;
+    m_pending.insert(name);
+    locker.unlock();
+    Log::instance()->entry(Log::LogLevelDebug, "compressing file in the background");
+    m_pool->start(new CompressionJob(this, path, mtime));
+}
+
+void CompressionCache::store(const QString &path, qint64 mtime, const QByteArray &content)
+{
+    QString name = key(path, mtime);
+    QMutexLocker locker(&m_lock);
+    m_pending.remove(name);
+    /* Files that do not compress still cost an entry, so they are not tried again */
+    m_entries.insert(name, new QByteArray(content), qMax(content.size(), 1));
+}
+
+bool CompressionCache::isCompressible(const QByteArray &type)
+{
+    return type.startsWith("text/") || (type == "application/javascript")
+            || (type == "application/json") || (type == "image/svg+xml");
+}
+
+/*
+ * A complete gzip stream, deflate with the gzip header and trailer.
+ */
+QByteArray CompressionCache::gzip(const QByteArray &data)
+{
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    if (deflateInit2(&stream, COMPRESSION_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return QByteArray();
+    QByteArray compressed;
+    compressed.resize((int)deflateBound(&stream, data.size()));
+    stream.next_in = (Bytef *)data.constData();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef *)compressed.data();
+    stream.avail_out = compressed.size();
+    int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END)
+        return QByteArray();
+    compressed.resize((int)stream.total_out);
+    return compressed;
+}
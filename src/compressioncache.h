@@ -0,0 +1,43 @@
+#ifndef COMPRESSIONCACHE_H
+#define COMPRESSIONCACHE_H
+
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QCache>
+#include <QtCore/QSet>
+#include <QtCore/QMutex>
+#include <QtCore/QThreadPool>
+
+#define COMPRESSION_MINIMUM 256     /* Smaller files do not gain anything */
+#define COMPRESSION_LEVEL 6         /* The usual balance between size and time */
+
+/*
+ * Gzip copies of the text files we serve, made in the background the first
+ * time somebody who can take them asks, and kept within a byte budget.
+ * Entries are keyed by the path and the modification time of the file, so a
+ * copy of an older version is never served, it just ages out of the cache.
+ * The cache is shared by all the workers, compression runs in a pool of its
+ * own so it never holds up an event loop.
+ */
+class CompressionCache
+{
+    /* A null entry means the file is not worth compressing */
+    QCache<QString, QByteArray> m_entries;
+    QSet<QString> m_pending;
+    QMutex m_lock;
+    QThreadPool *m_pool;
+    qint64 m_budget;
+
+    static QString key(const QString &path, qint64 mtime);
+public:
+    CompressionCache(qint64 budget);
+    ~CompressionCache();
+    qint64 maximumEntrySize() const { return m_budget / 8; }
+    bool lookup(const QString &path, qint64 mtime, QByteArray &content);
+    void compress(const QString &path, qint64 mtime, qint64 size);
+    void store(const QString &path, qint64 mtime, const QByteArray &content);
+    static bool isCompressible(const QByteArray &type);
+    static QByteArray gzip(const QByteArray &data);
+};
+
+#endif // COMPRESSIONCACHE_H
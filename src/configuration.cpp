@@ -1,17 +1,51 @@
 #include "configuration.h"
 
-#include <QtCore/QRegExp>
+#include <QtCore/QThread>
 #include <QtXml/QXmlStreamReader>
 #include <QDebug>
+#include <string.h>
 #include "log.h"
 #include "appfolder.h"
 #include "webfolder.h"
 
-Configuration::Configuration()
+Configuration::Configuration() :
+    m_port(0),
+    m_schedulerMode(EventDriven),
+    m_ioMode(QtSockets),
+    m_workers(1),
+    m_cacheBudget(0),
+    m_compressionBudget(0),
+    m_cache(NULL),
+    m_compression(NULL),
+    m_keepAlive(15000),
+    m_maxRequests(100),
+    m_headerTimeout(30000),
+    m_writeTimeout(60000),
+    m_maxConnections(0),
+    m_maxQueue(0),
+    m_overload(Admission::Reject),
+    m_retryAfter(5),
+    m_admission(NULL),
+    m_metricsPort(0),
+    m_watch(false),
+    m_references(1),
+    m_root(NULL)
 {
 }
 
-bool Configuration::parse()
+/*
+ * Folders carried over to a newer snapshot stay with it. The caches and the
+ * admission are never deleted, the next snapshot inherits them.
+ */
+Configuration::~Configuration()
+{
+    foreach (Folder *folder, m_folders) {
+        if (folder->release())
+            delete folder;
+    }
+}
+
+bool Configuration::parse(const Configuration *running)
 {
     Log *log = Log::instance();
     if (m_configurationFile.isEmpty()) {
@@ -20,9 +54,66 @@ bool Configuration::parse()
     }
     /*
      * The format of the configuration file is as follows:
-     * <rainbow port="server port">
-     *   <folder name="server namespace" handler="backend" type="handler type web|websocket"/>
+     * <rainbow port="server port" scheduler="event|pulse" workers="number|auto" cache="bytes"
+     *          keepalive="seconds" maxrequests="number" loglevel="debug|normal|critical"
+     *          logoverflow="drop|block" compression="bytes" headertimeout="seconds"
+     *          writetimeout="seconds" maxconnections="number" maxqueue="number"
+     *          overload="reject|pause" retryafter="seconds" metrics="path" metricsport="port"
+     *          reload="signal|watch" io="qt|epoll">
+     *   <folder name="server namespace" handler="backend" type="handler type web|application"
+     *           threads="number" protocol="fastcgi|scgi|http" script="path" connections="number"
+     *           queue="number" multiplex="number" balance="leastconn|p2c" deflate="on|off"/>
      * </rainbow>
+     * The scheduler is optional. "event" (the default) serves each request as soon
+     * as its socket is ready, "pulse" uses the stage queues and serves a bounded
+     * number of requests on every clock pulse.
+     * io is how the workers talk to the clients. "qt" (the default) uses QTcpSocket,
+     * "epoll" has every worker accept and serve its connections on raw descriptors,
+     * on Linux and in event driven mode only. Backends need "qt", with epoll the
+     * WebSocket folders serve ordinary requests only and overload="pause" rejects.
+     * The number of workers is optional, by default there is only one. "auto" starts
+     * one worker per core.
+     * The cache is optional, it is the amount of memory used to keep the content of
+     * files. Files bigger than an eighth of it are never cached. By default there is no cache.
+     * keepalive is how long a persistent connection may stay idle, 15 seconds by default,
+     * 0 disables persistent connections. maxrequests is how many requests a connection
+     * may carry, 100 by default.
+     * headertimeout is how long a client has to send the header of a request once the
+     * connection is open or the first byte of it arrived, 30 seconds by default.
+     * writetimeout is how long a reply may go without the client taking any of it,
+     * 60 seconds by default. Connections that hit either are closed.
+     * maxconnections is how many connections the server holds at once, maxqueue how many
+     * each worker holds. Neither has a limit by default. Beyond them new connections get
+     * a 503 reply with a Retry-After of retryafter seconds, 5 by default. With overload set
+     * to "pause" the server stops accepting connections instead when maxconnections is
+     * reached, until some of the connections are gone.
+     * metrics is the path the server serves its own metrics on, in the Prometheus text
+     * format. They are not served by default. With metricsport they are only served on
+     * that port of the loopback interface, not on the server port.
+     * The handler of a web folder is the directory it serves, the one of an application
+     * folder is the path of the plugin that replies its requests. threads is only for
+     * applications whose handler blocks, it is the number of threads they run on, one
+     * per core by default.
+     * With protocol the handler of an application folder is the address of a FastCGI or
+     * SCGI backend instead, "unix:/path" or "address:port". script is passed to it as
+     * SCRIPT_FILENAME. Each worker opens at most connections connections to it, 8 by
+     * default, and lets at most queue requests wait for one, 64 by default. multiplex is
+     * how many requests a FastCGI connection carries at once, for backends that can.
+     * With protocol="http" the folder is a reverse proxy: requests go to the backend as
+     * they came, with any method and with their body, and the replies come back as the
+     * backend sent them. The handler can list several backends separated by commas,
+     * balance picks one for each request, "leastconn" (the default) the one with the
+     * fewest requests in progress, "p2c" the less loaded of two chosen at random. A
+     * backend that fails 3 requests in a row is left out for 10 seconds.
+     * A plugin that implements WebSocketHandler also takes the WebSocket connections of
+     * its folder, in event driven mode only. deflate="on" lets them use permessage-deflate,
+     * off by default.
+     * SIGHUP reloads the configuration, with reload="watch" so does any change of the
+     * file. Requests in progress finish with the configuration they started with. Folders
+     * whose declaration did not change keep their index and their backend connections.
+     * The port, the scheduler, the workers, the caches, the limits on connections and
+     * the metrics port cannot change without a restart, a reload keeps the running ones.
+     * Folders added by a reload are served but only show in the metrics after a restart.
      */
     QFile configuration(m_configurationFile);
     if (!configuration.open(QIODevice::ReadOnly)) {
@@ -43,6 +134,125 @@ bool Configuration::parse()
                     {
                         log->entry(Log::LogLevelDebug, "found port");
                         m_port = (quint16)attribute.value().toString().toUInt();
+                    } else if (attribute.name() == "scheduler") {
+                        log->entry(Log::LogLevelDebug, "found scheduler");
+                        if (attribute.value() == "event") {
+                            m_schedulerMode = EventDriven;
+                        } else if (attribute.value() == "pulse") {
+                            m_schedulerMode = Pulse;
+                        } else {
+                            log->entry(Log::LogLevelCritical, "unknown scheduler, using event");
+                            m_schedulerMode = EventDriven;
+                        }
+                    } else if (attribute.name() == "io") {
+                        log->entry(Log::LogLevelDebug, "found io");
+                        if (attribute.value() == "qt") {
+                            m_ioMode = QtSockets;
+                        } else if (attribute.value() == "epoll") {
+                            m_ioMode = Epoll;
+                        } else {
+                            log->entry(Log::LogLevelCritical, "unknown io, using qt");
+                            m_ioMode = QtSockets;
+                        }
+                    } else if (attribute.name() == "workers") {
+                        log->entry(Log::LogLevelDebug, "found workers");
+                        if (attribute.value() == "auto") {
+                            m_workers = QThread::idealThreadCount();
+                        } else {
+                            m_workers = attribute.value().toString().toInt();
+                        }
+                        if (m_workers < 1) {
+                            log->entry(Log::LogLevelCritical, "invalid number of workers, using one");
+                            m_workers = 1;
+                        }
+                    } else if (attribute.name() == "cache") {
+                        log->entry(Log::LogLevelDebug, "found cache");
+                        m_cacheBudget = attribute.value().toString().toLongLong();
+                    } else if (attribute.name() == "compression") {
+                        log->entry(Log::LogLevelDebug, "found compression");
+                        m_compressionBudget = attribute.value().toString().toLongLong();
+                    } else if (attribute.name() == "keepalive") {
+                        log->entry(Log::LogLevelDebug, "found keepalive");
+                        m_keepAlive = attribute.value().toString().toInt() * 1000;
+                        if (m_keepAlive < 0)
+                            m_keepAlive = 0;
+                    } else if (attribute.name() == "maxrequests") {
+                        log->entry(Log::LogLevelDebug, "found maxrequests");
+                        m_maxRequests = attribute.value().toString().toInt();
+                        if (m_maxRequests < 1) {
+                            log->entry(Log::LogLevelCritical, "invalid maxrequests, using one");
+                            m_maxRequests = 1;
+                        }
+                    } else if (attribute.name() == "headertimeout") {
+                        log->entry(Log::LogLevelDebug, "found headertimeout");
+                        m_headerTimeout = attribute.value().toString().toInt() * 1000;
+                        if (m_headerTimeout <= 0) {
+                            log->entry(Log::LogLevelCritical, "invalid headertimeout, using 30 seconds");
+                            m_headerTimeout = 30000;
+                        }
+                    } else if (attribute.name() == "writetimeout") {
+                        log->entry(Log::LogLevelDebug, "found writetimeout");
+                        m_writeTimeout = attribute.value().toString().toInt() * 1000;
+                        if (m_writeTimeout <= 0) {
+                            log->entry(Log::LogLevelCritical, "invalid writetimeout, using 60 seconds");
+                            m_writeTimeout = 60000;
+                        }
+                    } else if (attribute.name() == "maxconnections") {
+                        log->entry(Log::LogLevelDebug, "found maxconnections");
+                        m_maxConnections = qMax(attribute.value().toString().toInt(), 0);
+                    } else if (attribute.name() == "maxqueue") {
+                        log->entry(Log::LogLevelDebug, "found maxqueue");
+                        m_maxQueue = qMax(attribute.value().toString().toInt(), 0);
+                    } else if (attribute.name() == "overload") {
+                        log->entry(Log::LogLevelDebug, "found overload");
+                        if (attribute.value() == "reject") {
+                            m_overload = Admission::Reject;
+                        } else if (attribute.value() == "pause") {
+                            m_overload = Admission::Pause;
+                        } else {
+                            log->entry(Log::LogLevelCritical, "unknown overload, using reject");
+                            m_overload = Admission::Reject;
+                        }
+                    } else if (attribute.name() == "retryafter") {
+                        log->entry(Log::LogLevelDebug, "found retryafter");
+                        m_retryAfter = qMax(attribute.value().toString().toInt(), 0);
+                    } else if (attribute.name() == "metrics") {
+                        log->entry(Log::LogLevelDebug, "found metrics");
+                        m_metricsPath = attribute.value().toString().toLatin1();
+                        if (!m_metricsPath.startsWith('/')) {
+                            log->entry(Log::LogLevelCritical, "metrics path does not start with /, not serving metrics");
+                            m_metricsPath.clear();
+                        }
+                    } else if (attribute.name() == "metricsport") {
+                        log->entry(Log::LogLevelDebug, "found metricsport");
+                        m_metricsPort = (quint16)attribute.value().toString().toUInt();
+                    } else if (attribute.name() == "reload") {
+                        log->entry(Log::LogLevelDebug, "found reload");
+                        m_watch = (attribute.value() == "watch");
+                        if (!m_watch && (attribute.value() != "signal"))
+                            log->entry(Log::LogLevelCritical, "unknown reload, using signal");
+                    } else if (attribute.name() == "loglevel") {
+                        log->entry(Log::LogLevelDebug, "found loglevel");
+                        if (attribute.value() == "debug") {
+                            log->setLevel(Log::LogLevelDebug);
+                        } else if (attribute.value() == "normal") {
+                            log->setLevel(Log::LogLevelNormal);
+                        } else if (attribute.value() == "critical") {
+                            log->setLevel(Log::LogLevelCritical);
+                        } else {
+                            log->entry(Log::LogLevelCritical, "unknown loglevel, using normal");
+                            log->setLevel(Log::LogLevelNormal);
+                        }
+                    } else if (attribute.name() == "logoverflow") {
+                        log->entry(Log::LogLevelDebug, "found logoverflow");
+                        if (attribute.value() == "drop") {
+                            log->setOverflowPolicy(Log::Drop);
+                        } else if (attribute.value() == "block") {
+                            log->setOverflowPolicy(Log::Block);
+                        } else {
+                            log->entry(Log::LogLevelCritical, "unknown logoverflow, using drop");
+                            log->setOverflowPolicy(Log::Drop);
+                        }
                     } else {
                         log->entry(Log::LogLevelNormal, "unknown attribute in rainbow declaration");
                     }
@@ -51,6 +261,7 @@ bool Configuration::parse()
                 log->entry(Log::LogLevelDebug, "found folder");
                 QXmlStreamAttributes attributes = reader.attributes();
                 QString name, handler, type;
+                QHash<QString, QString> options;
                 foreach (QXmlStreamAttribute attribute, attributes) {
                     if (attribute.name() == "name") {
                         log->entry(Log::LogLevelDebug, "found name");
@@ -62,21 +273,31 @@ bool Configuration::parse()
                         log->entry(Log::LogLevelDebug, "found type");
                         type = attribute.value().toString();
                     } else {
-                        log->entry(Log::LogLevelNormal, "unknown attribute in folder declaration");
+                        /* Left to the folder, only it knows what its type takes */
+                        options.insert(attribute.name().toString(), attribute.value().toString());
                     }
                 }
                 if ((name.isEmpty()) || (handler.isEmpty()) || (type.isEmpty())) {
                     log->entry(Log::LogLevelCritical, "incomplete declaration of folder");
                     return false;
                 }
-                if (type == "application") {
+                QString declaration = declare(type, handler, options);
+                Folder *carried = running ? running->carry(name, declaration) : NULL;
+                if (carried) {
+                    log->entry(Log::LogLevelDebug, "folder did not change, keeping it");
+                    carried->acquire();
+                    m_folders[name] = carried;
+                    m_declarations[name] = declaration;
+                } else if (type == "application") {
                     log->entry(Log::LogLevelDebug, "creating application folder");
                     AppFolder *folder = new AppFolder();
                     folder->setHandler(handler);
                     folder->setName(name);
-                    if (folder->load())
+                    set_options(folder, options);
+                    if (folder->load()) {
                         m_folders[name] = folder;
-                    else {
+                        m_declarations[name] = declaration;
+                    } else {
                         log->entry(Log::LogLevelCritical, "could not load folder, skipping it");
                         delete folder;
                     }
@@ -85,9 +306,11 @@ bool Configuration::parse()
                     WebFolder *folder = new WebFolder();
                     folder->setHandler(handler);
                     folder->setName(name);
-                    if (folder->load())
+                    set_options(folder, options);
+                    if (folder->load()) {
                         m_folders[name] = folder;
-                    else {
+                        m_declarations[name] = declaration;
+                    } else {
                         log->entry(Log::LogLevelCritical, "could not load folder, skipping it");
                         delete folder;
                     }
@@ -106,193 +329,358 @@ bool Configuration::parse()
     }
     if (reader.hasError()) {
         log->entry(Log::LogLevelCritical, "problems found while reading configuration file");
+        /* The file might be half written, the running configuration is better than part of it */
+        if (running)
+            return false;
+    }
+    if (running) {
+        inherit(running);
+    } else {
+        if (m_cacheBudget > 0)
+            m_cache = new ContentCache(m_cacheBudget);
+        if (m_compressionBudget > 0)
+            m_compression = new CompressionCache(m_compressionBudget);
+        m_admission = new Admission(m_maxConnections, m_maxQueue, m_overload, m_retryAfter);
     }
+    if (!check_io(running != NULL))
+        return false;
+    if (m_cache) {
+        foreach (Folder *folder, m_folders) {
+            if ((folder->type() == Folder::WEB) && !(running && running->holds(folder)))
+                m_cache->watchFolder(folder->handler());
+        }
+    }
+    build_routes();
     return true;
 }
 
-bool Configuration::hasPath(const QString &path) const
+/*
+ * What the process was started with stays, whatever the file says now.
+ */
+void Configuration::inherit(const Configuration *running)
 {
     Log *log = Log::instance();
-    /*
-     * We receive a full path and we have to find the real path.
-     * This is a complicated operation but we will take the path of least resistance.
-     * We assume that the root folder does not have any subfolders, therefore any
-     * paths with more than one slash is a different folder.
-     */
-    if (path.at(0) != '/') {
-        log->entry(Log::LogLevelCritical, "path does not start with /, malformed");
-        return false;
-    }
-    /*
-     * Remove the final '/' so the matching is easier.
-     * This is a complicated task, in theory the path could contain "///",
-     * so it is not just removing the final '/'.
-     */
-    QRegExp filter("^(/\\w*)(/*\\w+)*");
-    QString filteredPath;
-    QString documentPath;
+    if ((m_port != running->m_port) || (m_schedulerMode != running->m_schedulerMode) || (m_ioMode != running->m_ioMode)
+            || (m_workers != running->m_workers)
+            || (m_cacheBudget != running->m_cacheBudget) || (m_compressionBudget != running->m_compressionBudget)
+            || (m_maxConnections != running->m_maxConnections) || (m_maxQueue != running->m_maxQueue)
+            || (m_overload != running->m_overload) || (m_retryAfter != running->m_retryAfter)
+            || (m_metricsPort != running->m_metricsPort))
+        log->entry(Log::LogLevelCritical, "some of the changes need a restart, keeping the running values");
+    m_port = running->m_port;
+    m_schedulerMode = running->m_schedulerMode;
+    m_ioMode = running->m_ioMode;
+    m_workers = running->m_workers;
+    m_cacheBudget = running->m_cacheBudget;
+    m_compressionBudget = running->m_compressionBudget;
+    m_cache = running->m_cache;
+    m_compression = running->m_compression;
+    m_maxConnections = running->m_maxConnections;
+    m_maxQueue = running->m_maxQueue;
+    m_overload = running->m_overload;
+    m_retryAfter = running->m_retryAfter;
+    m_admission = running->m_admission;
+    m_metricsPort = running->m_metricsPort;
+}
 
-    if (filter.indexIn(path) != -1) {
-        filteredPath = filter.cap(1);
-        documentPath = filter.cap(2);
-        /*
-         * We captured our initial path. We need to check if it is a root folder request
-         * or not.
-         */
-        if (documentPath.isEmpty()) {
-            log->entry(Log::LogLevelDebug, "request for a root level folder");
-            if (m_folders.contains(filteredPath)) {
-                log->entry(Log::LogLevelDebug, "root level folder found");
-                return true;
-            } else {
-                /* The last chance is a file on the root folder */
-                WebFolder *wf = static_cast<WebFolder *>(m_folders["/"]);
-                return wf->has(path);
-            }
-        } else {
-            /*
-             * It was not a root folder request.
-             * Find out if we have a proper handler.
-             */
-            if (m_folders.contains(filteredPath)) {
-                Folder *folder = m_folders[filteredPath];
-                if (folder->type() == Folder::WEB) {
-                    WebFolder *wf = static_cast<WebFolder *>(folder);
-                    return wf->has(path);
-                } else {
-                    /* Apps do not have files or folders, at least not in this design. */
-                    return true;
-                }
-            } else {
-                /* not found */
-                return false;
-            }
+/*
+ * The epoll workers have nothing but the descriptor of a client, backends
+ * need a QTcpSocket to read the body from. A reload cannot change the
+ * workers, so it cannot add a backend to epoll workers either.
+ */
+bool Configuration::check_io(bool reload)
+{
+    Log *log = Log::instance();
+    if (m_ioMode != Epoll)
+        return true;
+#ifdef RAINBOW_EPOLL
+    if (m_schedulerMode != EventDriven) {
+        log->entry(Log::LogLevelCritical, "epoll needs the event scheduler, using qt");
+        m_ioMode = QtSockets;
+        return true;
+    }
+    foreach (Folder *folder, m_folders) {
+        if ((folder->type() != Folder::APP) || !static_cast<AppFolder *>(folder)->isUpstream())
+            continue;
+        if (reload) {
+            log->entry(Log::LogLevelCritical, "backends need io=\"qt\", not reloading");
+            return false;
         }
+        log->entry(Log::LogLevelCritical, "backends need io=\"qt\", using qt");
+        m_ioMode = QtSockets;
+        return true;
     }
-    return false;
+#else
+    Q_UNUSED(reload);
+    log->entry(Log::LogLevelCritical, "epoll is not available, using qt");
+    m_ioMode = QtSockets;
+#endif
+    return true;
 }
 
-QByteArray *Configuration::request(const QString &path, RequestType type) const
+/*
+ * Everything but the name takes part, the options in a stable order.
+ */
+QString Configuration::declare(const QString &type, const QString &handler, const QHash<QString, QString> &options)
+{
+    QStringList parts;
+    QHash<QString, QString>::const_iterator i;
+    for (i = options.constBegin(); i != options.constEnd(); ++i)
+        parts.append(i.key() + '=' + i.value());
+    parts.sort();
+    parts.prepend(handler);
+    parts.prepend(type);
+    return parts.join(QLatin1String("\n"));
+}
+
+/*
+ * The folder of the running configuration if it was declared the same way.
+ */
+Folder *Configuration::carry(const QString &name, const QString &declaration) const
+{
+    if (m_declarations.value(name) != declaration)
+        return NULL;
+    return m_folders.value(name, NULL);
+}
+
+/*
+ * Called by every worker from its own thread once it is done with the
+ * snapshot. The folders none of the snapshots it still holds can reach lose
+ * what that worker keeps for them.
+ */
+void Configuration::retire(const QList<const Configuration *> &held) const
+{
+    foreach (Folder *folder, m_folders) {
+        if (folder->type() != Folder::APP)
+            continue;
+        bool reachable = false;
+        foreach (const Configuration *configuration, held)
+            reachable = reachable || configuration->holds(folder);
+        if (!reachable)
+            static_cast<AppFolder *>(folder)->retire();
+    }
+}
+
+void Configuration::set_options(Folder *folder, const QHash<QString, QString> &options)
 {
     Log *log = Log::instance();
-    /*
-     * We receive a full path and we have to find the real path.
-     * This is a complicated operation but we will take the path of least resistance.
-     * We assume that the root folder does not have any subfolders, therefore any
-     * paths with more than one slash is a different folder.
-     */
-    QByteArray *response = new QByteArray();
-    if (path.at(0) != '/') {
+    QHash<QString, QString>::const_iterator i;
+    for (i = options.constBegin(); i != options.constEnd(); ++i) {
+        if (folder->setOption(i.key(), i.value()))
+            log->entry(Log::LogLevelDebug, QString("found %1").arg(i.key()));
+        else
+            log->entry(Log::LogLevelNormal, "unknown attribute in folder declaration");
+    }
+}
+
+/*
+ * The query is ignored, whatever comes after the path is up to the scraper.
+ */
+bool Configuration::isMetrics(const char *data, int size, quint16 port) const
+{
+    if (m_metricsPath.isEmpty())
+        return false;
+    if (m_metricsPort && (port != m_metricsPort))
+        return false;
+    const char *query = (const char *)memchr(data, '?', size);
+    if (query)
+        size = query - data;
+    return (size == m_metricsPath.size()) && (memcmp(data, m_metricsPath.constData(), size) == 0);
+}
+
+/*
+ * All folders live at the root level, so the first segment of a path is enough
+ * to find its folder. The table is built once and only read afterwards.
+ */
+void Configuration::build_routes()
+{
+    m_routes.clear();
+    QHash<QString, Folder *>::const_iterator i;
+    for (i = m_folders.constBegin(); i != m_folders.constEnd(); ++i)
+        m_routes.insert(i.key().toUtf8(), i.value());
+    m_root = m_folders.value("/", NULL);
+}
+
+/*
+ * We receive a full path and we have to find the folder and the path inside it.
+ * We assume that the root folder does not have any subfolders, therefore any
+ * paths with more than one slash is a different folder. "/name" and "/name/"
+ * are the folder itself if there is one with that name, otherwise a file in the
+ * root folder. In theory the path could contain "///", so repeated slashes are
+ * skipped. The query string is not part of the path.
+ */
+Route Configuration::resolve(const char *data, int size) const
+{
+    Log *log = Log::instance();
+    Route route;
+    if ((size <= 0) || (data[0] != '/')) {
         log->entry(Log::LogLevelCritical, "path does not start with /, malformed");
-        return response;
+        return route;
     }
-    /*
-     * Remove the final '/' so the matching is easier.
-     * This is a complicated task, in theory the path could contain "///",
-     * so it is not just removing the final '/'.
-     */
-    QRegExp filter("^(/\\w*)(/*\\w+)*");
-    QString filteredPath;
-    QString documentPath;
-    if (filter.indexIn(path) != -1) {
-        filteredPath = filter.cap(1);
-        documentPath = filter.cap(2);
-        /*
-         * We captured our initial path. We need to check if it is a root folder request
-         * or not.
-         */
-        if (documentPath.isEmpty()) {
-            log->entry(Log::LogLevelDebug, "request for a root level folder");
-            if (m_folders.contains(filteredPath)) {
-                log->entry(Log::LogLevelDebug, "root level folder found");
-                Folder *folder = m_folders[filteredPath];
-                if (folder->type() == Folder::WEB) {
-                    WebFolder *web = static_cast<WebFolder *>(folder);
-                    return web->listing(filteredPath);
-                } else {
-                    AppFolder *app = static_cast<AppFolder *>(folder);
-                    return response;
-                }
-            } else {
-                /* The last chance is a file on the root folder */
-                WebFolder *wf = static_cast<WebFolder *>(m_folders["/"]);
-                if (type == Content)
-                    return wf->file(path);
-                else
-                    return wf->info(path);
-            }
-        } else {
-            /*
-             * It was not a root folder request.
-             * Find out if we have a proper handler.
-             */
-            if (m_folders.contains(filteredPath)) {
-                Folder *folder = m_folders[filteredPath];
-                if (folder->type() == Folder::WEB) {
-                    WebFolder *wf = static_cast<WebFolder *>(folder);
-                    if (type == Info)
-                        return wf->info(documentPath);
-                    else
-                        return wf->file(documentPath);
-                } else {
-                    /* Apps do not have files or folders, at least not in this design. */
-                    return response;
-                }
-            } else {
-                /* not found */
-                return response;
-            }
+    const char *query = (const char *)memchr(data, '?', size);
+    if (query)
+        size = query - data;
+    int end = 1;
+    while ((end < size) && (data[end] != '/'))
+        ++end;
+    int rest = end;
+    while ((rest < size) && (data[rest] == '/'))
+        ++rest;
+    /* The view avoids copying the segment just to look it up */
+    QByteArray segment = QByteArray::fromRawData(data, end);
+    Folder *folder = m_routes.value(segment, NULL);
+    if (rest == size) {
+        if (folder) {
+            log->entry(Log::LogLevelDebug, "root level folder found");
+            route.kind = (folder->type() == Folder::WEB) ? Route::Listing : Route::Application;
+            route.folder = folder;
+            route.documentPath = QString::fromLatin1("/");
+            return route;
         }
+        /* The last chance is a file on the root folder */
+        if (!m_root || (m_root->type() != Folder::WEB))
+            return route;
+        route.documentPath = QString::fromUtf8(data, end);
+        if (!static_cast<WebFolder *>(m_root)->has(route.documentPath))
+            return route;
+        route.kind = Route::File;
+        route.folder = m_root;
+        return route;
     }
-    return response;
+    if (!folder) {
+        log->entry(Log::LogLevelNormal, "folder not found");
+        return route;
+    }
+    route.folder = folder;
+    /* Keep only the last of the slashes that separate the folder from the document */
+    route.documentPath = QString::fromUtf8(data + rest - 1, size - rest + 1);
+    if (folder->type() == Folder::APP) {
+        /* Apps do not have files or folders, at least not in this design. */
+        route.kind = Route::Application;
+        return route;
+    }
+    if (static_cast<WebFolder *>(folder)->has(route.documentPath))
+        route.kind = Route::File;
+    else
+        route.folder = NULL;
+    return route;
 }
 
-QByteArray *Configuration::file(const QString &path) const
+/*
+ * This function does not handle errors, the route has to be valid.
+ */
+void Configuration::request(const Route &route, RequestType type, QByteArray &response) const
 {
-    return request(path, Content);
-//    /*
-//     * This function does not handle errors. It is assumed that hasPath was called
-//     * before calling this function.
-//     */
-//    if (path == "/") {
-//        WebFolder *folder = static_cast<WebFolder *>(m_folders["/"]);
-//        return folder->listing("/");
-//    }
-//    QRegExp expression("(/\\w+)/?");
-//    expression.indexIn(path);
-//    QString prefix = expression.cap();
-//    if (prefix.endsWith('/')) {
-//        int position = prefix.lastIndexOf('/');
-//        QString corrected = prefix.remove(position, 1);
-//        WebFolder *folder = static_cast<WebFolder *>(m_folders[corrected]);
-//        return folder->file(path);
-//    }
-//    /* This is a file or folder in our root folder */
-//    WebFolder *folder = static_cast<WebFolder *>(m_folders["/"]);
-//    return folder->file(path);
+    if (route.kind == Route::Application) {
+        /* Application folders reply through their handler, see dispatch() */
+        return;
+    }
+    WebFolder *folder = static_cast<WebFolder *>(route.folder);
+    if (route.kind == Route::Listing) {
+        if (type == Content) {
+            folder->listing(folder->name(), response);
+            return;
+        }
+        /* Info is only the header, without the blank line that ends it */
+        QByteArray listing;
+        folder->listing(folder->name(), listing);
+        response.append(listing.constData(), listing.indexOf("\r\n\r\n") + 2);
+        return;
+    }
+    if (type == Info)
+        folder->info(route.documentPath, response);
+    else
+        folder->file(route.documentPath, response);
 }
 
-QByteArray *Configuration::info(const QString &path) const
+void Configuration::file(const Route &route, QByteArray &response) const
 {
-//    /*
-//     * This function does not handle errors. It is assumed that hasPath was called
-//     * before calling this function.
-//     */
-//    if (path == "/") {
-//        WebFolder *folder = static_cast<WebFolder *>(m_folders["/"]);
-//        return folder->listing("/");
-//    }
-//    QRegExp expression("(/\\w+)/?");
-//    expression.indexIn(path);
-//    QString prefix = expression.cap();
-//    if (prefix.endsWith('/')) {
-//        int position = prefix.lastIndexOf('/');
-//        QString corrected = prefix.remove(position, 1);
-//        WebFolder *folder = static_cast<WebFolder *>(m_folders[corrected]);
-//        return folder->info(path);
-//    }
-//    /* This is a file or folder in our root folder */
-//    WebFolder *folder = static_cast<WebFolder *>(m_folders["/"]);
-//    return folder->info(path);
-    return request(path, Info);
+    request(route, Content, response);
+}
+
+void Configuration::info(const Route &route, QByteArray &response) const
+{
+    request(route, Info, response);
+}
+
+void Configuration::info(const Route &route, qint64 size, QByteArray &response) const
+{
+    if (route.kind != Route::File) {
+        request(route, Info, response);
+        return;
+    }
+    static_cast<WebFolder *>(route.folder)->info(route.documentPath, response, size);
+}
+
+/*
+ * Only for application routes. The reply comes through the response, now or later.
+ */
+void Configuration::dispatch(const Route &route, const HandlerRequest &request, ResponseSink *response) const
+{
+    static_cast<AppFolder *>(route.folder)->dispatch(request, response);
+}
+
+WebSocketHandler *Configuration::webSocketHandler(const Route &route) const
+{
+    if (route.kind != Route::Application)
+        return NULL;
+    return static_cast<AppFolder *>(route.folder)->webSocketHandler();
+}
+
+bool Configuration::isWebSocketDeflate(const Route &route) const
+{
+    return (route.kind == Route::Application) && static_cast<AppFolder *>(route.folder)->isDeflate();
+}
+
+bool Configuration::isUpstream(const Route &route) const
+{
+    return (route.kind == Route::Application) && static_cast<AppFolder *>(route.folder)->isUpstream();
+}
+
+bool Configuration::isProxy(const Route &route) const
+{
+    return (route.kind == Route::Application) && static_cast<AppFolder *>(route.folder)->isProxy();
+}
+
+/*
+ * Only for routes of folders with a backend. The reply streams through the exchange.
+ */
+void Configuration::forward(const Route &route, const HandlerRequest &request, QTcpSocket *client, UpstreamExchange *exchange) const
+{
+    static_cast<AppFolder *>(route.folder)->forward(request, client, exchange);
+}
+
+/*
+ * The file behind a route, empty if the route is not backed by a file.
+ */
+QString Configuration::localFile(const Route &route) const
+{
+    if (route.kind != Route::File)
+        return QString();
+    return static_cast<WebFolder *>(route.folder)->location(route.documentPath);
+}
+
+/*
+ * What the folder index knows about the file behind a route, the file itself
+ * is not touched.
+ */
+bool Configuration::entry(const Route &route, WebFolder::Entry &entry) const
+{
+    if (route.kind != Route::File)
+        return false;
+    return static_cast<WebFolder *>(route.folder)->entry(route.documentPath, entry);
+}
+
+/*
+ * A precompressed copy of the file behind a route, such as foo.css.gz next
+ * to foo.css. A copy older than the file is out of date and ignored.
+ */
+bool Configuration::sidecar(const Route &route, const char *suffix, const WebFolder::Entry &original, WebFolder::Entry &sidecar) const
+{
+    if (route.kind != Route::File)
+        return false;
+    WebFolder *folder = static_cast<WebFolder *>(route.folder);
+    if (!folder->entry(route.documentPath + QLatin1String(suffix), sidecar) || sidecar.etag.isEmpty())
+        return false;
+    return sidecar.mtime >= original.mtime;
 }
@@ -4,29 +4,128 @@
 #include <QtCore/QString>
 #include <QtCore/QByteArray>
 #include <QtCore/QHash>
+#include <QtCore/QStringList>
+#include <QtCore/QAtomicInt>
 
 #include "webfolder.h"
 #include "appfolder.h"
+#include "contentcache.h"
+#include "compressioncache.h"
+#include "admission.h"
+#include "route.h"
+#include "atomics.h"
 
+/*
+ * A configuration is an immutable snapshot once parse returns. A reload parses
+ * a new one next to the running one and the workers move to it between
+ * requests, every request keeps the snapshot it was replied from. The server
+ * deletes a snapshot once no worker holds it anymore.
+ */
 class Configuration
 {
+public:
+    enum SchedulerMode {
+        EventDriven,
+        Pulse
+    };
+    /* How the workers talk to the clients */
+    enum IoMode {
+        QtSockets,
+        Epoll
+    };
+private:
     QHash<QString, Folder *> m_folders;
     QString m_configurationFile;
     quint16 m_port;
+    SchedulerMode m_schedulerMode;
+    IoMode m_ioMode;
+    int m_workers;
+    /* The caches and the admission belong to the process, a reload inherits them */
+    qint64 m_cacheBudget;
+    qint64 m_compressionBudget;
+    ContentCache *m_cache;
+    CompressionCache *m_compression;
+    int m_keepAlive;
+    int m_maxRequests;
+    int m_headerTimeout;
+    int m_writeTimeout;
+    int m_maxConnections;
+    int m_maxQueue;
+    Admission::Policy m_overload;
+    int m_retryAfter;
+    Admission *m_admission;
+    QByteArray m_metricsPath;
+    quint16 m_metricsPort;
+    bool m_watch;
+    /* One for the server and one for every worker that did not leave it behind yet */
+    mutable QAtomicInt m_references;
+    /* How each folder was declared, unchanged folders are carried over by a reload */
+    QHash<QString, QString> m_declarations;
+    /* Folders by the first segment of their path, built by parse */
+    QHash<QByteArray, Folder *> m_routes;
+    Folder *m_root;
     enum RequestType {
         Info,
         Content
     };
-    QByteArray *request(const QString &path, RequestType type) const;
+    void request(const Route &route, RequestType type, QByteArray &response) const;
+    void build_routes();
+    void inherit(const Configuration *running);
+    bool check_io(bool reload);
+    Folder *carry(const QString &name, const QString &declaration) const;
+    static void set_options(Folder *folder, const QHash<QString, QString> &options);
+    static QString declare(const QString &type, const QString &handler, const QHash<QString, QString> &options);
 public:
     Configuration();
+    ~Configuration();
     QString configurationFile() const { return m_configurationFile; }
     void setConfigurationFile(const QString &configuration_file) { m_configurationFile = configuration_file; }
-    bool parse();
+    /* With the running configuration it is a reload, only the folders and the limits change */
+    bool parse(const Configuration *running = NULL);
+    void acquire() const { m_references.fetchAndAddRelaxed(1); }
+    /* True for the last reference, the server still has to delete it */
+    bool release() const { return m_references.fetchAndAddOrdered(-1) == 1; }
+    bool isReleased() const { return load_acquire(m_references) == 0; }
+    bool holds(const Folder *folder) const { return m_folders.value(folder->name(), NULL) == folder; }
+    void retire(const QList<const Configuration *> &held) const;
+    /* Whether a change of the file reloads the configuration, not only SIGHUP */
+    bool isWatched() const { return m_watch; }
     quint16 port() const { return m_port; }
-    bool hasPath(const QString &path) const;
-    QByteArray *file(const QString &path) const;
-    QByteArray *info(const QString &path) const;
+    SchedulerMode schedulerMode() const { return m_schedulerMode; }
+    IoMode ioMode() const { return m_ioMode; }
+    int workers() const { return m_workers; }
+    ContentCache *cache() const { return m_cache; }
+    CompressionCache *compression() const { return m_compression; }
+    /* Idle timeout of persistent connections in milliseconds, 0 if they are disabled */
+    int keepAlive() const { return m_keepAlive; }
+    int maxRequests() const { return m_maxRequests; }
+    /* How long a request may take to send its header, and a reply may go without progress, in milliseconds */
+    int headerTimeout() const { return m_headerTimeout; }
+    int writeTimeout() const { return m_writeTimeout; }
+    Admission *admission() const { return m_admission; }
+    QStringList folderNames() const { return m_folders.keys(); }
+    QList<Folder *> folders() const { return m_folders.values(); }
+    /* Where the metrics are served, the port is 0 if they share the server port */
+    QByteArray metricsPath() const { return m_metricsPath; }
+    quint16 metricsPort() const { return m_metricsPort; }
+    bool isMetrics(const char *data, int size, quint16 port) const;
+    Route resolve(const char *data, int size) const;
+    Route resolve(const QByteArray &target) const { return resolve(target.constData(), target.size()); }
+    /* Both append to the response, which usually already holds the status line */
+    void file(const Route &route, QByteArray &response) const;
+    void info(const Route &route, QByteArray &response) const;
+    /* The header for a body of the given length, whatever the index says */
+    void info(const Route &route, qint64 size, QByteArray &response) const;
+    void dispatch(const Route &route, const HandlerRequest &request, ResponseSink *response) const;
+    /* NULL unless the route is an application that takes WebSocket connections */
+    WebSocketHandler *webSocketHandler(const Route &route) const;
+    bool isWebSocketDeflate(const Route &route) const;
+    bool isUpstream(const Route &route) const;
+    bool isProxy(const Route &route) const;
+    void forward(const Route &route, const HandlerRequest &request, QTcpSocket *client, UpstreamExchange *exchange) const;
+    QString localFile(const Route &route) const;
+    bool entry(const Route &route, WebFolder::Entry &entry) const;
+    bool sidecar(const Route &route, const char *suffix, const WebFolder::Entry &original, WebFolder::Entry &sidecar) const;
 };
 
 #endif // CONFIGURATION_H
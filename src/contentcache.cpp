@@ -0,0 +1,242 @@
+#include <QtCore/QFile>
+#include <QtCore/QStringList>
+
+#include <sys/stat.h>
+
+#include "contentcache.h"
+#include "log.h"
+
+ContentCache::ContentCache(qint64 budget) :
+    m_budget(budget),
+    m_used(0),
+    m_head(NULL),
+    m_tail(NULL),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+    m_invalidations(0)
+{
+    m_watcher = new QFileSystemWatcher(this);
+    connect(m_watcher, SIGNAL(fileChanged(QString)), this, SLOT(file_changed(QString)));
+    connect(m_watcher, SIGNAL(directoryChanged(QString)), this, SLOT(directory_changed(QString)));
+}
+
+ContentCache::~ContentCache()
+{
+    qDeleteAll(m_entries);
+}
+
+void ContentCache::unlink(Entry *entry)
+{
+    if (entry->previous)
+        entry->previous->next = entry->next;
+    else
+        m_head = entry->next;
+    if (entry->next)
+        entry->next->previous = entry->previous;
+    else
+        m_tail = entry->previous;
+    entry->previous = NULL;
+    entry->next = NULL;
+}
+
+void ContentCache::push_front(Entry *entry)
+{
+    entry->previous = NULL;
+    entry->next = m_head;
+    if (m_head)
+        m_head->previous = entry;
+    m_head = entry;
+    if (!m_tail)
+        m_tail = entry;
+}
+
+/*
+ * Must be called with the lock held. The watcher lives in the thread that
+ * created the cache, so we ask it to stop watching through its event loop.
+ */
+void ContentCache::remove(Entry *entry)
+{
+    unlink(entry);
+    m_entries.remove(entry->path);
+    m_used -= entry->size;
+    QMetaObject::invokeMethod(this, "unwatch_file", Qt::QueuedConnection, Q_ARG(QString, entry->path));
+    delete entry;
+}
+
+/*
+ * Called while the configuration is being parsed, from the main thread.
+ */
+void ContentCache::watchFolder(const QString &path)
+{
+    m_watcher->addPath(path);
+}
+
+bool ContentCache::lookup(const QString &path, QByteArray &header, QByteArray &content)
+{
+    QMutexLocker locker(&m_lock);
+    Entry *entry = m_entries.value(path, NULL);
+    if (!entry) {
+        ++m_misses;
+        return false;
+    }
+    ++m_hits;
+    if (entry != m_head) {
+        unlink(entry);
+        push_front(entry);
+    }
+    /* Both arrays are implicitly shared, nothing is copied here */
+    header = entry->header;
+    content = entry->content;
+    return true;
+}
+
+/*
+ * The modification time is the one of the descriptor the content was read
+ * from, so a file that changed while it was read is dropped once it is watched.
+ */
+void ContentCache::insert(const QString &path, const QByteArray &header, const QByteArray &content, qint64 mtime)
+{
+    Log *log = Log::instance();
+    qint64 size = header.size() + content.size();
+    if (size > maximumEntrySize()) {
+        log->entry(Log::LogLevelDebug, "file too big to be cached");
+        return;
+    }
+    QMutexLocker locker(&m_lock);
+    Entry *entry = m_entries.value(path, NULL);
+    if (entry)
+        remove(entry);
+    while (m_tail && (m_used + size > m_budget)) {
+        log->entry(Log::LogLevelDebug, "evicting file from cache");
+        ++m_evictions;
+        remove(m_tail);
+    }
+    entry = new Entry;
+    entry->path = path;
+    entry->header = header;
+    entry->content = content;
+    entry->size = size;
+    entry->length = content.size();
+    entry->mtime = mtime;
+    push_front(entry);
+    m_entries.insert(path, entry);
+    m_used += size;
+    QMetaObject::invokeMethod(this, "watch_file", Qt::QueuedConnection, Q_ARG(QString, path));
+}
+
+void ContentCache::invalidate(const QString &path)
+{
+    QMutexLocker locker(&m_lock);
+    Entry *entry = m_entries.value(path, NULL);
+    if (!entry)
+        return;
+    Log::instance()->entry(Log::LogLevelDebug, "invalidating cached file");
+    ++m_invalidations;
+    remove(entry);
+}
+
+/*
+ * The file might have changed between the moment it was read and now,
+ * once it is watched we check it one last time.
+ */
+void ContentCache::watch_file(const QString &path)
+{
+    m_lock.lock();
+    Entry *entry = m_entries.value(path, NULL);
+    qint64 length = 0;
+    qint64 mtime = 0;
+    if (entry) {
+        length = entry->length;
+        mtime = entry->mtime;
+    }
+    m_lock.unlock();
+    if (!entry)
+        return;
+    m_watcher->addPath(path);
+    if (!matches(path, length, mtime))
+        invalidate(path);
+}
+
+/*
+ * Whether the file on disk is still the one that was read.
+ */
+bool ContentCache::matches(const QString &path, qint64 length, qint64 mtime)
+{
+    struct stat status;
+    if (::stat(QFile::encodeName(path).constData(), &status) != 0)
+        return false;
+    return (status.st_size == length) && (status.st_mtime == mtime);
+}
+
+void ContentCache::unwatch_file(const QString &path)
+{
+    /* It might have been cached again in the meantime */
+    QMutexLocker locker(&m_lock);
+    if (m_entries.contains(path))
+        return;
+    locker.unlock();
+    m_watcher->removePath(path);
+}
+
+void ContentCache::file_changed(const QString &path)
+{
+    invalidate(path);
+}
+
+/*
+ * Something was added, removed or renamed in the folder. We only care about
+ * the files we have, and only the ones that no longer match the disk.
+ */
+void ContentCache::directory_changed(const QString &path)
+{
+    QString prefix = path;
+    if (!prefix.endsWith('/'))
+        prefix.append('/');
+    QStringList candidates;
+    m_lock.lock();
+    foreach (const QString &cached, m_entries.keys()) {
+        if (cached.startsWith(prefix))
+            candidates.append(cached);
+    }
+    m_lock.unlock();
+    foreach (const QString &cached, candidates) {
+        m_lock.lock();
+        Entry *entry = m_entries.value(cached, NULL);
+        qint64 length = entry ? entry->length : 0;
+        qint64 mtime = entry ? entry->mtime : 0;
+        m_lock.unlock();
+        if (entry && !matches(cached, length, mtime))
+            invalidate(cached);
+    }
+}
+
+quint64 ContentCache::hits() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_hits;
+}
+
+quint64 ContentCache::misses() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_misses;
+}
+
+quint64 ContentCache::evictions() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_evictions;
+}
+
+quint64 ContentCache::invalidations() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_invalidations;
+}
+
+qint64 ContentCache::used() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_used;
+}
@@ -0,0 +1,71 @@
+#ifndef CONTENTCACHE_H
+#define CONTENTCACHE_H
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QFileSystemWatcher>
+
+/*
+ * Keeps the content of the most requested files in memory, together with
+ * the header that goes with them. The cache is shared by all the workers,
+ * it is bounded by a byte budget and evicts the least recently used files.
+ * Entries are not checked against the disk on every request, instead the
+ * folders and the cached files are watched and entries are dropped when they
+ * change.
+ */
+class ContentCache : public QObject
+{
+    Q_OBJECT
+    struct Entry {
+        QString path;
+        QByteArray header;
+        QByteArray content;
+        qint64 size;
+        /* The file the content was read from, not the one the index describes */
+        qint64 length;
+        qint64 mtime;
+        Entry *previous;
+        Entry *next;
+    };
+    qint64 m_budget;
+    qint64 m_used;
+    QHash<QString, Entry *> m_entries;
+    /* Most recently used at the head, next victim at the tail */
+    Entry *m_head;
+    Entry *m_tail;
+    quint64 m_hits;
+    quint64 m_misses;
+    quint64 m_evictions;
+    quint64 m_invalidations;
+    QFileSystemWatcher *m_watcher;
+    mutable QMutex m_lock;
+
+    void unlink(Entry *entry);
+    void push_front(Entry *entry);
+    void remove(Entry *entry);
+    static bool matches(const QString &path, qint64 length, qint64 mtime);
+private slots:
+    void watch_file(const QString &path);
+    void unwatch_file(const QString &path);
+    void file_changed(const QString &path);
+    void directory_changed(const QString &path);
+public:
+    ContentCache(qint64 budget);
+    virtual ~ContentCache();
+    qint64 budget() const { return m_budget; }
+    qint64 maximumEntrySize() const { return m_budget / 8; }
+    void watchFolder(const QString &path);
+    bool lookup(const QString &path, QByteArray &header, QByteArray &content);
+    void insert(const QString &path, const QByteArray &header, const QByteArray &content, qint64 mtime);
+    void invalidate(const QString &path);
+    quint64 hits() const;
+    quint64 misses() const;
+    quint64 evictions() const;
+    quint64 invalidations() const;
+    qint64 used() const;
+};
+
+#endif // CONTENTCACHE_H
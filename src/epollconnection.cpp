@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "epollconnection.h"
+#include "epollworker.h"
+
+EpollConnection::EpollConnection(int descriptor, quint16 localPort, EpollWorker *worker) :
+    m_descriptor(descriptor),
+    m_localPort(localPort),
+    m_worker(worker),
+    m_request(NULL),
+    m_offset(0),
+    m_queued(0),
+    m_readable(false),
+    m_closing(false),
+    m_finished(false)
+{
+}
+
+/*
+ * Closing the descriptor also takes it out of the epoll set.
+ */
+EpollConnection::~EpollConnection()
+{
+    ::close(m_descriptor);
+}
+
+/*
+ * Straight into the room the buffer has left, which usually is the whole
+ * buffer the pool gave the request. A read that does not fill the room means
+ * the kernel has nothing more, that saves the read that would only tell us
+ * so. The limit keeps a client that sends faster than we read from holding
+ * the worker, the rest is read once the request is replied.
+ */
+qint64 EpollConnection::receive(QByteArray &buffer)
+{
+    qint64 total = 0;
+    while (m_readable && !m_finished && (total < EPOLL_READ_LIMIT)) {
+        int size = buffer.size();
+        if (buffer.capacity() - size < EPOLL_READ_ROOM)
+            buffer.reserve(qMax(buffer.capacity() * 2, size + EPOLL_READ_ROOM));
+        int room = buffer.capacity() - size;
+        buffer.resize(size + room);
+        ssize_t got = ::read(m_descriptor, buffer.data() + size, room);
+        buffer.resize(size + (int)qMax(got, (ssize_t)0));
+        if (got > 0) {
+            total += got;
+            if (got < room)
+                m_readable = false;
+            continue;
+        }
+        if (got == 0) {
+            /* The client is gone, like a QTcpSocket we do not answer what is left */
+            abort();
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            m_readable = false;
+        else
+            abort();
+    }
+    return total;
+}
+
+void EpollConnection::write(const QByteArray &data)
+{
+    if (data.isEmpty() || m_finished)
+        return;
+    m_queue.append(data);
+    m_queued += data.size();
+}
+
+void EpollConnection::write(const char *data, qint64 size)
+{
+    if ((size <= 0) || m_finished)
+        return;
+    m_queue.append(QByteArray(data, (int)size));
+    m_queued += size;
+}
+
+/*
+ * As much of the queue as the socket takes, up to EPOLL_IOVECS pieces per
+ * call. What does not fit waits for the next edge, the worker calls
+ * writable() then.
+ */
+void EpollConnection::flush()
+{
+    while (!m_queue.isEmpty() && !m_finished) {
+        struct iovec vectors[EPOLL_IOVECS];
+        int count = 0;
+        for (int i = 0; (i < m_queue.size()) && (count < EPOLL_IOVECS); ++i) {
+            const QByteArray &data = m_queue.at(i);
+            int skip = (i == 0) ? m_offset : 0;
+            vectors[count].iov_base = const_cast<char *>(data.constData()) + skip;
+            vectors[count].iov_len = data.size() - skip;
+            ++count;
+        }
+        /* The worker ignores SIGPIPE, a client that left only gives us EPIPE */
+        ssize_t written = ::writev(m_descriptor, vectors, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                abort();
+            return;
+        }
+        consume(written);
+    }
+    if (m_closing && m_queue.isEmpty())
+        finish();
+}
+
+void EpollConnection::consume(qint64 written)
+{
+    m_queued -= written;
+    while (written > 0) {
+        int left = m_queue.first().size() - m_offset;
+        if (written < left) {
+            m_offset += (int)written;
+            return;
+        }
+        written -= left;
+        m_queue.removeFirst();
+        m_offset = 0;
+    }
+}
+
+/*
+ * The socket has room again.
+ */
+void EpollConnection::writable()
+{
+    flush();
+}
+
+/*
+ * The connection goes once the client took everything.
+ */
+void EpollConnection::close()
+{
+    m_closing = true;
+    flush();
+}
+
+void EpollConnection::abort()
+{
+    m_queue.clear();
+    m_offset = 0;
+    m_queued = 0;
+    finish();
+}
+
+/*
+ * Nothing is deleted here, we are usually deep inside the request. The
+ * worker does it once the event is handled.
+ */
+void EpollConnection::finish()
+{
+    if (m_finished)
+        return;
+    m_finished = true;
+    m_readable = false;
+    if (m_worker)
+        m_worker->reap(this);
+}
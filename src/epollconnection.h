@@ -0,0 +1,60 @@
+#ifndef EPOLLCONNECTION_H
+#define EPOLLCONNECTION_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+
+#include "clientconnection.h"
+
+#define EPOLL_READ_LIMIT (64 * 1024)    /* Read at a time, more than the largest header we take */
+#define EPOLL_READ_ROOM 1024            /* Less room than this left in the buffer and it grows */
+#define EPOLL_IOVECS 16                 /* Pieces of the queue written with one call */
+
+class EpollWorker;
+class Request;
+
+/*
+ * A non-blocking descriptor registered edge triggered with the epoll of its
+ * worker. An edge only comes once, so the connection remembers that there is
+ * something to read until a read comes back short. Writes are queued as they
+ * are, the cached content a reply shares is not copied, and go out in a
+ * single call once the reply is built.
+ */
+class EpollConnection : public ClientConnection
+{
+    int m_descriptor;
+    quint16 m_localPort;
+    EpollWorker *m_worker;
+    Request *m_request;
+    QList<QByteArray> m_queue;
+    /* How much of the first piece of the queue is already written */
+    int m_offset;
+    qint64 m_queued;
+    bool m_readable;
+    bool m_closing;
+    bool m_finished;
+
+    void consume(qint64 written);
+    void finish();
+public:
+    EpollConnection(int descriptor, quint16 localPort, EpollWorker *worker);
+    virtual ~EpollConnection();
+    Request *request() const { return m_request; }
+    void setRequest(Request *request) { m_request = request; }
+    /* The edge came, read until the kernel has nothing more */
+    void setReadable() { m_readable = true; }
+    /* Done with, the worker deletes it once it is out of the event it is in */
+    bool isFinished() const { return m_finished; }
+    void writable();
+    virtual qint64 receive(QByteArray &buffer);
+    virtual void write(const QByteArray &data);
+    virtual void write(const char *data, qint64 size);
+    virtual qint64 bytesToWrite() const { return m_queued; }
+    virtual void flush();
+    virtual void close();
+    virtual void abort();
+    virtual int descriptor() const { return m_descriptor; }
+    virtual quint16 localPort() const { return m_localPort; }
+};
+
+#endif // EPOLLCONNECTION_H
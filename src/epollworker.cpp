@@ -0,0 +1,295 @@
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "log.h"
+#include "epollworker.h"
+
+EpollWorker::EpollWorker(const Configuration *configuration) :
+    Worker(configuration),
+    m_epoll(-1),
+    m_listener(-1),
+    m_port(0),
+    m_notifier(NULL),
+    m_reaping(false)
+{
+}
+
+EpollWorker::~EpollWorker()
+{
+    foreach (EpollConnection *connection, m_connections) {
+        if (connection->request())
+            release(connection->request());
+        delete connection;
+    }
+    if (m_listener != -1)
+        ::close(m_listener);
+    if (m_epoll != -1)
+        ::close(m_epoll);
+}
+
+/*
+ * Every worker listens on the same port, SO_REUSEPORT lets the kernel pick
+ * the worker of each connection, so there is no acceptor to hand them over.
+ */
+bool EpollWorker::listen(quint16 port)
+{
+    Log *log = Log::instance();
+    /* Without a QTcpSocket nobody else ignores it, writev() and sendfile() have no MSG_NOSIGNAL */
+    ::signal(SIGPIPE, SIG_IGN);
+    m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll == -1) {
+        log->entry(Log::LogLevelCritical, "could not create the epoll set");
+        return false;
+    }
+    m_listener = open_listener(port);
+    if (m_listener == -1) {
+        log->entry(Log::LogLevelCritical, QString("could not listen on port %1").arg(port));
+        return false;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLET;
+    /* The connections have their own pointer, the listener has none */
+    event.data.ptr = NULL;
+    if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listener, &event) == -1) {
+        log->entry(Log::LogLevelCritical, "could not watch the listening socket");
+        return false;
+    }
+    m_port = port;
+    return true;
+}
+
+/*
+ * Both IPv6 and IPv4 where there is IPv6, like QHostAddress::Any.
+ */
+int EpollWorker::open_listener(quint16 port)
+{
+    int one = 1;
+    int zero = 0;
+    int descriptor = ::socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (descriptor != -1) {
+        struct sockaddr_in6 address;
+        memset(&address, 0, sizeof(address));
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        ::setsockopt(descriptor, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        if ((::bind(descriptor, (struct sockaddr *)&address, sizeof(address)) == 0) && (::listen(descriptor, SOMAXCONN) == 0))
+            return descriptor;
+        ::close(descriptor);
+    }
+    descriptor = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (descriptor == -1)
+        return -1;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    if ((::bind(descriptor, (struct sockaddr *)&address, sizeof(address)) == 0) && (::listen(descriptor, SOMAXCONN) == 0))
+        return descriptor;
+    ::close(descriptor);
+    return -1;
+}
+
+/*
+ * Has to be called from the thread the worker lives in, the notifier
+ * belongs to it.
+ */
+void EpollWorker::start()
+{
+    Worker::start();
+    if (m_epoll == -1)
+        return;
+    m_notifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read, this);
+    connect(m_notifier, SIGNAL(activated(int)), this, SLOT(epoll_activated()));
+}
+
+/*
+ * The connections we have are served until the worker goes, new ones go
+ * to the other workers.
+ */
+void EpollWorker::stop()
+{
+    Worker::stop();
+    if (m_listener != -1) {
+        ::close(m_listener);
+        m_listener = -1;
+    }
+}
+
+/*
+ * The epoll descriptor is readable while there are events, we take them
+ * without waiting until there are none left.
+ */
+void EpollWorker::epoll_activated()
+{
+    adopt();
+    forever {
+        int count = ::epoll_wait(m_epoll, m_events, EPOLL_EVENTS, 0);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            Log::instance()->entry(Log::LogLevelCritical, "could not wait for the connections");
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            EpollConnection *connection = static_cast<EpollConnection *>(m_events[i].data.ptr);
+            if (connection)
+                serve(connection, m_events[i].events);
+            else
+                accept_connections();
+        }
+        if (count < EPOLL_EVENTS)
+            return;
+    }
+}
+
+/*
+ * Edge triggered, the listener only tells us again about connections that
+ * come after we took all of the ones waiting.
+ */
+void EpollWorker::accept_connections()
+{
+    while (m_listener != -1) {
+        int descriptor = ::accept4(m_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (descriptor == -1) {
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+                continue;
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                Log::instance()->entry(Log::LogLevelCritical, "could not accept a connection");
+            return;
+        }
+        open(descriptor);
+    }
+}
+
+/*
+ * The same admission as the acceptor does for the other workers. There is
+ * no acceptor to pause, the clients over the limit are always refused.
+ * Whatever the client sent already comes as the first edge.
+ */
+void EpollWorker::open(int descriptor)
+{
+    Log *log = Log::instance();
+    Admission *admission = m_configuration->admission();
+    if (!admission->admit()) {
+        log->entry(Log::LogLevelDebug, "too many connections, refusing it");
+        admission->refuse(descriptor);
+        return;
+    }
+    if (admission->maxQueue() && (queued() >= admission->maxQueue())) {
+        log->entry(Log::LogLevelDebug, "worker is full, shedding the connection");
+        admission->countShed();
+        admission->refuse(descriptor);
+        admission->release();
+        return;
+    }
+    EpollConnection *connection = new EpollConnection(descriptor, m_port, this);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = connection;
+    if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, descriptor, &event) == -1) {
+        log->entry(Log::LogLevelCritical, "could not watch the connection");
+        delete connection;
+        admission->release();
+        return;
+    }
+    m_connections.insert(connection);
+    Request *request = m_pool.acquire(connection, m_now, persistent(0));
+    connection->setRequest(request);
+    request->setStamp(Metrics::now());
+    arm(request, HeaderDeadline);
+}
+
+/*
+ * What readyRead and bytesWritten are for a QTcpSocket. Room in the socket
+ * first, it might let a replied request go on to the next one, which then
+ * reads what came.
+ */
+void EpollWorker::serve(EpollConnection *connection, quint32 events)
+{
+    if (connection->isFinished())
+        return;
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        Log::instance()->entry(Log::LogLevelDebug, "connection closed");
+        connection->abort();
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP))
+        connection->setReadable();
+    if (events & EPOLLOUT) {
+        connection->writable();
+        if (!connection->isFinished() && connection->request()->isReplied())
+            finish(connection->request());
+    }
+    if ((events & (EPOLLIN | EPOLLRDHUP)) && !connection->isFinished())
+        advance(connection->request());
+}
+
+/*
+ * Called by the connection, which might still be in use further up.
+ */
+void EpollWorker::reap(EpollConnection *connection)
+{
+    m_finished.append(connection);
+    if (m_reaping)
+        return;
+    m_reaping = true;
+    QMetaObject::invokeMethod(this, "reap_connections", Qt::QueuedConnection);
+}
+
+void EpollWorker::reap_connections()
+{
+    m_reaping = false;
+    QList<EpollConnection *> finished = m_finished;
+    m_finished.clear();
+    foreach (EpollConnection *connection, finished) {
+        m_connections.remove(connection);
+        if (connection->request())
+            release(connection->request());
+        delete connection;
+        m_configuration->admission()->release();
+    }
+}
+
+/*
+ * Our connections keep their EpollConnection, the metrics port still comes
+ * with QTcpSockets through the acceptor.
+ */
+Request *EpollWorker::follow(Request *request)
+{
+    if (request->socket())
+        return Worker::follow(request);
+    EpollConnection *connection = static_cast<EpollConnection *>(request->connection());
+    int sequence = request->sequence() + 1;
+    Request *next = m_pool.acquire(connection, m_now, persistent(sequence), sequence, request->remainder());
+    connection->setRequest(next);
+    release(request);
+    return next;
+}
+
+/*
+ * Every connection is watched for room all the time, the edge comes when
+ * the client took enough of what is in the socket.
+ */
+void EpollWorker::wait_writable(Request *request)
+{
+    if (request->socket())
+        Worker::wait_writable(request);
+}
+
+int EpollWorker::queued() const
+{
+    return Worker::queued() + m_connections.count();
+}
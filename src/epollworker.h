@@ -0,0 +1,58 @@
+#ifndef EPOLLWORKER_H
+#define EPOLLWORKER_H
+
+#include <QtCore/QSet>
+#include <QtCore/QList>
+#include <QtCore/QSocketNotifier>
+#include <sys/epoll.h>
+
+#include "worker.h"
+#include "epollconnection.h"
+
+#define EPOLL_EVENTS 256    /* Events taken from the kernel with one call */
+
+/*
+ * A worker that serves its clients without QTcpSocket. It has a listening
+ * socket of its own, the kernel spreads the connections among the workers,
+ * and an epoll set in edge triggered mode with the listener and all of its
+ * connections. The event loop only watches the epoll descriptor, a single
+ * notifier for all the connections, the timers and the replies of handlers
+ * go through it as in any other worker. The requests are the same ones,
+ * only their connection is different.
+ */
+class EpollWorker : public Worker
+{
+    Q_OBJECT
+    int m_epoll;
+    int m_listener;
+    quint16 m_port;
+    QSocketNotifier *m_notifier;
+    struct epoll_event m_events[EPOLL_EVENTS];
+    QSet<EpollConnection *> m_connections;
+    /* Finished while handling an event, deleted right after it */
+    QList<EpollConnection *> m_finished;
+    bool m_reaping;
+
+    int open_listener(quint16 port);
+    void accept_connections();
+    void open(int descriptor);
+    void serve(EpollConnection *connection, quint32 events);
+protected:
+    virtual Request *follow(Request *request);
+    virtual void wait_writable(Request *request);
+    virtual int queued() const;
+private slots:
+    void epoll_activated();
+    void reap_connections();
+public slots:
+    virtual void start();
+    virtual void stop();
+public:
+    EpollWorker(const Configuration *configuration);
+    virtual ~EpollWorker();
+    /* Has to be called before the worker starts */
+    bool listen(quint16 port);
+    void reap(EpollConnection *connection);
+};
+
+#endif // EPOLLWORKER_H
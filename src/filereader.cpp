@@ -0,0 +1,42 @@
+#include <errno.h>
+#include <unistd.h>
+
+#include "filereader.h"
+#include "log.h"
+
+FileReader::FileReader()
+{
+}
+
+BodyProducer::Status FileReader::produce(ClientConnection *socket)
+{
+    if (m_file == -1)
+        return Failed;
+    while (!m_parts.isEmpty()) {
+        /* bytesWritten brings us back once the client took some of it */
+        if (socket->bytesToWrite() >= BODY_HIGH_WATER)
+            return Pending;
+        Part &part = m_parts.first();
+        if (!part.data.isNull()) {
+            /* Memory parts are small, they go in whole */
+            socket->write(part.data);
+            part.remaining = 0;
+        } else if (part.remaining > 0) {
+            qint64 length = qMin(part.remaining, (qint64)BODY_CHUNK);
+            m_chunk.resize((int)length);
+            ssize_t read = pread(m_file, m_chunk.data(), (size_t)length, (off_t)part.offset);
+            if ((read < 0) && (errno == EINTR))
+                continue;
+            if (read <= 0) {
+                Log::instance()->entry(Log::LogLevelCritical, "file shrank during transfer");
+                return Failed;
+            }
+            socket->write(m_chunk.constData(), read);
+            part.offset += read;
+            part.remaining -= read;
+        }
+        if (part.remaining == 0)
+            m_parts.removeFirst();
+    }
+    return Done;
+}
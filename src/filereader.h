@@ -0,0 +1,21 @@
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include "bodyproducer.h"
+
+/*
+ * Reads the file a chunk at a time and hands it to the socket, never letting
+ * the socket buffer grow past the high-water mark. This is the way bodies are
+ * sent where FileTransfer is not available, it costs a copy but the memory
+ * used by a connection does not depend on the size of the file or on how
+ * fast the client reads.
+ */
+class FileReader : public BodyProducer
+{
+    QByteArray m_chunk;
+public:
+    FileReader();
+    virtual Status produce(ClientConnection *socket);
+};
+
+#endif // FILEREADER_H
@@ -0,0 +1,181 @@
+#include <QtCore/QtGlobal>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#endif
+
+#include "filetransfer.h"
+#include "log.h"
+
+/* Do not hog the worker with a single transfer */
+#define TRANSFER_CHUNK (1024 * 1024)
+
+FileTransfer::FileTransfer(int socket) :
+    m_socket(socket),
+    m_piped(0),
+    m_splice(false)
+{
+    m_pipe[0] = -1;
+    m_pipe[1] = -1;
+}
+
+FileTransfer::~FileTransfer()
+{
+    if (m_pipe[0] != -1)
+        ::close(m_pipe[0]);
+    if (m_pipe[1] != -1)
+        ::close(m_pipe[1]);
+}
+
+bool FileTransfer::isSupported()
+{
+#ifdef Q_OS_LINUX
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Send as much as the socket takes. Returns Blocked if the socket is full,
+ * in that case call it again when the socket is writable.
+ */
+BodyProducer::Status FileTransfer::produce(ClientConnection *socket)
+{
+    if (m_file == -1)
+        return Failed;
+    if (socket->bytesToWrite() > 0) {
+        socket->flush();
+        if (socket->bytesToWrite() > 0)
+            return Pending;
+    }
+    while (!m_parts.isEmpty()) {
+        Part &part = m_parts.first();
+        Status status;
+        if (!part.data.isNull())
+            status = send_data(part);
+        else if (m_splice)
+            status = send_splice(part);
+        else
+            status = send_file(part);
+        if (status != Done)
+            return status;
+        m_parts.removeFirst();
+    }
+    return Done;
+}
+
+BodyProducer::Status FileTransfer::send_file(Part &part)
+{
+#ifdef Q_OS_LINUX
+    while (part.remaining > 0) {
+        off_t offset = part.offset;
+        ssize_t sent = sendfile(m_socket, m_file, &offset, (size_t)qMin(part.remaining, (qint64)TRANSFER_CHUNK));
+        if (sent > 0) {
+            part.offset = offset;
+            part.remaining -= sent;
+            continue;
+        }
+        if (sent == 0) {
+            /* The file was truncated under our feet */
+            Log::instance()->entry(Log::LogLevelCritical, "file shrank during transfer");
+            return Failed;
+        }
+        if (errno == EINTR)
+            continue;
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            return Blocked;
+        if ((errno == EINVAL) || (errno == ENOSYS)) {
+            Log::instance()->entry(Log::LogLevelNormal, "sendfile not supported, using splice");
+            m_splice = true;
+            return send_splice(part);
+        }
+        return Failed;
+    }
+    return Done;
+#else
+    Q_UNUSED(part);
+    return Failed;
+#endif
+}
+
+/*
+ * splice needs a pipe in the middle. Whatever did not make it into the socket
+ * stays in the pipe until the next call.
+ */
+BodyProducer::Status FileTransfer::send_splice(Part &part)
+{
+#ifdef Q_OS_LINUX
+    if (m_pipe[0] == -1) {
+        if (pipe2(m_pipe, O_NONBLOCK) == -1) {
+            Log::instance()->entry(Log::LogLevelCritical, "could not create pipe for splice");
+            return Failed;
+        }
+    }
+    while ((part.remaining > 0) || (m_piped > 0)) {
+        if (m_piped == 0) {
+            loff_t offset = part.offset;
+            ssize_t filled = splice(m_file, &offset, m_pipe[1], NULL, (size_t)qMin(part.remaining, (qint64)TRANSFER_CHUNK), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (filled == 0) {
+                Log::instance()->entry(Log::LogLevelCritical, "file shrank during transfer");
+                return Failed;
+            }
+            if (filled < 0) {
+                if (errno == EINTR)
+                    continue;
+                return Failed;
+            }
+            part.offset = offset;
+            part.remaining -= filled;
+            m_piped = filled;
+        }
+        ssize_t sent = splice(m_pipe[0], NULL, m_socket, NULL, (size_t)m_piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (sent > 0) {
+            m_piped -= sent;
+            continue;
+        }
+        if ((sent < 0) && (errno == EINTR))
+            continue;
+        if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            return Blocked;
+        return Failed;
+    }
+    return Done;
+#else
+    Q_UNUSED(part);
+    return Failed;
+#endif
+}
+
+/*
+ * The pieces between the regions, such as the part headers of a multipart
+ * reply. They are written straight to the socket like the file data, the
+ * socket buffer is empty by the time the transfer runs.
+ */
+BodyProducer::Status FileTransfer::send_data(Part &part)
+{
+#ifdef Q_OS_LINUX
+    while (part.remaining > 0) {
+        const char *data = part.data.constData() + (part.data.size() - part.remaining);
+        ssize_t sent = ::send(m_socket, data, (size_t)part.remaining, MSG_NOSIGNAL);
+        if (sent > 0) {
+            part.remaining -= sent;
+            continue;
+        }
+        if ((sent < 0) && (errno == EINTR))
+            continue;
+        if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            return Blocked;
+        return Failed;
+    }
+    return Done;
+#else
+    Q_UNUSED(part);
+    return Failed;
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef FILETRANSFER_H
+#define FILETRANSFER_H
+
+#include "bodyproducer.h"
+
+/*
+ * Sends a region of a file to a socket without copying it into our memory.
+ * On Linux we use sendfile(2) and fall back to splice(2) through a pipe if the
+ * file system does not support sendfile. Both descriptors are expected to be
+ * non blocking on the socket side, a transfer that would block is resumed by
+ * calling produce() again once the socket is writable.
+ * Memory parts are written straight to the descriptor as well. Nothing can be
+ * sent until whatever the socket has buffered is gone, otherwise the body
+ * would overtake the header.
+ */
+class FileTransfer : public BodyProducer
+{
+    int m_socket;
+    int m_pipe[2];
+    qint64 m_piped;
+    bool m_splice;
+
+    Status send_file(Part &part);
+    Status send_splice(Part &part);
+    Status send_data(Part &part);
+public:
+    FileTransfer(int socket);
+    ~FileTransfer();
+    static bool isSupported();
+    virtual Status produce(ClientConnection *socket);
+    virtual qint64 remaining() const { return BodyProducer::remaining() + m_piped; }
+};
+
+#endif // FILETRANSFER_H
@@ -1,7 +1,9 @@
 #include "folder.h"
 
 Folder::Folder(FolderType type) :
-    m_type(type)
+    m_type(type),
+    m_references(1),
+    m_metric(-1)
 {
 }
 
@@ -13,6 +13,10 @@ protected:
     FolderType m_type;
     QString m_name;
     QString m_handler;
+    /* Configurations that hold the folder, a reload carries unchanged folders over */
+    int m_references;
+    /* Where its numbers are in the metrics, set before the workers see the folder */
+    int m_metric;
 public:
     Folder(FolderType type);
     virtual ~Folder();
@@ -21,7 +25,14 @@ public:
     QString handler() const { return m_handler; }
     virtual void setHandler(const QString &handler) { m_handler = handler; }
     virtual bool load() { return false; }
+    /* Attributes of the declaration that only some types know, false if this one does not */
+    virtual bool setOption(const QString &name, const QString &value) { Q_UNUSED(name); Q_UNUSED(value); return false; }
     FolderType type() const { return m_type; }
+    int metric() const { return m_metric; }
+    void setMetric(int metric) { m_metric = metric; }
+    /* Only the thread that parses the configuration takes and drops references */
+    void acquire() { ++m_references; }
+    bool release() { return --m_references == 0; }
 };
 
 #endif // FOLDER_H
@@ -1,5 +0,0 @@
-#include "handler.h"
-
-Handler::Handler()
-{
-}
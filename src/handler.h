@@ -1,10 +1,36 @@
 #ifndef HANDLER_H
 #define HANDLER_H
 
+#include <QtCore/QString>
+#include <QtCore/QtPlugin>
+
+#include "handlerrequest.h"
+#include "responsesink.h"
+
+/*
+ * What the plugin behind an application folder implements. The handler
+ * attribute of the folder is the path of a Qt plugin whose instance
+ * implements this interface, it is loaded once when the configuration is
+ * parsed. The same handler serves all the workers at the same time, so
+ * handle() has to be thread safe.
+ * A plugin only needs QtCore and the headers of this interface, everything
+ * it calls on the server is virtual.
+ */
 class Handler
 {
 public:
-    Handler();
+    virtual ~Handler() {}
+    /* Called once after loading with the name of the folder, false skips the folder */
+    virtual bool initialize(const QString &folder) { Q_UNUSED(folder); return true; }
+    /* Handlers that block, on a database or a remote service, run on the threads of their folder */
+    virtual bool isBlocking() const { return false; }
+    /*
+     * Has to call response->finish() exactly once, before returning or later
+     * from any thread. The request is a copy, it can be kept until then.
+     */
+    virtual void handle(const HandlerRequest &request, ResponseSink *response) = 0;
 };
 
+Q_DECLARE_INTERFACE(Handler, "org.rainbow.Handler/1.0")
+
 #endif // HANDLER_H
@@ -0,0 +1,52 @@
+#ifndef HANDLERREQUEST_H
+#define HANDLERREQUEST_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+#include "requestparser.h"
+
+/*
+ * The request as a handler sees it. It holds its own copy of the header and
+ * of the parser, so it stays valid after the connection moved on, and the
+ * receive buffer of the request still goes back to its pool. Everything is
+ * inline, plugins do not link against the server.
+ */
+class HandlerRequest
+{
+    QByteArray m_header;
+    RequestParser m_parser;
+    QString m_path;
+
+    QByteArray view(const RequestParser::Span &span) const { return m_header.mid(span.offset, span.length); }
+public:
+    HandlerRequest(const QByteArray &buffer, const RequestParser &parser, const QString &path) :
+        m_header(buffer.left(parser.length())), m_parser(parser), m_path(path) {}
+    QByteArray method() const { return view(m_parser.method()); }
+    QByteArray target() const { return view(m_parser.target()); }
+    QByteArray version() const { return view(m_parser.version()); }
+    /* The path inside the folder, always starting with '/', without the query */
+    QString path() const { return m_path; }
+    QByteArray query() const
+    {
+        QByteArray target = view(m_parser.target());
+        int index = target.indexOf('?');
+        return (index == -1) ? QByteArray() : target.mid(index + 1);
+    }
+    int headerCount() const { return m_parser.headerCount(); }
+    QByteArray headerName(int i) const { return view(m_parser.header(i).name); }
+    QByteArray headerValue(int i) const { return view(m_parser.header(i).value); }
+    /* Names are compared without case, the first header with the name wins */
+    QByteArray header(const char *name) const
+    {
+        int length = qstrlen(name);
+        for (int i = 0; i < m_parser.headerCount(); ++i) {
+            const RequestParser::Span &span = m_parser.header(i).name;
+            if ((span.length == length) && (qstrnicmp(m_header.constData() + span.offset, name, length) == 0))
+                return view(m_parser.header(i).value);
+        }
+        return QByteArray();
+    }
+};
+
+#endif // HANDLERREQUEST_H
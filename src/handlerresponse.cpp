@@ -0,0 +1,116 @@
+#include <QtCore/QMutexLocker>
+
+#include "handlerresponse.h"
+
+/*
+ * One reference for the request, one for the handler.
+ */
+HandlerResponse::HandlerResponse(Request *request) :
+    m_request(request),
+    m_references(2),
+    m_finished(false),
+    m_notify(false),
+    m_status(200)
+{
+}
+
+void HandlerResponse::setStatus(int code)
+{
+    m_status = code;
+}
+
+/*
+ * The framing of the reply is ours, the handler does not know about keep alive or ranges.
+ */
+void HandlerResponse::addHeader(const QByteArray &name, const QByteArray &value)
+{
+    if ((qstricmp(name.constData(), "content-length") == 0) || (qstricmp(name.constData(), "connection") == 0)
+            || (qstricmp(name.constData(), "transfer-encoding") == 0))
+        return;
+    m_headers.append(name);
+    m_headers.append(": ");
+    m_headers.append(value);
+    m_headers.append("\r\n");
+}
+
+void HandlerResponse::write(const QByteArray &data)
+{
+    m_body.append(data);
+}
+
+/*
+ * Might be called from any thread. The lock also makes whatever the handler
+ * wrote visible to the worker that reads it afterwards.
+ */
+void HandlerResponse::finish()
+{
+    {
+        QMutexLocker locker(&m_lock);
+        m_finished = true;
+        if (m_notify && m_request) {
+            /* The notification holds the sink until the worker got it */
+            ++m_references;
+            emit finished();
+        }
+    }
+    release();
+}
+
+bool HandlerResponse::isFinished()
+{
+    QMutexLocker locker(&m_lock);
+    return m_finished;
+}
+
+/*
+ * Returns false if the handler already finished, then there is nothing to wait
+ * for. The connection is queued, the receiver hears about it in its own thread.
+ */
+bool HandlerResponse::notify(QObject *receiver, const char *member)
+{
+    QMutexLocker locker(&m_lock);
+    if (m_finished)
+        return false;
+    if (!m_notify) {
+        connect(this, SIGNAL(finished()), receiver, member, Qt::QueuedConnection);
+        m_notify = true;
+    }
+    return true;
+}
+
+/*
+ * NULL once the request took the reply or went away.
+ */
+Request *HandlerResponse::request()
+{
+    QMutexLocker locker(&m_lock);
+    return m_request;
+}
+
+/*
+ * Called by the request, which gives up its reference too.
+ */
+void HandlerResponse::detach()
+{
+    {
+        QMutexLocker locker(&m_lock);
+        m_request = NULL;
+    }
+    release();
+}
+
+/*
+ * The last one might be the handler on a thread of its own, the deletion
+ * happens in the thread the sink belongs to.
+ */
+void HandlerResponse::release()
+{
+    bool last;
+    {
+        QMutexLocker locker(&m_lock);
+        last = (--m_references == 0);
+    }
+    /* Outside the lock, the worker might delete it before we are done otherwise */
+    if (last)
+        deleteLater();
+}
@@ -0,0 +1,51 @@
+#ifndef HANDLERRESPONSE_H
+#define HANDLERRESPONSE_H
+
+#include <QtCore/QObject>
+#include <QtCore/QMutex>
+#include <QtCore/QByteArray>
+
+#include "responsesink.h"
+
+class Request;
+
+/*
+ * The sink a request hands to its handler. It belongs to the request and to
+ * the handler until finish(), and to a pending notification while one is on
+ * its way to the worker, it deletes itself when the last of them lets it go.
+ * The request lets it go when it took the reply or when the connection moved
+ * on without it, whichever comes first.
+ */
+class HandlerResponse : public QObject, public ResponseSink
+{
+    Q_OBJECT
+    QMutex m_lock;
+    Request *m_request;
+    int m_references;
+    bool m_finished;
+    bool m_notify;
+    int m_status;
+    QByteArray m_headers;
+    QByteArray m_body;
+signals:
+    /* Emitted by finish(), only once somebody asked to be notified */
+    void finished();
+public:
+    HandlerResponse(Request *request);
+    /* For the handler */
+    virtual void setStatus(int code);
+    virtual void addHeader(const QByteArray &name, const QByteArray &value);
+    virtual void write(const QByteArray &data);
+    virtual void finish();
+    /* For the server */
+    bool isFinished();
+    bool notify(QObject *receiver, const char *member);
+    Request *request();
+    void detach();
+    void release();
+    int status() const { return m_status; }
+    const QByteArray &headers() const { return m_headers; }
+    const QByteArray &body() const { return m_body; }
+};
+
+#endif // HANDLERRESPONSE_H
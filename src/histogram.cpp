@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "histogram.h"
+
+#define HISTOGRAM_SUBS (1 << HISTOGRAM_SUB_BITS)
+
+Histogram::Histogram()
+{
+    clear();
+}
+
+void Histogram::clear()
+{
+    memset(m_counts, 0, sizeof(m_counts));
+    m_count = 0;
+    m_sum = 0;
+}
+
+/*
+ * Values below the number of parts have a bucket each. For the others the
+ * highest bit gives the power of two and the bits that follow it the part.
+ */
+int Histogram::bucket(qint64 value)
+{
+    if (value < HISTOGRAM_SUBS)
+        return (value < 0) ? 0 : (int)value;
+    int power = 63 - __builtin_clzll((unsigned long long)value);
+    if (power > HISTOGRAM_POWERS)
+        return HISTOGRAM_BUCKETS - 1;
+    int part = (int)(value >> (power - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUBS - 1);
+    return ((power - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + part;
+}
+
+/*
+ * The first value that does not fall in the bucket.
+ */
+qint64 Histogram::upperBound(int bucket)
+{
+    if (bucket < HISTOGRAM_SUBS)
+        return bucket + 1;
+    int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    int part = bucket & (HISTOGRAM_SUBS - 1);
+    return (qint64)(HISTOGRAM_SUBS + part + 1) << shift;
+}
+
+void Histogram::record(qint64 value)
+{
+    ++m_counts[bucket(value)];
+    ++m_count;
+    m_sum += (quint64)qMax(value, (qint64)0);
+}
+
+void Histogram::merge(const Histogram &other)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        m_counts[i] += other.m_counts[i];
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+}
+
+quint64 Histogram::countBelow(qint64 limit) const
+{
+    quint64 count = 0;
+    int last = bucket(limit);
+    for (int i = 0; i < last; ++i)
+        count += m_counts[i];
+    return count;
+}
+
+qint64 Histogram::percentile(double fraction) const
+{
+    if (m_count == 0)
+        return 0;
+    quint64 wanted = (quint64)(fraction * m_count);
+    if (wanted >= m_count)
+        wanted = m_count - 1;
+    quint64 count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        count += m_counts[i];
+        if (count > wanted)
+            return upperBound(i);
+    }
+    return upperBound(HISTOGRAM_BUCKETS - 1);
+}
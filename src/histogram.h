@@ -0,0 +1,37 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <QtCore/QtGlobal>
+
+#define HISTOGRAM_SUB_BITS 2                                    /* 4 buckets per power of two, within 25% */
+#define HISTOGRAM_POWERS 32                                     /* Up to 2^33, in microseconds more than two hours */
+#define HISTOGRAM_BUCKETS (HISTOGRAM_POWERS << HISTOGRAM_SUB_BITS)
+
+/*
+ * Counts values in buckets that grow with the value, like HDR histograms do:
+ * every power of two is split in a few equal parts, so the error is the same
+ * for small and big values and the whole range fits in a fixed array.
+ * Recording is finding the bucket and an increment, there is no allocation.
+ * It has a single writer, readers from other threads might see it a moment late.
+ */
+class Histogram
+{
+    quint64 m_counts[HISTOGRAM_BUCKETS];
+    quint64 m_count;
+    quint64 m_sum;
+public:
+    Histogram();
+    void record(qint64 value);
+    void merge(const Histogram &other);
+    void clear();
+    quint64 count() const { return m_count; }
+    quint64 sum() const { return m_sum; }
+    /* How many values are below the limit, exact when the limit is a power of two */
+    quint64 countBelow(qint64 limit) const;
+    /* The upper bound of the bucket the given fraction of the values falls in */
+    qint64 percentile(double fraction) const;
+    static int bucket(qint64 value);
+    static qint64 upperBound(int bucket);
+};
+
+#endif // HISTOGRAM_H
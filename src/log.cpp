@@ -2,18 +2,37 @@
 
 #include <QtCore/QFile>
 #include <QtCore/QDateTime>
+#include <QtCore/QThread>
 #include <iostream>
 using namespace std;
 
+class LogWriter : public QThread
+{
+    Log *m_log;
+public:
+    LogWriter(Log *log) : m_log(log) {}
+protected:
+    void run() { m_log->run(); }
+};
+
 Log *Log::m_instance = NULL;
-Log::Log()
+Log::Log() :
+    m_level(LogLevelNormal),
+    m_overflow(Drop),
+    m_head(0),
+    m_tail(0),
+    m_dropped(0),
+    m_reportedDropped(0),
+    m_running(true)
 {
-    // Debug mode is hard coded for now
-    m_debug = true;
+    for (int i = 0; i < LOG_CAPACITY; ++i)
+        m_slots[i].sequence = i;
     // Will be created in our work directory
     m_log = new QFile("rainbow.log");
     if (!m_log->open(QIODevice::WriteOnly))
         cerr << "Emergency, could not create log file!";
+    m_writer = new LogWriter(this);
+    m_writer->start();
 }
 
 Log *Log::instance()
@@ -24,34 +43,142 @@ Log *Log::instance()
     return Log::m_instance;
 }
 
-void Log::entry(LogLevel level, const QString &message)
+void Log::entry(LogLevel level, const char *message)
 {
-    // Small optimization to avoid calling QDateTime
-    if ((level == LogLevelDebug) && (!m_debug))
+    // The level is checked before anything else, disabled entries cost a comparison
+    if (!isEnabled(level))
         return;
-    if (!m_log)
-    {
-        cerr << "Trying to write to a non opened file\n";
+    enqueue(level, QByteArray(message));
+}
+
+void Log::entry(LogLevel level, const QByteArray &message)
+{
+    if (!isEnabled(level))
+        return;
+    enqueue(level, message);
+}
+
+void Log::entry(LogLevel level, const QString &message)
+{
+    if (!isEnabled(level))
         return;
+    enqueue(level, message.toLatin1());
+}
+
+/*
+ * Bounded multi producer queue. Every slot carries a sequence number that tells
+ * whose turn it is: a producer may fill slot (position % capacity) when its sequence
+ * equals position, the writer may take it when it equals position + 1. Producers
+ * only compete for the head, they never wait for each other.
+ */
+bool Log::enqueue(LogLevel level, const QByteArray &message)
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    forever {
+        int position = load_relaxed(m_head);
+        Slot &slot = m_slots[position & (LOG_CAPACITY - 1)];
+        int difference = (int)((unsigned)load_acquire(slot.sequence) - (unsigned)position);
+        if (difference == 0) {
+            if (!m_head.testAndSetRelaxed(position, (int)((unsigned)position + 1)))
+                continue;
+            slot.level = level;
+            slot.time = now;
+            slot.message = message;
+            slot.sequence.fetchAndStoreRelease((int)((unsigned)position + 1));
+            if (((position + 1) & (LOG_BATCH - 1)) == 0)
+                m_wakeup.wakeOne();
+            return true;
+        }
+        if (difference < 0) {
+            /* The buffer is full */
+            if (load_relaxed(m_overflow) == Drop) {
+                m_dropped.fetchAndAddRelaxed(1);
+                return false;
+            }
+            m_wakeup.wakeOne();
+            QThread::yieldCurrentThread();
+        }
+        /* Somebody else took that slot, try the next one */
     }
-    QString currentTime = QDateTime::currentDateTime().toString(Qt::TextDate);
-    m_log->write(currentTime.toLatin1());
+}
+
+void Log::write(LogLevel level, qint64 time, const QByteArray &message, QByteArray &batch)
+{
+    QByteArray currentTime = QDateTime::fromMSecsSinceEpoch(time).toString(Qt::TextDate).toLatin1();
+    batch.append(currentTime);
     switch (level)
     {
     case LogLevelDebug:
-        m_log->write(QByteArray(" -- debug -- "));
+        batch.append(" -- debug -- ");
         break;
     case LogLevelNormal:
-        m_log->write(QByteArray(" -- normal -- "));
+        batch.append(" -- normal -- ");
         break;
     case LogLevelCritical:
-        m_log->write(QByteArray(" -- critical -- "));
-        cerr << currentTime.toStdString() << " " << message.toStdString() << "\n";
+        batch.append(" -- critical -- ");
+        cerr << currentTime.constData() << " " << message.constData() << "\n";
         break;
     default:
         return;
     }
-    m_log->write(message.toLatin1());
-    m_log->write(QByteArray("\n"));
-    m_log->flush();
+    batch.append(message);
+    batch.append("\n");
+}
+
+/*
+ * Runs in the writer thread. Everything that is ready is formatted into a
+ * single buffer and written at once.
+ */
+int Log::drain()
+{
+    QByteArray batch;
+    int written = 0;
+    forever {
+        Slot &slot = m_slots[m_tail & (LOG_CAPACITY - 1)];
+        int difference = (int)((unsigned)load_acquire(slot.sequence) - ((unsigned)m_tail + 1));
+        if (difference != 0)
+            break;
+        write(slot.level, slot.time, slot.message, batch);
+        slot.message.clear();
+        slot.sequence.fetchAndStoreRelease((int)((unsigned)m_tail + LOG_CAPACITY));
+        m_tail = (int)((unsigned)m_tail + 1);
+        ++written;
+    }
+    int dropped = load_relaxed(m_dropped);
+    if (dropped != m_reportedDropped) {
+        write(LogLevelCritical, QDateTime::currentMSecsSinceEpoch(),
+              QByteArray::number(dropped - m_reportedDropped) + " log entries dropped, the buffer was full", batch);
+        m_reportedDropped = dropped;
+    }
+    if (!batch.isEmpty() && m_log->isOpen()) {
+        m_log->write(batch);
+        m_log->flush();
+    }
+    return written;
+}
+
+void Log::run()
+{
+    forever {
+        m_lock.lock();
+        bool running = m_running;
+        if (running)
+            m_wakeup.wait(&m_lock, LOG_FLUSH_INTERVAL);
+        m_lock.unlock();
+        drain();
+        if (!running)
+            return;
+    }
+}
+
+/*
+ * Writes whatever is still queued and stops the writer.
+ */
+void Log::shutdown()
+{
+    m_lock.lock();
+    m_running = false;
+    m_wakeup.wakeOne();
+    m_lock.unlock();
+    m_writer->wait();
 }
@@ -3,22 +3,79 @@
 
 #include <QtCore/QFile>
 #include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
 
+#include "atomics.h"
+
+#define LOG_CAPACITY 8192       /* Entries waiting to be written, must be a power of two */
+#define LOG_BATCH 256           /* Wake up the writer every time this many entries are queued */
+#define LOG_FLUSH_INTERVAL 500  /* Otherwise it writes whatever there is every half a second */
+
+class LogWriter;
+
+/*
+ * Entries are queued in a bounded buffer and written by a background thread,
+ * so logging never touches the disk from the request path. The buffer can be
+ * filled from any number of threads without locks. What happens when it is full
+ * depends on the policy: entries are dropped and counted, or the caller waits
+ * for the writer.
+ */
 class Log
 {
-    Log();
-    bool m_debug;
-    QFile * m_log;
-    static Log *m_instance;
 public:
     enum LogLevel {
         LogLevelDebug,
         LogLevelNormal,
         LogLevelCritical
     };
+    enum OverflowPolicy {
+        Drop,
+        Block
+    };
+private:
+    struct Slot {
+        QAtomicInt sequence;
+        LogLevel level;
+        qint64 time;
+        QByteArray message;
+    };
+    Log();
+    QAtomicInt m_level;
+    /* An OverflowPolicy, a reload changes it while the workers log */
+    QAtomicInt m_overflow;
+    QFile * m_log;
+    Slot m_slots[LOG_CAPACITY];
+    /* Next slot to fill, shared by all the producers */
+    QAtomicInt m_head;
+    /* Next slot to write, only touched by the writer */
+    int m_tail;
+    QAtomicInt m_dropped;
+    int m_reportedDropped;
+    bool m_running;
+    QMutex m_lock;
+    QWaitCondition m_wakeup;
+    LogWriter *m_writer;
+    static Log *m_instance;
 
+    bool enqueue(LogLevel level, const QByteArray &message);
+    int drain();
+    void write(LogLevel level, qint64 time, const QByteArray &message, QByteArray &batch);
+    void run();
+    friend class LogWriter;
+public:
     static Log *instance();
+    /* Cheap enough to call before building an expensive message */
+    bool isEnabled(LogLevel level) const { return (int)level >= load_relaxed(m_level); }
+    void setLevel(LogLevel level) { m_level.fetchAndStoreOrdered((int)level); }
+    void setOverflowPolicy(OverflowPolicy policy) { m_overflow.fetchAndStoreOrdered((int)policy); }
+    int dropped() const { return load_relaxed(m_dropped); }
+    void entry(LogLevel level, const char *message);
+    void entry(LogLevel level, const QByteArray &message);
     void entry(LogLevel level, const QString &message);
+    void shutdown();
 };
 
 #endif // LOG_H
@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "server.h"
+#include "log.h"
 
 const char *optstring = "c:h";
 void usage()
@@ -39,5 +40,7 @@ int main(int argc, char *argv[])
     if (server->start()) {
         app->exec();
     }
+    /* Whatever is still queued gets written before leaving */
+    Log::instance()->shutdown();
     return 0;
 }
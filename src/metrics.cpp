@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "admission.h"
+#include "log.h"
+#include "responseheader.h"
+
+/* Indexed by Stage and by Expiry */
+static const char *stage_names[Metrics::StageCount] = {
+    "incomming"
+    , "pending"
+    , "inprogress"
+    , "outgoing"
+    , "waiting"
+};
+static const char *expiry_names[Metrics::ExpiryCount] = {
+    "header"
+    , "idle"
+    , "write"
+};
+/* Exported bucket limits are powers of two microseconds, from 16us to about a minute */
+#define METRICS_FIRST_POWER 4
+#define METRICS_LAST_POWER 26
+
+Metrics *Metrics::m_instance = NULL;
+
+Metrics::Shard::Shard(int folders) :
+    connections(0),
+    requests(0),
+    poolCreated(0),
+    bufferAllocations(0),
+    bufferReuses(0),
+    folders(folders)
+{
+    memset(depth, 0, sizeof(depth));
+    memset(expired, 0, sizeof(expired));
+}
+
+Metrics::Metrics()
+{
+}
+
+Metrics *Metrics::instance()
+{
+    if (!Metrics::m_instance) {
+        Metrics::m_instance = new Metrics();
+    }
+    return Metrics::m_instance;
+}
+
+qint64 Metrics::now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (qint64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Called by the server for the folders of every configuration, before the
+ * workers get it. A folder keeps its index across reloads.
+ */
+int Metrics::addFolder(const QString &folder)
+{
+    QMutexLocker locker(&m_lock);
+    QHash<QString, int>::const_iterator i = m_folderIndex.constFind(folder);
+    if (i != m_folderIndex.constEnd())
+        return i.value();
+    m_folders.append(folder);
+    m_folderIndex.insert(folder, m_folders.count() - 1);
+    return m_folders.count() - 1;
+}
+
+/*
+ * Called once by every worker, from its own thread.
+ */
+Metrics::Shard *Metrics::createShard()
+{
+    QMutexLocker locker(&m_lock);
+    Shard *shard = new Shard(m_folders.count());
+    m_shards.append(shard);
+    return shard;
+}
+
+/*
+ * Called by the worker of the shard, only when a reload added a folder.
+ */
+void Metrics::growShard(Shard *shard)
+{
+    QMutexLocker locker(&m_lock);
+    shard->folders.resize(m_folders.count());
+}
+
+static void append_number(QByteArray &out, double value)
+{
+    char number[32];
+    int length = snprintf(number, sizeof(number), "%.6g", value);
+    out.append(number, length);
+}
+
+static void append_sample(QByteArray &out, const char *name, const QByteArray &labels, quint64 value)
+{
+    out.append(name);
+    if (!labels.isEmpty()) {
+        out.append('{');
+        out.append(labels);
+        out.append('}');
+    }
+    out.append(' ');
+    ResponseHeader::appendNumber(out, (qint64)value);
+    out.append('\n');
+}
+
+static void append_type(QByteArray &out, const char *name, const char *type, const char *help)
+{
+    out.append("# HELP ");
+    out.append(name);
+    out.append(' ');
+    out.append(help);
+    out.append("\n# TYPE ");
+    out.append(name);
+    out.append(' ');
+    out.append(type);
+    out.append('\n');
+}
+
+/*
+ * The labels go before le, the values are in seconds.
+ */
+void Metrics::append_histogram(QByteArray &out, const char *name, const QByteArray &labels, const Histogram &histogram)
+{
+    QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+    for (int power = METRICS_FIRST_POWER; power <= METRICS_LAST_POWER; ++power) {
+        out.append(name);
+        out.append("_bucket{");
+        out.append(prefix);
+        out.append("le=\"");
+        append_number(out, (double)((qint64)1 << power) / 1000000.0);
+        out.append("\"} ");
+        ResponseHeader::appendNumber(out, (qint64)histogram.countBelow((qint64)1 << power));
+        out.append('\n');
+    }
+    out.append(name);
+    out.append("_bucket{");
+    out.append(prefix);
+    out.append("le=\"+Inf\"} ");
+    ResponseHeader::appendNumber(out, (qint64)histogram.count());
+    out.append('\n');
+    out.append(name);
+    out.append("_sum");
+    if (!labels.isEmpty())
+        out.append('{' + labels + '}');
+    out.append(' ');
+    append_number(out, (double)histogram.sum() / 1000000.0);
+    out.append('\n');
+    out.append(name);
+    out.append("_count");
+    if (!labels.isEmpty())
+        out.append('{' + labels + '}');
+    out.append(' ');
+    ResponseHeader::appendNumber(out, (qint64)histogram.count());
+    out.append('\n');
+}
+
+/*
+ * Counters and histograms are summed over the workers, the gauges are given
+ * for every worker.
+ */
+void Metrics::render(QByteArray &out, Admission *admission)
+{
+    m_lock.lock();
+    QList<Shard *> shards = m_shards;
+    QStringList names = m_folders;
+
+    Histogram stages[StageCount];
+    QVector<FolderStats> folders(names.count());
+    quint64 requests = 0;
+    quint64 expired[ExpiryCount];
+    memset(expired, 0, sizeof(expired));
+    foreach (Shard *shard, shards) {
+        requests += shard->requests;
+        for (int i = 0; i < StageCount; ++i)
+            stages[i].merge(shard->stages[i]);
+        for (int i = 0; i < ExpiryCount; ++i)
+            expired[i] += shard->expired[i];
+        /* A worker that did not serve a new folder yet has no room for it */
+        for (int i = 0; i < shard->folders.count(); ++i) {
+            folders[i].requests += shard->folders.at(i).requests;
+            folders[i].bytes += shard->folders.at(i).bytes;
+            folders[i].latency.merge(shard->folders.at(i).latency);
+        }
+    }
+    m_lock.unlock();
+
+    append_type(out, "rainbow_requests_total", "counter", "Requests replied.");
+    append_sample(out, "rainbow_requests_total", QByteArray(), requests);
+    append_type(out, "rainbow_expired_total", "counter", "Connections that missed a deadline.");
+    for (int i = 0; i < ExpiryCount; ++i)
+        append_sample(out, "rainbow_expired_total", QByteArray("deadline=\"") + expiry_names[i] + '"', expired[i]);
+    append_type(out, "rainbow_stage_seconds", "histogram", "Time requests spent in each stage.");
+    for (int i = 0; i < StageCount; ++i)
+        append_histogram(out, "rainbow_stage_seconds", QByteArray("stage=\"") + stage_names[i] + '"', stages[i]);
+
+    append_type(out, "rainbow_folder_requests_total", "counter", "Requests replied by each folder.");
+    for (int i = 0; i < folders.count(); ++i)
+        append_sample(out, "rainbow_folder_requests_total", "folder=\"" + names.at(i).toUtf8() + '"', folders.at(i).requests);
+    append_type(out, "rainbow_folder_bytes_total", "counter", "Bytes of the replies of each folder.");
+    for (int i = 0; i < folders.count(); ++i)
+        append_sample(out, "rainbow_folder_bytes_total", "folder=\"" + names.at(i).toUtf8() + '"', folders.at(i).bytes);
+    append_type(out, "rainbow_folder_seconds", "histogram", "Time each folder took to produce its replies.");
+    for (int i = 0; i < folders.count(); ++i)
+        append_histogram(out, "rainbow_folder_seconds", "folder=\"" + names.at(i).toUtf8() + '"', folders.at(i).latency);
+
+    append_type(out, "rainbow_queue_depth", "gauge", "Requests in each stage queue, as of the last pulse.");
+    for (int worker = 0; worker < shards.count(); ++worker) {
+        QByteArray labels = "worker=\"" + QByteArray::number(worker) + "\",stage=\"";
+        for (int i = 0; i < StageCount; ++i)
+            append_sample(out, "rainbow_queue_depth", labels + stage_names[i] + '"', (quint64)shards.at(worker)->depth[i]);
+    }
+    append_type(out, "rainbow_worker_connections", "gauge", "Connections held by each worker, as of the last pulse.");
+    for (int worker = 0; worker < shards.count(); ++worker)
+        append_sample(out, "rainbow_worker_connections", "worker=\"" + QByteArray::number(worker) + '"', (quint64)shards.at(worker)->connections);
+    append_type(out, "rainbow_pool_requests_created_total", "counter", "Requests the pools had to create.");
+    for (int worker = 0; worker < shards.count(); ++worker)
+        append_sample(out, "rainbow_pool_requests_created_total", "worker=\"" + QByteArray::number(worker) + '"', shards.at(worker)->poolCreated);
+    append_type(out, "rainbow_pool_buffer_allocations_total", "counter", "Buffers the pools had to allocate.");
+    for (int worker = 0; worker < shards.count(); ++worker)
+        append_sample(out, "rainbow_pool_buffer_allocations_total", "worker=\"" + QByteArray::number(worker) + '"', shards.at(worker)->bufferAllocations);
+    append_type(out, "rainbow_pool_buffer_reuses_total", "counter", "Buffers that came from the pools.");
+    for (int worker = 0; worker < shards.count(); ++worker)
+        append_sample(out, "rainbow_pool_buffer_reuses_total", "worker=\"" + QByteArray::number(worker) + '"', shards.at(worker)->bufferReuses);
+
+    if (admission) {
+        append_type(out, "rainbow_connections", "gauge", "Open connections.");
+        append_sample(out, "rainbow_connections", QByteArray(), (quint64)admission->connections());
+        append_type(out, "rainbow_accepted_total", "counter", "Connections admitted.");
+        append_sample(out, "rainbow_accepted_total", QByteArray(), (quint64)admission->accepted());
+        append_type(out, "rainbow_rejected_total", "counter", "Connections refused for going over maxconnections.");
+        append_sample(out, "rainbow_rejected_total", QByteArray(), (quint64)admission->rejected());
+        append_type(out, "rainbow_shed_total", "counter", "Connections refused for going over maxqueue.");
+        append_sample(out, "rainbow_shed_total", QByteArray(), (quint64)admission->shed());
+        append_type(out, "rainbow_accept_pauses_total", "counter", "Times accepting was paused.");
+        append_sample(out, "rainbow_accept_pauses_total", QByteArray(), (quint64)admission->pauses());
+    }
+    append_type(out, "rainbow_log_dropped_total", "counter", "Log entries dropped because the buffer was full.");
+    append_sample(out, "rainbow_log_dropped_total", QByteArray(), (quint64)Log::instance()->dropped());
+}
@@ -0,0 +1,85 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include "histogram.h"
+
+class Admission;
+
+/*
+ * What the server counts about itself, served in the Prometheus text format.
+ * Every worker writes to a shard of its own, so nothing is shared on the
+ * request path: no locks, no atomics, no cache lines bouncing between cores.
+ * The shards are only put together when somebody asks for the numbers, what
+ * is read from the other threads might be a moment old.
+ */
+class Metrics
+{
+public:
+    /* The queues of the pulse scheduler, event driven mode uses the same names */
+    enum Stage {
+        StageIncomming
+        , StagePending
+        , StageInProgress
+        , StageOutgoing
+        , StageWaiting
+        , StageCount
+    };
+    enum Expiry {
+        ExpiredHeader
+        , ExpiredIdle
+        , ExpiredWrite
+        , ExpiryCount
+    };
+    struct FolderStats {
+        quint64 requests;
+        quint64 bytes;
+        /* Time it took the folder to produce the reply */
+        Histogram latency;
+        FolderStats() : requests(0), bytes(0) {}
+    };
+    struct Shard {
+        /* Time spent in each stage, in microseconds */
+        Histogram stages[StageCount];
+        int depth[StageCount];
+        int connections;
+        quint64 requests;
+        quint64 expired[ExpiryCount];
+        quint64 poolCreated;
+        quint64 bufferAllocations;
+        quint64 bufferReuses;
+        /* Indexed like the folder names, it only grows, under the lock */
+        QVector<FolderStats> folders;
+        Shard(int folders);
+    };
+private:
+    Metrics();
+    /* Also held while the shards are summed, a shard only grows with it held */
+    QMutex m_lock;
+    QList<Shard *> m_shards;
+    /* Folders of every configuration so far, a folder that goes keeps its numbers */
+    QStringList m_folders;
+    QHash<QString, int> m_folderIndex;
+    static Metrics *m_instance;
+
+    static void append_histogram(QByteArray &out, const char *name, const QByteArray &labels, const Histogram &histogram);
+public:
+    static Metrics *instance();
+    /* Monotonic clock in microseconds */
+    static qint64 now();
+    /* The index of the folder, it gets one the first time */
+    int addFolder(const QString &folder);
+    Shard *createShard();
+    /* Room for the folders added since the shard was created or grew */
+    void growShard(Shard *shard);
+    void render(QByteArray &out, Admission *admission);
+};
+
+#endif // METRICS_H
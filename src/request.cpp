@@ -1,35 +1,128 @@
 #include <QtCore/QFile>
-#include <QtCore/QTextStream>
+#include <QtCore/QFileInfo>
+#include <QtCore/QAtomicInt>
 #include <QDebug>
+#include <sys/stat.h>
 
 #include "request.h"
 #include "log.h"
+#include "responseheader.h"
+#include "filetransfer.h"
+#include "filereader.h"
+#include "metrics.h"
 
-Request::Request(QTcpSocket *s, qint64 started)
+static const QByteArray http_10("HTTP/1.0");
+static const QByteArray http_11("HTTP/1.1");
+
+/*
+ * A persistent connection carries a sequence of requests, each one of them
+ * starts with whatever the previous one did not consume from the wire.
+ */
+Request::Request(QTcpSocket *s, qint64 started, bool persistent, int sequence, const QByteArray &pending) :
+    m_timer(this)
+{
+    m_body = NULL;
+    m_response = NULL;
+    m_upstream = NULL;
+    reset(s, started, persistent, sequence, pending);
+}
+
+/*
+ * Requests that come from a pool are set up with reset().
+ */
+Request::Request() :
+    m_timer(this)
+{
+    m_body = NULL;
+    m_response = NULL;
+    m_upstream = NULL;
+    reset((ClientConnection *)NULL, 0);
+}
+
+/*
+ * The socket belongs to the worker, it outlives the requests of a persistent connection.
+ */
+Request::~Request()
+{
+    delete m_body;
+    if (m_response)
+        m_response->detach();
+    if (m_upstream)
+        m_upstream->detach();
+}
+
+void Request::reset(QTcpSocket *s, qint64 started, bool persistent, int sequence, const QByteArray &pending)
 {
-    m_socket = s;
-    m_buffer.clear();
-    m_target.clear();
-    m_version.clear();
+    reset(s ? &m_socket : NULL, started, persistent, sequence, pending);
+    m_socket.setSocket(s);
+}
+
+/*
+ * Forget the previous request, keeping the memory of the buffers and the parser.
+ */
+void Request::reset(ClientConnection *connection, qint64 started, bool persistent, int sequence, const QByteArray &pending)
+{
+    m_connection = connection;
+    m_socket.setSocket(NULL);
+    m_buffer.resize(0);
+    m_buffer.append(pending);
+    m_output.resize(0);
+    m_shared = 0;
+    m_parser.reset(0);
+    m_route = Route();
+    m_entry = WebFolder::Entry();
+    m_hasEntry = false;
+    m_version = http_10;
     m_valid = false;
     m_replied = false;
     m_expired = false;
+    m_persistent = persistent;
+    m_keepAlive = false;
+    m_sequence = sequence;
     m_started = started;
+    m_vary = false;
+    delete m_body;
+    m_body = NULL;
+    m_blocked = false;
+    m_upgrade = false;
+    m_deflate = false;
+    m_configuration = NULL;
+    m_timer.cancel();
+    m_stamp = 0;
+    /* A handler that is still running finishes into the void */
+    if (m_response) {
+        m_response->detach();
+        m_response = NULL;
+    }
+    if (m_upstream) {
+        m_upstream->detach();
+        m_upstream = NULL;
+    }
 }
 
-Request::~Request()
+/*
+ * Has to be followed by reset(), which empties them.
+ */
+void Request::setBuffers(const QByteArray &input, const QByteArray &output)
 {
-    delete m_socket;
+    m_buffer = input;
+    m_output = output;
 }
 
-bool Request::isExpired(qint64 now)
+void Request::takeBuffers(QByteArray &input, QByteArray &output)
 {
-    qint64 elapsed = now - m_started;
-    if (elapsed > REQUEST_TIMEOUT)
-        m_expired = true;
-    return m_expired;
+    input = m_buffer;
+    output = m_output;
+    m_buffer = QByteArray();
+    m_output = QByteArray();
 }
 
+/*
+ * Returns true once the whole header is in the buffer, or once it is clear that
+ * it will never be valid. Pipelined requests might already be complete without
+ * reading anything from the socket. The parser continues where it stopped, so
+ * the bytes we already looked at are not looked at again.
+ */
 bool Request::fetch()
 {
     Log *log = Log::instance();
@@ -37,23 +130,181 @@ bool Request::fetch()
         log->entry(Log::LogLevelDebug, "ignoring expired request");
         return true;
     }
-    if (m_socket->atEnd())
+    m_connection->receive(m_buffer);
+    if (m_buffer.isEmpty())
         return false;
-    if (!m_socket->canReadLine())
+    if (m_parser.parse(m_buffer) == RequestParser::Incomplete)
         return false;
-    m_buffer.append(m_socket->readAll());
     log->entry(Log::LogLevelDebug, "done fetching bytes");
     return true;
 }
 
+QByteArray Request::remainder() const
+{
+    int length = m_parser.length();
+    if ((length == -1) || (length >= m_buffer.size()))
+        return QByteArray();
+    return m_buffer.mid(length);
+}
+
 /*
- * This is not a complete parser. It does not even deserve the name parser,
- * but it gets the job done.
- * The real solution would be to use yacc and write a proper parser for this.
+ * A token in a comma separated header value, such as "keep-alive, Upgrade".
+ */
+static bool has_token(const QByteArray &value, const char *token)
+{
+    int length = qstrlen(token);
+    int start = 0;
+    while (start < value.size()) {
+        int end = value.indexOf(',', start);
+        if (end == -1)
+            end = value.size();
+        int first = start;
+        int last = end;
+        while ((first < last) && ((value.at(first) == ' ') || (value.at(first) == '\t')))
+            ++first;
+        while ((last > first) && ((value.at(last - 1) == ' ') || (value.at(last - 1) == '\t')))
+            --last;
+        if ((last - first == length) && (qstrnicmp(value.constData() + first, token, length) == 0))
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+/*
+ * If-None-Match carries a list of entity tags, or "*". For GET and HEAD the
+ * comparison is weak, "W/" prefixes are ignored on both sides.
+ */
+static bool match_etag(const QByteArray &value, const QByteArray &etag)
+{
+    QByteArray strong = etag.startsWith("W/") ? etag.mid(2) : etag;
+    int start = 0;
+    while (start < value.size()) {
+        int end = value.indexOf(',', start);
+        if (end == -1)
+            end = value.size();
+        QByteArray candidate = value.mid(start, end - start).trimmed();
+        if (candidate == "*")
+            return true;
+        if (candidate.startsWith("W/"))
+            candidate.remove(0, 2);
+        if (candidate == strong)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+/*
+ * An inclusive range of bytes, already clamped to the file.
+ */
+struct ByteRange {
+    qint64 first;
+    qint64 last;
+};
+
+/*
+ * "bytes=0-99, 200-, -50". Returns how many of the ranges can be satisfied,
+ * 0 if none of them, -1 if the header has to be ignored because it uses
+ * another unit, it is malformed or it asks for too many ranges.
+ */
+static int parse_ranges(const QByteArray &value, qint64 size, QList<ByteRange> &ranges)
+{
+    if (!value.startsWith("bytes="))
+        return -1;
+    QList<QByteArray> specs = value.mid(6).split(',');
+    if (specs.size() > REQUEST_MAX_RANGES)
+        return -1;
+    foreach (QByteArray spec, specs) {
+        spec = spec.trimmed();
+        int dash = spec.indexOf('-');
+        if (dash == -1)
+            return -1;
+        bool ok;
+        ByteRange range;
+        if (dash == 0) {
+            /* The last bytes of the file */
+            qint64 suffix = spec.mid(1).toLongLong(&ok);
+            if (!ok || (suffix < 0))
+                return -1;
+            if ((suffix == 0) || (size == 0))
+                continue;
+            range.first = qMax(size - suffix, (qint64)0);
+            range.last = size - 1;
+        } else {
+            range.first = spec.left(dash).toLongLong(&ok);
+            if (!ok || (range.first < 0))
+                return -1;
+            if (dash == spec.size() - 1) {
+                range.last = size - 1;
+            } else {
+                range.last = spec.mid(dash + 1).toLongLong(&ok);
+                if (!ok || (range.last < range.first))
+                    return -1;
+            }
+            if (range.first >= size)
+                continue;
+            if (range.last >= size)
+                range.last = size - 1;
+        }
+        ranges.append(range);
+    }
+    return ranges.size();
+}
+
+/*
+ * If-Range only lets the range through if the client has the same file we
+ * have. Entity tags are compared strongly, dates have to be exactly ours.
+ */
+static bool if_range_matches(const QByteArray &value, const WebFolder::Entry &entry)
+{
+    if (value.startsWith('"') || value.startsWith("W/"))
+        return value == entry.etag;
+    time_t date;
+    return ResponseHeader::parseDate(value, date) && (date == entry.mtime);
+}
+
+/*
+ * Whether Accept-Encoding lets us use a content coding. "gzip;q=0" refuses
+ * it, "*" stands for anything that is not listed.
+ */
+static bool accepts_coding(const QByteArray &value, const char *coding)
+{
+    bool any = false;
+    foreach (const QByteArray &item, value.split(',')) {
+        QByteArray name = item;
+        double quality = 1;
+        int semicolon = item.indexOf(';');
+        if (semicolon != -1) {
+            name = item.left(semicolon);
+            QByteArray parameter = item.mid(semicolon + 1).trimmed().toLower();
+            if (parameter.startsWith("q="))
+                quality = parameter.mid(2).toDouble();
+        }
+        name = name.trimmed().toLower();
+        if (name == coding)
+            return quality > 0;
+        if (name == "*")
+            any = quality > 0;
+    }
+    return any;
+}
+
+static QByteArray content_range(const ByteRange &range, qint64 size)
+{
+    return "Content-Range: bytes " + QByteArray::number(range.first) + '-'
+            + QByteArray::number(range.last) + '/' + QByteArray::number(size) + "\r\n";
+}
+
+/*
+ * The actual parsing is done by the parser while fetching, here we only
+ * look at the result.
  * The HTTP request consists of several parts, the first one is the first line,
  * which consists of the command, the requested resource and the HTTP version.
- * After that there is a list of attributes, for now we will ignore them.
- * The list of attributes is where it is specified if we want to switch to WebSocket.
+ * After that there is a list of attributes, here we only look at Connection,
+ * the conditional ones are looked at when replying.
+ * The list of attributes is where it is specified if we want to switch to WebSocket,
+ * the handshake itself is only looked at when replying, by reply_websocket().
  */
 bool Request::parse()
 {
@@ -62,42 +313,67 @@ bool Request::parse()
         log->entry(Log::LogLevelDebug, "ignoring expired request");
         return true;
     }
-    if (m_buffer.isEmpty()) {
-        log->entry(Log::LogLevelCritical, "empty request");
+    RequestParser::Status status = m_parser.status();
+    if (status == RequestParser::Incomplete) {
+        log->entry(Log::LogLevelDebug, "incomplete request");
         return false;
     }
-    QRegExp first("^(GET|HEAD)\\s+(\\S+)\\s+(HTTP/1.[01])");
-    int position = first.indexIn(m_buffer);
-    if (position == -1)
-    {
+    if (status != RequestParser::Complete) {
         log->entry(Log::LogLevelNormal, "invalid request");
         m_valid = false;
         return true;
     }
     log->entry(Log::LogLevelDebug, "valid request");
-    if (first.cap(1) == "GET") {
+    if (RequestParser::equals(m_buffer, m_parser.method(), "GET")) {
         log->entry(Log::LogLevelDebug, "GET");
         m_command = GET;
-    } else {
+    } else if (RequestParser::equals(m_buffer, m_parser.method(), "HEAD")) {
         log->entry(Log::LogLevelDebug, "HEAD");
         m_command = HEAD;
+    } else {
+        log->entry(Log::LogLevelDebug, "other method");
+        m_command = UNSUPPORTED;
     }
-    m_target.append(first.cap(2));
-    m_version.append(first.cap(3));
-    log->entry(Log::LogLevelDebug, m_target);
-    log->entry(Log::LogLevelDebug, m_version);
+    /* The parser only lets these two versions through */
+    if (RequestParser::equals(m_buffer, m_parser.version(), "HTTP/1.1"))
+        m_version = http_11;
+    else
+        m_version = http_10;
     m_valid = true;
+    /*
+     * HTTP/1.1 connections are persistent unless the client says otherwise,
+     * HTTP/1.0 connections only if the client asks for it.
+     */
+    RequestParser::Span span;
+    QByteArray connection;
+    if (m_parser.find(m_buffer, "connection", span))
+        connection = RequestParser::view(m_buffer, span);
+    if (m_version == "HTTP/1.1")
+        m_keepAlive = m_persistent && !has_token(connection, "close");
+    else
+        m_keepAlive = m_persistent && has_token(connection, "keep-alive");
+    /*
+     * We do not read request bodies, whatever follows the header could not be told apart from the next request.
+     * Reverse proxies pass them on, but the connection still ends with them.
+     */
+    if (m_parser.find(m_buffer, "content-length", span) || m_parser.find(m_buffer, "transfer-encoding", span))
+        m_keepAlive = false;
     return true;
 }
 
-void Request::reply(Configuration *configuration)
+void Request::reply(const Configuration *configuration)
 {
+    m_replied = true;
+    m_configuration = configuration;
     if (m_expired) {
         reply_expired();
         return;
     }
     if (!m_valid) {
-        reply_invalid();
+        if (m_parser.status() == RequestParser::TooLarge)
+            reply_too_large();
+        else
+            reply_invalid();
         return;
     }
     switch (m_command) {
@@ -107,33 +383,100 @@ void Request::reply(Configuration *configuration)
     case HEAD:
         reply_head(configuration);
         break;
+    case UNSUPPORTED:
+        reply_other(configuration);
+        break;
     default:
         reply_invalid();
         break;
     }
 }
 
+/*
+ * Besides telling if everything was written, this pushes the next piece of
+ * a streamed body. It is called again whenever the socket wrote something.
+ * If the socket descriptor cannot take more data, isBlocked() is true until
+ * it is writable again.
+ */
 bool Request::isReady()
 {
-    if (m_socket->bytesToWrite() > 0)
-        return false;
+    m_blocked = false;
+    if (m_response) {
+        if (!m_response->isFinished())
+            return false;
+        complete();
+    }
+    if (m_upstream) {
+        m_upstream->pullBody();
+        BodyProducer::Status status = m_upstream->produce(m_connection);
+        if (status == BodyProducer::Pending)
+            return false;
+        if (status == BodyProducer::Failed) {
+            Log::instance()->entry(Log::LogLevelCritical, "backend failed in the middle of the reply, aborting connection");
+            m_connection->abort();
+        }
+        /* The backend might have sent a body that only ends with the connection */
+        m_keepAlive = m_keepAlive && m_upstream->keepAlive();
+        m_upstream->detach();
+        m_upstream = NULL;
+    }
+    if (m_body) {
+        BodyProducer::Status status = m_body->produce(m_connection);
+        if (status == BodyProducer::Pending)
+            return false;
+        if (status == BodyProducer::Blocked) {
+            m_blocked = true;
+            return false;
+        }
+        if (status == BodyProducer::Failed) {
+            /* We already promised a length, the only honest thing left is to drop the connection */
+            Log::instance()->entry(Log::LogLevelCritical, "file transfer failed, aborting connection");
+            m_connection->abort();
+        }
+        delete m_body;
+        m_body = NULL;
+    }
+    if (m_connection->bytesToWrite() > 0) {
+        m_connection->flush();
+        if (m_connection->bytesToWrite() > 0)
+            return false;
+    }
     return true;
 }
 
-void Request::close()
+/*
+ * The client sent more of the body of a request that went to a backend.
+ */
+void Request::transfer()
 {
-    if (m_socket) {
-        m_socket->disconnectFromHost();
-    }
+    if (m_upstream)
+        m_upstream->pullBody();
+}
+
+/*
+ * Returns false if there is nothing to wait for, either the reply is not
+ * deferred or the handler finished already.
+ */
+bool Request::notify(QObject *receiver, const char *member)
+{
+    if (m_upstream)
+        return m_upstream->notify(receiver, member);
+    return m_response && m_response->notify(receiver, member);
+}
+
+/*
+ * What the reply puts on the wire, header and body. Only meaningful once replied.
+ */
+qint64 Request::replySize() const
+{
+    return m_output.size() + m_shared + (m_body ? m_body->remaining() : 0);
 }
 
-QByteArray Request::generate_date()
+void Request::close()
 {
-    QByteArray date;
-    QTextStream stream(&date, QIODevice::ReadWrite);
-    QDateTime now = QDateTime::currentDateTimeUtc();
-    stream << "Date: " << now.toString("ddd, dd MMM yyyy hh:mm:ss") << " GMT\n";
-    return date;
+    if (m_connection) {
+        m_connection->close();
+    }
 }
 
 void Request::reply_expired()
@@ -146,15 +489,14 @@ void Request::reply_expired()
     Log *log = Log::instance();
     // We could this more elegantly, but it is a simple reply
     log->entry(Log::LogLevelCritical, "timed out request");
+    m_keepAlive = false;
     if (m_version == "HTTP/1.1") {
-        m_socket->write("HTTP/1.1 408 Request Timeout\n", strlen("HTTP/1.1 408 Request Timeout\n"));
-        m_socket->write(generate_date());
-        m_socket->write("Server: rainbow/1.0\n\n");
+        ResponseHeader header(m_output, m_version, ResponseHeader::RequestTimeout, false);
+        m_connection->write(header.finish());
     } else {
         /* Even if the version does not match, we use HTTP/1.0 to be on the safe side */
-        m_socket->write("HTTP/1.0 400 Bad request\n", strlen("HTTP/1.0 400 Bad request\n"));
-        m_socket->write(generate_date());
-        m_socket->write("Server: rainbow/1.0\n\n");
+        ResponseHeader header(m_output, QByteArray(), ResponseHeader::BadRequest, false);
+        m_connection->write(header.finish());
     }
 }
 
@@ -164,56 +506,573 @@ void Request::reply_invalid()
     // We could this more elegantly, but it is a simple reply
     log->entry(Log::LogLevelCritical, "400 malformed request");
     /* We assume HTTP/1.0 since the request could be invalid because of an invalid protocol */
-    m_socket->write("HTTP/1.0 400 Bad request\n", strlen("HTTP/1.0 400 Bad request\n"));
-    m_socket->write(generate_date());
-    m_socket->write("Server: rainbow/1.0\n\n");
-    return;
+    m_keepAlive = false;
+    ResponseHeader header(m_output, QByteArray(), ResponseHeader::BadRequest, false);
+    m_connection->write(header.finish());
+}
+
+void Request::reply_too_large()
+{
+    Log *log = Log::instance();
+    log->entry(Log::LogLevelCritical, "431 request header too large");
+    m_keepAlive = false;
+    ResponseHeader header(m_output, "HTTP/1.1", ResponseHeader::RequestHeaderTooLarge, false);
+    m_connection->write(header.finish());
+}
+
+void Request::reply_unsupported()
+{
+    Log *log = Log::instance();
+    log->entry(Log::LogLevelNormal, "501 Not Implemented");
+    m_keepAlive = false;
+    ResponseHeader header(m_output, m_version, ResponseHeader::NotImplemented, false);
+    header.append("Content-Length: 0\r\n");
+    m_connection->write(header.finish());
+}
+
+/*
+ * Other methods are only for reverse proxies, they pass them on.
+ */
+void Request::reply_other(const Configuration *configuration)
+{
+    m_route = configuration->resolve(m_buffer.constData() + m_parser.target().offset, m_parser.target().length);
+    if (!m_route.isValid() || !configuration->isProxy(m_route)) {
+        reply_unsupported();
+        return;
+    }
+    m_valid = true;
+    reply_application(configuration);
 }
 
-void Request::reply_get(Configuration *configuration)
+void Request::reply_get(const Configuration *configuration)
 {
     Log *log = Log::instance();
-    if (!configuration->hasPath(m_target)) {
+    if (configuration->isMetrics(m_buffer.constData() + m_parser.target().offset, m_parser.target().length, m_connection->localPort())) {
+        reply_metrics(configuration);
+        return;
+    }
+    m_route = configuration->resolve(m_buffer.constData() + m_parser.target().offset, m_parser.target().length);
+    if (!m_route.isValid()) {
         log->entry(Log::LogLevelNormal, "404 Not Found");
         m_valid = false;
-        m_socket->write(m_version);
-        m_socket->write(" 404 Not Found\n", strlen(" 404 Not Found\n"));
-        m_socket->write(generate_date());
-        m_socket->write("Server: rainbow/1.0\n\n");
+        ResponseHeader header(m_output, m_version, ResponseHeader::NotFound, m_keepAlive);
+        header.append("Content-Length: 0\r\n");
+        m_connection->write(header.finish());
+        return;
+    }
+    m_valid = true;
+    if (m_route.kind == Route::Application) {
+        if (!reply_websocket(configuration))
+            reply_application(configuration);
         return;
     }
+    /* Looked up once, everything that follows works from this copy */
+    m_hasEntry = configuration->entry(m_route, m_entry) && !m_entry.etag.isEmpty();
+    QString local = configuration->localFile(m_route);
+    if (!local.isEmpty() && reply_encoded(local, configuration))
+        return;
+    if (reply_not_modified())
+        return;
+    if (!local.isEmpty() && reply_range(local, configuration))
+        return;
     log->entry(Log::LogLevelDebug, "200 OK");
+    if (!local.isEmpty() && reply_cached(local, configuration))
+        return;
+    if (!local.isEmpty() && reply_file(local, configuration))
+        return;
+    ResponseHeader header(m_output, m_version, ResponseHeader::OK, m_keepAlive);
+    append_vary(header);
+    int size = header.buffer().size();
+    /* The folder ends the header itself, the body follows in the same buffer */
+    configuration->file(m_route, header.buffer());
+    if (header.buffer().size() == size)
+        header.append("Content-Length: 0\r\n\r\n");
+    m_connection->write(header.buffer());
+}
+
+/*
+ * Rendered on every scrape, it is small and scrapes are rare.
+ */
+void Request::reply_metrics(const Configuration *configuration)
+{
     m_valid = true;
-    m_socket->write(m_version);
-    m_socket->write(" 200 OK\n", strlen(" 200 OK\n"));
-    m_socket->write(generate_date());
-    m_socket->write("Server: rainbow/1.0\n");
-    QByteArray *data = configuration->file(m_target);
-    /* We need to dereference the array because the data might contain binary information */
-    m_socket->write(*data);
-    delete data;
+    QByteArray body;
+    Metrics::instance()->render(body, configuration->admission());
+    ResponseHeader header(m_output, m_version, ResponseHeader::OK, m_keepAlive);
+    header.append("Content-Type: text/plain; version=0.0.4\r\n");
+    header.append("Content-Length", body.size());
+    header.finish().append(body);
+    m_connection->write(header.buffer());
 }
 
-void Request::reply_head(Configuration *configuration)
+/*
+ * The handler gets the request and a sink for the reply, or the backend gets
+ * the request and the exchange brings its reply back. Nothing is written
+ * here, the reply goes out from isReady() as it becomes available, which
+ * might already be the case when this returns.
+ * Backends also get the body, the part that came with the header right
+ * away, the rest from transfer() as the client sends it. Only bodies with a
+ * length, a chunked one would have to be decoded first.
+ */
+void Request::reply_application(const Configuration *configuration)
+{
+    HandlerRequest request(m_buffer, m_parser, m_route.documentPath);
+    if (configuration->isUpstream(m_route)) {
+        qint64 length = 0;
+        RequestParser::Span span;
+        if (m_parser.find(m_buffer, "transfer-encoding", span)) {
+            reply_unsupported();
+            return;
+        }
+        if (m_parser.find(m_buffer, "content-length", span)) {
+            bool ok;
+            length = RequestParser::view(m_buffer, span).trimmed().toLongLong(&ok);
+            if (!ok || (length < 0)) {
+                reply_invalid();
+                return;
+            }
+        }
+        m_upstream = new UpstreamExchange(this, m_version, m_keepAlive, m_command == HEAD);
+        if (length > 0) {
+            QByteArray start = remainder();
+            if (start.size() > length)
+                start.truncate((int)length);
+            m_upstream->setBody(length, start);
+        }
+        configuration->forward(m_route, request, m_socket.socket(), m_upstream);
+        return;
+    }
+    m_response = new HandlerResponse(this);
+    configuration->dispatch(m_route, request, m_response);
+}
+
+/*
+ * The handshake of RFC 6455, for GET only. A request for an upgrade that the
+ * folder cannot take is an ordinary request, returns false then. Once the
+ * 101 is written the worker hands the connection over, whatever the client
+ * sent after the handshake goes with it.
+ */
+bool Request::reply_websocket(const Configuration *configuration)
 {
     Log *log = Log::instance();
-    if (!configuration->hasPath(m_target)) {
+    RequestParser::Span span;
+    if (!m_parser.find(m_buffer, "upgrade", span) || !has_token(RequestParser::view(m_buffer, span), "websocket"))
+        return false;
+    if (!m_parser.find(m_buffer, "connection", span) || !has_token(RequestParser::view(m_buffer, span), "upgrade"))
+        return false;
+    /* The WebSocket takes over the QTcpSocket, other connections cannot be upgraded */
+    if ((m_version != http_11) || !configuration->webSocketHandler(m_route)
+            || (configuration->schedulerMode() != Configuration::EventDriven) || !m_socket.socket())
+        return false;
+    QByteArray version;
+    if (m_parser.find(m_buffer, "sec-websocket-version", span))
+        version = RequestParser::view(m_buffer, span).trimmed();
+    if (version != "13") {
+        log->entry(Log::LogLevelNormal, "426 Upgrade Required");
+        ResponseHeader header(m_output, m_version, ResponseHeader::UpgradeRequired, m_keepAlive);
+        header.append("Sec-WebSocket-Version: 13\r\nContent-Length: 0\r\n");
+        m_connection->write(header.finish());
+        return true;
+    }
+    QByteArray key;
+    if (m_parser.find(m_buffer, "sec-websocket-key", span))
+        key = RequestParser::view(m_buffer, span).trimmed();
+    /* Sixteen bytes in base64 */
+    if (key.size() != 24) {
+        reply_invalid();
+        return true;
+    }
+    log->entry(Log::LogLevelDebug, "101 Switching Protocols");
+    m_deflate = configuration->isWebSocketDeflate(m_route) && accept_deflate();
+    ResponseHeader header(m_output, m_version, ResponseHeader::SwitchingProtocols, true);
+    header.append("Upgrade: websocket\r\nSec-WebSocket-Accept: ");
+    header.append(WebSocketFrame::acceptKey(key));
+    header.append("\r\n");
+    if (m_deflate)
+        header.append("Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_no_context_takeover\r\n");
+    m_connection->write(header.finish());
+    m_upgrade = true;
+    return true;
+}
+
+/*
+ * Whether one of the offers of the client is permessage-deflate with
+ * parameters we can live with. Our compressor is shared and always uses the
+ * whole window, an offer that limits the window of the server is declined.
+ * Context takeover is off in both directions whatever the offer said, the
+ * server may decide that for the client too.
+ */
+bool Request::accept_deflate() const
+{
+    RequestParser::Span span;
+    if (!m_parser.find(m_buffer, "sec-websocket-extensions", span))
+        return false;
+    QList<QByteArray> offers = RequestParser::view(m_buffer, span).split(',');
+    foreach (const QByteArray &offer, offers) {
+        QList<QByteArray> parameters = offer.split(';');
+        if (parameters.first().trimmed().toLower() != "permessage-deflate")
+            continue;
+        bool limited = false;
+        for (int i = 1; i < parameters.size(); ++i) {
+            if (parameters.at(i).trimmed().toLower().startsWith("server_max_window_bits"))
+                limited = true;
+        }
+        if (!limited)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * The handler is done with the sink, it is ours to read. Statuses we do not
+ * know are a broken handler.
+ */
+void Request::complete()
+{
+    Log *log = Log::instance();
+    HandlerResponse *response = m_response;
+    m_response = NULL;
+    ResponseHeader::Status status;
+    /* A 101 is only ours to send, with the handshake */
+    if (!ResponseHeader::fromCode(response->status(), status) || (status == ResponseHeader::SwitchingProtocols)) {
+        log->entry(Log::LogLevelCritical, "handler replied with an unknown status");
+        ResponseHeader header(m_output, m_version, ResponseHeader::InternalServerError, m_keepAlive);
+        header.append("Content-Length: 0\r\n");
+        m_connection->write(header.finish());
+        response->detach();
+        return;
+    }
+    ResponseHeader header(m_output, m_version, status, m_keepAlive);
+    header.append(response->headers());
+    header.append("Content-Length", response->body().size());
+    header.finish();
+    if (m_command != HEAD)
+        header.append(response->body());
+    m_connection->write(header.buffer());
+    response->detach();
+}
+
+/*
+ * Revalidation of a file the client already has. Everything needed comes
+ * from the folder index, the file is not opened to answer 304.
+ */
+bool Request::reply_not_modified()
+{
+    if (!m_hasEntry)
+        return false;
+    const WebFolder::Entry &entry = m_entry;
+    if (!is_not_modified(entry.etag, entry.mtime))
+        return false;
+    Log::instance()->entry(Log::LogLevelDebug, "304 Not Modified");
+    ResponseHeader header(m_output, m_version, ResponseHeader::NotModified, m_keepAlive);
+    append_vary(header);
+    WebFolder::appendValidators(entry, header.buffer());
+    m_connection->write(header.finish());
+    return true;
+}
+
+/*
+ * If-None-Match wins over If-Modified-Since when both are present.
+ */
+bool Request::is_not_modified(const QByteArray &etag, qint64 mtime) const
+{
+    RequestParser::Span span;
+    if (m_parser.find(m_buffer, "if-none-match", span))
+        return match_etag(RequestParser::view(m_buffer, span), etag);
+    if (!m_parser.find(m_buffer, "if-modified-since", span))
+        return false;
+    time_t since;
+    return ResponseHeader::parseDate(RequestParser::view(m_buffer, span), since) && (mtime <= since);
+}
+
+void Request::append_vary(ResponseHeader &header) const
+{
+    if (m_vary)
+        header.append("Vary: Accept-Encoding\r\n");
+}
+
+/*
+ * Content negotiation. A precompressed copy next to the file wins, brotli
+ * before gzip, then a gzip copy made by us. If there is none the file is
+ * sent as it is and compressed in the background for the next time.
+ * Each compressed representation has its own ETag, and ranges are only
+ * served from the file as it is.
+ */
+bool Request::reply_encoded(const QString &local, const Configuration *configuration)
+{
+    Log *log = Log::instance();
+    if (!m_hasEntry)
+        return false;
+    const WebFolder::Entry &entry = m_entry;
+    CompressionCache *compression = configuration->compression();
+    bool compressible = compression && CompressionCache::isCompressible(entry.type);
+    WebFolder::Entry brotli;
+    WebFolder::Entry gzip;
+    bool hasBrotli = configuration->sidecar(m_route, ".br", entry, brotli);
+    bool hasGzip = configuration->sidecar(m_route, ".gz", entry, gzip);
+    m_vary = compressible || hasBrotli || hasGzip;
+    if (!m_vary)
+        return false;
+    RequestParser::Span span;
+    QByteArray accepted;
+    if (m_parser.find(m_buffer, "accept-encoding", span))
+        accepted = RequestParser::view(m_buffer, span);
+    if (hasBrotli && accepts_coding(accepted, "br") && reply_sidecar(local + ".br", "br", entry, brotli))
+        return true;
+    if (hasGzip && accepts_coding(accepted, "gzip") && reply_sidecar(local + ".gz", "gzip", entry, gzip))
+        return true;
+    if (!compressible || !accepts_coding(accepted, "gzip"))
+        return false;
+    QByteArray content;
+    if (!compression->lookup(local, entry.mtime, content)) {
+        compression->compress(local, entry.mtime, entry.size);
+        return false;
+    }
+    /* Not worth compressing */
+    if (content.isEmpty())
+        return false;
+    QByteArray etag = entry.etag;
+    etag.insert(etag.size() - 1, "-gzip");
+    QByteArray validators = "ETag: " + etag + "\r\nLast-Modified: " + entry.lastModified + "\r\n";
+    if (is_not_modified(etag, entry.mtime)) {
+        log->entry(Log::LogLevelDebug, "304 Not Modified");
+        ResponseHeader header(m_output, m_version, ResponseHeader::NotModified, m_keepAlive);
+        append_vary(header);
+        header.append(validators);
+        m_connection->write(header.finish());
+        return true;
+    }
+    log->entry(Log::LogLevelDebug, "200 OK, compressed");
+    ResponseHeader header(m_output, m_version, ResponseHeader::OK, m_keepAlive);
+    append_vary(header);
+    header.append(validators);
+    header.append("Content-Type: " + entry.type + "\r\nContent-Encoding: gzip\r\n");
+    header.append("Content-Length", content.size());
+    header.finish();
+    if (m_command != HEAD)
+        header.append(content);
+    m_connection->write(header.buffer());
+    return true;
+}
+
+/*
+ * A precompressed copy is a file of its own, it is streamed like any other
+ * file and its ETag is its own.
+ */
+bool Request::reply_sidecar(const QString &path, const char *coding, const WebFolder::Entry &original, const WebFolder::Entry &sidecar)
+{
+    Log *log = Log::instance();
+    QByteArray validators = "ETag: " + sidecar.etag + "\r\nLast-Modified: " + original.lastModified + "\r\n";
+    if (is_not_modified(sidecar.etag, original.mtime)) {
+        log->entry(Log::LogLevelDebug, "304 Not Modified");
+        ResponseHeader header(m_output, m_version, ResponseHeader::NotModified, m_keepAlive);
+        append_vary(header);
+        header.append(validators);
+        m_connection->write(header.finish());
+        return true;
+    }
+    BodyProducer *body = open_body(path);
+    if (!body)
+        return false;
+    log->entry(Log::LogLevelDebug, "200 OK, precompressed");
+    ResponseHeader header(m_output, m_version, ResponseHeader::OK, m_keepAlive);
+    append_vary(header);
+    header.append(validators);
+    header.append("Content-Type: " + original.type + "\r\nContent-Encoding: " + coding + "\r\n");
+    header.append("Content-Length", body->size());
+    m_connection->write(header.finish());
+    if ((m_command == HEAD) || !body->addRegion()) {
+        delete body;
+        return true;
+    }
+    m_body = body;
+    return true;
+}
+
+/*
+ * Parts of a file. Only GET asks for them, a Range header we cannot honour
+ * is ignored and the whole file is sent instead. The parts go through the
+ * same producers as whole files, so only the requested bytes are read,
+ * wherever they are in the file.
+ */
+bool Request::reply_range(const QString &local, const Configuration *configuration)
+{
+    static QAtomicInt boundaries(0);
+    Log *log = Log::instance();
+    RequestParser::Span span;
+    if (!m_parser.find(m_buffer, "range", span))
+        return false;
+    QByteArray value = RequestParser::view(m_buffer, span);
+    if (!m_hasEntry)
+        return false;
+    const WebFolder::Entry &entry = m_entry;
+    if (m_parser.find(m_buffer, "if-range", span) && !if_range_matches(RequestParser::view(m_buffer, span), entry))
+        return false;
+    BodyProducer *body = open_body(local);
+    if (!body)
+        return false;
+    /* The index might be a moment behind the file, the ranges must fit what we send */
+    qint64 size = body->size();
+    QList<ByteRange> ranges;
+    int count = parse_ranges(value, size, ranges);
+    if (count == -1) {
+        delete body;
+        return false;
+    }
+    if (count == 0) {
+        log->entry(Log::LogLevelNormal, "416 Range Not Satisfiable");
+        delete body;
+        ResponseHeader header(m_output, m_version, ResponseHeader::RangeNotSatisfiable, m_keepAlive);
+        append_vary(header);
+        header.append("Content-Range: bytes */" + QByteArray::number(size) + "\r\n");
+        header.append("Content-Length: 0\r\n");
+        m_connection->write(header.finish());
+        return true;
+    }
+    log->entry(Log::LogLevelDebug, "206 Partial Content");
+    ResponseHeader header(m_output, m_version, ResponseHeader::PartialContent, m_keepAlive);
+    append_vary(header);
+    WebFolder::appendValidators(entry, header.buffer());
+    /* Each part of a multipart reply is preceded by its own small header */
+    QList<QByteArray> separators;
+    QByteArray closing;
+    qint64 length = 0;
+    if (count == 1) {
+        header.append("Content-Type: " + entry.type + "\r\n");
+        header.append(content_range(ranges.first(), size));
+        length = ranges.first().last - ranges.first().first + 1;
+    } else {
+        QByteArray boundary = "rainbow-" + QByteArray::number(m_started, 16) + '-'
+                + QByteArray::number(boundaries.fetchAndAddRelaxed(1), 16);
+        header.append("Content-Type: multipart/byteranges; boundary=" + boundary + "\r\n");
+        foreach (const ByteRange &range, ranges) {
+            QByteArray separator = "\r\n--" + boundary + "\r\nContent-Type: " + entry.type + "\r\n"
+                    + content_range(range, size) + "\r\n";
+            separators.append(separator);
+            length += separator.size() + range.last - range.first + 1;
+        }
+        closing = "\r\n--" + boundary + "--\r\n";
+        length += closing.size();
+    }
+    header.append("Content-Length", length);
+    header.finish();
+    for (int i = 0; i < count; ++i) {
+        if (count > 1)
+            body->addData(separators.at(i));
+        body->addRegion(ranges.at(i).first, ranges.at(i).last - ranges.at(i).first + 1);
+    }
+    if (count > 1)
+        body->addData(closing);
+    m_connection->write(header.buffer());
+    m_body = body;
+    return true;
+}
+
+/*
+ * Only the header goes through the socket buffer, the body is streamed by
+ * isReady() as the client takes it.
+ */
+bool Request::reply_file(const QString &local, const Configuration *configuration)
+{
+    BodyProducer *body = open_body(local);
+    if (!body)
+        return false;
+    if (!body->addRegion()) {
+        delete body;
+        return false;
+    }
+    ResponseHeader header(m_output, m_version, ResponseHeader::OK, m_keepAlive);
+    append_vary(header);
+    configuration->info(m_route, header.buffer());
+    m_connection->write(header.finish());
+    m_body = body;
+    return true;
+}
+
+/*
+ * Straight from the file to the socket where the system can do it, otherwise
+ * read in chunks that never pile up in the socket buffer.
+ */
+BodyProducer *Request::open_body(const QString &local)
+{
+    BodyProducer *body;
+    if (FileTransfer::isSupported())
+        body = new FileTransfer(m_connection->descriptor());
+    else
+        body = new FileReader();
+    if (body->open(local))
+        return body;
+    delete body;
+    return NULL;
+}
+
+/*
+ * Small files are served from memory. On a miss the file is read once and
+ * kept for the next requests, bigger files are left to reply_file.
+ */
+bool Request::reply_cached(const QString &local, const Configuration *configuration)
+{
+    ContentCache *cache = configuration->cache();
+    if (!cache)
+        return false;
+    QByteArray header;
+    QByteArray content;
+    if (!cache->lookup(local, header, content)) {
+        QFile data(local);
+        if (!data.open(QIODevice::ReadOnly))
+            return false;
+        /* The index might be behind the file, the length is the one of what we read */
+        struct stat status;
+        if ((::fstat(data.handle(), &status) != 0) || (status.st_size > cache->maximumEntrySize()))
+            return false;
+        content = data.readAll();
+        configuration->info(m_route, content.size(), header);
+        header.append("\r\n");
+        /* Its validators come from the index, a version it does not describe yet is not kept */
+        if (m_hasEntry && (m_entry.size == content.size()) && (m_entry.mtime == status.st_mtime))
+            cache->insert(local, header, content, status.st_mtime);
+    }
+    ResponseHeader response(m_output, m_version, ResponseHeader::OK, m_keepAlive);
+    append_vary(response);
+    response.append(header);
+    /* The connection sends both in one go, the content is not copied to get there */
+    m_connection->write(response.buffer());
+    m_connection->write(content);
+    m_shared = content.size();
+    return true;
+}
+
+void Request::reply_head(const Configuration *configuration)
+{
+    Log *log = Log::instance();
+    m_route = configuration->resolve(m_buffer.constData() + m_parser.target().offset, m_parser.target().length);
+    if (!m_route.isValid()) {
         log->entry(Log::LogLevelNormal, "404 Not Found");
         m_valid = false;
-        m_socket->write(m_version);
-        m_socket->write(" 404 Not Found\n", strlen(" 404 Not Found\n"));
-        m_socket->write(generate_date());
-        m_socket->write("Server: rainbow/1.0\n");
+        ResponseHeader header(m_output, m_version, ResponseHeader::NotFound, m_keepAlive);
+        header.append("Content-Length: 0\r\n");
+        m_connection->write(header.finish());
         return;
     }
     /* HEAD and GET differentiate only on the lack of data in the reply to HEAD */
-    log->entry(Log::LogLevelDebug, "200 OK");
     m_valid = true;
-    m_socket->write(m_version);
-    m_socket->write(" 200 OK\n\n", strlen(" 200 OK\n\n"));
-    m_socket->write(generate_date());
-    m_socket->write("Server: rainbow/1.0\n");
-    QByteArray *data = configuration->info(m_target);
-    m_socket->write(data->constData());
-    delete data;
+    if (m_route.kind == Route::Application) {
+        reply_application(configuration);
+        return;
+    }
+    /* Looked up once, everything that follows works from this copy */
+    m_hasEntry = configuration->entry(m_route, m_entry) && !m_entry.etag.isEmpty();
+    QString local = configuration->localFile(m_route);
+    if (!local.isEmpty() && reply_encoded(local, configuration))
+        return;
+    if (reply_not_modified())
+        return;
+    log->entry(Log::LogLevelDebug, "200 OK");
+    ResponseHeader header(m_output, m_version, ResponseHeader::OK, m_keepAlive);
+    append_vary(header);
+    int size = header.buffer().size();
+    configuration->info(m_route, header.buffer());
+    if (header.buffer().size() == size)
+        header.append("Content-Length: 0\r\n");
+    m_connection->write(header.finish());
 }
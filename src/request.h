@@ -7,7 +7,16 @@
 #include <QtNetwork/QTcpSocket>
 
 #include "configuration.h"
-#define REQUEST_TIMEOUT 30000   /* We expire after 30 seconds */
+#include "clientconnection.h"
+#include "bodyproducer.h"
+#include "requestparser.h"
+#include "route.h"
+#include "responseheader.h"
+#include "timerwheel.h"
+#include "handlerresponse.h"
+#include "upstreamexchange.h"
+#include "websocketframe.h"
+#define REQUEST_MAX_RANGES 16   /* More ranges than this and the whole file is sent */
 
 class Request
 {
@@ -15,33 +24,116 @@ public:
     enum Commands {
         GET
         , HEAD
+        , UNSUPPORTED
     };
 private:
     bool m_valid;
     bool m_replied;
     bool m_expired;
+    /* Whether the server allows this connection to carry another request */
+    bool m_persistent;
+    /* Whether the connection stays open after this request */
+    bool m_keepAlive;
+    int m_sequence;
     qint64 m_started;
-    QTcpSocket *m_socket;
+    /* Either our own wrapper of a QTcpSocket or a connection the worker owns */
+    ClientConnection *m_connection;
+    SocketConnection m_socket;
     Commands m_command;
-    QByteArray m_target;
+    /* One of two shared constants, never a copy of the request line */
     QByteArray m_version;
+    /* Receive and send buffers, they come from the worker's buffer pool */
     QByteArray m_buffer;
+    QByteArray m_output;
+    /* What the reply wrote from memory it shares with a cache instead of from m_output */
+    qint64 m_shared;
+    RequestParser m_parser;
+    Route m_route;
+    WebFolder::Entry m_entry;
+    bool m_hasEntry;
+    /* The reply depends on Accept-Encoding */
+    bool m_vary;
+    /* Body of the reply that is streamed from the file as the client takes it */
+    BodyProducer *m_body;
+    bool m_blocked;
+    /* The next deadline of the connection, scheduled by the worker */
+    TimerWheel::Timer m_timer;
+    /* When the request entered its current stage, for the metrics */
+    qint64 m_stamp;
+    /* The reply of an application handler, until it is written */
+    HandlerResponse *m_response;
+    /* The reply of a backend, streamed as it comes */
+    UpstreamExchange *m_upstream;
+    /* The handshake went out, the connection is a WebSocket once it is written */
+    bool m_upgrade;
+    bool m_deflate;
+    /* The snapshot the reply came from, the worker keeps it until the request goes back to the pool */
+    const Configuration *m_configuration;
 
-    static QByteArray generate_date();
     void reply_expired();
     void reply_invalid();
-    void reply_get(Configuration *configuration);
-    void reply_head(Configuration *configuration);
+    void reply_too_large();
+    void reply_unsupported();
+    void reply_other(const Configuration *configuration);
+    void reply_get(const Configuration *configuration);
+    bool reply_not_modified();
+    bool is_not_modified(const QByteArray &etag, qint64 mtime) const;
+    bool reply_encoded(const QString &local, const Configuration *configuration);
+    bool reply_sidecar(const QString &path, const char *coding, const WebFolder::Entry &original, const WebFolder::Entry &sidecar);
+    void append_vary(ResponseHeader &header) const;
+    bool reply_range(const QString &local, const Configuration *configuration);
+    BodyProducer *open_body(const QString &local);
+    bool reply_file(const QString &local, const Configuration *configuration);
+    bool reply_cached(const QString &local, const Configuration *configuration);
+    void reply_head(const Configuration *configuration);
+    void reply_metrics(const Configuration *configuration);
+    void reply_application(const Configuration *configuration);
+    bool reply_websocket(const Configuration *configuration);
+    bool accept_deflate() const;
+    void complete();
 public:
 
-    Request(QTcpSocket *s, qint64 started);
+    Request();
+    Request(QTcpSocket *s, qint64 started, bool persistent = false, int sequence = 0, const QByteArray &pending = QByteArray());
     virtual ~Request();
-    virtual bool isExpired(qint64 now);
+    void reset(QTcpSocket *s, qint64 started, bool persistent = false, int sequence = 0, const QByteArray &pending = QByteArray());
+    void reset(ClientConnection *connection, qint64 started, bool persistent = false, int sequence = 0, const QByteArray &pending = QByteArray());
+    void setBuffers(const QByteArray &input, const QByteArray &output);
+    void takeBuffers(QByteArray &input, QByteArray &output);
+    void expire() { m_expired = true; }
+    bool isExpired() const { return m_expired; }
     virtual bool fetch();
     virtual bool parse();
-    virtual void reply(Configuration *configuration);
+    virtual void reply(const Configuration *configuration);
     virtual void close();
     virtual bool isReady();
+    void transfer();
+    bool isReplied() const { return m_replied; }
+    bool isBlocked() const { return m_blocked; }
+    /* The 101 of a WebSocket handshake went out, the connection changes hands */
+    bool isUpgrade() const { return m_upgrade; }
+    /* The client agreed to permessage-deflate */
+    bool isDeflate() const { return m_deflate; }
+    /* Replied, but the handler or the backend did not finish yet */
+    bool isDeferred() const { return (m_response != NULL) || (m_upstream != NULL); }
+    bool notify(QObject *receiver, const char *member);
+    bool keepAlive() const { return m_keepAlive; }
+    int sequence() const { return m_sequence; }
+    qint64 started() const { return m_started; }
+    /* Waiting for the next request on a persistent connection */
+    bool isIdle() const { return (m_sequence > 0) && m_buffer.isEmpty(); }
+    QByteArray remainder() const;
+    /* NULL unless the connection is a QTcpSocket */
+    QTcpSocket *socket() const { return m_socket.socket(); }
+    ClientConnection *connection() const { return m_connection; }
+    TimerWheel::Timer *timer() { return &m_timer; }
+    qint64 stamp() const { return m_stamp; }
+    void setStamp(qint64 stamp) { m_stamp = stamp; }
+    const Route &route() const { return m_route; }
+    const Configuration *configuration() const { return m_configuration; }
+    qint64 replySize() const;
+    const RequestParser &parser() const { return m_parser; }
+    const QByteArray &buffer() const { return m_buffer; }
 };
 
 #endif // REQUEST_H
@@ -0,0 +1,218 @@
+#include <string.h>
+
+#include "requestparser.h"
+
+/*
+ * Characters allowed in methods and header names (RFC 7230 tchar).
+ */
+static inline bool is_token(char c)
+{
+    if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')))
+        return true;
+    switch (c) {
+    case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+    case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+        return true;
+    default:
+        return false;
+    }
+}
+
+static inline char lower(char c)
+{
+    if ((c >= 'A') && (c <= 'Z'))
+        return c - 'A' + 'a';
+    return c;
+}
+
+RequestParser::RequestParser(int maxSize, int maxHeaders) :
+    m_maxSize(maxSize),
+    m_maxHeaders(maxHeaders)
+{
+    m_headers.reserve(16);
+    reset();
+}
+
+/*
+ * The request starts at the given offset of the buffer, on persistent connections
+ * the buffer might still hold the end of the previous request.
+ */
+void RequestParser::reset(int start)
+{
+    m_state = Start;
+    m_status = Incomplete;
+    m_position = start;
+    m_start = start;
+    m_length = -1;
+    m_method.offset = m_target.offset = m_version.offset = start;
+    m_method.length = m_target.length = m_version.length = 0;
+    m_current.name.offset = m_current.value.offset = start;
+    m_current.name.length = m_current.value.length = 0;
+    m_valueEnd = start;
+    /* resize keeps the memory around for the next request */
+    m_headers.resize(0);
+}
+
+RequestParser::Status RequestParser::fail(Status status)
+{
+    m_state = Error;
+    m_status = status;
+    return status;
+}
+
+/*
+ * Line endings can be either CRLF or a bare LF, we have always accepted both.
+ * Folded header lines are obsolete and rejected.
+ */
+RequestParser::Status RequestParser::parse(const QByteArray &buffer)
+{
+    if ((m_state == Done) || (m_state == Error))
+        return m_status;
+    const char *data = buffer.constData();
+    int size = buffer.size();
+    if (size - m_start > m_maxSize)
+        size = m_start + m_maxSize;
+    while (m_position < size) {
+        char c = data[m_position];
+        switch (m_state) {
+        case Start:
+            /* Empty lines before the request line are ignored */
+            if ((c == '\r') || (c == '\n')) {
+                ++m_position;
+                continue;
+            }
+            if (!is_token(c))
+                return fail(Invalid);
+            m_method.offset = m_position;
+            m_state = Method;
+            break;
+        case Method:
+            if (c == ' ') {
+                m_method.length = m_position - m_method.offset;
+                m_target.offset = m_position + 1;
+                m_state = Target;
+            } else if (!is_token(c)) {
+                return fail(Invalid);
+            }
+            break;
+        case Target:
+            if (c == ' ') {
+                m_target.length = m_position - m_target.offset;
+                if (m_target.length == 0)
+                    return fail(Invalid);
+                m_version.offset = m_position + 1;
+                m_state = Version;
+            } else if ((unsigned char)c <= ' ' || c == 0x7f) {
+                return fail(Invalid);
+            }
+            break;
+        case Version:
+            if ((c == '\r') || (c == '\n')) {
+                m_version.length = m_position - m_version.offset;
+                if (!equals(buffer, m_version, "HTTP/1.0") && !equals(buffer, m_version, "HTTP/1.1"))
+                    return fail(Invalid);
+                m_state = (c == '\r') ? RequestLineEnd : HeaderLineStart;
+            }
+            break;
+        case RequestLineEnd:
+        case HeaderLineEnd:
+            if (c != '\n')
+                return fail(Invalid);
+            m_state = HeaderLineStart;
+            break;
+        case HeaderLineStart:
+            if (c == '\r') {
+                m_state = HeadersEnd;
+            } else if (c == '\n') {
+                m_length = m_position + 1;
+                m_state = Done;
+                m_status = Complete;
+                return m_status;
+            } else if (is_token(c)) {
+                if (m_headers.size() >= m_maxHeaders)
+                    return fail(TooLarge);
+                m_current.name.offset = m_position;
+                m_state = HeaderName;
+            } else {
+                return fail(Invalid);
+            }
+            break;
+        case HeaderName:
+            if (c == ':') {
+                m_current.name.length = m_position - m_current.name.offset;
+                m_state = HeaderValueStart;
+            } else if (!is_token(c)) {
+                return fail(Invalid);
+            }
+            break;
+        case HeaderValueStart:
+            if ((c == ' ') || (c == '\t'))
+                break;
+            m_current.value.offset = m_position;
+            m_valueEnd = m_position;
+            m_state = HeaderValue;
+            /* fall through */
+        case HeaderValue:
+            if ((c == '\r') || (c == '\n')) {
+                m_current.value.length = m_valueEnd - m_current.value.offset;
+                m_headers.append(m_current);
+                m_state = (c == '\r') ? HeaderLineEnd : HeaderLineStart;
+            } else if ((c != ' ') && (c != '\t')) {
+                m_valueEnd = m_position + 1;
+            }
+            break;
+        case HeadersEnd:
+            if (c != '\n')
+                return fail(Invalid);
+            m_length = m_position + 1;
+            m_state = Done;
+            m_status = Complete;
+            return m_status;
+        default:
+            return m_status;
+        }
+        ++m_position;
+    }
+    if (m_position - m_start >= m_maxSize)
+        return fail(TooLarge);
+    return m_status;
+}
+
+/*
+ * Header names are case insensitive. Returns the first header with that name.
+ */
+bool RequestParser::find(const QByteArray &buffer, const char *name, Span &value) const
+{
+    int length = qstrlen(name);
+    const char *data = buffer.constData();
+    for (int i = 0; i < m_headers.size(); ++i) {
+        const Header &header = m_headers.at(i);
+        if (header.name.length != length)
+            continue;
+        int j = 0;
+        while ((j < length) && (lower(data[header.name.offset + j]) == lower(name[j])))
+            ++j;
+        if (j == length) {
+            value = header.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RequestParser::equals(const QByteArray &buffer, const Span &span, const char *text)
+{
+    int length = qstrlen(text);
+    if (span.length != length)
+        return false;
+    return memcmp(buffer.constData() + span.offset, text, length) == 0;
+}
+
+/*
+ * The returned array points into the buffer, it is only valid as long as the
+ * buffer is not modified.
+ */
+QByteArray RequestParser::view(const QByteArray &buffer, const Span &span)
+{
+    return QByteArray::fromRawData(buffer.constData() + span.offset, span.length);
+}
@@ -0,0 +1,82 @@
+#ifndef REQUESTPARSER_H
+#define REQUESTPARSER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+#define PARSER_MAX_HEADER_SIZE 8192
+#define PARSER_MAX_HEADERS 64
+
+/*
+ * Parses the header of an HTTP request directly on the receive buffer.
+ * Nothing is copied, the parser only records where each part starts and how
+ * long it is. It can be called again every time more data is appended to the
+ * buffer and it continues where it stopped, so partial reads cost only the new
+ * bytes.
+ */
+class RequestParser
+{
+public:
+    enum Status {
+        Incomplete
+        , Complete
+        , Invalid
+        , TooLarge
+    };
+    struct Span {
+        int offset;
+        int length;
+    };
+    struct Header {
+        Span name;
+        Span value;
+    };
+private:
+    enum State {
+        Start
+        , Method
+        , Target
+        , Version
+        , RequestLineEnd
+        , HeaderLineStart
+        , HeaderName
+        , HeaderValueStart
+        , HeaderValue
+        , HeaderLineEnd
+        , HeadersEnd
+        , Done
+        , Error
+    };
+    State m_state;
+    Status m_status;
+    int m_position;
+    int m_start;
+    int m_length;
+    int m_maxSize;
+    int m_maxHeaders;
+    Span m_method;
+    Span m_target;
+    Span m_version;
+    Header m_current;
+    int m_valueEnd;
+    QVector<Header> m_headers;
+
+    Status fail(Status status);
+public:
+    RequestParser(int maxSize = PARSER_MAX_HEADER_SIZE, int maxHeaders = PARSER_MAX_HEADERS);
+    void reset(int start = 0);
+    Status parse(const QByteArray &buffer);
+    Status status() const { return m_status; }
+    /* Where the header ends, the body or the next request starts there */
+    int length() const { return m_length; }
+    Span method() const { return m_method; }
+    Span target() const { return m_target; }
+    Span version() const { return m_version; }
+    int headerCount() const { return m_headers.size(); }
+    const Header &header(int i) const { return m_headers.at(i); }
+    bool find(const QByteArray &buffer, const char *name, Span &value) const;
+    static bool equals(const QByteArray &buffer, const Span &span, const char *text);
+    static QByteArray view(const QByteArray &buffer, const Span &span);
+};
+
+#endif // REQUESTPARSER_H
@@ -0,0 +1,56 @@
+#include "requestpool.h"
+
+RequestPool::RequestPool() :
+    m_created(0)
+{
+    m_free.reserve(REQUESTPOOL_KEEP);
+}
+
+RequestPool::~RequestPool()
+{
+    qDeleteAll(m_free);
+}
+
+Request *RequestPool::take(int pending)
+{
+    Request *request;
+    if (!m_free.isEmpty()) {
+        request = m_free.last();
+        m_free.resize(m_free.size() - 1);
+    } else {
+        request = new Request();
+        ++m_created;
+    }
+    request->setBuffers(m_buffers.acquire(qMax(pending, REQUEST_INPUT_SIZE)), m_buffers.acquire(REQUEST_OUTPUT_SIZE));
+    return request;
+}
+
+Request *RequestPool::acquire(QTcpSocket *socket, qint64 started, bool persistent, int sequence, const QByteArray &pending)
+{
+    Request *request = take(pending.size());
+    request->reset(socket, started, persistent, sequence, pending);
+    return request;
+}
+
+Request *RequestPool::acquire(ClientConnection *connection, qint64 started, bool persistent, int sequence, const QByteArray &pending)
+{
+    Request *request = take(pending.size());
+    request->reset(connection, started, persistent, sequence, pending);
+    return request;
+}
+
+void RequestPool::release(Request *request)
+{
+    QByteArray input;
+    QByteArray output;
+    request->takeBuffers(input, output);
+    m_buffers.release(input);
+    m_buffers.release(output);
+    if (m_free.size() >= REQUESTPOOL_KEEP) {
+        delete request;
+        return;
+    }
+    /* Whatever the request still holds (a file, a route) goes now, not when it is reused */
+    request->reset((ClientConnection *)NULL, 0);
+    m_free.append(request);
+}
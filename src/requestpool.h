@@ -0,0 +1,37 @@
+#ifndef REQUESTPOOL_H
+#define REQUESTPOOL_H
+
+#include <QtCore/QVector>
+#include <QtNetwork/QTcpSocket>
+
+#include "bufferpool.h"
+#include "request.h"
+
+#define REQUESTPOOL_KEEP 256            /* Idle requests kept around */
+#define REQUEST_INPUT_SIZE 4096         /* Enough for the header of most requests */
+#define REQUEST_OUTPUT_SIZE 4096        /* Enough for a reply header and a small body */
+
+/*
+ * Requests are reused instead of being created and deleted for every request
+ * on every connection. A request that comes back keeps its parser and gives
+ * its buffers back to the buffer pool, the next one starts with buffers that
+ * already have their memory. Each worker has its own pool, nothing is shared.
+ */
+class RequestPool
+{
+    QVector<Request *> m_free;
+    BufferPool m_buffers;
+    quint64 m_created;
+
+    Request *take(int pending);
+public:
+    RequestPool();
+    ~RequestPool();
+    Request *acquire(QTcpSocket *socket, qint64 started, bool persistent = false, int sequence = 0, const QByteArray &pending = QByteArray());
+    Request *acquire(ClientConnection *connection, qint64 started, bool persistent = false, int sequence = 0, const QByteArray &pending = QByteArray());
+    void release(Request *request);
+    quint64 created() const { return m_created; }
+    const BufferPool &buffers() const { return m_buffers; }
+};
+
+#endif // REQUESTPOOL_H
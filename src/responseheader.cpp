@@ -0,0 +1,238 @@
+#include <QtCore/QThreadStorage>
+#include <stdio.h>
+#include <string.h>
+
+#include "responseheader.h"
+
+/*
+ * Indexed by Status. Anything that is not HTTP/1.1 gets the HTTP/1.0 line,
+ * it is the safe choice for invalid requests.
+ */
+static const char *status_10[ResponseHeader::StatusCount] = {
+    "HTTP/1.0 101 Switching Protocols\r\n"
+    , "HTTP/1.0 200 OK\r\n"
+    , "HTTP/1.0 201 Created\r\n"
+    , "HTTP/1.0 202 Accepted\r\n"
+    , "HTTP/1.0 204 No Content\r\n"
+    , "HTTP/1.0 206 Partial Content\r\n"
+    , "HTTP/1.0 301 Moved Permanently\r\n"
+    , "HTTP/1.0 302 Found\r\n"
+    , "HTTP/1.0 303 See Other\r\n"
+    , "HTTP/1.0 304 Not Modified\r\n"
+    , "HTTP/1.0 307 Temporary Redirect\r\n"
+    , "HTTP/1.0 400 Bad request\r\n"
+    , "HTTP/1.0 401 Unauthorized\r\n"
+    , "HTTP/1.0 403 Forbidden\r\n"
+    , "HTTP/1.0 404 Not Found\r\n"
+    , "HTTP/1.0 405 Method Not Allowed\r\n"
+    , "HTTP/1.0 408 Request Timeout\r\n"
+    , "HTTP/1.0 409 Conflict\r\n"
+    , "HTTP/1.0 410 Gone\r\n"
+    , "HTTP/1.0 413 Payload Too Large\r\n"
+    , "HTTP/1.0 416 Range Not Satisfiable\r\n"
+    , "HTTP/1.0 426 Upgrade Required\r\n"
+    , "HTTP/1.0 429 Too Many Requests\r\n"
+    , "HTTP/1.0 431 Request Header Fields Too Large\r\n"
+    , "HTTP/1.0 500 Internal Server Error\r\n"
+    , "HTTP/1.0 501 Not Implemented\r\n"
+    , "HTTP/1.0 502 Bad Gateway\r\n"
+    , "HTTP/1.0 503 Service Unavailable\r\n"
+    , "HTTP/1.0 504 Gateway Timeout\r\n"
+};
+static const char *status_11[ResponseHeader::StatusCount] = {
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    , "HTTP/1.1 200 OK\r\n"
+    , "HTTP/1.1 201 Created\r\n"
+    , "HTTP/1.1 202 Accepted\r\n"
+    , "HTTP/1.1 204 No Content\r\n"
+    , "HTTP/1.1 206 Partial Content\r\n"
+    , "HTTP/1.1 301 Moved Permanently\r\n"
+    , "HTTP/1.1 302 Found\r\n"
+    , "HTTP/1.1 303 See Other\r\n"
+    , "HTTP/1.1 304 Not Modified\r\n"
+    , "HTTP/1.1 307 Temporary Redirect\r\n"
+    , "HTTP/1.1 400 Bad request\r\n"
+    , "HTTP/1.1 401 Unauthorized\r\n"
+    , "HTTP/1.1 403 Forbidden\r\n"
+    , "HTTP/1.1 404 Not Found\r\n"
+    , "HTTP/1.1 405 Method Not Allowed\r\n"
+    , "HTTP/1.1 408 Request Timeout\r\n"
+    , "HTTP/1.1 409 Conflict\r\n"
+    , "HTTP/1.1 410 Gone\r\n"
+    , "HTTP/1.1 413 Payload Too Large\r\n"
+    , "HTTP/1.1 416 Range Not Satisfiable\r\n"
+    , "HTTP/1.1 426 Upgrade Required\r\n"
+    , "HTTP/1.1 429 Too Many Requests\r\n"
+    , "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+    , "HTTP/1.1 500 Internal Server Error\r\n"
+    , "HTTP/1.1 501 Not Implemented\r\n"
+    , "HTTP/1.1 502 Bad Gateway\r\n"
+    , "HTTP/1.1 503 Service Unavailable\r\n"
+    , "HTTP/1.1 504 Gateway Timeout\r\n"
+};
+static const int status_codes[ResponseHeader::StatusCount] = {
+    101
+    , 200
+    , 201
+    , 202
+    , 204
+    , 206
+    , 301
+    , 302
+    , 303
+    , 304
+    , 307
+    , 400
+    , 401
+    , 403
+    , 404
+    , 405
+    , 408
+    , 409
+    , 410
+    , 413
+    , 416
+    , 426
+    , 429
+    , 431
+    , 500
+    , 501
+    , 502
+    , 503
+    , 504
+};
+static const char *server_keep_alive = "Server: rainbow/1.0\r\nConnection: keep-alive\r\n";
+static const char *server_close = "Server: rainbow/1.0\r\nConnection: close\r\n";
+static const char *server_upgrade = "Server: rainbow/1.0\r\nConnection: Upgrade\r\n";
+
+/*
+ * The Date format is fixed by RFC 7231 and must not depend on the locale,
+ * so the names are ours and not the ones QDateTime would use.
+ */
+static const char *days[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+struct DateCache {
+    time_t second;
+    QByteArray line;
+    DateCache() : second(-1) {}
+};
+/* Every worker keeps its own copy, nobody has to lock anything to read it */
+static QThreadStorage<DateCache *> date_cache;
+
+ResponseHeader::ResponseHeader(QByteArray &buffer, const QByteArray &version, Status status, bool keepAlive) :
+    m_buffer(buffer)
+{
+    /* resize keeps the memory of the buffer, clear would not */
+    m_buffer.resize(0);
+    if (version == "HTTP/1.1")
+        m_buffer.append(status_11[status]);
+    else
+        m_buffer.append(status_10[status]);
+    m_buffer.append(date());
+    if (status == SwitchingProtocols)
+        m_buffer.append(server_upgrade);
+    else
+        m_buffer.append(keepAlive ? server_keep_alive : server_close);
+}
+
+void ResponseHeader::append(const char *name, qint64 value)
+{
+    m_buffer.append(name);
+    m_buffer.append(": ");
+    appendNumber(m_buffer, value);
+    m_buffer.append("\r\n");
+}
+
+/*
+ * QByteArray::number would need an array of its own.
+ */
+void ResponseHeader::appendNumber(QByteArray &buffer, qint64 value)
+{
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%lld", (long long)value);
+    buffer.append(digits, length);
+}
+
+bool ResponseHeader::fromCode(int code, Status &status)
+{
+    for (int i = 0; i < StatusCount; ++i) {
+        if (status_codes[i] == code) {
+            status = (Status)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+QByteArray &ResponseHeader::finish()
+{
+    m_buffer.append("\r\n");
+    return m_buffer;
+}
+
+/*
+ * The complete Date line, refreshed when the second changes.
+ */
+QByteArray ResponseHeader::date()
+{
+    if (!date_cache.hasLocalData())
+        date_cache.setLocalData(new DateCache());
+    DateCache *cache = date_cache.localData();
+    time_t now = time(NULL);
+    if (now == cache->second)
+        return cache->line;
+    cache->line = "Date: " + httpDate(now) + "\r\n";
+    cache->second = now;
+    return cache->line;
+}
+
+/*
+ * The IMF-fixdate format, "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+QByteArray ResponseHeader::httpDate(time_t time)
+{
+    struct tm utc;
+    gmtime_r(&time, &utc);
+    char date[32];
+    int length = snprintf(date, sizeof(date), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                          days[utc.tm_wday], utc.tm_mday, months[utc.tm_mon], utc.tm_year + 1900,
+                          utc.tm_hour, utc.tm_min, utc.tm_sec);
+    return QByteArray(date, length);
+}
+
+/*
+ * Only the IMF-fixdate format is understood. Clients send the value we gave
+ * them in Last-Modified, a date in one of the obsolete formats is treated as
+ * missing and the client simply gets the full reply.
+ */
+bool ResponseHeader::parseDate(const QByteArray &date, time_t &time)
+{
+    if (date.size() != 29)
+        return false;
+    const char *data = date.constData();
+    if ((data[3] != ',') || (data[4] != ' ') || (data[7] != ' ') || (data[11] != ' ')
+            || (data[16] != ' ') || (data[19] != ':') || (data[22] != ':') || (strncmp(data + 25, " GMT", 4) != 0))
+        return false;
+    static const int digits[] = { 5, 6, 12, 13, 14, 15, 17, 18, 20, 21, 23, 24 };
+    for (unsigned i = 0; i < sizeof(digits) / sizeof(digits[0]); ++i) {
+        if ((data[digits[i]] < '0') || (data[digits[i]] > '9'))
+            return false;
+    }
+    int month = 0;
+    while ((month < 12) && (strncmp(data + 8, months[month], 3) != 0))
+        ++month;
+    if (month == 12)
+        return false;
+    struct tm utc;
+    memset(&utc, 0, sizeof(utc));
+    utc.tm_mday = (data[5] - '0') * 10 + (data[6] - '0');
+    utc.tm_mon = month;
+    utc.tm_year = (data[12] - '0') * 1000 + (data[13] - '0') * 100 + (data[14] - '0') * 10 + (data[15] - '0') - 1900;
+    utc.tm_hour = (data[17] - '0') * 10 + (data[18] - '0');
+    utc.tm_min = (data[20] - '0') * 10 + (data[21] - '0');
+    utc.tm_sec = (data[23] - '0') * 10 + (data[24] - '0');
+    time = timegm(&utc);
+    return time != (time_t)-1;
+}
@@ -0,0 +1,69 @@
+#ifndef RESPONSEHEADER_H
+#define RESPONSEHEADER_H
+
+#include <QtCore/QByteArray>
+#include <time.h>
+
+
+/*
+ * Builds the header of a reply in a single buffer, so the whole header (and a
+ * small body) goes to the socket in one write. The buffer is the caller's, a
+ * request keeps reusing the same one. The status lines and the lines
+ * that are the same for every reply are serialized once, the Date line is
+ * formatted at most once per second on each thread.
+ */
+class ResponseHeader
+{
+public:
+    enum Status {
+        SwitchingProtocols
+        , OK
+        , Created
+        , Accepted
+        , NoContent
+        , PartialContent
+        , MovedPermanently
+        , Found
+        , SeeOther
+        , NotModified
+        , TemporaryRedirect
+        , BadRequest
+        , Unauthorized
+        , Forbidden
+        , NotFound
+        , MethodNotAllowed
+        , RequestTimeout
+        , Conflict
+        , Gone
+        , PayloadTooLarge
+        , RangeNotSatisfiable
+        , UpgradeRequired
+        , TooManyRequests
+        , RequestHeaderTooLarge
+        , InternalServerError
+        , NotImplemented
+        , BadGateway
+        , ServiceUnavailable
+        , GatewayTimeout
+        , StatusCount
+    };
+private:
+    QByteArray &m_buffer;
+public:
+    /* The buffer belongs to the caller, it is emptied and reused. A 101 says Connection: Upgrade */
+    ResponseHeader(QByteArray &buffer, const QByteArray &version, Status status, bool keepAlive);
+    void append(const char *line) { m_buffer.append(line); }
+    void append(const QByteArray &lines) { m_buffer.append(lines); }
+    void append(const char *name, qint64 value);
+    /* Ends the header and returns it, the body can still be appended afterwards */
+    QByteArray &finish();
+    QByteArray &buffer() { return m_buffer; }
+    /* Replies that are not built by us come with a number */
+    static bool fromCode(int code, Status &status);
+    static QByteArray date();
+    static void appendNumber(QByteArray &buffer, qint64 value);
+    static QByteArray httpDate(time_t time);
+    static bool parseDate(const QByteArray &date, time_t &time);
+};
+
+#endif // RESPONSEHEADER_H
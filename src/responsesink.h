@@ -0,0 +1,22 @@
+#ifndef RESPONSESINK_H
+#define RESPONSESINK_H
+
+#include <QtCore/QByteArray>
+
+/*
+ * Where a handler puts its reply. It can be filled from any thread, but only
+ * from one at a time, and it must not be touched once finish() was called.
+ * The server adds Content-Length and Connection itself, a handler that sets
+ * them is ignored. The status is 200 unless set.
+ */
+class ResponseSink
+{
+public:
+    virtual ~ResponseSink() {}
+    virtual void setStatus(int code) = 0;
+    virtual void addHeader(const QByteArray &name, const QByteArray &value) = 0;
+    virtual void write(const QByteArray &data) = 0;
+    virtual void finish() = 0;
+};
+
+#endif // RESPONSESINK_H
@@ -0,0 +1,31 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <QtCore/QString>
+
+#include "folder.h"
+
+/*
+ * The result of resolving a request target against the configuration.
+ * It is computed once per request and used both to decide if the path
+ * exists and to produce the reply.
+ */
+class Route
+{
+public:
+    enum Kind {
+        NotFound
+        , Listing
+        , File
+        , Application
+    };
+    Kind kind;
+    Folder *folder;
+    /* Path inside the folder, always starting with '/' */
+    QString documentPath;
+
+    Route() : kind(NotFound), folder(NULL) {}
+    bool isValid() const { return kind != NotFound; }
+};
+
+#endif // ROUTE_H
@@ -1,20 +1,33 @@
 #include <QHostAddress>
 #include <QDebug>
+#include <sys/socket.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "log.h"
 #include "server.h"
+#include "metrics.h"
+#ifdef RAINBOW_EPOLL
+#include "epollworker.h"
+#endif
 
-#define CLOCK_PULSE 1000
+#define SERVER_SETTLE 500    /* Milliseconds without changes before a watched file is read */
+
+int Server::m_hangupPair[2];
 
 Server::Server(QObject *parent) :
-    m_schedulerThreshold(5),
     m_started(false)
 {
     m_configuration = new Configuration();
-    m_server = new QTcpServer(parent);
-    m_scheduler = new QTimer(parent);
-    m_scheduler->setInterval(CLOCK_PULSE);
-    m_now = 0;
+    m_server = new Acceptor(parent);
+    m_metrics = NULL;
+    m_watcher = NULL;
+    m_hangup = NULL;
+    m_settle = new QTimer(this);
+    m_settle->setSingleShot(true);
+    m_settle->setInterval(SERVER_SETTLE);
+    connect(m_settle, SIGNAL(timeout()), this, SLOT(reload()));
 }
 
 bool Server::start()
@@ -28,259 +41,205 @@ bool Server::start()
         log->entry(Log::LogLevelCritical, "could not parse configuration file");
         return false;
     }
-    // Set the initial time
-    m_now = QDateTime::currentMSecsSinceEpoch();
-    // Connect the appropriate signals
-    connect(m_server, SIGNAL(newConnection()), this, SLOT(incomming_connection()));
-    connect(m_scheduler, SIGNAL(timeout()), this, SLOT(dispatch()));
-    // Finally start the server and the scheduler
-    m_started = m_server->listen(QHostAddress::Any, m_configuration->port());
-    m_scheduler->start();
+    count_folders(m_configuration);
+    /*
+     * From now on the configuration is read only, it is shared by all the workers.
+     * A reload does not change it either, it replaces it.
+     * With a single worker there is no need for extra threads, it uses our event loop.
+     */
+    int workers = m_configuration->workers();
+    for (int i = 0; i < workers; ++i) {
+        Worker *worker = create_worker();
+        if (!worker) {
+            stop();
+            return false;
+        }
+        connect(worker, SIGNAL(released()), this, SLOT(collect()), Qt::QueuedConnection);
+        m_workers.append(worker);
+        if (workers == 1) {
+            worker->start();
+            continue;
+        }
+        QThread *thread = new QThread(this);
+        worker->moveToThread(thread);
+        connect(thread, SIGNAL(started()), worker, SLOT(start()));
+        connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+        m_threads.append(thread);
+        thread->start();
+    }
+    log->entry(Log::LogLevelNormal, QString("started %1 workers").arg(workers));
+    // Finally start accepting connections
+    m_server->setWorkers(m_workers);
+    m_server->setAdmission(m_configuration->admission());
+    if (m_configuration->ioMode() == Configuration::Epoll)
+        m_started = true;
+    else
+        m_started = m_server->listen(QHostAddress::Any, m_configuration->port());
+    /* The same workers serve the metrics, they only listen on the loopback */
+    if (m_started && m_configuration->metricsPort()) {
+        m_metrics = new Acceptor(m_server->parent());
+        m_metrics->setWorkers(m_workers);
+        /* No admission, a full server is exactly when the operator wants to look at it */
+        if (!m_metrics->listen(QHostAddress::LocalHost, m_configuration->metricsPort()))
+            log->entry(Log::LogLevelCritical, "could not listen on the metrics port");
+    }
+    if (m_started) {
+        if (!install_hangup())
+            log->entry(Log::LogLevelCritical, "could not install the SIGHUP handler, reloads are off");
+        watch();
+    }
     return m_started;
 }
 
 /*
- * Take care of incomming connections
+ * With io="epoll" every worker listens on the port itself, the acceptor
+ * only serves the metrics port then.
  */
-int Server::process_incomming(int max_requests)
+Worker *Server::create_worker()
 {
-    Log *log = Log::instance();
-    if (m_incomming.isEmpty()) {
-        log->entry(Log::LogLevelDebug, "no incomming connections");
-        return 0;
-    }
-    int processed = 0;
-    log->entry(Log::LogLevelDebug, "found incomming connections");
-    QMutableListIterator<QTcpSocket *> i(m_incomming);
-    while (i.hasNext()) {
-        if (processed >= max_requests) {
-            log->entry(Log::LogLevelNormal, "stopping processing of incomming connections after max_requests");
-            return processed;
-        }
-        ++processed;
-        QTcpSocket *connection = i.next();
-        if (connection->bytesAvailable()) {
-            // Remove it carefully from the list
-            m_incomming.removeOne(connection);
-            // Construct a new request
-            Request *request = new Request(connection, m_now);
-            // Add it to the pending queue
-            m_pending.enqueue(request);
+#ifdef RAINBOW_EPOLL
+    if (m_configuration->ioMode() == Configuration::Epoll) {
+        EpollWorker *worker = new EpollWorker(m_configuration);
+        if (!worker->listen(m_configuration->port())) {
+            delete worker;
+            return NULL;
         }
+        return worker;
     }
-    return processed;
+#endif
+    return new Worker(m_configuration);
 }
+
 /*
- * Take care of pending requests
+ * The usual way out of a signal handler: the only thing it does is writing a
+ * byte, the event loop sees it and does the work.
  */
-int Server::process_pending(int max_requests)
+bool Server::install_hangup()
 {
-    Log *log = Log::instance();
-    // Check if we have pending requests
-    if (m_pending.isEmpty()) {
-        log->entry(Log::LogLevelDebug, "no pending requests");
-        return 0;
-    }
-    int processed = 0;
-    while (!m_pending.isEmpty()) {
-        if (processed >= max_requests) {
-            log->entry(Log::LogLevelNormal, "stopping processing of pending requests after max_requests");
-            return processed;
-        }
-        ++processed;
-        Request *request = m_pending.dequeue();
-        if (request->isExpired(m_now))
-        {
-            log->entry(Log::LogLevelNormal, "request expired");
-            continue;
-        }
-        if (request->fetch())
-        {
-            log->entry(Log::LogLevelDebug, "pending request was fetched from the wire");
-            // Put it into the inProgress queue
-            m_inProgress.enqueue(request);
-        }
-    }
-    return processed;
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, m_hangupPair) != 0)
+        return false;
+    m_hangup = new QSocketNotifier(m_hangupPair[1], QSocketNotifier::Read, this);
+    connect(m_hangup, SIGNAL(activated(int)), this, SLOT(hangup_activated()));
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = hangup_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    return ::sigaction(SIGHUP, &action, NULL) == 0;
 }
 
-/*
- * Take care of in progress requests
- */
-int Server::process_inProgress(int max_requests)
+void Server::hangup_handler(int signal)
 {
-    Log *log = Log::instance();
-    if (m_inProgress.isEmpty()) {
-        log->entry(Log::LogLevelDebug, "no in progress requests");
-        return 0;
-    }
-    int processed = 0;
-    while (!m_inProgress.isEmpty()) {
-        if (processed >= max_requests) {
-            log->entry(Log::LogLevelNormal, "stopping processing of in progress requests after max_requests");
-            return processed;
-        }
-        ++processed;
-        Request *request = m_inProgress.dequeue();
-        if (request->parse()) {
-            /*
-             * It does not matter if there are errors in the request, since we are just a scheduler.
-             * The only situation that is of interest to us is if the request requires more data from
-             * the network. In that case parse() returns false.
-             */
-            log->entry(Log::LogLevelDebug, "moving forward");
-            m_outgoing.enqueue(request);
-        } else {
-            /* Back to pending */
-            log->entry(Log::LogLevelDebug, "going back");
-            m_pending.enqueue(request);
-        }
-    }
-    return processed;
+    Q_UNUSED(signal);
+    char byte = 1;
+    ssize_t written = ::write(m_hangupPair[0], &byte, sizeof(byte));
+    Q_UNUSED(written);
+}
+
+void Server::hangup_activated()
+{
+    char byte;
+    m_hangup->setEnabled(false);
+    ssize_t bytes = ::read(m_hangupPair[1], &byte, sizeof(byte));
+    Q_UNUSED(bytes);
+    m_hangup->setEnabled(true);
+    reload();
 }
 
 /*
- * Take care of outgoing requests
+ * Every folder gets its place in the metrics before a worker can see it, the
+ * ones a reload adds included.
  */
-int Server::process_outgoing(int max_requests)
+void Server::count_folders(Configuration *configuration)
 {
-    Log *log = Log::instance();
-    if (m_outgoing.isEmpty()) {
-        log->entry(Log::LogLevelDebug, "no outgoing requests");
-        return 0;
-    }
-    int processed = 0;
-    while (!m_outgoing.isEmpty()) {
-        if (processed >= max_requests) {
-            log->entry(Log::LogLevelNormal, "stopping processing of outgoing requests after max_requests");
-            return processed;
-        }
-        ++processed;
-        Request *request = m_outgoing.dequeue();
-        request->reply(m_configuration);
-        log->entry(Log::LogLevelDebug, "connection replied, closing it");
-        m_waiting.append(request);
-    }
-    return processed;
+    Metrics *metrics = Metrics::instance();
+    foreach (Folder *folder, configuration->folders())
+        folder->setMetric(metrics->addFolder(folder->name()));
 }
 
 /*
- * Take care of waiting requests
+ * Editors usually replace the file instead of writing it, then the watcher
+ * forgets it, so it is added again every time.
  */
-int Server::process_waiting(int max_requests)
+void Server::watch()
 {
-    Log *log = Log::instance();
-    if (m_waiting.isEmpty()) {
-        log->entry(Log::LogLevelDebug, "no waiting requests");
-        return 0;
+    if (!m_configuration->isWatched()) {
+        delete m_watcher;
+        m_watcher = NULL;
+        return;
     }
-    int processed = 0;
-    QMutableListIterator<Request *> i(m_waiting);
-    while (i.hasNext()) {
-        if (processed >= max_requests) {
-            log->entry(Log::LogLevelNormal, "stopping processing of waiting requests after max_requests");
-            return processed;
-        }
-        ++processed;
-        Request *request = i.next();
-        if (request->isReady()) {
-            log->entry(Log::LogLevelDebug, "request replied");
-            m_waiting.removeOne(request);
-            request->close();
-        }
+    if (!m_watcher) {
+        m_watcher = new QFileSystemWatcher(this);
+        connect(m_watcher, SIGNAL(fileChanged(QString)), this, SLOT(file_changed()));
     }
-    return processed;
+    if (!m_watcher->files().contains(m_configuration->configurationFile()))
+        m_watcher->addPath(m_configuration->configurationFile());
 }
 
-void Server::stop()
+void Server::file_changed()
 {
-    m_server->close();
-    m_started = false;
+    m_settle->start();
 }
 
 /*
- * We do not service the connection here, we just put it into the incomming queue
+ * The file is parsed into a new snapshot next to the running one, which
+ * stays if the file has problems. The workers take the new one between
+ * requests, unchanged folders come along with everything they have.
  */
-void Server::incomming_connection()
+void Server::reload()
 {
     Log *log = Log::instance();
-    log->entry(Log::LogLevelDebug, "received connection");
-    QTcpSocket *connection = m_server->nextPendingConnection();
-    m_incomming.append(connection);
+    if (!m_started)
+        return;
+    log->entry(Log::LogLevelNormal, "reloading configuration");
+    Configuration *configuration = new Configuration();
+    configuration->setConfigurationFile(m_configuration->configurationFile());
+    if (!configuration->parse(m_configuration)) {
+        log->entry(Log::LogLevelCritical, "could not parse configuration file, keeping the running one");
+        delete configuration;
+        watch();
+        return;
+    }
+    count_folders(configuration);
+    foreach (Worker *worker, m_workers)
+        worker->publish(configuration);
+    m_retired.append(m_configuration);
+    m_configuration->release();
+    m_configuration = configuration;
+    watch();
+    collect();
 }
 
 /*
- * Scheduler: Find what is the highest priority task to perform
- * and do it.
- * We try to execute light tasks often and leave those tasks that
- * take longer time to when we are free.
- * Priorization:
- * 1. incomming (cpu)
- * 2. inProgress (cpu)
- * 3. waiting (cpu)
- * 4. pending (I/O)
- * 5. outgoing (I/O)
- *
- * If any of the queues go above the threshold, then we serve that queue
- * first regardless of the priorities. We start in reverse order.
- *
- * If there are no requests, we just return.
+ * A worker dropped a snapshot. Folders are only ever deleted from here, web
+ * folders and plugins live in our thread.
  */
-void Server::dispatch()
+void Server::collect()
 {
-    if (!m_started)
-        return;
-    Log *log = Log::instance();
-    log->entry(Log::LogLevelDebug, "mark");
-    /* We add one second */
-    m_now += CLOCK_PULSE;
-    int incomming_count = m_incomming.count();
-    int pending_count = m_pending.count();
-    int inProgress_count = m_inProgress.count();
-    int outgoing_count = m_outgoing.count();
-    int waiting_count = m_waiting.count();
-    int total_count = incomming_count + pending_count + inProgress_count + outgoing_count + waiting_count;
-
-    if (total_count == 0)
-        return;
-
-    if (outgoing_count >= m_schedulerThreshold) {
-        process_outgoing(m_schedulerThreshold/2);
-        return;
-    }
-    if (pending_count >= m_schedulerThreshold) {
-        process_pending(m_schedulerThreshold/2);
-        return;
-    }
-    if (waiting_count >= m_schedulerThreshold) {
-        process_waiting(m_schedulerThreshold/2);
-        return;
-    }
-    if (inProgress_count >= m_schedulerThreshold) {
-        process_inProgress(m_schedulerThreshold/2);
-        return;
-    }
-    if (incomming_count >= m_schedulerThreshold) {
-        process_incomming(m_schedulerThreshold/2);
-        return;
+    QMutableListIterator<Configuration *> i(m_retired);
+    while (i.hasNext()) {
+        Configuration *configuration = i.next();
+        if (configuration->isReleased()) {
+            i.remove();
+            delete configuration;
+        }
     }
+}
 
-    /*
-     * If we have come all the way here, then there are no urgencies.
-     * Go through them in order of priorities.
-     */
-    int total_served = 0;
-    total_served = process_incomming(m_schedulerThreshold);
-    if (total_served >= m_schedulerThreshold)
-        return;
-    total_served += process_inProgress(m_schedulerThreshold);
-    if (total_served >= m_schedulerThreshold)
-        return;
-    total_served += process_waiting(m_schedulerThreshold);
-    if (total_served >= m_schedulerThreshold)
-        return;
-    total_served += process_pending(m_schedulerThreshold);
-    if (total_served >= m_schedulerThreshold)
-        return;
-    total_served += process_outgoing(m_schedulerThreshold);
+void Server::stop()
+{
+    m_server->close();
+    if (m_metrics)
+        m_metrics->close();
+    if (m_threads.isEmpty()) {
+        foreach (Worker *worker, m_workers)
+            worker->stop();
+    }
+    /* The workers living in other threads are deleted when their thread finishes */
+    foreach (QThread *thread, m_threads) {
+        thread->quit();
+        thread->wait();
+    }
+    m_threads.clear();
+    m_started = false;
 }
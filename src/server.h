@@ -3,41 +3,54 @@
 
 #include <QtCore/QString>
 #include <QtCore/QList>
-#include <QtCore/QQueue>
+#include <QtCore/QThread>
 #include <QtCore/QTimer>
-#include <QtCore/QDateTime>
-#include <QtNetwork/QTcpServer>
-#include <QtNetwork/QTcpSocket>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QFileSystemWatcher>
 
 #include "configuration.h"
 #include "log.h"
-#include "request.h"
+#include "acceptor.h"
+#include "worker.h"
 
+/*
+ * The server owns the configuration and the acceptor. The connections are
+ * served by the workers, each one of them in its own thread if more than
+ * one worker is configured.
+ * SIGHUP, or a change of the file when it is watched, reloads the
+ * configuration. The new snapshot is published to the workers, the previous
+ * ones are kept until every worker is done with them.
+ */
 class Server : public QObject
 {
     Q_OBJECT
-    int m_schedulerThreshold;
     bool m_started;
-    qint64 m_now;
-    QTimer *m_scheduler;
     Configuration *m_configuration;
-    QTcpServer *m_server;
-    QList<QTcpSocket *> m_incomming;
-    QQueue<Request *> m_pending;
-    QQueue<Request *> m_inProgress;
-    QQueue<Request *> m_outgoing;
-    QList<Request *> m_waiting;
+    Acceptor *m_server;
+    /* Only when the metrics have a port of their own */
+    Acceptor *m_metrics;
+    QList<Worker *> m_workers;
+    QList<QThread *> m_threads;
+    /* Replaced by a reload, deleted once no worker holds them */
+    QList<Configuration *> m_retired;
+    QFileSystemWatcher *m_watcher;
+    /* Editors write a file in several steps, the reload waits for the last one */
+    QTimer *m_settle;
+    QSocketNotifier *m_hangup;
+    /* The signal handler writes to the first one, the event loop reads the second */
+    static int m_hangupPair[2];
 
-    int process_incomming(int max_requests);
-    int process_pending(int max_requests);
-    int process_inProgress(int max_requests);
-    int process_outgoing(int max_requests);
-    int process_waiting(int max_requests);
-
-     friend class Request;
+    Worker *create_worker();
+    bool install_hangup();
+    void watch();
+    static void count_folders(Configuration *configuration);
+    static void hangup_handler(int signal);
 private slots:
-    void incomming_connection();
-    void dispatch();
+    void hangup_activated();
+    void file_changed();
+    void collect();
+public slots:
+    void reload();
 public:
     Server(QObject *parent);
     void setConfigurationFile(const QString &file) { m_configuration->setConfigurationFile(file); }
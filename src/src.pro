@@ -14,23 +14,86 @@ CONFIG   -= app_bundle
 
 TEMPLATE = app
 
+LIBS += -lz
+
 
 SOURCES += main.cpp \
-    handler.cpp \
     configuration.cpp \
     log.cpp \
     folder.cpp \
     webfolder.cpp \
     appfolder.cpp \
+    handlerresponse.cpp \
+    upstream.cpp \
+    upstreampool.cpp \
+    upstreamexchange.cpp \
+    cgiprotocol.cpp \
+    websocket.cpp \
+    websocketframe.cpp \
+    websocketdeflate.cpp \
     server.cpp \
-    request.cpp
+    worker.cpp \
+    acceptor.cpp \
+    admission.cpp \
+    bodyproducer.cpp \
+    filetransfer.cpp \
+    filereader.cpp \
+    contentcache.cpp \
+    compressioncache.cpp \
+    request.cpp \
+    requestpool.cpp \
+    metrics.cpp \
+    histogram.cpp \
+    timerwheel.cpp \
+    bufferpool.cpp \
+    requestparser.cpp \
+    responseheader.cpp
 
 HEADERS += \
     handler.h \
     configuration.h \
     log.h \
+    atomics.h \
     folder.h \
     webfolder.h \
     appfolder.h \
+    handlerrequest.h \
+    responsesink.h \
+    handlerresponse.h \
+    upstream.h \
+    upstreampool.h \
+    upstreamexchange.h \
+    cgiprotocol.h \
+    websocketchannel.h \
+    websockethandler.h \
+    websocket.h \
+    websocketframe.h \
+    websocketdeflate.h \
     server.h \
-    request.h
+    worker.h \
+    acceptor.h \
+    admission.h \
+    bodyproducer.h \
+    filetransfer.h \
+    filereader.h \
+    contentcache.h \
+    compressioncache.h \
+    request.h \
+    requestpool.h \
+    clientconnection.h \
+    metrics.h \
+    histogram.h \
+    timerwheel.h \
+    bufferpool.h \
+    requestparser.h \
+    route.h \
+    responseheader.h
+
+# Workers that serve their clients from epoll instead of QTcpSocket, io="epoll"
+linux {
+    DEFINES += RAINBOW_EPOLL
+    SOURCES += epollconnection.cpp \
+        epollworker.cpp
+    HEADERS += epollconnection.h \
+        epollworker.h
+}
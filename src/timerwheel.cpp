@@ -0,0 +1,137 @@
+#include "timerwheel.h"
+
+void TimerWheel::Timer::cancel()
+{
+    if (!m_next)
+        return;
+    m_previous->m_next = m_next;
+    m_next->m_previous = m_previous;
+    m_previous = NULL;
+    m_next = NULL;
+}
+
+/*
+ * The tick is in milliseconds, deadlines are rounded up to it.
+ */
+TimerWheel::TimerWheel(int tick) :
+    m_tick(qMax(tick, 1)),
+    m_current(0)
+{
+    for (int level = 0; level < TIMERWHEEL_LEVELS; ++level) {
+        for (int slot = 0; slot < TIMERWHEEL_SLOTS; ++slot) {
+            m_slots[level][slot].m_previous = &m_slots[level][slot];
+            m_slots[level][slot].m_next = &m_slots[level][slot];
+        }
+    }
+}
+
+/*
+ * Timers that are still waiting outlive us, they are left unlinked.
+ */
+TimerWheel::~TimerWheel()
+{
+    for (int level = 0; level < TIMERWHEEL_LEVELS; ++level) {
+        for (int slot = 0; slot < TIMERWHEEL_SLOTS; ++slot) {
+            Timer *head = &m_slots[level][slot];
+            while (head->m_next != head)
+                head->m_next->cancel();
+            head->m_previous = NULL;
+            head->m_next = NULL;
+        }
+    }
+}
+
+/*
+ * Where the clock starts, only meant to be called before anything is scheduled.
+ */
+void TimerWheel::reset(qint64 now)
+{
+    m_current = now / m_tick;
+}
+
+/*
+ * A timer that is already scheduled is moved. Deadlines that already passed
+ * expire on the next tick.
+ */
+void TimerWheel::schedule(Timer *timer, qint64 deadline, int kind)
+{
+    timer->cancel();
+    timer->m_deadline = deadline;
+    timer->m_kind = kind;
+    qint64 ticks = (deadline + m_tick - 1) / m_tick;
+    insert(timer, qMax(ticks, m_current + 1));
+}
+
+/*
+ * The level is chosen by how far the deadline is, the slot by the bits of
+ * the tick that belong to that level. Deadlines beyond the last level wait
+ * in its farthest slot and are sorted again when they get there.
+ */
+void TimerWheel::insert(Timer *timer, qint64 ticks)
+{
+    qint64 distance = ticks - m_current;
+    int level = 0;
+    while ((level < TIMERWHEEL_LEVELS - 1) && (distance >= ((qint64)1 << (TIMERWHEEL_BITS * (level + 1)))))
+        ++level;
+    qint64 farthest = ((qint64)1 << (TIMERWHEEL_BITS * TIMERWHEEL_LEVELS)) - 1;
+    if (distance > farthest)
+        ticks = m_current + farthest;
+    Timer *head = &m_slots[level][(ticks >> (TIMERWHEEL_BITS * level)) & (TIMERWHEEL_SLOTS - 1)];
+    timer->m_previous = head->m_previous;
+    timer->m_next = head;
+    head->m_previous->m_next = timer;
+    head->m_previous = timer;
+}
+
+/*
+ * The level below completed a turn, the current slot of this level is spread
+ * over the levels below. When this level completes a turn too, the one above
+ * goes next.
+ */
+void TimerWheel::cascade(int level)
+{
+    int index = (m_current >> (TIMERWHEEL_BITS * level)) & (TIMERWHEEL_SLOTS - 1);
+    Timer *head = &m_slots[level][index];
+    Timer *timer = NULL;
+    /* Detach the whole list first, some timers might go back to the same slot */
+    if (head->m_next != head) {
+        timer = head->m_next;
+        head->m_previous->m_next = NULL;
+        head->m_previous = head;
+        head->m_next = head;
+    }
+    while (timer) {
+        Timer *next = timer->m_next;
+        qint64 ticks = (timer->m_deadline + m_tick - 1) / m_tick;
+        insert(timer, qMax(ticks, m_current));
+        timer = next;
+    }
+    if ((index == 0) && (level + 1 < TIMERWHEEL_LEVELS))
+        cascade(level + 1);
+}
+
+/*
+ * Moves the clock towards now and hands out the next timer that expired,
+ * NULL once there is none left. One at a time, whatever the caller does with
+ * a timer can cancel or move the others, a timer cancelled in between is not
+ * handed out anymore. A timer is no longer scheduled when the caller gets it,
+ * scheduling it again does not bring it back before the next tick.
+ */
+TimerWheel::Timer *TimerWheel::take(qint64 now)
+{
+    qint64 target = now / m_tick;
+    forever {
+        /* Only the timers of the current tick can be in its slot */
+        Timer *head = &m_slots[0][m_current & (TIMERWHEEL_SLOTS - 1)];
+        if (head->m_next != head) {
+            Timer *timer = head->m_next;
+            timer->cancel();
+            return timer;
+        }
+        if (m_current >= target)
+            return NULL;
+        ++m_current;
+        if ((m_current & (TIMERWHEEL_SLOTS - 1)) == 0)
+            cascade(1);
+    }
+}
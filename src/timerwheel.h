@@ -0,0 +1,62 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QtCore/QtGlobal>
+
+#define TIMERWHEEL_LEVELS 3     /* With 64 slots each, 3 days of one second ticks */
+#define TIMERWHEEL_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_BITS)
+
+/*
+ * Deadlines sorted into slots by the tick they fall in, like the wheel of a
+ * clock: the first level has a slot per tick, every level above has a slot
+ * per turn of the one below. Scheduling and cancelling only link or unlink
+ * a timer, and advancing only looks at the slots the clock goes through, so
+ * the number of timers that are waiting does not matter. Timers of the upper
+ * levels move down a level when the one below completes a turn.
+ * Every worker has its own wheel, it is not thread safe.
+ */
+class TimerWheel
+{
+public:
+    /*
+     * Lives inside whatever it times, so it costs no allocation. It unlinks
+     * itself when it is cancelled or destroyed, it does not need the wheel.
+     */
+    class Timer
+    {
+        friend class TimerWheel;
+        Timer *m_previous;
+        Timer *m_next;
+        void *m_owner;
+        qint64 m_deadline;
+        int m_kind;
+
+        Timer(const Timer &);
+        Timer &operator=(const Timer &);
+    public:
+        Timer(void *owner = NULL) : m_previous(NULL), m_next(NULL), m_owner(owner), m_deadline(0), m_kind(0) {}
+        ~Timer() { cancel(); }
+        void cancel();
+        bool isActive() const { return m_next != NULL; }
+        void *owner() const { return m_owner; }
+        qint64 deadline() const { return m_deadline; }
+        int kind() const { return m_kind; }
+    };
+private:
+    int m_tick;
+    qint64 m_current;
+    /* Heads of the circular lists, they are never handed out */
+    Timer m_slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+
+    void insert(Timer *timer, qint64 ticks);
+    void cascade(int level);
+public:
+    TimerWheel(int tick);
+    ~TimerWheel();
+    void reset(qint64 now);
+    void schedule(Timer *timer, qint64 deadline, int kind = 0);
+    Timer *take(qint64 now);
+};
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,105 @@
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QLocalSocket>
+#include <time.h>
+
+#include "upstream.h"
+#include "log.h"
+
+Upstream::Upstream(Protocol protocol) :
+    m_protocol(protocol),
+    m_port(0),
+    m_connections(UPSTREAM_CONNECTIONS),
+    m_queue(UPSTREAM_QUEUE),
+    m_multiplex(1),
+    m_load(0),
+    m_failures(0),
+    m_downUntil(0)
+{
+}
+
+bool Upstream::isAvailable() const
+{
+    return load_relaxed(m_downUntil) <= (int)time(NULL);
+}
+
+/*
+ * Every reply gets here, the count is only written if there is one.
+ */
+void Upstream::succeeded() const
+{
+    if (load_relaxed(m_failures))
+        m_failures.fetchAndStoreRelaxed(0);
+}
+
+/*
+ * Only the failure that completes the series takes the backend out, the
+ * series starts again for when it comes back.
+ */
+void Upstream::failed() const
+{
+    if (m_failures.fetchAndAddRelaxed(1) + 1 < UPSTREAM_FAILURES)
+        return;
+    m_failures.fetchAndStoreRelaxed(0);
+    m_downUntil.fetchAndStoreRelaxed((int)time(NULL) + UPSTREAM_DOWNTIME);
+    Log::instance()->entry(Log::LogLevelCritical, QString("backend %1 keeps failing, leaving it alone for a while").arg(m_address));
+}
+
+/*
+ * Addresses are numeric, resolving names would block the worker.
+ */
+bool Upstream::setAddress(const QString &address)
+{
+    m_address = address;
+    if (address.startsWith("unix:")) {
+        m_path = address.mid(5);
+        return !m_path.isEmpty();
+    }
+    int colon = address.lastIndexOf(':');
+    if (colon <= 0)
+        return false;
+    bool ok;
+    uint port = address.mid(colon + 1).toUInt(&ok);
+    if (!ok || (port == 0) || (port > 65535))
+        return false;
+    m_port = (quint16)port;
+    return m_host.setAddress(address.left(colon));
+}
+
+/*
+ * Both kinds of socket read at most UPSTREAM_READ_BUFFER ahead, so a backend
+ * that is faster than the client is held back by the socket.
+ */
+QIODevice *Upstream::create(QObject *parent) const
+{
+    if (isLocal()) {
+        QLocalSocket *socket = new QLocalSocket(parent);
+        socket->setReadBufferSize(UPSTREAM_READ_BUFFER);
+        return socket;
+    }
+    QTcpSocket *socket = new QTcpSocket(parent);
+    socket->setReadBufferSize(UPSTREAM_READ_BUFFER);
+    return socket;
+}
+
+/*
+ * The connection is on its way when this returns, connected() tells when it
+ * is there. A local socket might fail right away, before returning.
+ */
+void Upstream::connect(QIODevice *device) const
+{
+    QLocalSocket *local = qobject_cast<QLocalSocket *>(device);
+    if (local)
+        local->connectToServer(m_path);
+    else
+        static_cast<QTcpSocket *>(device)->connectToHost(m_host, m_port);
+}
+
+void Upstream::close(QIODevice *device)
+{
+    QLocalSocket *local = qobject_cast<QLocalSocket *>(device);
+    if (local)
+        local->abort();
+    else
+        static_cast<QTcpSocket *>(device)->abort();
+    device->deleteLater();
+}
@@ -0,0 +1,76 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <QtCore/QString>
+#include <QtCore/QIODevice>
+#include <QtCore/QObject>
+#include <QtCore/QAtomicInt>
+#include <QtNetwork/QHostAddress>
+
+#include "atomics.h"
+
+#define UPSTREAM_CONNECTIONS 8      /* Connections each worker may open to a backend */
+#define UPSTREAM_QUEUE 64           /* Requests each worker lets wait for a connection */
+#define UPSTREAM_READ_BUFFER (64 * 1024)    /* What a connection reads ahead of a slow client */
+#define UPSTREAM_FAILURES 3         /* Failures in a row that take a backend out */
+#define UPSTREAM_DOWNTIME 10        /* Seconds it stays out before it is tried again */
+
+/*
+ * A backend an application folder forwards its requests to, "unix:/path"
+ * for a local socket or "host:port" for TCP. Only the description is shared,
+ * the connections belong to the pool of each worker, so the limits are per
+ * worker too, like maxqueue.
+ * What the balancer needs is shared by all the workers and atomic: how many
+ * requests the backend has, and whether it is up. Health is only checked
+ * passively, a backend that failed UPSTREAM_FAILURES requests in a row, by
+ * not connecting or not replying, is left alone for UPSTREAM_DOWNTIME
+ * seconds.
+ */
+class Upstream
+{
+public:
+    enum Protocol {
+        FastCgi
+        , Scgi
+        , Http
+    };
+private:
+    Protocol m_protocol;
+    QString m_address;
+    QString m_path;
+    QHostAddress m_host;
+    quint16 m_port;
+    int m_connections;
+    int m_queue;
+    int m_multiplex;
+    mutable QAtomicInt m_load;
+    mutable QAtomicInt m_failures;
+    mutable QAtomicInt m_downUntil;
+public:
+    Upstream(Protocol protocol);
+    bool setAddress(const QString &address);
+    Protocol protocol() const { return m_protocol; }
+    QString address() const { return m_address; }
+    bool isLocal() const { return !m_path.isEmpty(); }
+    int connections() const { return m_connections; }
+    void setConnections(int connections) { m_connections = connections; }
+    int queue() const { return m_queue; }
+    void setQueue(int queue) { m_queue = queue; }
+    /* Requests a connection carries at once, only FastCGI can have more than one */
+    int multiplex() const { return (m_protocol == FastCgi) ? m_multiplex : 1; }
+    void setMultiplex(int multiplex) { m_multiplex = multiplex; }
+    /* Whether a connection is used again once its requests are done */
+    bool isPersistent() const { return m_protocol != Scgi; }
+    /* Requests of all the workers that are queued for the backend or on it */
+    int load() const { return load_relaxed(m_load); }
+    void acquire() const { m_load.fetchAndAddRelaxed(1); }
+    void release() const { m_load.fetchAndAddRelaxed(-1); }
+    bool isAvailable() const;
+    void succeeded() const;
+    void failed() const;
+    QIODevice *create(QObject *parent) const;
+    void connect(QIODevice *device) const;
+    static void close(QIODevice *device);
+};
+
+#endif // UPSTREAM_H
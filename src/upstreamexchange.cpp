@@ -0,0 +1,651 @@
+#include <QtNetwork/QHostAddress>
+
+#include "upstreamexchange.h"
+#include "upstreampool.h"
+#include "log.h"
+
+static const QByteArray http_11("HTTP/1.1");
+
+/*
+ * The headers that only concern one connection, they are not passed on
+ * in either direction.
+ */
+static bool is_hop_by_hop(const QByteArray &name)
+{
+    return (name == "connection") || (name == "keep-alive") || (name == "proxy-connection") || (name == "te")
+            || (name == "trailer") || (name == "transfer-encoding") || (name == "upgrade");
+}
+
+UpstreamExchange::UpstreamExchange(Request *request, const QByteArray &version, bool keepAlive, bool head) :
+    m_request(request),
+    m_pool(NULL),
+    m_version(version),
+    m_keepAlive(keepAlive),
+    m_head(head),
+    m_client(NULL),
+    m_protocol(Upstream::Http),
+    m_bodyRemaining(0),
+    m_retryable(false),
+    m_received(false),
+    m_headerDone(false),
+    m_chunked(false),
+    m_complete(false),
+    m_failed(false),
+    m_sent(false),
+    m_notify(false),
+    m_framing(Close),
+    m_remaining(0),
+    m_chunkState(ChunkSize),
+    m_persistent(false),
+    m_connection(NULL),
+    m_id(0),
+    m_stalled(false)
+{
+}
+
+UpstreamExchange::~UpstreamExchange()
+{
+}
+
+/*
+ * The length the client announced and what of the body came with the header.
+ */
+void UpstreamExchange::setBody(qint64 length, const QByteArray &start)
+{
+    m_bodyStart = start;
+    m_bodyRemaining = length - start.size();
+}
+
+/*
+ * The meta variables of RFC 3875, plus the header lines of the request as
+ * HTTP_ variables. The body is read from the client by pullBody(), like the
+ * one of a proxied request.
+ */
+void UpstreamExchange::setEnvironment(const HandlerRequest &request, QTcpSocket *client, const QString &folder, const QString &script)
+{
+    qint64 length = m_bodyRemaining + m_bodyStart.size();
+    m_client = client;
+    QByteArray host = request.header("host");
+    int colon = host.lastIndexOf(':');
+    if ((colon != -1) && !host.endsWith(']'))
+        host.truncate(colon);
+    if (host.isEmpty())
+        host = client->localAddress().toString().toLatin1();
+    m_params.reserve(16 + request.headerCount());
+    m_params.append(qMakePair(QByteArray("GATEWAY_INTERFACE"), QByteArray("CGI/1.1")));
+    m_params.append(qMakePair(QByteArray("SERVER_SOFTWARE"), QByteArray("rainbow")));
+    m_params.append(qMakePair(QByteArray("SERVER_PROTOCOL"), request.version()));
+    m_params.append(qMakePair(QByteArray("SERVER_NAME"), host));
+    m_params.append(qMakePair(QByteArray("SERVER_ADDR"), client->localAddress().toString().toLatin1()));
+    m_params.append(qMakePair(QByteArray("SERVER_PORT"), QByteArray::number(client->localPort())));
+    m_params.append(qMakePair(QByteArray("REMOTE_ADDR"), client->peerAddress().toString().toLatin1()));
+    m_params.append(qMakePair(QByteArray("REMOTE_PORT"), QByteArray::number(client->peerPort())));
+    m_params.append(qMakePair(QByteArray("REQUEST_METHOD"), request.method()));
+    m_params.append(qMakePair(QByteArray("REQUEST_URI"), request.target()));
+    m_params.append(qMakePair(QByteArray("SCRIPT_NAME"), (folder == "/") ? QByteArray() : folder.toUtf8()));
+    m_params.append(qMakePair(QByteArray("PATH_INFO"), request.path().toUtf8()));
+    m_params.append(qMakePair(QByteArray("QUERY_STRING"), request.query()));
+    m_params.append(qMakePair(QByteArray("CONTENT_LENGTH"), (length > 0) ? QByteArray::number(length) : QByteArray()));
+    QByteArray type = request.header("content-type");
+    if (!type.isEmpty())
+        m_params.append(qMakePair(QByteArray("CONTENT_TYPE"), type));
+    if (!script.isEmpty())
+        m_params.append(qMakePair(QByteArray("SCRIPT_FILENAME"), script.toUtf8()));
+    for (int i = 0; i < request.headerCount(); ++i) {
+        QByteArray name = request.headerName(i).toUpper().replace('-', '_');
+        /* Not forwarded as HTTP_ variables, they would clash with the ones above */
+        if ((name == "CONTENT_LENGTH") || (name == "CONTENT_TYPE") || (name == "PROXY"))
+            continue;
+        m_params.append(qMakePair("HTTP_" + name, request.headerValue(i)));
+    }
+    if (m_bodyRemaining > 0)
+        client->setReadBufferSize(UPSTREAM_READ_BUFFER);
+}
+
+/*
+ * The request as the client sent it, always as HTTP/1.1 on a persistent
+ * connection, without what concerned the client's connection and with the
+ * client added to X-Forwarded-For. The body that came with the header goes
+ * in the same write, the rest is read from the client by pullBody(). Only a
+ * request without a body and without effects can be sent again if a kept
+ * connection turns out to be closed.
+ */
+void UpstreamExchange::setProxyRequest(const HandlerRequest &request, QTcpSocket *client)
+{
+    QByteArray method = request.method();
+    QByteArray forwarded;
+    bool host = false;
+    m_client = client;
+    m_retryable = (m_bodyRemaining == 0) && m_bodyStart.isEmpty()
+            && ((method == "GET") || (method == "HEAD") || (method == "OPTIONS"));
+    m_encoded.reserve(request.target().size() + 256 + 64 * request.headerCount());
+    m_encoded.append(method);
+    m_encoded.append(' ');
+    m_encoded.append(request.target());
+    m_encoded.append(" HTTP/1.1\r\n");
+    for (int i = 0; i < request.headerCount(); ++i) {
+        QByteArray name = request.headerName(i).toLower();
+        if (is_hop_by_hop(name))
+            continue;
+        if (name == "x-forwarded-for") {
+            forwarded = request.headerValue(i);
+            continue;
+        }
+        if (name == "host")
+            host = true;
+        m_encoded.append(request.headerName(i));
+        m_encoded.append(": ");
+        m_encoded.append(request.headerValue(i));
+        m_encoded.append("\r\n");
+    }
+    if (!host) {
+        m_encoded.append("Host: ");
+        m_encoded.append(client->localAddress().toString().toLatin1());
+        m_encoded.append("\r\n");
+    }
+    QByteArray peer = client->peerAddress().toString().toLatin1();
+    m_encoded.append("X-Forwarded-For: ");
+    m_encoded.append(forwarded.isEmpty() ? peer : forwarded + ", " + peer);
+    m_encoded.append("\r\nX-Forwarded-Proto: http\r\nConnection: keep-alive\r\n\r\n");
+    m_encoded.append(m_bodyStart);
+    m_bodyStart = QByteArray();
+    /* The client socket must not read the whole body into memory ahead of the backend */
+    if (m_bodyRemaining > 0)
+        client->setReadBufferSize(UPSTREAM_READ_BUFFER);
+}
+
+/*
+ * Only used before anything reached the client, afterwards the only way to
+ * tell that the reply is broken is to close the connection.
+ */
+void UpstreamExchange::reply_error(ResponseHeader::Status status)
+{
+    m_keepAlive = false;
+    m_chunked = false;
+    m_persistent = false;
+    ResponseHeader header(m_output, m_version, status, false);
+    header.append("Content-Length: 0\r\n");
+    header.finish();
+    m_headerDone = true;
+    m_complete = true;
+}
+
+/*
+ * Our header from what the backend said. A body of unknown length is sent
+ * chunked to HTTP/1.1 clients and ends with the connection for the others.
+ */
+bool UpstreamExchange::build_header(int code, const QByteArray &lines, bool length)
+{
+    ResponseHeader::Status status;
+    if (!ResponseHeader::fromCode(code, status) || (status == ResponseHeader::SwitchingProtocols)) {
+        Log::instance()->entry(Log::LogLevelCritical, "backend replied with an unknown status");
+        return false;
+    }
+    if (!length && !m_head) {
+        if (m_version == http_11)
+            m_chunked = true;
+        else
+            m_keepAlive = false;
+    }
+    ResponseHeader header(m_output, m_version, status, m_keepAlive);
+    header.append(lines);
+    if (m_chunked)
+        header.append("Transfer-Encoding: chunked\r\n");
+    header.finish();
+    m_headerDone = true;
+    return true;
+}
+
+/*
+ * The CGI header becomes the header of our reply: Status gives the status,
+ * a Location without it is a redirect, everything else goes through except
+ * what frames the reply, which is ours to decide.
+ */
+bool UpstreamExchange::translate_header(int end, int skip)
+{
+    int code = 200;
+    bool location = false;
+    bool status = false;
+    bool length = false;
+    QByteArray lines;
+    int start = 0;
+    while (start < end) {
+        int stop = m_header.indexOf('\n', start);
+        if ((stop == -1) || (stop > end))
+            stop = end;
+        QByteArray line = m_header.mid(start, stop - start);
+        start = stop + 1;
+        if (line.endsWith('\r'))
+            line.chop(1);
+        int colon = line.indexOf(':');
+        if (colon <= 0)
+            continue;
+        QByteArray name = line.left(colon).trimmed().toLower();
+        QByteArray value = line.mid(colon + 1).trimmed();
+        if (name == "status") {
+            code = value.left(3).toInt();
+            status = true;
+            continue;
+        }
+        if (is_hop_by_hop(name))
+            continue;
+        if (name == "location")
+            location = true;
+        else if (name == "content-length")
+            length = true;
+        lines.append(line);
+        lines.append("\r\n");
+    }
+    if (location && !status)
+        code = 302;
+    if (!build_header(code, lines, length))
+        return false;
+    int rest = m_header.size() - end - skip;
+    if (rest > 0)
+        append_body(m_header.constData() + end + skip, rest);
+    m_header = QByteArray();
+    return true;
+}
+
+/*
+ * The header of an HTTP backend. Returns 0 for an interim 1xx reply, which
+ * is dropped, and -1 if it makes no sense. How the body ends decides whether
+ * the connection can carry another request afterwards.
+ */
+int UpstreamExchange::translate_response(int limit)
+{
+    int first = m_header.indexOf("\r\n");
+    if ((first == -1) || (first > limit))
+        first = limit;
+    QByteArray status = m_header.left(first);
+    if (!status.startsWith("HTTP/1.") || (status.size() < 12))
+        return -1;
+    int code = status.mid(9, 3).toInt();
+    if (code < 100)
+        return -1;
+    if (code < 200)
+        return 0;
+    bool close = (status.at(7) == '0');
+    bool chunked = false;
+    bool length = false;
+    bool ok = true;
+    QByteArray lines;
+    QByteArray lengthLine;
+    int start = first + 2;
+    while (start < limit) {
+        int stop = m_header.indexOf("\r\n", start);
+        if ((stop == -1) || (stop > limit))
+            stop = limit;
+        QByteArray line = m_header.mid(start, stop - start);
+        start = stop + 2;
+        int colon = line.indexOf(':');
+        if (colon <= 0)
+            continue;
+        QByteArray name = line.left(colon).trimmed().toLower();
+        QByteArray value = line.mid(colon + 1).trimmed().toLower();
+        if (name == "connection") {
+            if (value.contains("close"))
+                close = true;
+            else if (value.contains("keep-alive"))
+                close = false;
+            continue;
+        }
+        if (name == "transfer-encoding") {
+            chunked = value.contains("chunked");
+            continue;
+        }
+        if (is_hop_by_hop(name))
+            continue;
+        if (name == "content-length") {
+            m_remaining = value.toLongLong(&ok);
+            if (!ok || (m_remaining < 0))
+                return -1;
+            length = true;
+            lengthLine = line + "\r\n";
+            continue;
+        }
+        lines.append(line);
+        lines.append("\r\n");
+    }
+    if (m_head || (code == 204) || (code == 304))
+        m_framing = NoBody;
+    else if (chunked)
+        m_framing = Chunked;
+    else if (length)
+        m_framing = Length;
+    else
+        m_framing = Close;
+    m_persistent = !close && (m_framing != Close);
+    /* A chunked body has no length, whatever the backend also said */
+    if ((m_framing == Length) || ((m_framing == NoBody) && !chunked))
+        lines.append(lengthLine);
+    if (!build_header(code, lines, (m_framing == Length) || (m_framing == NoBody)))
+        return -1;
+    if ((m_framing == NoBody) || ((m_framing == Length) && (m_remaining == 0)))
+        end();
+    return 1;
+}
+
+void UpstreamExchange::append_body(const char *data, int size)
+{
+    if (m_head || (size == 0))
+        return;
+    if (m_chunked) {
+        m_output.append(QByteArray::number(size, 16));
+        m_output.append("\r\n");
+        m_output.append(data, size);
+        m_output.append("\r\n");
+        return;
+    }
+    m_output.append(data, size);
+}
+
+/*
+ * What the CGI backend wrote, the header first and then the body.
+ */
+void UpstreamExchange::receive(const char *data, int size)
+{
+    if (m_complete)
+        return;
+    m_received = true;
+    if (m_headerDone) {
+        append_body(data, size);
+        return;
+    }
+    m_header.append(data, size);
+    int end = m_header.indexOf("\r\n\r\n");
+    int skip = 4;
+    int bare = m_header.indexOf("\n\n");
+    if ((bare != -1) && ((end == -1) || (bare < end))) {
+        end = bare;
+        skip = 2;
+    }
+    if (end == -1) {
+        if (m_header.size() > UPSTREAM_MAX_HEADER) {
+            Log::instance()->entry(Log::LogLevelCritical, "backend header too large");
+            m_header = QByteArray();
+            reply_error(ResponseHeader::BadGateway);
+        }
+        return;
+    }
+    if (!translate_header(end, skip)) {
+        m_header = QByteArray();
+        reply_error(ResponseHeader::BadGateway);
+    }
+}
+
+/*
+ * What an HTTP backend wrote. Returns how much of it belongs to this reply,
+ * anything after its end is not ours.
+ */
+int UpstreamExchange::receiveResponse(const char *data, int size)
+{
+    Log *log = Log::instance();
+    if (size > 0)
+        m_received = true;
+    int used = 0;
+    while (!m_complete && (used < size)) {
+        if (m_headerDone) {
+            used += receive_body(data + used, size - used);
+            continue;
+        }
+        int before = m_header.size();
+        m_header.append(data + used, size - used);
+        int end = m_header.indexOf("\r\n\r\n");
+        if (end == -1) {
+            if (m_header.size() > UPSTREAM_MAX_HEADER) {
+                log->entry(Log::LogLevelCritical, "backend header too large");
+                m_header = QByteArray();
+                reply_error(ResponseHeader::BadGateway);
+            }
+            return size;
+        }
+        used += end + 4 - before;
+        int result = translate_response(end);
+        m_header = QByteArray();
+        if (result < 0) {
+            log->entry(Log::LogLevelCritical, "invalid reply from backend");
+            reply_error(ResponseHeader::BadGateway);
+            return size;
+        }
+    }
+    return used;
+}
+
+int UpstreamExchange::receive_body(const char *data, int size)
+{
+    switch (m_framing) {
+    case Length: {
+        int length = (int)qMin((qint64)size, m_remaining);
+        append_body(data, length);
+        m_remaining -= length;
+        if (m_remaining == 0)
+            end();
+        return length;
+    }
+    case Chunked:
+        return receive_chunked(data, size);
+    case Close:
+        append_body(data, size);
+        return size;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * A line of the chunked framing, which might come in pieces.
+ */
+bool UpstreamExchange::take_line(const char *data, int size, int &used)
+{
+    const char *newline = (const char *)memchr(data + used, '\n', size - used);
+    if (!newline) {
+        m_line.append(data + used, size - used);
+        used = size;
+        return false;
+    }
+    m_line.append(data + used, newline - (data + used));
+    used = newline - data + 1;
+    if (m_line.endsWith('\r'))
+        m_line.chop(1);
+    return true;
+}
+
+/*
+ * The backend's chunks are taken apart, the client gets ours, which are as
+ * big as what we happened to read.
+ */
+int UpstreamExchange::receive_chunked(const char *data, int size)
+{
+    int used = 0;
+    while ((used < size) && !m_complete) {
+        if (m_chunkState == ChunkData) {
+            int length = (int)qMin((qint64)(size - used), m_remaining);
+            append_body(data + used, length);
+            used += length;
+            m_remaining -= length;
+            if (m_remaining == 0)
+                m_chunkState = ChunkEnd;
+            continue;
+        }
+        if (!take_line(data, size, used)) {
+            if (m_line.size() > UPSTREAM_MAX_HEADER) {
+                Log::instance()->entry(Log::LogLevelCritical, "invalid chunk from backend");
+                fail();
+            }
+            return used;
+        }
+        QByteArray line = m_line;
+        m_line.resize(0);
+        if (m_chunkState == ChunkEnd) {
+            m_chunkState = ChunkSize;
+        } else if (m_chunkState == ChunkSize) {
+            int extension = line.indexOf(';');
+            if (extension != -1)
+                line.truncate(extension);
+            bool ok;
+            m_remaining = line.trimmed().toLongLong(&ok, 16);
+            if (!ok || (m_remaining < 0)) {
+                Log::instance()->entry(Log::LogLevelCritical, "invalid chunk from backend");
+                fail();
+                return size;
+            }
+            m_chunkState = (m_remaining == 0) ? Trailer : ChunkData;
+        } else if (line.isEmpty()) {
+            /* Trailers are dropped, the empty line ends the reply */
+            end();
+        }
+    }
+    return used;
+}
+
+/*
+ * The backend is done. A reply that never got its header is a broken backend.
+ */
+void UpstreamExchange::end()
+{
+    if (m_complete)
+        return;
+    if (!m_headerDone) {
+        Log::instance()->entry(Log::LogLevelCritical, "backend closed before its header");
+        reply_error(ResponseHeader::BadGateway);
+        return;
+    }
+    if (m_chunked)
+        m_output.append("0\r\n\r\n");
+    m_complete = true;
+}
+
+/*
+ * The connection to the backend broke, never came up, or the reply made no sense.
+ */
+void UpstreamExchange::fail()
+{
+    if (m_complete)
+        return;
+    m_persistent = false;
+    if (!m_headerDone || !m_sent) {
+        m_output.resize(0);
+        reply_error(ResponseHeader::BadGateway);
+        return;
+    }
+    m_failed = true;
+    m_complete = true;
+}
+
+/*
+ * The pool has no room for it.
+ */
+void UpstreamExchange::reject()
+{
+    reply_error(ResponseHeader::ServiceUnavailable);
+}
+
+/*
+ * More of the request body for the backend, as much as the connection has
+ * room for. Called when the client sent more and when the connection wrote
+ * some, whatever is not read stays in the client socket, which stops reading
+ * once its buffer is full.
+ */
+void UpstreamExchange::pullBody()
+{
+    if ((m_bodyRemaining <= 0) || !m_client || !m_connection || !m_connection->connected)
+        return;
+    qint64 room = BODY_HIGH_WATER - m_connection->device->bytesToWrite();
+    qint64 size = qMin(qMin(room, m_client->bytesAvailable()), m_bodyRemaining);
+    if (size <= 0)
+        return;
+    QByteArray data = m_client->read(size);
+    m_bodyRemaining -= data.size();
+    QByteArray encoded;
+    encode_body(encoded, data);
+    m_connection->device->write(encoded);
+}
+
+/*
+ * For the pool, right after the header of the request: the part of the body
+ * that came with the header of the client.
+ */
+void UpstreamExchange::appendBodyStart(QByteArray &request)
+{
+    encode_body(request, m_bodyStart);
+    m_bodyStart = QByteArray();
+}
+
+/*
+ * FastCGI wraps the body in stdin records and ends it with an empty one,
+ * which a request without a body gets too. The others take it as it is.
+ */
+void UpstreamExchange::encode_body(QByteArray &buffer, const QByteArray &data) const
+{
+    if (m_protocol != Upstream::FastCgi) {
+        buffer.append(data);
+        return;
+    }
+    if (!data.isEmpty())
+        FastCgi::appendStdin(buffer, m_id, data.constData(), data.size());
+    if (m_bodyRemaining <= 0)
+        FastCgi::appendStdin(buffer, m_id, NULL, 0);
+}
+
+void UpstreamExchange::notifyProgress()
+{
+    if (m_notify && m_request)
+        emit progress();
+}
+
+/*
+ * Pending while there is nothing for the client yet or while the client has
+ * enough to take, the worker hears about the first from progress() and about
+ * the second from the socket. A connection the pool stopped reading for us
+ * is resumed as soon as we are below the mark again.
+ */
+BodyProducer::Status UpstreamExchange::produce(ClientConnection *socket)
+{
+    if (!m_output.isEmpty()) {
+        qint64 room = BODY_HIGH_WATER - socket->bytesToWrite();
+        if (room <= 0)
+            return BodyProducer::Pending;
+        if (room >= m_output.size()) {
+            socket->write(m_output);
+            m_output.resize(0);
+        } else {
+            socket->write(m_output.constData(), room);
+            m_output.remove(0, (int)room);
+        }
+        m_sent = true;
+        if (m_stalled && m_pool && !isFull()) {
+            m_stalled = false;
+            m_pool->resume();
+        }
+    }
+    if (!m_output.isEmpty() || !m_complete)
+        return BodyProducer::Pending;
+    return m_failed ? BodyProducer::Failed : BodyProducer::Done;
+}
+
+/*
+ * Connected once, on the same thread, so the receiver hears about it right away.
+ */
+bool UpstreamExchange::notify(QObject *receiver, const char *member)
+{
+    if (!m_notify) {
+        connect(this, SIGNAL(progress()), receiver, member);
+        m_notify = true;
+    }
+    return true;
+}
+
+/*
+ * The request is done with it, either the reply went out or the client went
+ * away. The pool decides what happens to the connection.
+ */
+void UpstreamExchange::detach()
+{
+    m_request = NULL;
+    m_client = NULL;
+    if (m_pool)
+        m_pool->retire(this);
+    else
+        deleteLater();
+}
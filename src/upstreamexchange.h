@@ -0,0 +1,129 @@
+#ifndef UPSTREAMEXCHANGE_H
+#define UPSTREAMEXCHANGE_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtNetwork/QTcpSocket>
+
+#include "bodyproducer.h"
+#include "cgiprotocol.h"
+#include "handlerrequest.h"
+#include "responseheader.h"
+#include "upstream.h"
+
+#define UPSTREAM_MAX_HEADER 8192    /* Longest header a backend may reply with */
+
+class Request;
+class UpstreamPool;
+class UpstreamConnection;
+
+/*
+ * One request forwarded to a backend and its reply on the way back. The pool
+ * feeds it what the backend sends, it turns the header of the backend into
+ * ours and frames the body, with the length the backend gave or chunked, and
+ * the request pushes that to the client as it takes it. Nothing is held
+ * beyond the high-water mark: once that much waits for the client the pool
+ * stops reading the connection. The body of the request goes the other way
+ * the same way, it is only read from the client while the connection to the
+ * backend has room for it. A FastCGI backend gets it as stdin records.
+ * It lives in the thread of its worker. The pool owns it, the request lets
+ * go of it with detach().
+ */
+class UpstreamExchange : public QObject
+{
+    Q_OBJECT
+    friend class UpstreamPool;
+    enum Framing {
+        NoBody
+        , Length
+        , Chunked
+        , Close
+    };
+    enum ChunkState {
+        ChunkSize
+        , ChunkData
+        , ChunkEnd
+        , Trailer
+    };
+    Request *m_request;
+    UpstreamPool *m_pool;
+    /* A CGI backend gets the params, an HTTP one the encoded request */
+    CgiParams m_params;
+    QByteArray m_encoded;
+    QByteArray m_version;
+    bool m_keepAlive;
+    bool m_head;
+    /* The request body, the part that was read with the header goes with the request */
+    QTcpSocket *m_client;
+    Upstream::Protocol m_protocol;
+    qint64 m_bodyRemaining;
+    QByteArray m_bodyStart;
+    bool m_retryable;
+    /* The header of the backend until it is complete, then the framed reply for the client */
+    QByteArray m_header;
+    QByteArray m_output;
+    bool m_received;
+    bool m_headerDone;
+    bool m_chunked;
+    bool m_complete;
+    bool m_failed;
+    bool m_sent;
+    bool m_notify;
+    /* How the reply of an HTTP backend ends, and whether its connection can be used again */
+    Framing m_framing;
+    qint64 m_remaining;
+    ChunkState m_chunkState;
+    QByteArray m_line;
+    bool m_persistent;
+    /* Where the pool has it, for the pool only */
+    UpstreamConnection *m_connection;
+    int m_id;
+    bool m_stalled;
+
+    void reply_error(ResponseHeader::Status status);
+    bool build_header(int code, const QByteArray &lines, bool length);
+    bool translate_header(int end, int skip);
+    int translate_response(int limit);
+    int receive_body(const char *data, int size);
+    int receive_chunked(const char *data, int size);
+    bool take_line(const char *data, int size, int &used);
+    void append_body(const char *data, int size);
+    void encode_body(QByteArray &buffer, const QByteArray &data) const;
+signals:
+    /* Something changed for the client: more output, the end, a failure */
+    void progress();
+public:
+    UpstreamExchange(Request *request, const QByteArray &version, bool keepAlive, bool head);
+    virtual ~UpstreamExchange();
+    void setBody(qint64 length, const QByteArray &start);
+    void setEnvironment(const HandlerRequest &request, QTcpSocket *client, const QString &folder, const QString &script);
+    void setProxyRequest(const HandlerRequest &request, QTcpSocket *client);
+    const CgiParams &params() const { return m_params; }
+    const QByteArray &encoded() const { return m_encoded; }
+    /* For the pool */
+    void receive(const char *data, int size);
+    int receiveResponse(const char *data, int size);
+    void end();
+    void fail();
+    void reject();
+    void pullBody();
+    void appendBodyStart(QByteArray &request);
+    bool isFull() const { return m_output.size() >= BODY_HIGH_WATER; }
+    bool isComplete() const { return m_complete; }
+    bool hasHeader() const { return m_headerDone; }
+    bool hasReceived() const { return m_received; }
+    /* Safe to send again on another connection, nothing of it can have had an effect */
+    bool isRetryable() const { return m_retryable && !m_received; }
+    bool isCloseDelimited() const { return m_framing == Close; }
+    bool isPersistent() const { return m_persistent && (m_bodyRemaining == 0); }
+    void notifyProgress();
+    /* For the request */
+    BodyProducer::Status produce(ClientConnection *socket);
+    /* The client cannot send another request before it sent all of the body */
+    bool keepAlive() const { return m_keepAlive && (m_bodyRemaining <= 0); }
+    Request *request() const { return m_request; }
+    bool notify(QObject *receiver, const char *member);
+    void detach();
+};
+
+#endif // UPSTREAMEXCHANGE_H
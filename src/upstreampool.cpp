@@ -0,0 +1,456 @@
+#include <QtCore/QMetaObject>
+#include <QtNetwork/QLocalSocket>
+#include <QtNetwork/QTcpSocket>
+
+#include "upstreampool.h"
+#include "log.h"
+
+UpstreamPool::UpstreamPool(const Upstream *upstream) :
+    m_upstream(upstream),
+    m_active(0),
+    m_resume(false),
+    m_reap(false)
+{
+}
+
+/*
+ * Only when the worker goes, its requests went first.
+ */
+UpstreamPool::~UpstreamPool()
+{
+    foreach (UpstreamConnection *connection, m_connections) {
+        connection->device->disconnect(this);
+        Upstream::close(connection->device);
+        for (int i = 0; i < connection->active; ++i)
+            m_upstream->release();
+        delete connection;
+    }
+    foreach (UpstreamExchange *exchange, m_queue) {
+        m_upstream->release();
+        delete exchange;
+    }
+}
+
+/*
+ * Waiting requests keep their order, a new one does not overtake them. The
+ * backend carries the load of the request from here until it leaves the
+ * pool.
+ */
+void UpstreamPool::submit(UpstreamExchange *exchange)
+{
+    Log *log = Log::instance();
+    exchange->m_pool = this;
+    m_upstream->acquire();
+    if (m_queue.isEmpty()) {
+        UpstreamConnection *connection = available();
+        if (!connection && (m_connections.size() < m_upstream->connections()))
+            connection = open();
+        if (connection) {
+            start(connection, exchange);
+            return;
+        }
+    }
+    if (m_queue.size() >= m_upstream->queue()) {
+        log->entry(Log::LogLevelNormal, "backend queue is full, rejecting request");
+        m_upstream->release();
+        exchange->reject();
+        return;
+    }
+    log->entry(Log::LogLevelDebug, "no connection to the backend available, queueing request");
+    m_queue.enqueue(exchange);
+}
+
+/*
+ * The request let go of the exchange. If the backend is still at it, a
+ * multiplexed connection is told to abort that request and the others are
+ * left alone, any other connection is closed since the rest of the reply
+ * would otherwise have to be read and thrown away.
+ */
+void UpstreamPool::retire(UpstreamExchange *exchange)
+{
+    if (m_queue.removeOne(exchange)) {
+        m_upstream->release();
+        exchange->deleteLater();
+        return;
+    }
+    UpstreamConnection *connection = exchange->m_connection;
+    if (!connection) {
+        exchange->deleteLater();
+        return;
+    }
+    if (m_upstream->multiplex() > 1) {
+        QByteArray abort;
+        FastCgi::appendAbort(abort, exchange->m_id);
+        if (connection->connected)
+            connection->device->write(abort);
+        else
+            connection->output.append(abort);
+        /* It goes when the backend ends the request */
+        return;
+    }
+    QList<UpstreamExchange *> touched;
+    close(connection, touched);
+    notify(touched);
+    pump();
+}
+
+void UpstreamPool::resume()
+{
+    if (m_resume)
+        return;
+    m_resume = true;
+    QMetaObject::invokeMethod(this, "resume_connections", Qt::QueuedConnection);
+}
+
+/*
+ * Not right away from produce(), the request that resumes us might be in the
+ * middle of being notified by one of our reads.
+ */
+void UpstreamPool::resume_connections()
+{
+    m_resume = false;
+    QList<UpstreamConnection *> connections = m_connections;
+    foreach (UpstreamConnection *connection, connections) {
+        if (connection->stalled && m_connections.contains(connection))
+            read(connection);
+    }
+}
+
+UpstreamConnection *UpstreamPool::available() const
+{
+    foreach (UpstreamConnection *connection, m_connections) {
+        if (!connection->finished && !connection->spent && !connection->broken
+                && (connection->active < connection->exchanges.size()))
+            return connection;
+    }
+    return NULL;
+}
+
+/*
+ * The request is written by start(), the connection is only on its way then.
+ */
+UpstreamConnection *UpstreamPool::open()
+{
+    QIODevice *device = m_upstream->create(this);
+    UpstreamConnection *connection = new UpstreamConnection(device, m_upstream->multiplex());
+    m_connections.append(connection);
+    m_devices.insert(device, connection);
+    connect(device, SIGNAL(connected()), this, SLOT(connection_connected()));
+    connect(device, SIGNAL(readyRead()), this, SLOT(connection_readyRead()));
+    connect(device, SIGNAL(disconnected()), this, SLOT(connection_disconnected()));
+    connect(device, SIGNAL(bytesWritten(qint64)), this, SLOT(connection_bytesWritten()));
+    if (qobject_cast<QLocalSocket *>(device))
+        connect(device, SIGNAL(error(QLocalSocket::LocalSocketError)), this, SLOT(connection_error()));
+    else
+        connect(device, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(connection_error()));
+    m_upstream->connect(device);
+    return connection;
+}
+
+/*
+ * The whole request goes out in one write, except for the part of the body
+ * that did not come with the header, which follows as the client sends it.
+ */
+void UpstreamPool::start(UpstreamConnection *connection, UpstreamExchange *exchange)
+{
+    int id = connection->exchanges.indexOf(NULL);
+    connection->exchanges[id] = exchange;
+    ++connection->active;
+    ++m_active;
+    exchange->m_connection = connection;
+    exchange->m_id = id + 1;
+    exchange->m_protocol = m_upstream->protocol();
+    QByteArray request;
+    if (m_upstream->protocol() == Upstream::Http) {
+        ++connection->served;
+        if (connection->connected)
+            connection->device->write(exchange->encoded());
+        else
+            connection->output.append(exchange->encoded());
+        exchange->pullBody();
+        return;
+    }
+    if (m_upstream->protocol() == Upstream::FastCgi) {
+        FastCgi::appendRequest(request, id + 1, true, exchange->params());
+    } else {
+        Scgi::appendRequest(request, exchange->params());
+        connection->spent = true;
+    }
+    exchange->appendBodyStart(request);
+    if (connection->connected)
+        connection->device->write(request);
+    else
+        connection->output.append(request);
+    exchange->pullBody();
+}
+
+/*
+ * The exchange leaves the connection, and with it the load of the backend.
+ */
+void UpstreamPool::release(UpstreamConnection *connection, int index)
+{
+    UpstreamExchange *exchange = connection->exchanges.at(index);
+    connection->exchanges[index] = NULL;
+    --connection->active;
+    --m_active;
+    exchange->m_connection = NULL;
+    m_upstream->release();
+}
+
+/*
+ * Waiting requests take the room that was freed, in order.
+ */
+void UpstreamPool::pump()
+{
+    while (!m_queue.isEmpty()) {
+        UpstreamConnection *connection = available();
+        if (!connection && (m_connections.size() < m_upstream->connections()))
+            connection = open();
+        if (!connection)
+            return;
+        start(connection, m_queue.dequeue());
+    }
+}
+
+/*
+ * Everything the connection has for us, unless one of its exchanges already
+ * has enough waiting for its client. Then nothing is read, the socket stops
+ * reading too once its own buffer is full, and the backend is held back by
+ * the kernel until resume_connections().
+ * The exchanges hear about it once we are done with the connection, what
+ * they do might close it.
+ */
+void UpstreamPool::read(UpstreamConnection *connection)
+{
+    foreach (UpstreamExchange *exchange, connection->exchanges) {
+        if (exchange && exchange->request() && exchange->isFull()) {
+            connection->stalled = true;
+            exchange->m_stalled = true;
+            return;
+        }
+    }
+    connection->stalled = false;
+    QList<UpstreamExchange *> touched;
+    connection->input.append(connection->device->readAll());
+    if (m_upstream->protocol() == Upstream::FastCgi) {
+        read_fastcgi(connection, touched);
+    } else if (m_upstream->protocol() == Upstream::Http) {
+        read_http(connection, touched);
+    } else if (!connection->input.isEmpty()) {
+        UpstreamExchange *exchange = connection->exchanges.at(0);
+        if (exchange && exchange->request()) {
+            bool header = exchange->hasHeader();
+            exchange->receive(connection->input.constData(), connection->input.size());
+            if (!header && exchange->hasHeader())
+                m_upstream->succeeded();
+            touched.append(exchange);
+        }
+        connection->input.resize(0);
+    }
+    if (connection->finished || (connection->spent && !connection->active))
+        close(connection, touched);
+    notify(touched);
+    pump();
+}
+
+void UpstreamPool::read_fastcgi(UpstreamConnection *connection, QList<UpstreamExchange *> &touched)
+{
+    Log *log = Log::instance();
+    int offset = 0;
+    forever {
+        FastCgi::Record record;
+        int length = FastCgi::parse(connection->input.constData() + offset, connection->input.size() - offset, record);
+        if (!length)
+            break;
+        const char *content = connection->input.constData() + offset + record.offset;
+        offset += length;
+        if ((record.id < 1) || (record.id > connection->exchanges.size()))
+            continue;
+        UpstreamExchange *exchange = connection->exchanges.at(record.id - 1);
+        if (!exchange)
+            continue;
+        if (record.type == FastCgi::Stdout) {
+            /* Requests that were aborted still send what they had */
+            if (!exchange->request())
+                continue;
+            bool header = exchange->hasHeader();
+            exchange->receive(content, record.length);
+            if (!header && exchange->hasHeader())
+                m_upstream->succeeded();
+            if (!touched.contains(exchange))
+                touched.append(exchange);
+        } else if (record.type == FastCgi::Stderr) {
+            log->entry(Log::LogLevelNormal, QByteArray("backend: ") + QByteArray(content, record.length).trimmed());
+        } else if (record.type == FastCgi::EndRequest) {
+            release(connection, record.id - 1);
+            if (!exchange->request()) {
+                exchange->deleteLater();
+                continue;
+            }
+            exchange->end();
+            if (!touched.contains(exchange))
+                touched.append(exchange);
+        }
+    }
+    connection->input.remove(0, offset);
+}
+
+/*
+ * The reply to the request on the connection. What comes after its end was
+ * not asked for, the connection cannot be trusted with another request then,
+ * and neither when the reply ended it.
+ */
+void UpstreamPool::read_http(UpstreamConnection *connection, QList<UpstreamExchange *> &touched)
+{
+    UpstreamExchange *exchange = connection->exchanges.at(0);
+    if (!exchange) {
+        if (!connection->input.isEmpty())
+            connection->spent = true;
+        connection->input.resize(0);
+        return;
+    }
+    if (connection->input.isEmpty())
+        return;
+    bool header = exchange->hasHeader();
+    int used = exchange->receiveResponse(connection->input.constData(), connection->input.size());
+    connection->input.remove(0, used);
+    if (!header && exchange->hasHeader())
+        m_upstream->succeeded();
+    if (!touched.contains(exchange))
+        touched.append(exchange);
+    if (!exchange->isComplete())
+        return;
+    if (!exchange->isPersistent() || !connection->input.isEmpty())
+        connection->spent = true;
+    connection->input.resize(0);
+    release(connection, 0);
+}
+
+/*
+ * The connection goes. SCGI replies end this way, and so do HTTP replies
+ * without a length. A kept HTTP connection the backend closed just as we
+ * sent the next request is no failure of the backend, a request that can
+ * safely be sent again goes back to the front of the queue. For everything
+ * else an exchange that is still on it is broken, and if the backend did
+ * not even reply that counts against it.
+ */
+void UpstreamPool::close(UpstreamConnection *connection, QList<UpstreamExchange *> &touched)
+{
+    Upstream::Protocol protocol = m_upstream->protocol();
+    for (int i = 0; i < connection->exchanges.size(); ++i) {
+        UpstreamExchange *exchange = connection->exchanges.at(i);
+        if (!exchange)
+            continue;
+        release(connection, i);
+        if (!exchange->request()) {
+            exchange->deleteLater();
+            continue;
+        }
+        if (connection->finished && ((protocol == Upstream::Scgi)
+                || ((protocol == Upstream::Http) && exchange->hasHeader() && exchange->isCloseDelimited()))) {
+            exchange->end();
+        } else if (connection->finished && (protocol == Upstream::Http) && (connection->served > 1) && exchange->isRetryable()) {
+            Log::instance()->entry(Log::LogLevelDebug, "backend closed a kept connection, sending the request again");
+            m_upstream->acquire();
+            m_queue.prepend(exchange);
+            continue;
+        } else {
+            if (!exchange->hasHeader())
+                m_upstream->failed();
+            exchange->fail();
+        }
+        if (!touched.contains(exchange))
+            touched.append(exchange);
+    }
+    m_connections.removeOne(connection);
+    m_devices.remove(connection->device);
+    connection->device->disconnect(this);
+    Upstream::close(connection->device);
+    delete connection;
+}
+
+void UpstreamPool::notify(const QList<UpstreamExchange *> &touched)
+{
+    foreach (UpstreamExchange *exchange, touched)
+        exchange->notifyProgress();
+}
+
+void UpstreamPool::connection_connected()
+{
+    UpstreamConnection *connection = m_devices.value(qobject_cast<QIODevice *>(sender()), NULL);
+    if (!connection)
+        return;
+    connection->connected = true;
+    if (!connection->output.isEmpty()) {
+        connection->device->write(connection->output);
+        connection->output = QByteArray();
+    }
+    connection_bytesWritten();
+}
+
+/*
+ * The connection has room for more of the body of a request.
+ */
+void UpstreamPool::connection_bytesWritten()
+{
+    UpstreamConnection *connection = m_devices.value(qobject_cast<QIODevice *>(sender()), NULL);
+    if (!connection)
+        return;
+    foreach (UpstreamExchange *exchange, connection->exchanges) {
+        if (exchange)
+            exchange->pullBody();
+    }
+}
+
+void UpstreamPool::connection_readyRead()
+{
+    UpstreamConnection *connection = m_devices.value(qobject_cast<QIODevice *>(sender()), NULL);
+    if (connection && !connection->stalled)
+        read(connection);
+}
+
+/*
+ * What the socket still buffers is read first. A stalled connection is
+ * closed once its exchange took the rest.
+ */
+void UpstreamPool::connection_disconnected()
+{
+    UpstreamConnection *connection = m_devices.value(qobject_cast<QIODevice *>(sender()), NULL);
+    if (!connection)
+        return;
+    connection->finished = true;
+    read(connection);
+}
+
+/*
+ * Errors of a connection that is up are followed by disconnected(), only
+ * the ones of a connection that never came up are handled here. Not right
+ * away, we might still be inside open().
+ */
+void UpstreamPool::connection_error()
+{
+    UpstreamConnection *connection = m_devices.value(qobject_cast<QIODevice *>(sender()), NULL);
+    if (!connection || connection->connected || connection->broken)
+        return;
+    connection->broken = true;
+    if (m_reap)
+        return;
+    m_reap = true;
+    QMetaObject::invokeMethod(this, "reap_connections", Qt::QueuedConnection);
+}
+
+void UpstreamPool::reap_connections()
+{
+    Log *log = Log::instance();
+    m_reap = false;
+    QList<UpstreamExchange *> touched;
+    QList<UpstreamConnection *> connections = m_connections;
+    foreach (UpstreamConnection *connection, connections) {
+        if (!connection->broken)
+            continue;
+        log->entry(Log::LogLevelCritical, QString("could not connect to backend %1").arg(m_upstream->address()));
+        close(connection, touched);
+    }
+    notify(touched);
+    pump();
+}
@@ -0,0 +1,101 @@
+#ifndef UPSTREAMPOOL_H
+#define UPSTREAMPOOL_H
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QQueue>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtCore/QIODevice>
+
+#include "upstream.h"
+#include "upstreamexchange.h"
+
+/*
+ * A connection to a backend and the exchanges it carries, by FastCGI request
+ * id. Output written before the connection is up waits in output. HTTP
+ * connections carry one request after the other, served counts them.
+ */
+class UpstreamConnection
+{
+public:
+    QIODevice *device;
+    QByteArray input;
+    QByteArray output;
+    QVector<UpstreamExchange *> exchanges;
+    int active;
+    int served;
+    bool connected;
+    /* The backend closed it, what is still buffered is read before it goes */
+    bool finished;
+    /* Not read while one of its exchanges has enough waiting for its client */
+    bool stalled;
+    /* SCGI connections carry a single request, HTTP ones until a reply says otherwise */
+    bool spent;
+    /* Could not connect, it goes on the next turn of the event loop */
+    bool broken;
+
+    UpstreamConnection(QIODevice *d, int multiplex) :
+        device(d), exchanges(multiplex, NULL), active(0), served(0), connected(false), finished(false), stalled(false), spent(false),
+        broken(false) {}
+};
+
+/*
+ * The connections of one worker to one backend. They stay open between
+ * requests where the protocol allows it, so a request usually costs no
+ * connect, and there are never more of them than the limit: requests that
+ * find no room wait in a bounded queue and get a 503 beyond it. Each worker
+ * has its own pool, it is not thread safe.
+ */
+class UpstreamPool : public QObject
+{
+    Q_OBJECT
+    const Upstream *m_upstream;
+    QList<UpstreamConnection *> m_connections;
+    QHash<QIODevice *, UpstreamConnection *> m_devices;
+    QQueue<UpstreamExchange *> m_queue;
+    int m_active;
+    bool m_resume;
+    bool m_reap;
+
+    UpstreamConnection *available() const;
+    UpstreamConnection *open();
+    void start(UpstreamConnection *connection, UpstreamExchange *exchange);
+    void read(UpstreamConnection *connection);
+    void read_fastcgi(UpstreamConnection *connection, QList<UpstreamExchange *> &touched);
+    void read_http(UpstreamConnection *connection, QList<UpstreamExchange *> &touched);
+    void release(UpstreamConnection *connection, int index);
+    void close(UpstreamConnection *connection, QList<UpstreamExchange *> &touched);
+    void pump();
+    static void notify(const QList<UpstreamExchange *> &touched);
+private slots:
+    void connection_connected();
+    void connection_readyRead();
+    void connection_bytesWritten();
+    void connection_disconnected();
+    void connection_error();
+    void resume_connections();
+    void reap_connections();
+public:
+    UpstreamPool(const Upstream *upstream);
+    virtual ~UpstreamPool();
+    void submit(UpstreamExchange *exchange);
+    void retire(UpstreamExchange *exchange);
+    /* Called when an exchange has room again, the reading happens later */
+    void resume();
+    /* Exchanges on a connection, not the ones in the queue */
+    int active() const { return m_active; }
+    int queued() const { return m_queue.size(); }
+};
+
+/*
+ * The pools of one worker for the backends of one folder, in the order of
+ * the backends.
+ */
+class UpstreamPools : public QVector<UpstreamPool *>
+{
+public:
+    ~UpstreamPools() { qDeleteAll(*this); }
+};
+
+#endif // UPSTREAMPOOL_H
@@ -1,9 +1,12 @@
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
-#include <QtCore/QTextStream>
 #include <QtCore/QStringList>
+#include <QtCore/QtAlgorithms>
+
+#include <sys/stat.h>
 
 #include "webfolder.h"
+#include "responseheader.h"
 #include "log.h"
 
 bool WebFolder::m_extensionsLoaded = false;
@@ -18,25 +21,30 @@ WebFolder::WebFolder() :
     Folder(WEB)
 {
     m_dir = NULL;
+    m_watcher = new QFileSystemWatcher(this);
+    connect(m_watcher, SIGNAL(directoryChanged(QString)), this, SLOT(directory_changed(QString)));
     if (!WebFolder::m_extensionsLoaded) {
         /* Load all the extensions
          * The following table is based on the data from:
          * http://www.utoronto.ca/web/htmldocs/book/book-3ed/appb/mimetype.html
          */
-        WebFolder::m_extensions["html"] = "text/html\n";
-        WebFolder::m_extensions["htm"] = "text/html\n";
-        WebFolder::m_extensions["jpeg"] = "image/jpeg\n";
-        WebFolder::m_extensions["jpg"] = "image/jpeg\n";
-        WebFolder::m_extensions["jpe"] = "image/jpeg\n";
-        WebFolder::m_extensions["txt"] = "text/plain\n";
-        WebFolder::m_extensions["c"] = "text/plain\n";
-        WebFolder::m_extensions["c++"] = "text/plain\n";
-        WebFolder::m_extensions["pl"] = "text/plain\n";
-        WebFolder::m_extensions["cc"] = "text/plain\n";
-        WebFolder::m_extensions["h"] = "text/plain\n";
-        WebFolder::m_extensions["h"] = "text/css\n";
-        WebFolder::m_extensions["png"] = "image/x-png\n";
-        WebFolder::m_extensions["gif"] = "image/gif\n";
+        WebFolder::m_extensions["html"] = "text/html";
+        WebFolder::m_extensions["htm"] = "text/html";
+        WebFolder::m_extensions["jpeg"] = "image/jpeg";
+        WebFolder::m_extensions["jpg"] = "image/jpeg";
+        WebFolder::m_extensions["jpe"] = "image/jpeg";
+        WebFolder::m_extensions["txt"] = "text/plain";
+        WebFolder::m_extensions["c"] = "text/plain";
+        WebFolder::m_extensions["c++"] = "text/plain";
+        WebFolder::m_extensions["pl"] = "text/plain";
+        WebFolder::m_extensions["cc"] = "text/plain";
+        WebFolder::m_extensions["h"] = "text/plain";
+        WebFolder::m_extensions["css"] = "text/css";
+        WebFolder::m_extensions["js"] = "application/javascript";
+        WebFolder::m_extensions["json"] = "application/json";
+        WebFolder::m_extensions["svg"] = "image/svg+xml";
+        WebFolder::m_extensions["png"] = "image/x-png";
+        WebFolder::m_extensions["gif"] = "image/gif";
         WebFolder::m_extensionsLoaded = true;
     }
 
@@ -52,6 +60,114 @@ bool WebFolder::load()
     }
     m_dir = new QDir(m_handler);
     m_timestamp = info.lastModified();
+    m_watcher->addPath(m_handler);
+    scan();
+    return true;
+}
+
+/*
+ * Bring the index in line with the folder. Only the entries that were added,
+ * removed or whose size or modification time changed are touched, the rest
+ * of the index stays as it is. Only plain files are served, hidden ones and
+ * subfolders are not even indexed.
+ */
+void WebFolder::scan()
+{
+    Log *log = Log::instance();
+    m_dir->refresh();
+    QFileInfoList entries = m_dir->entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+    QHash<QString, QFileInfo> found;
+    foreach (const QFileInfo &info, entries)
+        found.insert(info.fileName(), info);
+    QStringList removed;
+    QFileInfoList changed;
+    m_indexLock.lockForRead();
+    QHash<QString, Entry>::const_iterator i;
+    for (i = m_index.constBegin(); i != m_index.constEnd(); ++i) {
+        if (!found.contains(i.key()))
+            removed.append(i.key());
+    }
+    foreach (const QFileInfo &info, found) {
+        i = m_index.constFind(info.fileName());
+        if ((i == m_index.constEnd()) || (i.value().size != info.size()) || (i.value().modified != info.lastModified()))
+            changed.append(info);
+    }
+    m_indexLock.unlock();
+    foreach (const QString &name, removed) {
+        log->entry(Log::LogLevelDebug, "file removed from index");
+        m_indexLock.lockForWrite();
+        m_index.remove(name);
+        m_indexLock.unlock();
+    }
+    foreach (const QFileInfo &info, changed)
+        update(info);
+}
+
+/*
+ * Add or refresh one entry.
+ * The ETag is built like most servers do, from the inode, the size and the
+ * modification time, so a file that is replaced or rewritten gets a new one.
+ * Both validators are formatted here, once per change, not once per request.
+ */
+void WebFolder::update(const QFileInfo &info)
+{
+    Entry entry;
+    entry.size = info.size();
+    entry.modified = info.lastModified();
+    entry.mtime = 0;
+    struct stat status;
+    if ((::stat(QFile::encodeName(info.absoluteFilePath()).constData(), &status) == 0)) {
+        entry.size = status.st_size;
+        entry.mtime = status.st_mtime;
+        entry.etag = '"' + QByteArray::number((qulonglong)status.st_ino, 16) + '-'
+                + QByteArray::number((qlonglong)status.st_size, 16) + '-'
+                + QByteArray::number((qlonglong)status.st_mtime, 16) + '"';
+        entry.lastModified = ResponseHeader::httpDate(status.st_mtime);
+        entry.type = content_type(info.fileName());
+    }
+    m_indexLock.lockForWrite();
+    m_index.insert(info.fileName(), entry);
+    m_indexLock.unlock();
+}
+
+/*
+ * Files added, removed or renamed, and attributes changed. Every entry is
+ * looked at again, the ones whose size or modification time moved are
+ * refreshed.
+ */
+void WebFolder::directory_changed(const QString &path)
+{
+    Q_UNUSED(path);
+    Log::instance()->entry(Log::LogLevelDebug, "folder changed, updating index");
+    scan();
+}
+
+/*
+ * The type used for a part of a file, the replies for the whole file still
+ * use their own rules for files without a known extension.
+ */
+QByteArray WebFolder::content_type(const QString &name)
+{
+    int position = name.lastIndexOf('.');
+    QString type;
+    if (position != -1)
+        type = WebFolder::m_extensions.value(name.mid(position + 1));
+    if (type.isEmpty())
+        return QByteArray("application/octet-stream");
+    return type.toLatin1();
+}
+
+/*
+ * What the index knows about a path, without asking the file system.
+ */
+bool WebFolder::entry(const QString &path, Entry &entry) const
+{
+    QString name = path.startsWith('/') ? path.mid(1) : path;
+    QReadLocker locker(&m_indexLock);
+    QHash<QString, Entry>::const_iterator i = m_index.constFind(name);
+    if (i == m_index.constEnd())
+        return false;
+    entry = i.value();
     return true;
 }
 
@@ -70,7 +186,8 @@ bool WebFolder::has(const QString &path)
     }
     QString internalPath = path;
     internalPath.remove(0, 1);
-    if (!m_dir->entryList().contains(internalPath)) {
+    QReadLocker locker(&m_indexLock);
+    if (!m_index.contains(internalPath)) {
         log->entry(Log::LogLevelNormal, "path was not found");
         log->entry(Log::LogLevelDebug, internalPath);
         return false;
@@ -80,102 +197,109 @@ bool WebFolder::has(const QString &path)
 
 /*
  * Both file and info methods do something similar.
- * file returns the file info + the file content.
- * info returns only the info.
+ * file appends the file info + the file content.
+ * info appends only the info.
  */
-QByteArray *WebFolder::file(const QString &path)
+void WebFolder::file(const QString &path, QByteArray &response)
 {
-    Log *log = Log::instance();
-    QString extension = path;
-    int position = extension.lastIndexOf('.');
-    if (position == -1) {
-        log->entry(Log::LogLevelDebug, "file without extension assuming html");
-        extension.fromLatin1("html");
-    } else {
-        extension = extension.right(extension.size() - position - 1);
-    }
-    QString internalPath = m_handler + path;
-    QFileInfo file(internalPath);
-    QFile content(internalPath);
+    QFile content(m_handler + path);
     content.open(QIODevice::ReadOnly);
-    QByteArray *response = new QByteArray();
-    response->append("Content-Length: ");
-    response->append(QByteArray::number(file.size()));
-    response->append("\n");
-    response->append("Connection: close\n");
-    if (!WebFolder::m_extensions.contains(extension)) {
-        log->entry(Log::LogLevelDebug, "unknown extension");
-        response->append("Content-Type: unknown/unknown\n\n");
-    } else {
-        QString type = WebFolder::m_extensions[extension];
-        response->append("Content-Type: ");
-        response->append(type);
-        response->append("\n");
-        response->append(content.readAll());
-    }
-    return response;
+    qint64 size = content.size();
+    info(path, response, size);
+    response.append("\r\n");
+    /* Read straight behind the header, there is no intermediate copy */
+    int start = response.size();
+    response.resize(start + (int)size);
+    qint64 read = content.read(response.data() + start, size);
+    response.resize(start + (int)qMax(read, (qint64)0));
 }
 
-QByteArray *WebFolder::info(const QString &path)
+void WebFolder::info(const QString &path, QByteArray &response)
+{
+    info(path, response, -1);
+}
+
+/*
+ * A negative size means the one in the index.
+ */
+void WebFolder::info(const QString &path, QByteArray &response, qint64 size)
 {
     Log *log = Log::instance();
-    QString extension = path;
-    int position = extension.lastIndexOf('.');
-    if (position == -1) {
-        log->entry(Log::LogLevelDebug, "file without extension assuming html");
-        extension.fromLatin1("html");
+    Entry file;
+    if (!entry(path, file))
+        file.size = 0;
+    if (size >= 0)
+        file.size = size;
+    response.append("Content-Length: ");
+    ResponseHeader::appendNumber(response, file.size);
+    response.append("\r\n");
+    appendValidators(file, response);
+    response.append("Content-Type: ");
+    if (!file.type.isEmpty()) {
+        response.append(file.type);
     } else {
-        extension = extension.right(extension.size() - position - 1);
-    }
-    QString internalPath = m_handler + path;
-    QFileInfo file(internalPath);
-    QByteArray *response = new QByteArray();
-    response->append("Content-Length: ");
-    response->append(QByteArray::number(file.size()));
-    response->append("\n");
-    response->append("Connection: close\n");
-    if (!WebFolder::m_extensions.contains(extension)) {
         log->entry(Log::LogLevelDebug, "unknown extension");
-        response->append("Content-Type: unknown\n");
-    } else {
-        response->append("Content-Type: ");
-        response->append(WebFolder::m_extensions[extension]);
+        response.append(content_type(path));
     }
-    return response;
+    response.append("\r\n");
+}
+
+/*
+ * The ETag and Last-Modified lines of a reply with the content of the entry.
+ * Files with validators can be asked for in ranges.
+ */
+void WebFolder::appendValidators(const Entry &entry, QByteArray &lines)
+{
+    if (entry.etag.isEmpty())
+        return;
+    lines.append("Accept-Ranges: bytes\r\nETag: ");
+    lines.append(entry.etag);
+    lines.append("\r\nLast-Modified: ");
+    lines.append(entry.lastModified);
+    lines.append("\r\n");
+}
+
+
+/*
+ * Where the file lives on disk, so it can be sent without reading it.
+ */
+QString WebFolder::location(const QString &path) const
+{
+    return m_handler + path;
 }
 
 /*
  * Find my list of files and display it.
  */
-QByteArray *WebFolder::listing(const QString &path)
+void WebFolder::listing(const QString &path, QByteArray &response)
 {
-    QByteArray *response_header = new QByteArray();
-    QTextStream header_stream(response_header, QIODevice::ReadWrite);
-    QByteArray *response_data = new QByteArray();
-    response_data->append("<html><head><title>Index of ");
-    response_data->append(path);
-    response_data->append("</title></head>\n");
-    response_data->append("<body>\n");
-    response_data->append("<h1>Index of ");
-    response_data->append(path);
-    response_data->append("</h1>\n");
-    response_data->append("<pre>Name - Last modified - Size - Description\n");
-    QFileInfoList entries = m_dir->entryInfoList();
-    foreach (QFileInfo entry, entries) {
-        response_data->append("<hr>");
-        response_data->append(entry.fileName());
-        response_data->append(entry.lastModified().toString());
-        response_data->append(QByteArray::number(entry.size()));
-        response_data->append("<br>\n");
+    QByteArray data;
+    data.append("<html><head><title>Index of ");
+    data.append(path);
+    data.append("</title></head>\n");
+    data.append("<body>\n");
+    data.append("<h1>Index of ");
+    data.append(path);
+    data.append("</h1>\n");
+    data.append("<pre>Name - Last modified - Size - Description\n");
+    m_indexLock.lockForRead();
+    QStringList names = m_index.keys();
+    qSort(names.begin(), names.end());
+    foreach (const QString &name, names) {
+        Entry entry = m_index.value(name);
+        data.append("<hr>");
+        data.append(name);
+        data.append(entry.modified.toString());
+        data.append(QByteArray::number(entry.size));
+        data.append("<br>\n");
     }
-    response_data->append("<hr></pre>\n");
-    response_data->append("<address>rainbow/1.0</address>\n");
-    header_stream << "Content-Length: " << response_data->size() << "\n";
-    header_stream << "Connection: close\n";
-    header_stream << "Content-Type: text/html;charset=ISO-8859-1\n\n";
-    header_stream << response_data->constData();
-    delete response_data;
-    return response_header;
+    m_indexLock.unlock();
+    data.append("<hr></pre>\n");
+    data.append("<address>rainbow/1.0</address>\n");
+    response.append("Content-Length: ");
+    ResponseHeader::appendNumber(response, data.size());
+    response.append("\r\nContent-Type: text/html;charset=ISO-8859-1\r\n\r\n");
+    response.append(data);
 }
 
 void WebFolder::setHandler(const QString &handler)
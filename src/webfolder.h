@@ -6,21 +6,57 @@
 #include <QtCore/QString>
 #include <QtCore/QByteArray>
 #include <QtCore/QDateTime>
+#include <QtCore/QObject>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QFileSystemWatcher>
 #include "folder.h"
 
-class WebFolder : public Folder
+class WebFolder : public QObject, public Folder
 {
+    Q_OBJECT
+public:
+    struct Entry {
+        qint64 size;
+        QDateTime modified;
+        /* Validators for conditional requests, only for files */
+        qint64 mtime;
+        QByteArray etag;
+        QByteArray lastModified;
+        QByteArray type;
+    };
+private:
     QDateTime m_timestamp;
     QDir *m_dir;
+    /*
+     * What is in the folder, by file name. It is built when the folder is loaded
+     * and kept up to date from the change notifications, so requests never have
+     * to ask the file system. The workers read it, the watcher writes it.
+     * Only the folder itself is watched, a watch per file would soon run out of
+     * inotify watches, and the content cache already watches the files it has.
+     */
+    QHash<QString, Entry> m_index;
+    mutable QReadWriteLock m_indexLock;
+    QFileSystemWatcher *m_watcher;
     static QHash<QString, QString> m_extensions;
     static bool m_extensionsLoaded;
+
+    void scan();
+    void update(const QFileInfo &info);
+    static QByteArray content_type(const QString &name);
+private slots:
+    void directory_changed(const QString &path);
 public:
     WebFolder();
     virtual bool load();
     bool has(const QString &path);
-    QByteArray *listing(const QString &path);
-    QByteArray *file(const QString &path);
-    QByteArray *info(const QString &path);
+    void listing(const QString &path, QByteArray &response);
+    void file(const QString &path, QByteArray &response);
+    void info(const QString &path, QByteArray &response);
+    /* With the length of the body that is actually sent, a negative one is the one in the index */
+    void info(const QString &path, QByteArray &response, qint64 size);
+    QString location(const QString &path) const;
+    bool entry(const QString &path, Entry &entry) const;
+    static void appendValidators(const Entry &entry, QByteArray &lines);
     virtual void setHandler(const QString &handler);
 };
 
@@ -0,0 +1,274 @@
+#include <QtCore/QMetaObject>
+
+#include "websocket.h"
+#include "log.h"
+
+WebSocket::WebSocket(QTcpSocket *socket, WebSocketHandler *handler, WebSocketDeflate *deflate, const QByteArray &pending) :
+    QObject(socket),
+    m_socket(socket),
+    m_handler(handler),
+    m_deflate(deflate),
+    m_input(pending),
+    m_messageOpcode(0),
+    m_messageCompressed(false),
+    m_fragmented(false),
+    m_closeCode(0),
+    m_scheduled(false),
+    m_closeSent(false),
+    m_gone(false)
+{
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(socket_readyRead()));
+    connect(m_socket, SIGNAL(disconnected()), this, SLOT(socket_disconnected()));
+}
+
+WebSocket::~WebSocket()
+{
+}
+
+/*
+ * The handler hears about the connection before the frames the client sent
+ * right after the handshake are parsed.
+ */
+void WebSocket::open(const HandlerRequest &request)
+{
+    m_handler->opened(this, request);
+    if (m_socket->bytesAvailable())
+        m_input.append(m_socket->readAll());
+    if (!m_input.isEmpty())
+        process();
+}
+
+void WebSocket::send(const QByteArray &message, bool binary)
+{
+    QMutexLocker locker(&m_lock);
+    if (m_closeCode)
+        return;
+    m_outgoing.append(Outgoing(binary ? WebSocketFrame::Binary : WebSocketFrame::Text, message));
+    schedule();
+}
+
+void WebSocket::close(int code)
+{
+    QMutexLocker locker(&m_lock);
+    if (m_closeCode)
+        return;
+    m_closeCode = code;
+    schedule();
+}
+
+/*
+ * With the lock held. Whatever is queued until the worker gets to it goes
+ * out in one write.
+ */
+void WebSocket::schedule()
+{
+    if (m_scheduled)
+        return;
+    m_scheduled = true;
+    QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+}
+
+void WebSocket::flush()
+{
+    m_lock.lock();
+    QList<Outgoing> outgoing = m_outgoing;
+    m_outgoing.clear();
+    int code = m_closeCode;
+    m_scheduled = false;
+    m_lock.unlock();
+    if (m_closeSent || m_gone)
+        return;
+    QByteArray frames;
+    foreach (const Outgoing &message, outgoing)
+        append_message(frames, message.opcode, message.data);
+    if (code) {
+        WebSocketFrame::appendClose(frames, code);
+        m_closeSent = true;
+    }
+    write(frames);
+    if (m_closeSent && !m_gone)
+        m_socket->disconnectFromHost();
+}
+
+/*
+ * Messages that do not get smaller go out as they are, the extension lets
+ * every message choose.
+ */
+void WebSocket::append_message(QByteArray &frames, int opcode, const QByteArray &message)
+{
+    if (m_deflate && (message.size() >= WEBSOCKET_DEFLATE_MIN)) {
+        QByteArray compressed;
+        if (m_deflate->compress(message, compressed) && (compressed.size() < message.size())) {
+            WebSocketFrame::appendHeader(frames, opcode, true, compressed.size());
+            frames.append(compressed);
+            return;
+        }
+    }
+    WebSocketFrame::appendHeader(frames, opcode, false, message.size());
+    frames.append(message);
+}
+
+/*
+ * A client that lets the backlog grow past the limit is not reading, there
+ * is no point in keeping its messages.
+ */
+void WebSocket::write(const QByteArray &frames)
+{
+    if (frames.isEmpty())
+        return;
+    if (m_socket->bytesToWrite() > WEBSOCKET_MAX_BACKLOG) {
+        Log::instance()->entry(Log::LogLevelNormal, "websocket client does not take its messages, dropping the connection");
+        m_socket->abort();
+        return;
+    }
+    m_socket->write(frames);
+}
+
+void WebSocket::socket_readyRead()
+{
+    m_input.append(m_socket->readAll());
+    process();
+}
+
+/*
+ * Whole frames only, a partial one waits in the input for the rest. Once
+ * everything was parsed the input is let go, an idle connection holds no
+ * buffer.
+ */
+void WebSocket::process()
+{
+    int offset = 0;
+    while (!m_gone && !m_closeSent) {
+        WebSocketFrame::Header header;
+        int length = WebSocketFrame::parse(m_input.constData() + offset, m_input.size() - offset, header);
+        if (!length)
+            break;
+        if (!header.masked || header.reserved || (header.compressed && !m_deflate)) {
+            fail(ProtocolError, "invalid frame");
+            break;
+        }
+        if (header.length > WEBSOCKET_MAX_MESSAGE) {
+            fail(MessageTooBig, "message too big");
+            break;
+        }
+        if (m_input.size() - offset - length < header.length)
+            break;
+        char *payload = m_input.data() + offset + length;
+        WebSocketFrame::unmask(payload, header.length, header.mask);
+        offset += length + (int)header.length;
+        if (!frame(header, payload))
+            break;
+    }
+    if (offset >= m_input.size())
+        m_input = QByteArray();
+    else
+        m_input.remove(0, offset);
+}
+
+/*
+ * Control frames are answered here, data frames are put together into
+ * messages. Returns false once the connection is closing.
+ */
+bool WebSocket::frame(const WebSocketFrame::Header &header, const char *payload)
+{
+    int length = (int)header.length;
+    if (WebSocketFrame::isControl(header.opcode)) {
+        if (!header.final || header.compressed || (length > WEBSOCKET_MAX_CONTROL))
+            return fail(ProtocolError, "invalid control frame");
+        if (header.opcode == WebSocketFrame::Ping) {
+            QByteArray pong;
+            WebSocketFrame::appendHeader(pong, WebSocketFrame::Pong, false, length);
+            pong.append(payload, length);
+            write(pong);
+            return !m_gone;
+        }
+        if (header.opcode == WebSocketFrame::Pong)
+            return true;
+        if (header.opcode != WebSocketFrame::Close)
+            return fail(ProtocolError, "unknown opcode");
+        /* The client's code goes back to it, unless it is one that must not be sent */
+        int code = NormalClosure;
+        if (length >= 2)
+            code = ((unsigned char)payload[0] << 8) | (unsigned char)payload[1];
+        if ((length == 1) || (code < 1000) || (code >= 5000) || ((code >= 1004) && (code <= 1006)))
+            code = ProtocolError;
+        QByteArray close;
+        WebSocketFrame::appendClose(close, code);
+        m_closeSent = true;
+        write(close);
+        if (!m_gone)
+            m_socket->disconnectFromHost();
+        return false;
+    }
+    switch (header.opcode) {
+    case WebSocketFrame::Text:
+    case WebSocketFrame::Binary:
+        if (m_fragmented)
+            return fail(ProtocolError, "new message in the middle of another one");
+        if (header.final)
+            return deliver(header.opcode, header.compressed, QByteArray(payload, length));
+        m_fragmented = true;
+        m_messageOpcode = header.opcode;
+        m_messageCompressed = header.compressed;
+        m_message = QByteArray(payload, length);
+        return true;
+    case WebSocketFrame::Continuation: {
+        if (!m_fragmented || header.compressed)
+            return fail(ProtocolError, "unexpected continuation frame");
+        if (m_message.size() + length > WEBSOCKET_MAX_MESSAGE)
+            return fail(MessageTooBig, "message too big");
+        m_message.append(payload, length);
+        if (!header.final)
+            return true;
+        QByteArray message = m_message;
+        m_message = QByteArray();
+        m_fragmented = false;
+        return deliver(m_messageOpcode, m_messageCompressed, message);
+    }
+    default:
+        return fail(ProtocolError, "unknown opcode");
+    }
+}
+
+bool WebSocket::deliver(int opcode, bool compressed, const QByteArray &message)
+{
+    if (!compressed) {
+        m_handler->message(this, message, opcode == WebSocketFrame::Binary);
+        return !m_gone;
+    }
+    QByteArray inflated;
+    if (!m_deflate->decompress(message.constData(), message.size(), WEBSOCKET_MAX_MESSAGE, inflated))
+        return fail(MessageTooBig, "message does not inflate within the limit");
+    m_handler->message(this, inflated, opcode == WebSocketFrame::Binary);
+    return !m_gone;
+}
+
+/*
+ * The client broke the protocol, it gets a Close with the reason and the
+ * connection ends.
+ */
+bool WebSocket::fail(int code, const char *reason)
+{
+    Log::instance()->entry(Log::LogLevelNormal, QString("closing websocket: %1").arg(reason));
+    if (!m_closeSent) {
+        QByteArray close;
+        WebSocketFrame::appendClose(close, code);
+        m_closeSent = true;
+        write(close);
+    }
+    if (!m_gone)
+        m_socket->disconnectFromHost();
+    return false;
+}
+
+/*
+ * The socket goes first, we are its child.
+ */
+void WebSocket::socket_disconnected()
+{
+    if (m_gone)
+        return;
+    m_gone = true;
+    m_handler->closed(this);
+    m_socket->deleteLater();
+}
@@ -0,0 +1,75 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtNetwork/QTcpSocket>
+
+#include "handlerrequest.h"
+#include "websocketchannel.h"
+#include "websockethandler.h"
+#include "websocketdeflate.h"
+#include "websocketframe.h"
+
+#define WEBSOCKET_MAX_MESSAGE (1024 * 1024)     /* Longest message a client may send, reassembled and inflated */
+#define WEBSOCKET_MAX_BACKLOG (1024 * 1024)     /* What may wait for a client that does not read before it is dropped */
+#define WEBSOCKET_DEFLATE_MIN 64                /* Shorter messages are not worth compressing */
+
+/*
+ * A connection after the handshake. It is no longer a request: it left the
+ * queues of the worker and has no deadline, it only wakes up when the client
+ * sends something or the handler has something to send. What it holds while
+ * idle is the socket and this object, the input buffer is let go as soon as
+ * everything in it was parsed, and the compression state is the worker's.
+ * It is a child of its socket and goes with it.
+ */
+class WebSocket : public QObject, public WebSocketChannel
+{
+    Q_OBJECT
+    struct Outgoing {
+        int opcode;
+        QByteArray data;
+        Outgoing(int o, const QByteArray &d) : opcode(o), data(d) {}
+    };
+    QTcpSocket *m_socket;
+    WebSocketHandler *m_handler;
+    /* The worker's, only when the client agreed to permessage-deflate */
+    WebSocketDeflate *m_deflate;
+    QByteArray m_input;
+    /* A fragmented message until its last frame */
+    QByteArray m_message;
+    int m_messageOpcode;
+    bool m_messageCompressed;
+    bool m_fragmented;
+    /* Filled from any thread by send() and close(), emptied by the worker */
+    QMutex m_lock;
+    QList<Outgoing> m_outgoing;
+    int m_closeCode;
+    bool m_scheduled;
+    /* Ours, on the worker only */
+    bool m_closeSent;
+    bool m_gone;
+
+    void process();
+    bool frame(const WebSocketFrame::Header &header, const char *payload);
+    bool deliver(int opcode, bool compressed, const QByteArray &message);
+    bool fail(int code, const char *reason);
+    void append_message(QByteArray &frames, int opcode, const QByteArray &message);
+    void write(const QByteArray &frames);
+    void schedule();
+private slots:
+    void socket_readyRead();
+    void socket_disconnected();
+    void flush();
+public:
+    WebSocket(QTcpSocket *socket, WebSocketHandler *handler, WebSocketDeflate *deflate, const QByteArray &pending);
+    virtual ~WebSocket();
+    void open(const HandlerRequest &request);
+    /* For the handler */
+    virtual void send(const QByteArray &message, bool binary = false);
+    virtual void close(int code = NormalClosure);
+};
+
+#endif // WEBSOCKET_H
@@ -0,0 +1,32 @@
+#ifndef WEBSOCKETCHANNEL_H
+#define WEBSOCKETCHANNEL_H
+
+#include <QtCore/QByteArray>
+
+/*
+ * An upgraded connection as a handler sees it. send() and close() can be
+ * called from any thread, they only queue, the worker of the connection
+ * does the writing. Nothing is sent once close() was called. The channel
+ * must not be touched once closed() was called on the handler, a handler
+ * that sends from other threads has to make sure of that itself.
+ */
+class WebSocketChannel
+{
+public:
+    /* The status codes of a Close frame, RFC 6455 section 7.4.1 */
+    enum CloseCode {
+        NormalClosure = 1000
+        , GoingAway = 1001
+        , ProtocolError = 1002
+        , UnsupportedData = 1003
+        , InvalidPayload = 1007
+        , PolicyViolation = 1008
+        , MessageTooBig = 1009
+        , InternalError = 1011
+    };
+    virtual ~WebSocketChannel() {}
+    virtual void send(const QByteArray &message, bool binary = false) = 0;
+    virtual void close(int code = NormalClosure) = 0;
+};
+
+#endif // WEBSOCKETCHANNEL_H
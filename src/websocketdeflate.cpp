@@ -0,0 +1,111 @@
+#include <zlib.h>
+#include <string.h>
+
+#include "websocketdeflate.h"
+#include "compressioncache.h"
+
+/* What a flush ends with, the sender strips it and the receiver puts it back */
+static const char flush_tail[4] = { 0x00, 0x00, (char)0xFF, (char)0xFF };
+
+WebSocketDeflate::WebSocketDeflate() :
+    m_deflate(NULL),
+    m_inflate(NULL)
+{
+}
+
+WebSocketDeflate::~WebSocketDeflate()
+{
+    if (m_deflate) {
+        deflateEnd(m_deflate);
+        delete m_deflate;
+    }
+    if (m_inflate) {
+        inflateEnd(m_inflate);
+        delete m_inflate;
+    }
+}
+
+/*
+ * Raw deflate up to a sync flush, without its empty block.
+ */
+bool WebSocketDeflate::compress(const QByteArray &message, QByteArray &compressed)
+{
+    if (!m_deflate) {
+        z_stream *stream = new z_stream;
+        stream->zalloc = Z_NULL;
+        stream->zfree = Z_NULL;
+        stream->opaque = Z_NULL;
+        if (deflateInit2(stream, COMPRESSION_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete stream;
+            return false;
+        }
+        m_deflate = stream;
+    } else if (deflateReset(m_deflate) != Z_OK) {
+        return false;
+    }
+    /* Room for the flush marker too, so one call does it all */
+    compressed.resize((int)deflateBound(m_deflate, message.size()) + 8);
+    m_deflate->next_in = (Bytef *)message.constData();
+    m_deflate->avail_in = message.size();
+    m_deflate->next_out = (Bytef *)compressed.data();
+    m_deflate->avail_out = compressed.size();
+    int result = deflate(m_deflate, Z_SYNC_FLUSH);
+    if ((result != Z_OK) || (m_deflate->avail_in > 0))
+        return false;
+    int size = compressed.size() - m_deflate->avail_out;
+    if ((size >= 4) && (memcmp(compressed.constData() + size - 4, flush_tail, 4) == 0))
+        size -= 4;
+    compressed.resize(size);
+    return true;
+}
+
+bool WebSocketDeflate::decompress(const char *data, int size, int limit, QByteArray &message)
+{
+    if (!m_inflate) {
+        z_stream *stream = new z_stream;
+        stream->zalloc = Z_NULL;
+        stream->zfree = Z_NULL;
+        stream->opaque = Z_NULL;
+        stream->next_in = Z_NULL;
+        stream->avail_in = 0;
+        if (inflateInit2(stream, -15) != Z_OK) {
+            delete stream;
+            return false;
+        }
+        m_inflate = stream;
+    } else if (inflateReset(m_inflate) != Z_OK) {
+        return false;
+    }
+    message.resize(0);
+    return inflate_part(data, size, limit, message) && inflate_part(flush_tail, 4, limit, message);
+}
+
+/*
+ * The output grows as needed, never beyond limit, a small message that
+ * inflates to gigabytes is refused before it gets there.
+ */
+bool WebSocketDeflate::inflate_part(const char *data, int size, int limit, QByteArray &message)
+{
+    m_inflate->next_in = (Bytef *)data;
+    m_inflate->avail_in = size;
+    forever {
+        int used = message.size();
+        int room = qMin(qMax(4 * size, 4096), limit - used);
+        if (room <= 0)
+            return false;
+        message.resize(used + room);
+        m_inflate->next_out = (Bytef *)message.data() + used;
+        m_inflate->avail_out = room;
+        int result = inflate(m_inflate, Z_SYNC_FLUSH);
+        message.resize(used + room - m_inflate->avail_out);
+        if (result == Z_STREAM_END)
+            return true;
+        if ((result != Z_OK) && (result != Z_BUF_ERROR))
+            return false;
+        /* Everything was taken and there was room left, nothing more comes out */
+        if ((m_inflate->avail_in == 0) && (m_inflate->avail_out > 0))
+            return true;
+        if ((result == Z_BUF_ERROR) && (m_inflate->avail_out > 0))
+            return false;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef WEBSOCKETDEFLATE_H
+#define WEBSOCKETDEFLATE_H
+
+#include <QtCore/QByteArray>
+
+struct z_stream_s;
+
+/*
+ * permessage-deflate of RFC 7692, always without context takeover in either
+ * direction: every message is compressed on its own, so one pair of zlib
+ * streams serves all the connections of a worker and a connection keeps no
+ * zlib state, which would cost it a few hundred kilobytes. The streams are
+ * set up on first use, a worker without compressed connections pays nothing.
+ * Not thread safe, each worker has its own.
+ */
+class WebSocketDeflate
+{
+    z_stream_s *m_deflate;
+    z_stream_s *m_inflate;
+
+    bool inflate_part(const char *data, int size, int limit, QByteArray &message);
+public:
+    WebSocketDeflate();
+    ~WebSocketDeflate();
+    bool compress(const QByteArray &message, QByteArray &compressed);
+    /* False if the data is not deflate or inflates beyond limit */
+    bool decompress(const char *data, int size, int limit, QByteArray &message);
+};
+
+#endif // WEBSOCKETDEFLATE_H
@@ -0,0 +1,126 @@
+#include <QtCore/QCryptographicHash>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "websocketframe.h"
+
+static const char *accept_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+int WebSocketFrame::parse(const char *data, int size, Header &header)
+{
+    if (size < 2)
+        return 0;
+    const unsigned char *bytes = (const unsigned char *)data;
+    header.final = (bytes[0] & 0x80) != 0;
+    header.compressed = (bytes[0] & 0x40) != 0;
+    header.reserved = (bytes[0] & 0x30) != 0;
+    header.opcode = bytes[0] & 0x0F;
+    header.masked = (bytes[1] & 0x80) != 0;
+    int length = 2;
+    header.length = bytes[1] & 0x7F;
+    if (header.length == 126) {
+        if (size < 4)
+            return 0;
+        header.length = (bytes[2] << 8) | bytes[3];
+        length = 4;
+    } else if (header.length == 127) {
+        if (size < 10)
+            return 0;
+        header.length = 0;
+        for (int i = 2; i < 10; ++i)
+            header.length = (header.length << 8) | bytes[i];
+        /* The most significant bit must be 0, a negative length makes no sense either */
+        if (header.length < 0)
+            header.length = 0x7FFFFFFFFFFFFFFFLL;
+        length = 10;
+    }
+    if (header.masked) {
+        if (size < length + 4)
+            return 0;
+        memcpy(header.mask, bytes + length, 4);
+        length += 4;
+    }
+    return length;
+}
+
+void WebSocketFrame::appendHeader(QByteArray &buffer, int opcode, bool compressed, qint64 length)
+{
+    char header[10];
+    int size = 2;
+    header[0] = (char)(0x80 | (compressed ? 0x40 : 0) | opcode);
+    if (length < 126) {
+        header[1] = (char)length;
+    } else if (length <= 0xFFFF) {
+        header[1] = 126;
+        header[2] = (char)(length >> 8);
+        header[3] = (char)length;
+        size = 4;
+    } else {
+        header[1] = 127;
+        for (int i = 0; i < 8; ++i)
+            header[2 + i] = (char)(length >> (56 - 8 * i));
+        size = 10;
+    }
+    buffer.append(header, size);
+}
+
+void WebSocketFrame::appendClose(QByteArray &buffer, int code)
+{
+    appendHeader(buffer, Close, false, 2);
+    buffer.append((char)(code >> 8));
+    buffer.append((char)code);
+}
+
+/*
+ * The mask repeats every four bytes, so a word of it lines up with the
+ * payload at any multiple of four: sixteen bytes at a time with SSE2, four
+ * registers per turn, eight at a time without, and the tail byte by byte.
+ * Loads and stores are unaligned, the payload starts wherever its header
+ * ended. Most messages of a push service are small, the wide loops are
+ * only worth it from a few dozen bytes on, below that only the tail runs.
+ */
+void WebSocketFrame::unmask(char *data, qint64 size, const unsigned char *mask)
+{
+    qint64 i = 0;
+    quint32 word;
+    memcpy(&word, mask, 4);
+#ifdef __SSE2__
+    if (size >= 64) {
+        __m128i key = _mm_set1_epi32((int)word);
+        for (; i + 64 <= size; i += 64) {
+            __m128i *block = (__m128i *)(data + i);
+            __m128i a = _mm_loadu_si128(block);
+            __m128i b = _mm_loadu_si128(block + 1);
+            __m128i c = _mm_loadu_si128(block + 2);
+            __m128i d = _mm_loadu_si128(block + 3);
+            _mm_storeu_si128(block, _mm_xor_si128(a, key));
+            _mm_storeu_si128(block + 1, _mm_xor_si128(b, key));
+            _mm_storeu_si128(block + 2, _mm_xor_si128(c, key));
+            _mm_storeu_si128(block + 3, _mm_xor_si128(d, key));
+        }
+        for (; i + 16 <= size; i += 16) {
+            __m128i *block = (__m128i *)(data + i);
+            _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), key));
+        }
+    }
+#endif
+    quint64 key = ((quint64)word << 32) | word;
+    for (; i + 8 <= size; i += 8) {
+        quint64 block;
+        memcpy(&block, data + i, 8);
+        block ^= key;
+        memcpy(data + i, &block, 8);
+    }
+    for (; i < size; ++i)
+        data[i] ^= mask[i & 3];
+}
+
+QByteArray WebSocketFrame::acceptKey(const QByteArray &key)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(key);
+    hash.addData(accept_guid, (int)strlen(accept_guid));
+    return hash.result().toBase64();
+}
@@ -0,0 +1,45 @@
+#ifndef WEBSOCKETFRAME_H
+#define WEBSOCKETFRAME_H
+
+#include <QtCore/QByteArray>
+
+#define WEBSOCKET_MAX_CONTROL 125   /* Most a control frame carries */
+
+/*
+ * The framing of RFC 6455. Frames are parsed where they were read, the
+ * payload of a client frame is unmasked in place, it is only copied when it
+ * is handed to the handler. Frames of the server are never masked.
+ */
+class WebSocketFrame
+{
+public:
+    enum Opcode {
+        Continuation = 0x0
+        , Text = 0x1
+        , Binary = 0x2
+        , Close = 0x8
+        , Ping = 0x9
+        , Pong = 0xA
+    };
+    struct Header {
+        bool final;
+        /* RSV1, the first frame of a message compressed with permessage-deflate */
+        bool compressed;
+        /* RSV2 or RSV3, no extension of ours uses them */
+        bool reserved;
+        bool masked;
+        int opcode;
+        qint64 length;
+        unsigned char mask[4];
+    };
+    /* The length of the header at the start of data, 0 if it is not all there yet */
+    static int parse(const char *data, int size, Header &header);
+    static void appendHeader(QByteArray &buffer, int opcode, bool compressed, qint64 length);
+    static void appendClose(QByteArray &buffer, int code);
+    static void unmask(char *data, qint64 size, const unsigned char *mask);
+    /* The value of Sec-WebSocket-Accept for the key of the client */
+    static QByteArray acceptKey(const QByteArray &key);
+    static bool isControl(int opcode) { return (opcode & 0x8) != 0; }
+};
+
+#endif // WEBSOCKETFRAME_H
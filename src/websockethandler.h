@@ -0,0 +1,31 @@
+#ifndef WEBSOCKETHANDLER_H
+#define WEBSOCKETHANDLER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QtPlugin>
+
+#include "handlerrequest.h"
+#include "websocketchannel.h"
+
+/*
+ * What the plugin of an application folder implements, besides Handler, to
+ * take WebSocket connections. The server does the handshake and the
+ * framing, the handler gets the request that asked for the upgrade and then
+ * whole messages, reassembled and decompressed. All three are called on the
+ * worker of the connection, by every worker at the same time, so they have
+ * to be thread safe and must not block.
+ */
+class WebSocketHandler
+{
+public:
+    virtual ~WebSocketHandler() {}
+    /* The request is only valid during the call, a handler that refuses the connection closes the channel */
+    virtual void opened(WebSocketChannel *channel, const HandlerRequest &request) = 0;
+    virtual void message(WebSocketChannel *channel, const QByteArray &message, bool binary) = 0;
+    /* Whichever side closed it, the channel goes once this returns */
+    virtual void closed(WebSocketChannel *channel) = 0;
+};
+
+Q_DECLARE_INTERFACE(WebSocketHandler, "org.rainbow.WebSocketHandler/1.0")
+
+#endif // WEBSOCKETHANDLER_H
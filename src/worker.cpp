@@ -0,0 +1,790 @@
+#include <QtCore/QDateTime>
+#include <unistd.h>
+
+#include "log.h"
+#include "worker.h"
+
+#define CLOCK_PULSE 1000
+
+Worker::Worker(const Configuration *configuration) :
+    m_schedulerThreshold(5),
+    m_now(0),
+    m_configuration(configuration),
+    m_timers(CLOCK_PULSE)
+{
+    configuration->acquire();
+    m_snapshots.insert(configuration, 0);
+    m_metrics = Metrics::instance()->createShard();
+    /* The timer is our child so it follows us to our thread */
+    m_scheduler = new QTimer(this);
+    m_scheduler->setInterval(CLOCK_PULSE);
+    connect(m_scheduler, SIGNAL(timeout()), this, SLOT(dispatch()));
+}
+
+Worker::~Worker()
+{
+    foreach (Request *request, m_requests)
+        release(request);
+}
+
+/*
+ * Has to be called from the thread the worker lives in, otherwise the timer
+ * would be started from the wrong thread.
+ */
+void Worker::start()
+{
+    // Set the initial time
+    m_now = QDateTime::currentMSecsSinceEpoch();
+    m_timers.reset(m_now);
+    /* qrand() has a seed per thread, unseeded every worker would pick the same backends */
+    qsrand((uint)m_now ^ (uint)(quintptr)this);
+    m_scheduler->start();
+}
+
+void Worker::stop()
+{
+    m_scheduler->stop();
+}
+
+/*
+ * Called by the server on a reload, from its own thread. A snapshot we never
+ * got to take is simply dropped.
+ */
+void Worker::publish(const Configuration *configuration)
+{
+    configuration->acquire();
+    const Configuration *skipped = m_published.fetchAndStoreRelease(configuration);
+    if (skipped && skipped->release())
+        emit released();
+}
+
+/*
+ * Run between requests. From here on new requests use the published snapshot,
+ * the previous one goes as soon as none of ours uses it.
+ */
+void Worker::adopt()
+{
+    const Configuration *next = m_published.fetchAndStoreAcquire(NULL);
+    if (!next)
+        return;
+    const Configuration *previous = m_configuration;
+    m_configuration = next;
+    m_snapshots.insert(next, 0);
+    if (m_snapshots.value(previous) == 0)
+        retire(previous);
+}
+
+/*
+ * The request keeps the snapshot it is replied from until it goes back to the
+ * pool, its route points into it.
+ */
+void Worker::reply(Request *request)
+{
+    const Configuration *configuration = request->configuration();
+    if (!configuration) {
+        configuration = m_configuration;
+        ++m_snapshots[configuration];
+    }
+    request->reply(configuration);
+}
+
+void Worker::release(Request *request)
+{
+    if (request->configuration())
+        unpin(request->configuration());
+    m_pool.release(request);
+}
+
+void Worker::unpin(const Configuration *configuration)
+{
+    if ((--m_snapshots[configuration] == 0) && (configuration != m_configuration))
+        retire(configuration);
+}
+
+/*
+ * None of our requests can reach the snapshot anymore, what we keep for its
+ * folders goes from here, the server deletes the rest.
+ */
+void Worker::retire(const Configuration *configuration)
+{
+    m_snapshots.remove(configuration);
+    configuration->retire(m_snapshots.keys());
+    if (configuration->release())
+        emit released();
+}
+
+/*
+ * Take care of incomming connections
+ */
+int Worker::process_incomming(int max_requests)
+{
+    Log *log = Log::instance();
+    if (m_incomming.isEmpty()) {
+        log->entry(Log::LogLevelDebug, "no incomming connections");
+        return 0;
+    }
+    int processed = 0;
+    log->entry(Log::LogLevelDebug, "found incomming connections");
+    QMutableListIterator<Request *> i(m_incomming);
+    while (i.hasNext()) {
+        if (processed >= max_requests) {
+            log->entry(Log::LogLevelNormal, "stopping processing of incomming connections after max_requests");
+            return processed;
+        }
+        ++processed;
+        Request *request = i.next();
+        if (request->socket()->bytesAvailable()) {
+            // Remove it carefully from the list
+            i.remove();
+            measure(request, Metrics::StageIncomming);
+            // Add it to the pending queue
+            m_pending.enqueue(request);
+        }
+    }
+    return processed;
+}
+/*
+ * Take care of pending requests
+ */
+int Worker::process_pending(int max_requests)
+{
+    Log *log = Log::instance();
+    // Check if we have pending requests
+    if (m_pending.isEmpty()) {
+        log->entry(Log::LogLevelDebug, "no pending requests");
+        return 0;
+    }
+    int processed = 0;
+    while (!m_pending.isEmpty()) {
+        if (processed >= max_requests) {
+            log->entry(Log::LogLevelNormal, "stopping processing of pending requests after max_requests");
+            return processed;
+        }
+        ++processed;
+        Request *request = m_pending.dequeue();
+        /* Expired requests go through too, they are answered with a timeout */
+        if (request->fetch())
+        {
+            log->entry(Log::LogLevelDebug, "pending request was fetched from the wire");
+            measure(request, Metrics::StagePending);
+            // Put it into the inProgress queue
+            m_inProgress.enqueue(request);
+        } else {
+            // The header is not complete yet
+            m_pending.enqueue(request);
+        }
+    }
+    return processed;
+}
+
+/*
+ * Take care of in progress requests
+ */
+int Worker::process_inProgress(int max_requests)
+{
+    Log *log = Log::instance();
+    if (m_inProgress.isEmpty()) {
+        log->entry(Log::LogLevelDebug, "no in progress requests");
+        return 0;
+    }
+    int processed = 0;
+    while (!m_inProgress.isEmpty()) {
+        if (processed >= max_requests) {
+            log->entry(Log::LogLevelNormal, "stopping processing of in progress requests after max_requests");
+            return processed;
+        }
+        ++processed;
+        Request *request = m_inProgress.dequeue();
+        if (request->parse()) {
+            /*
+             * It does not matter if there are errors in the request, since we are just a scheduler.
+             * The only situation that is of interest to us is if the request requires more data from
+             * the network. In that case parse() returns false.
+             */
+            log->entry(Log::LogLevelDebug, "moving forward");
+            measure(request, Metrics::StageInProgress);
+            m_outgoing.enqueue(request);
+        } else {
+            /* Back to pending */
+            log->entry(Log::LogLevelDebug, "going back");
+            m_pending.enqueue(request);
+        }
+    }
+    return processed;
+}
+
+/*
+ * Take care of outgoing requests
+ */
+int Worker::process_outgoing(int max_requests)
+{
+    Log *log = Log::instance();
+    if (m_outgoing.isEmpty()) {
+        log->entry(Log::LogLevelDebug, "no outgoing requests");
+        return 0;
+    }
+    int processed = 0;
+    while (!m_outgoing.isEmpty()) {
+        if (processed >= max_requests) {
+            log->entry(Log::LogLevelNormal, "stopping processing of outgoing requests after max_requests");
+            return processed;
+        }
+        ++processed;
+        Request *request = m_outgoing.dequeue();
+        reply(request);
+        account(request, measure(request, Metrics::StageOutgoing));
+        log->entry(Log::LogLevelDebug, "connection replied, closing it");
+        arm(request, WriteDeadline);
+        m_waiting.append(request);
+    }
+    return processed;
+}
+
+/*
+ * Take care of waiting requests
+ */
+int Worker::process_waiting(int max_requests)
+{
+    Log *log = Log::instance();
+    if (m_waiting.isEmpty()) {
+        log->entry(Log::LogLevelDebug, "no waiting requests");
+        return 0;
+    }
+    int processed = 0;
+    QMutableListIterator<Request *> i(m_waiting);
+    while (i.hasNext()) {
+        if (processed >= max_requests) {
+            log->entry(Log::LogLevelNormal, "stopping processing of waiting requests after max_requests");
+            return processed;
+        }
+        ++processed;
+        Request *request = i.next();
+        if (request->isReady()) {
+            log->entry(Log::LogLevelDebug, "request replied");
+            measure(request, Metrics::StageWaiting);
+            i.remove();
+            /* Ours to release, close might already tell socket_closed() */
+            m_requests.remove(request->socket());
+            request->close();
+            release(request);
+        }
+    }
+    return processed;
+}
+
+/*
+ * The acceptor hands us the descriptor of a new connection, the socket is created
+ * here so it belongs to our thread.
+ * In pulse mode we do not service the connection here, we just put it into the incomming queue,
+ * its request is created right away so the header deadline covers clients that never send a byte.
+ * In event driven mode the connection gets its request right away and the socket signals
+ * move it forward.
+ * The connections of the metrics port were not admitted, they are never shed either.
+ */
+void Worker::handle_connection(int descriptor, bool admitted)
+{
+    Log *log = Log::instance();
+    adopt();
+    QTcpSocket *connection = new QTcpSocket(this);
+    if (!connection->setSocketDescriptor(descriptor)) {
+        log->entry(Log::LogLevelCritical, "could not take over the connection");
+        delete connection;
+        ::close(descriptor);
+        if (admitted)
+            m_configuration->admission()->release();
+        return;
+    }
+    /* The acceptor counted the connection, it is given back when the socket goes */
+    if (admitted)
+        connect(connection, SIGNAL(destroyed()), this, SLOT(socket_destroyed()));
+    Admission *admission = m_configuration->admission();
+    if (admitted && admission->maxQueue() && (queued() >= admission->maxQueue())) {
+        log->entry(Log::LogLevelDebug, "worker is full, shedding the connection");
+        admission->countShed();
+        shed(connection);
+        return;
+    }
+    if (m_configuration->schedulerMode() == Configuration::Pulse) {
+        /* Persistent connections are only supported in event driven mode */
+        connect(connection, SIGNAL(disconnected()), this, SLOT(socket_closed()));
+        Request *request = m_pool.acquire(connection, m_now);
+        m_requests.insert(connection, request);
+        request->setStamp(Metrics::now());
+        arm(request, HeaderDeadline);
+        m_incomming.append(request);
+        return;
+    }
+    Request *request = m_pool.acquire(connection, m_now, persistent(0));
+    m_requests.insert(connection, request);
+    request->setStamp(Metrics::now());
+    arm(request, HeaderDeadline);
+    connect(connection, SIGNAL(readyRead()), this, SLOT(socket_readyRead()));
+    connect(connection, SIGNAL(bytesWritten(qint64)), this, SLOT(socket_bytesWritten(qint64)));
+    connect(connection, SIGNAL(disconnected()), this, SLOT(socket_disconnected()));
+    if (connection->bytesAvailable())
+        advance(request);
+}
+
+/*
+ * Every request is in exactly one of the queues, so bounding what comes in
+ * bounds all of them.
+ */
+int Worker::queued() const
+{
+    if (m_configuration->schedulerMode() == Configuration::EventDriven)
+        return m_requests.count();
+    return m_incomming.count() + m_pending.count() + m_inProgress.count() + m_outgoing.count() + m_waiting.count();
+}
+
+/*
+ * The request is not even read, the connection only gets the 503 and is closed.
+ */
+void Worker::shed(QTcpSocket *connection)
+{
+    QByteArray response;
+    m_configuration->admission()->unavailable(response);
+    connect(connection, SIGNAL(disconnected()), connection, SLOT(deleteLater()));
+    connection->write(response);
+    connection->disconnectFromHost();
+}
+
+/*
+ * How long the request spent in the stage it is leaving, the next one starts now.
+ */
+qint64 Worker::measure(Request *request, Metrics::Stage stage)
+{
+    qint64 now = Metrics::now();
+    qint64 elapsed = now - request->stamp();
+    m_metrics->stages[stage].record(elapsed);
+    request->setStamp(now);
+    return elapsed;
+}
+
+/*
+ * Once the reply is built. The time is the one the folder took to build it.
+ */
+void Worker::account(Request *request, qint64 elapsed)
+{
+    ++m_metrics->requests;
+    const Route &route = request->route();
+    if (!route.folder)
+        return;
+    int index = route.folder->metric();
+    if (index < 0)
+        return;
+    /* The folder came with a reload */
+    if (index >= m_metrics->folders.count())
+        Metrics::instance()->growShard(m_metrics);
+    Metrics::FolderStats &folder = m_metrics->folders[index];
+    ++folder.requests;
+    folder.bytes += request->replySize();
+    folder.latency.record(elapsed);
+}
+
+/*
+ * The queues are ours, other threads only get to see the numbers.
+ */
+void Worker::update_gauges()
+{
+    m_metrics->depth[Metrics::StageIncomming] = m_incomming.count();
+    m_metrics->depth[Metrics::StagePending] = m_pending.count();
+    m_metrics->depth[Metrics::StageInProgress] = m_inProgress.count();
+    m_metrics->depth[Metrics::StageOutgoing] = m_outgoing.count();
+    m_metrics->depth[Metrics::StageWaiting] = m_waiting.count();
+    m_metrics->connections = queued();
+    m_metrics->poolCreated = m_pool.created();
+    m_metrics->bufferAllocations = m_pool.buffers().allocations();
+    m_metrics->bufferReuses = m_pool.buffers().reuses();
+}
+
+/*
+ * Event driven mode: take the request as far as it can go with the data we have.
+ * The stages are the same ones the queues represent, we just do not wait for
+ * the next pulse to move from one to the other.
+ */
+void Worker::advance(Request *request)
+{
+    Log *log = Log::instance();
+    /* Only a request body that goes to a backend is read after the reply started */
+    if (request->isReplied()) {
+        request->transfer();
+        return;
+    }
+    bool idle = request->isIdle();
+    bool fetched = request->fetch();
+    /* The next request started to arrive, it has to be complete in time */
+    if (idle && !request->isIdle()) {
+        request->setStamp(Metrics::now());
+        arm(request, HeaderDeadline);
+    }
+    if (!fetched)
+        return;
+    if (!request->parse()) {
+        log->entry(Log::LogLevelDebug, "waiting for more data");
+        return;
+    }
+    measure(request, Metrics::StagePending);
+    reply(request);
+    account(request, measure(request, Metrics::StageOutgoing));
+    finish(request);
+}
+
+/*
+ * Whether the request with the given sequence number may leave the connection open.
+ */
+bool Worker::persistent(int sequence) const
+{
+    if (m_configuration->keepAlive() <= 0)
+        return false;
+    return (sequence + 1) < m_configuration->maxRequests();
+}
+
+/*
+ * Push the rest of the reply. Once everything is written the connection is either
+ * closed or handed to the next request. Requests the client pipelined are already
+ * in our buffer, they are answered in order without waiting for the socket.
+ * close might delete the request, so it has to be the last thing we do.
+ */
+void Worker::finish(Request *request)
+{
+    Log *log = Log::instance();
+    forever {
+        if (!request->isReady()) {
+            /* The handler might have finished in between, then the reply is there now */
+            if (request->isDeferred() && !request->notify(this, SLOT(deferred_progress())))
+                continue;
+            /* We only get here when the client took some of the reply, or right after replying */
+            arm(request, WriteDeadline);
+            if (request->isBlocked())
+                wait_writable(request);
+            return;
+        }
+        log->entry(Log::LogLevelDebug, "request replied");
+        measure(request, Metrics::StageWaiting);
+        if (request->isUpgrade()) {
+            upgrade(request);
+            return;
+        }
+        if (!request->keepAlive()) {
+            /* The client still has to take what is left in the socket */
+            arm(request, WriteDeadline);
+            request->close();
+            return;
+        }
+        request = follow(request);
+        request->setStamp(Metrics::now());
+        arm(request, request->isIdle() ? IdleDeadline : HeaderDeadline);
+        if (!request->fetch() || !request->parse())
+            return;
+        measure(request, Metrics::StagePending);
+        reply(request);
+        account(request, measure(request, Metrics::StageOutgoing));
+    }
+}
+
+/*
+ * The connection goes on with the next request, which starts with whatever
+ * the previous one did not consume. The previous one goes back to the pool.
+ */
+Request *Worker::follow(Request *request)
+{
+    QTcpSocket *connection = request->socket();
+    int sequence = request->sequence() + 1;
+    Request *next = m_pool.acquire(connection, m_now, persistent(sequence), sequence, request->remainder());
+    m_requests.insert(connection, next);
+    release(request);
+    return next;
+}
+
+/*
+ * The handshake is written, the connection is no request anymore. It leaves
+ * our bookkeeping and belongs to its WebSocket from now on, the request goes
+ * back to the pool. The socket still gives its admission back when it goes.
+ */
+void Worker::upgrade(Request *request)
+{
+    QTcpSocket *connection = request->socket();
+    m_requests.remove(connection);
+    delete m_notifiers.take(connection);
+    disconnect(connection, SIGNAL(readyRead()), this, SLOT(socket_readyRead()));
+    disconnect(connection, SIGNAL(bytesWritten(qint64)), this, SLOT(socket_bytesWritten(qint64)));
+    disconnect(connection, SIGNAL(disconnected()), this, SLOT(socket_disconnected()));
+    const Route &route = request->route();
+    const Configuration *configuration = request->configuration();
+    HandlerRequest handshake(request->buffer(), request->parser(), route.documentPath);
+    WebSocket *socket = new WebSocket(connection, configuration->webSocketHandler(route),
+                                      request->isDeflate() ? &m_deflate : NULL, request->remainder());
+    /* Its handler comes from the snapshot, the connection keeps it for as long as it lasts */
+    ++m_snapshots[configuration];
+    m_webSockets.insert(socket, configuration);
+    connect(socket, SIGNAL(destroyed()), this, SLOT(websocket_destroyed()));
+    release(request);
+    socket->open(handshake);
+}
+
+/*
+ * When the body is sent straight from a file the socket does not tell us
+ * when it has room again, since its own buffer is empty. We watch the
+ * descriptor ourselves, only while we need it, so we do not compete with
+ * the socket's own notifier.
+ */
+void Worker::wait_writable(Request *request)
+{
+    QTcpSocket *connection = request->socket();
+    QSocketNotifier *notifier = m_notifiers.value(connection, NULL);
+    if (!notifier) {
+        notifier = new QSocketNotifier(connection->socketDescriptor(), QSocketNotifier::Write, connection);
+        connect(notifier, SIGNAL(activated(int)), this, SLOT(socket_writable()));
+        m_notifiers.insert(connection, notifier);
+    }
+    notifier->setEnabled(true);
+}
+
+void Worker::socket_writable()
+{
+    QSocketNotifier *notifier = qobject_cast<QSocketNotifier *>(sender());
+    if (!notifier)
+        return;
+    notifier->setEnabled(false);
+    QTcpSocket *connection = qobject_cast<QTcpSocket *>(notifier->parent());
+    Request *request = m_requests.value(connection, NULL);
+    if (request)
+        finish(request);
+}
+
+void Worker::socket_readyRead()
+{
+    adopt();
+    QTcpSocket *connection = qobject_cast<QTcpSocket *>(sender());
+    Request *request = m_requests.value(connection, NULL);
+    if (request)
+        advance(request);
+}
+
+void Worker::socket_bytesWritten(qint64 bytes)
+{
+    Q_UNUSED(bytes);
+    QTcpSocket *connection = qobject_cast<QTcpSocket *>(sender());
+    Request *request = m_requests.value(connection, NULL);
+    if (!request)
+        return;
+    if (request->isReplied())
+        finish(request);
+}
+
+/*
+ * An application handler finished a reply that was deferred, or a backend
+ * sent more of one. In pulse mode nobody asks to be notified, the waiting
+ * queue looks at the request anyway.
+ */
+void Worker::deferred_progress()
+{
+    Request *request = NULL;
+    HandlerResponse *response = qobject_cast<HandlerResponse *>(sender());
+    if (response) {
+        request = response->request();
+        response->release();
+    } else {
+        UpstreamExchange *exchange = qobject_cast<UpstreamExchange *>(sender());
+        if (exchange)
+            request = exchange->request();
+    }
+    if (request)
+        finish(request);
+}
+
+void Worker::socket_destroyed()
+{
+    m_configuration->admission()->release();
+}
+
+void Worker::websocket_destroyed()
+{
+    const Configuration *configuration = m_webSockets.take(sender());
+    if (configuration)
+        unpin(configuration);
+}
+
+void Worker::socket_disconnected()
+{
+    QTcpSocket *connection = qobject_cast<QTcpSocket *>(sender());
+    Request *request = m_requests.take(connection);
+    /* The notifier is a child of the socket, it goes away with it */
+    m_notifiers.remove(connection);
+    if (request) {
+        Log::instance()->entry(Log::LogLevelDebug, "connection closed");
+        release(request);
+    }
+    connection->deleteLater();
+}
+
+/*
+ * Pulse mode: the client went away while its request sits in one of the
+ * queues. The request leaves them and goes back to the pool, which cancels
+ * its timer, before the socket it points to is deleted.
+ */
+void Worker::socket_closed()
+{
+    QTcpSocket *connection = qobject_cast<QTcpSocket *>(sender());
+    Request *request = m_requests.take(connection);
+    if (request) {
+        Log::instance()->entry(Log::LogLevelDebug, "connection closed before it was replied");
+        m_incomming.removeOne(request);
+        m_pending.removeOne(request);
+        m_inProgress.removeOne(request);
+        m_outgoing.removeOne(request);
+        m_waiting.removeOne(request);
+        release(request);
+    }
+    connection->deleteLater();
+}
+
+/*
+ * The deadline is counted from the last pulse, it is at most one pulse late.
+ */
+void Worker::arm(Request *request, Deadline deadline)
+{
+    int timeout;
+    switch (deadline) {
+    case IdleDeadline:
+        timeout = m_configuration->keepAlive();
+        break;
+    case WriteDeadline:
+        timeout = m_configuration->writeTimeout();
+        break;
+    default:
+        timeout = m_configuration->headerTimeout();
+        break;
+    }
+    m_timers.schedule(request->timer(), m_now + timeout, deadline);
+}
+
+/*
+ * Run on every pulse. Only the connections whose deadline passed are looked at,
+ * the ones that are fine are not even touched. Expiring one request can close
+ * another, so the timers are taken one at a time.
+ */
+void Worker::expire_requests()
+{
+    TimerWheel::Timer *timer;
+    while ((timer = m_timers.take(m_now)))
+        expire(static_cast<Request *>(timer->owner()), timer->kind());
+}
+
+/*
+ * Persistent connections that stayed idle for too long are closed without a reply.
+ * Requests that took too long to arrive get a timeout reply and their connection
+ * is closed. Connections whose client stopped taking the reply are dropped.
+ * In pulse mode the timeout reply is left to the queues, the request only has to
+ * get out of the incomming queue if it never sent a byte.
+ * close might delete the request, so it has to be the last thing we do.
+ */
+void Worker::expire(Request *request, int deadline)
+{
+    Log *log = Log::instance();
+    if (deadline == WriteDeadline) {
+        ++m_metrics->expired[Metrics::ExpiredWrite];
+        log->entry(Log::LogLevelNormal, "client stopped reading, dropping the connection");
+        request->connection()->abort();
+        return;
+    }
+    if (deadline == IdleDeadline) {
+        ++m_metrics->expired[Metrics::ExpiredIdle];
+        log->entry(Log::LogLevelDebug, "closing idle connection");
+        arm(request, WriteDeadline);
+        request->close();
+        return;
+    }
+    ++m_metrics->expired[Metrics::ExpiredHeader];
+    log->entry(Log::LogLevelNormal, "request expired");
+    request->expire();
+    arm(request, WriteDeadline);
+    if (m_configuration->schedulerMode() == Configuration::Pulse) {
+        if (m_incomming.removeOne(request))
+            m_pending.enqueue(request);
+        return;
+    }
+    reply(request);
+    request->close();
+}
+
+/*
+ * Scheduler: Find what is the highest priority task to perform
+ * and do it. This is only done in pulse mode, in event driven mode
+ * the requests move on their own. Timeouts are taken care of in both.
+ * We try to execute light tasks often and leave those tasks that
+ * take longer time to when we are free.
+ * Priorization:
+ * 1. incomming (cpu)
+ * 2. inProgress (cpu)
+ * 3. waiting (cpu)
+ * 4. pending (I/O)
+ * 5. outgoing (I/O)
+ *
+ * If any of the queues go above the threshold, then we serve that queue
+ * first regardless of the priorities. We start in reverse order.
+ *
+ * If there are no requests, we just return.
+ */
+void Worker::dispatch()
+{
+    Log *log = Log::instance();
+    log->entry(Log::LogLevelDebug, "mark");
+    /* We add one second */
+    m_now += CLOCK_PULSE;
+    /* Idle workers move to a new snapshot too, so the old one can go */
+    adopt();
+    expire_requests();
+    update_gauges();
+    if (m_configuration->schedulerMode() == Configuration::EventDriven)
+        return;
+    int incomming_count = m_incomming.count();
+    int pending_count = m_pending.count();
+    int inProgress_count = m_inProgress.count();
+    int outgoing_count = m_outgoing.count();
+    int waiting_count = m_waiting.count();
+    int total_count = incomming_count + pending_count + inProgress_count + outgoing_count + waiting_count;
+
+    if (total_count == 0)
+        return;
+
+    if (outgoing_count >= m_schedulerThreshold) {
+        process_outgoing(m_schedulerThreshold/2);
+        return;
+    }
+    if (pending_count >= m_schedulerThreshold) {
+        process_pending(m_schedulerThreshold/2);
+        return;
+    }
+    if (waiting_count >= m_schedulerThreshold) {
+        process_waiting(m_schedulerThreshold/2);
+        return;
+    }
+    if (inProgress_count >= m_schedulerThreshold) {
+        process_inProgress(m_schedulerThreshold/2);
+        return;
+    }
+    if (incomming_count >= m_schedulerThreshold) {
+        process_incomming(m_schedulerThreshold/2);
+        return;
+    }
+
+    /*
+     * If we have come all the way here, then there are no urgencies.
+     * Go through them in order of priorities.
+     */
+    int total_served = 0;
+    total_served = process_incomming(m_schedulerThreshold);
+    if (total_served >= m_schedulerThreshold)
+        return;
+    total_served += process_inProgress(m_schedulerThreshold);
+    if (total_served >= m_schedulerThreshold)
+        return;
+    total_served += process_waiting(m_schedulerThreshold);
+    if (total_served >= m_schedulerThreshold)
+        return;
+    total_served += process_pending(m_schedulerThreshold);
+    if (total_served >= m_schedulerThreshold)
+        return;
+    total_served += process_outgoing(m_schedulerThreshold);
+}
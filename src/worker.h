@@ -0,0 +1,114 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QQueue>
+#include <QtCore/QHash>
+#include <QtCore/QTimer>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QAtomicPointer>
+#include <QtNetwork/QTcpSocket>
+
+#include "configuration.h"
+#include "request.h"
+#include "requestpool.h"
+#include "timerwheel.h"
+#include "metrics.h"
+#include "websocket.h"
+
+/*
+ * A worker owns an event loop, the sockets handed to it and the queues of
+ * requests built on top of them. The configuration is a snapshot shared among
+ * all the workers, a reload publishes a new one and every worker moves to it
+ * on its own, while its requests finish with the one they were replied from.
+ */
+class Worker : public QObject
+{
+    Q_OBJECT
+    int m_schedulerThreshold;
+    QTimer *m_scheduler;
+    /* Left by the server until we take it, we hold a reference to it already */
+    QAtomicPointer<const Configuration> m_published;
+    /* The snapshots we hold and how many of our requests and WebSockets use each */
+    QHash<const Configuration *, int> m_snapshots;
+    QHash<QObject *, const Configuration *> m_webSockets;
+    QList<Request *> m_incomming;
+    QQueue<Request *> m_pending;
+    QQueue<Request *> m_inProgress;
+    QQueue<Request *> m_outgoing;
+    QList<Request *> m_waiting;
+    /* Every connection has its own request, in pulse mode only until it is replied */
+    QHash<QTcpSocket *, Request *> m_requests;
+    /* Created when a reply sent from a file has to wait for the socket */
+    QHash<QTcpSocket *, QSocketNotifier *> m_notifiers;
+    /* Shared by the WebSocket connections of the worker that compress */
+    WebSocketDeflate m_deflate;
+
+    int process_incomming(int max_requests);
+    int process_pending(int max_requests);
+    int process_inProgress(int max_requests);
+    int process_outgoing(int max_requests);
+    int process_waiting(int max_requests);
+    void unpin(const Configuration *configuration);
+    void retire(const Configuration *configuration);
+    void upgrade(Request *request);
+    void shed(QTcpSocket *connection);
+    void update_gauges();
+    void expire_requests();
+    void expire(Request *request, int deadline);
+protected:
+    /* What a connection is waiting for, the kind of its timer */
+    enum Deadline {
+        HeaderDeadline
+        , IdleDeadline
+        , WriteDeadline
+    };
+    qint64 m_now;
+    /* The snapshot new requests are replied from */
+    const Configuration *m_configuration;
+    /* Requests and their buffers are reused, not created for every request */
+    RequestPool m_pool;
+    /* Every connection has one deadline at a time, in both modes */
+    TimerWheel m_timers;
+    /* Ours only, nobody else writes to it */
+    Metrics::Shard *m_metrics;
+
+    void adopt();
+    void reply(Request *request);
+    void release(Request *request);
+    void advance(Request *request);
+    void finish(Request *request);
+    bool persistent(int sequence) const;
+    qint64 measure(Request *request, Metrics::Stage stage);
+    void account(Request *request, qint64 elapsed);
+    void arm(Request *request, Deadline deadline);
+    /* Where the connections of other kinds of workers differ */
+    virtual Request *follow(Request *request);
+    virtual void wait_writable(Request *request);
+    virtual int queued() const;
+private slots:
+    void dispatch();
+    void socket_readyRead();
+    void socket_bytesWritten(qint64 bytes);
+    void socket_disconnected();
+    void socket_closed();
+    void socket_writable();
+    void socket_destroyed();
+    void deferred_progress();
+    void websocket_destroyed();
+signals:
+    /* We dropped our reference to a snapshot, it might be the last one */
+    void released();
+public slots:
+    virtual void start();
+    virtual void stop();
+    void handle_connection(int descriptor, bool admitted = true);
+public:
+    Worker(const Configuration *configuration);
+    virtual ~Worker();
+    /* Thread safe, the snapshot is taken on our next event */
+    void publish(const Configuration *configuration);
+};
+
+#endif // WORKER_H